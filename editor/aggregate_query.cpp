@@ -0,0 +1,317 @@
+#include "aggregate_query.h"
+
+#include <math.h>
+#include <stdio.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	const int AUTO_BUCKETS = 100;
+
+	/**
+	* Quote and escape a string for a JSON pipeline.
+	*/
+	std::string json_string(const std::string& value)
+	{
+		std::string quoted = "\"";
+		for (auto c : value)
+		{
+			if (c == '"' || c == '\\')
+				quoted += '\\';
+			quoted += c;
+		}
+		return quoted + "\"";
+	}
+
+	std::string json_number(double value)
+	{
+		char number[32];
+		snprintf(number, sizeof(number), "%.17g", value);
+		return number;
+	}
+
+	/**
+	* Expression evaluating to [x, y, z] for a position field.
+	* Strings such as "Vector3(x, y, z)" are split on the server, anything that does not convert becomes null.
+	*/
+	std::string position_expression(const std::string& field, int position_parser)
+	{
+		auto ref = json_string("$" + field);
+
+		if (position_parser > 0)
+		{
+			auto open = "{ \"$indexOfCP\": [" + ref + ", \"(\"] }";
+			auto start = "{ \"$add\": [" + open + ", 1] }";
+			auto length = "{ \"$subtract\": [{ \"$strLenCP\": " + ref + " }, { \"$add\": [" + open + ", 2] }] }";
+			auto inner = "{ \"$substrCP\": [" + ref + ", " + start + ", " + length + "] }";
+
+			return "{ \"$map\": { \"input\": { \"$split\": [" + inner + ", \",\"] }, "
+				"\"in\": { \"$convert\": { \"input\": { \"$trim\": { \"input\": \"$$this\" } }, \"to\": \"double\", \"onError\": null, \"onNull\": null } } } }";
+		}
+
+		return "{ \"$cond\": [{ \"$isArray\": " + ref + " }, " + ref + ", ["
+			+ json_string("$" + field + ".x") + ", " + json_string("$" + field + ".y") + ", " + json_string("$" + field + ".z") + "]] }";
+	}
+
+	/**
+	* Append the stages of a JSON array to the pipeline array, continuing at index.
+	*/
+	bool append_json_stages(bson_t* stages, uint32_t& index, const std::string& json, std::string& error)
+	{
+		bson_t parsed;
+		bson_error_t bson_error;
+		auto document = "{ \"stages\": " + json + " }";
+
+		if (!bson_init_from_json(&parsed, document.c_str(), (ssize_t)document.size(), &bson_error))
+		{
+			error = bson_error.message;
+			return false;
+		}
+
+		bson_iter_t iter, stage;
+		if (bson_iter_init_find(&iter, &parsed, "stages") && bson_iter_recurse(&iter, &stage))
+		{
+			while (bson_iter_next(&stage))
+			{
+				char key[16];
+				const char* key_str = nullptr;
+				auto key_length = bson_uint32_to_string(index++, &key_str, key, sizeof(key));
+				bson_append_iter(stages, key_str, (int)key_length, &stage);
+			}
+		}
+
+		bson_destroy(&parsed);
+		return true;
+	}
+
+	/**
+	* Start a pipeline with the filter, skip and limit of a fetch query.
+	*/
+	void append_match_stages(const FetchQuery& query, bson_t* stages, uint32_t& index)
+	{
+		bson_t filter, opts, stage;
+		bson_init(&filter);
+		bson_init(&opts);
+		build_fetch_query(query, &filter, &opts);
+
+		char key[16];
+		const char* key_str = nullptr;
+
+		bson_uint32_to_string(index++, &key_str, key, sizeof(key));
+		BSON_APPEND_DOCUMENT_BEGIN(stages, key_str, &stage);
+		BSON_APPEND_DOCUMENT(&stage, "$match", &filter);
+		bson_append_document_end(stages, &stage);
+
+		if (query.skip > 0)
+		{
+			bson_uint32_to_string(index++, &key_str, key, sizeof(key));
+			BSON_APPEND_DOCUMENT_BEGIN(stages, key_str, &stage);
+			BSON_APPEND_INT64(&stage, "$skip", query.skip);
+			bson_append_document_end(stages, &stage);
+		}
+
+		if (query.limit > 0)
+		{
+			bson_uint32_to_string(index++, &key_str, key, sizeof(key));
+			BSON_APPEND_DOCUMENT_BEGIN(stages, key_str, &stage);
+			BSON_APPEND_INT64(&stage, "$limit", query.limit);
+			bson_append_document_end(stages, &stage);
+		}
+
+		bson_destroy(&opts);
+		bson_destroy(&filter);
+	}
+
+	/**
+	* Build { pipeline: [$match..., <json stages>] }.
+	*/
+	bool build_pipeline(const FetchQuery& query, const std::string& json_stages, bson_t* pipeline, std::string& error)
+	{
+		bson_t stages;
+		uint32_t index = 0;
+
+		BSON_APPEND_ARRAY_BEGIN(pipeline, "pipeline", &stages);
+		append_match_stages(query, &stages, index);
+		auto ok = append_json_stages(&stages, index, json_stages, error);
+		bson_append_array_end(pipeline, &stages);
+		return ok;
+	}
+
+	std::string cell_stages(const FetchQuery& query, const AggregateQuery& aggregate)
+	{
+		auto cell = json_number(aggregate.cell_size > 0.0 ? aggregate.cell_size : 1.0);
+		auto axis = [&](int i) {
+			return "{ \"$floor\": { \"$divide\": [{ \"$arrayElemAt\": [\"$p\", " + std::to_string(i) + "] }, " + cell + "] } }";
+		};
+
+		std::string project = "\"p\": " + position_expression(aggregate.position_field, query.position_parser);
+		if (!aggregate.scalar_field.empty())
+			project += ", \"v\": " + json_string("$" + aggregate.scalar_field);
+
+		return "["
+			"{ \"$project\": { " + project + " } },"
+			"{ \"$match\": { \"p.0\": { \"$type\": \"number\" }, \"p.1\": { \"$type\": \"number\" }, \"p.2\": { \"$type\": \"number\" } } },"
+			"{ \"$group\": { \"_id\": { \"x\": " + axis(0) + ", \"y\": " + axis(1) + ", \"z\": " + axis(2) + " },"
+				" \"count\": { \"$sum\": 1 }, \"min\": { \"$min\": \"$v\" }, \"max\": { \"$max\": \"$v\" }, \"avg\": { \"$avg\": \"$v\" } } },"
+			"{ \"$limit\": " + std::to_string(aggregate.max_cells) + " }"
+			"]";
+	}
+
+	/**
+	* Run a pipeline with disk use allowed and call on_document for every result.
+	*/
+	template<typename OnDocument>
+	bool run_pipeline(mongoc_collection_t* collection, const bson_t* pipeline, std::string& error, OnDocument on_document)
+	{
+		bson_t opts;
+		bson_error_t bson_error;
+		const bson_t* doc = nullptr;
+
+		bson_init(&opts);
+		BSON_APPEND_BOOL(&opts, "allowDiskUse", true);
+
+		auto cursor = mongoc_collection_aggregate(collection, MONGOC_QUERY_NONE, pipeline, &opts, NULL);
+		while (mongoc_cursor_next(cursor, &doc))
+			on_document(doc);
+
+		auto ok = !mongoc_cursor_error(cursor, &bson_error);
+		if (!ok)
+			error = bson_error.message;
+
+		mongoc_cursor_destroy(cursor);
+		bson_destroy(&opts);
+		return ok;
+	}
+
+	/**
+	* Read a numeric field of a result document, false if it is missing or not a number.
+	*/
+	bool read_number(const bson_t* doc, const char* path, double& value)
+	{
+		bson_iter_t iter, field;
+		if (!bson_iter_init(&iter, doc) || !bson_iter_find_descendant(&iter, path, &field))
+			return false;
+
+		auto type = bson_iter_type(&field);
+		if (type != BSON_TYPE_DOUBLE && type != BSON_TYPE_INT32 && type != BSON_TYPE_INT64)
+			return false;
+
+		value = bson_iter_as_double(&field);
+		return true;
+	}
+
+	void push_number(Column& column, const bson_t* doc, const char* path)
+	{
+		double value;
+		if (read_number(doc, path, value))
+			column.push_double(value);
+		else
+			column.push_null();
+	}
+
+	bool aggregate_cells(mongoc_collection_t* collection, const FetchQuery& query, const AggregateQuery& aggregate, std::vector<Column>& cells, std::string& error)
+	{
+		bson_t pipeline;
+		bson_init(&pipeline);
+		if (!build_pipeline(query, cell_stages(query, aggregate), &pipeline, error))
+		{
+			bson_destroy(&pipeline);
+			return false;
+		}
+
+		static const char* names[] = { "x", "y", "z", "count", "min", "max", "avg" };
+		cells.clear();
+		cells.resize(7);
+		for (auto i = 0; i < 7; ++i)
+			cells[i].name = names[i];
+
+		auto cell_size = aggregate.cell_size > 0.0 ? aggregate.cell_size : 1.0;
+		auto ok = run_pipeline(collection, &pipeline, error, [&](const bson_t* doc) {
+			static const char* axes[] = { "_id.x", "_id.y", "_id.z" };
+			for (auto i = 0; i < 3; ++i)
+			{
+				double index;
+				if (read_number(doc, axes[i], index))
+					cells[i].push_double((index + 0.5) * cell_size); // Cell center
+				else
+					cells[i].push_null();
+			}
+
+			double count = 0.0;
+			read_number(doc, "count", count);
+			cells[3].push_int64((int64_t)count);
+
+			push_number(cells[4], doc, "min");
+			push_number(cells[5], doc, "max");
+			push_number(cells[6], doc, "avg");
+		});
+
+		bson_destroy(&pipeline);
+		return ok;
+	}
+
+	bool aggregate_summary(mongoc_collection_t* collection, const FetchQuery& query, const AggregateQuery& aggregate, ScalarSummary& summary, std::string& error)
+	{
+		if (aggregate.scalar_field.empty())
+		{
+			error = "No scalar field to summarize";
+			return false;
+		}
+
+		auto numbers = "{ \"$project\": { \"v\": " + json_string("$" + aggregate.scalar_field) + " } },"
+			"{ \"$match\": { \"v\": { \"$type\": \"number\" } } },";
+
+		bson_t pipeline;
+		bson_init(&pipeline);
+		auto ok = build_pipeline(query, "[" + numbers +
+			"{ \"$group\": { \"_id\": null, \"count\": { \"$sum\": 1 }, \"min\": { \"$min\": \"$v\" }, \"max\": { \"$max\": \"$v\" }, \"avg\": { \"$avg\": \"$v\" } } }]",
+			&pipeline, error);
+
+		ok = ok && run_pipeline(collection, &pipeline, error, [&](const bson_t* doc) {
+			double count = 0.0;
+			read_number(doc, "count", count);
+			summary.count = (int64_t)count;
+			read_number(doc, "min", summary.min);
+			read_number(doc, "max", summary.max);
+			read_number(doc, "avg", summary.avg);
+		});
+		bson_destroy(&pipeline);
+
+		if (!ok || aggregate.percentiles.empty() || summary.count == 0)
+			return ok;
+
+		// Equal count buckets, percentiles are interpolated inside the bucket they fall in
+		std::vector<double> bucket_min, bucket_max;
+
+		bson_init(&pipeline);
+		ok = build_pipeline(query, "[" + numbers +
+			"{ \"$bucketAuto\": { \"groupBy\": \"$v\", \"buckets\": " + std::to_string(AUTO_BUCKETS) + " } }]",
+			&pipeline, error);
+
+		ok = ok && run_pipeline(collection, &pipeline, error, [&](const bson_t* doc) {
+			double min = 0.0, max = 0.0;
+			if (read_number(doc, "_id.min", min) && read_number(doc, "_id.max", max))
+			{
+				bucket_min.push_back(min);
+				bucket_max.push_back(max);
+			}
+		});
+		bson_destroy(&pipeline);
+
+		if (!ok || bucket_min.empty())
+			return ok;
+
+		for (auto percentile : aggregate.percentiles)
+		{
+			auto position = percentile / 100.0 * bucket_min.size();
+			auto bucket = (size_t)floor(position);
+			if (position <= 0.0)
+				summary.percentiles.push_back(summary.min);
+			else if (bucket >= bucket_min.size())
+				summary.percentiles.push_back(summary.max);
+			else
+				summary.percentiles.push_back(bucket_min[bucket] + (position - bucket) * (bucket_max[bucket] - bucket_min[bucket]));
+		}
+
+		return ok;
+	}
+}
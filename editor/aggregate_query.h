@@ -0,0 +1,51 @@
+#pragma once
+
+#include "column_set.h"
+#include "fetch_query.h"
+
+#include <mongoc.h>
+#include <bson.h>
+
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Server side binning of a fetch query. Documents are grouped in cubic cells of the position field
+	* and only the cells and a summary of the scalar field are sent back.
+	*/
+	struct AggregateQuery
+	{
+		std::string position_field;
+		std::string scalar_field; // Optional, cells only get a count without it
+		double cell_size = 1.0;
+		std::vector<double> percentiles; // In [0, 100]
+		int64_t max_cells = 100000;
+	};
+
+	/**
+	* Statistics of the scalar field over all matched documents.
+	* Percentiles are approximated from 100 equal count buckets ($bucketAuto).
+	*/
+	struct ScalarSummary
+	{
+		int64_t count = 0;
+		double min = 0.0;
+		double max = 0.0;
+		double avg = 0.0;
+		std::vector<double> percentiles; // One value per requested percentile
+	};
+
+	/**
+	* Group the matched documents in cells with [$match, $skip, $limit, $project { p: [x, y, z], v }, $match p, $group cell, $limit].
+	* String positions are parsed on the server (needs MongoDB 4.0 for $convert), arrays and { x, y, z } documents are read directly.
+	* Returns columns x, y, z (cell centers), count, and min, max, avg of the scalar field.
+	*/
+	bool aggregate_cells(mongoc_collection_t* collection, const FetchQuery& query, const AggregateQuery& aggregate, std::vector<Column>& cells, std::string& error);
+
+	/**
+	* Compute the count, min, max, average and percentiles of the scalar field on the server.
+	*/
+	bool aggregate_summary(mongoc_collection_t* collection, const FetchQuery& query, const AggregateQuery& aggregate, ScalarSummary& summary, std::string& error);
+}
@@ -0,0 +1,164 @@
+#include "block_codec.h"
+
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	const unsigned LZ_HASH_BITS = 14;
+	const size_t LZ_MIN_MATCH = 4;
+	const size_t LZ_MAX_OFFSET = 65535;
+	const size_t LZ_LAST_LITERALS = 5; // The format ends every block with literals
+
+	void shuffle_bytes(const uint8_t* src, size_t size, size_t width, uint8_t* dst)
+	{
+		auto count = size / width;
+		for (size_t b = 0; b < width; ++b)
+		{
+			for (size_t i = 0; i < count; ++i)
+				dst[b * count + i] = src[i * width + b];
+		}
+		if (count * width < size)
+			memcpy(dst + count * width, src + count * width, size - count * width);
+	}
+
+	void unshuffle_bytes(const uint8_t* src, size_t size, size_t width, uint8_t* dst)
+	{
+		auto count = size / width;
+		for (size_t b = 0; b < width; ++b)
+		{
+			for (size_t i = 0; i < count; ++i)
+				dst[i * width + b] = src[b * count + i];
+		}
+		if (count * width < size)
+			memcpy(dst + count * width, src + count * width, size - count * width);
+	}
+
+	inline uint32_t read_u32(const uint8_t* p)
+	{
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline uint32_t lz_hash(uint32_t sequence)
+	{
+		return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+	}
+
+	void write_length(size_t length, std::vector<uint8_t>& dst)
+	{
+		for (; length >= 255; length -= 255)
+			dst.push_back(255);
+		dst.push_back((uint8_t)length);
+	}
+
+	void write_sequence(const uint8_t* literals, size_t literal_length, size_t offset, size_t match_length, std::vector<uint8_t>& dst)
+	{
+		auto match_code = match_length >= LZ_MIN_MATCH ? match_length - LZ_MIN_MATCH : 0;
+		dst.push_back((uint8_t)((literal_length < 15 ? literal_length : 15) << 4 | (match_code < 15 ? match_code : 15)));
+		if (literal_length >= 15)
+			write_length(literal_length - 15, dst);
+		dst.insert(dst.end(), literals, literals + literal_length);
+
+		if (match_length == 0)
+			return; // Last sequence
+
+		dst.push_back((uint8_t)(offset & 0xFF));
+		dst.push_back((uint8_t)(offset >> 8));
+		if (match_code >= 15)
+			write_length(match_code - 15, dst);
+	}
+
+	void lz_compress(const uint8_t* src, size_t size, std::vector<uint8_t>& dst)
+	{
+		std::vector<uint32_t> table((size_t)1 << LZ_HASH_BITS, 0);
+		size_t anchor = 0;
+		size_t i = 0;
+
+		// Matches must end LZ_LAST_LITERALS bytes before the end of the block
+		auto match_limit = size > LZ_LAST_LITERALS + LZ_MIN_MATCH ? size - LZ_LAST_LITERALS - LZ_MIN_MATCH : 0;
+
+		while (i < match_limit)
+		{
+			auto sequence = read_u32(src + i);
+			auto hash = lz_hash(sequence);
+			auto candidate = (size_t)table[hash];
+			table[hash] = (uint32_t)i;
+
+			if (candidate >= i || i - candidate > LZ_MAX_OFFSET || read_u32(src + candidate) != sequence)
+			{
+				++i;
+				continue;
+			}
+
+			auto length = LZ_MIN_MATCH;
+			while (i + length < size - LZ_LAST_LITERALS && src[candidate + length] == src[i + length])
+				++length;
+
+			write_sequence(src + anchor, i - anchor, i - candidate, length, dst);
+			i += length;
+			anchor = i;
+		}
+
+		write_sequence(src + anchor, size - anchor, 0, 0, dst);
+	}
+
+	bool read_length(const uint8_t*& p, const uint8_t* end, size_t& length)
+	{
+		uint8_t byte;
+		do
+		{
+			if (p == end)
+				return false;
+			byte = *p++;
+			length += byte;
+		} while (byte == 255);
+		return true;
+	}
+
+	bool lz_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t size)
+	{
+		auto p = src;
+		auto end = src + src_size;
+		size_t out = 0;
+
+		while (p < end)
+		{
+			auto token = *p++;
+
+			size_t literal_length = token >> 4;
+			if (literal_length == 15 && !read_length(p, end, literal_length))
+				return false;
+			if ((size_t)(end - p) < literal_length || size - out < literal_length)
+				return false;
+			if (literal_length > 0)
+				memcpy(dst + out, p, literal_length);
+			p += literal_length;
+			out += literal_length;
+
+			if (p == end)
+				break; // Last sequence has no match
+
+			if (end - p < 2)
+				return false;
+			size_t offset = p[0] | (p[1] << 8);
+			p += 2;
+
+			size_t match_length = token & 15;
+			if (match_length == 15 && !read_length(p, end, match_length))
+				return false;
+			match_length += LZ_MIN_MATCH;
+
+			if (offset == 0 || offset > out || size - out < match_length)
+				return false;
+
+			// Byte by byte, matches may overlap the bytes they produce
+			auto match = dst + out - offset;
+			for (size_t k = 0; k < match_length; ++k)
+				dst[out + k] = match[k];
+			out += match_length;
+		}
+
+		return out == size;
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Transpose the bytes of width byte values so that byte 0 of every value comes first, then byte 1 and so on.
+	* Neighbouring doubles, floats and offsets share their high bytes, which then compress into long runs.
+	*/
+	void shuffle_bytes(const uint8_t* src, size_t size, size_t width, uint8_t* dst);
+
+	/**
+	* Undo shuffle_bytes.
+	*/
+	void unshuffle_bytes(const uint8_t* src, size_t size, size_t width, uint8_t* dst);
+
+	/**
+	* Compress a block with a fast LZ77 coder (the LZ4 block format). Appends to dst.
+	*/
+	void lz_compress(const uint8_t* src, size_t size, std::vector<uint8_t>& dst);
+
+	/**
+	* Decompress a block written by lz_compress into exactly size bytes.
+	* Returns false if the block is malformed or does not decode to size bytes.
+	*/
+	bool lz_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t size);
+}
@@ -0,0 +1,78 @@
+#include "cluster_requests.h"
+
+#include <memory>
+
+namespace PLUGIN_NAMESPACE
+{
+	// Requests are only started, polled and released from the UI thread.
+	std::vector<std::unique_ptr<ClusterRequest>> cluster_requests;
+	unsigned next_cluster_handle = 1;
+
+	void run_cluster_request(ClusterRequest* request)
+	{
+		auto num_points = (uint32_t)(request->positions.size() / 3);
+		auto scalars = request->scalars.empty() ? nullptr : request->scalars.data();
+
+		if (request->settings.method == CLUSTER_KMEANS)
+			cluster_kmeans(request->positions.data(), scalars, num_points, request->settings, request->cancelled, request->result);
+		else
+			cluster_dbscan(request->positions.data(), scalars, num_points, request->settings, request->cancelled, request->result);
+
+		request->finished = true;
+	}
+
+	unsigned start_cluster_request(const ClusterSettings& settings, std::vector<float>&& positions, std::vector<float>&& scalars)
+	{
+		std::unique_ptr<ClusterRequest> request(new ClusterRequest());
+		request->handle = next_cluster_handle++;
+		request->settings = settings;
+		request->positions = std::move(positions);
+		request->scalars = std::move(scalars);
+
+		request->worker = std::thread(run_cluster_request, request.get());
+
+		cluster_requests.push_back(std::move(request));
+		return cluster_requests.back()->handle;
+	}
+
+	ClusterRequest* find_cluster_request(unsigned handle)
+	{
+		for (auto& request : cluster_requests)
+		{
+			if (request->handle == handle)
+				return request.get();
+		}
+		return nullptr;
+	}
+
+	void release_cluster_request(unsigned handle)
+	{
+		for (auto it = cluster_requests.begin(); it != cluster_requests.end(); ++it)
+		{
+			auto& request = *it;
+			if (request->handle != handle)
+				continue;
+
+			request->cancelled = true;
+			if (request->worker.joinable())
+				request->worker.join();
+
+			cluster_requests.erase(it);
+			return;
+		}
+	}
+
+	void shutdown_cluster_requests()
+	{
+		for (auto& request : cluster_requests)
+			request->cancelled = true;
+
+		for (auto& request : cluster_requests)
+		{
+			if (request->worker.joinable())
+				request->worker.join();
+		}
+
+		cluster_requests.clear();
+	}
+}
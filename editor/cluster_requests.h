@@ -0,0 +1,51 @@
+#pragma once
+
+#include "point_clustering.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* A clustering of points run on a worker thread, which splits the work over settings.thread_count threads.
+	* The request owns a copy of the points, so the fetch they come from can be released while it runs.
+	*/
+	struct ClusterRequest
+	{
+		unsigned handle = 0;
+		ClusterSettings settings;
+		std::vector<float> positions;
+		std::vector<float> scalars; // Empty without a scalar field
+
+		std::thread worker;
+		std::atomic<bool> cancelled{ false };
+		std::atomic<bool> finished{ false };
+
+		ClusterResult result; // Only read once finished is set
+	};
+
+	/**
+	* Start clustering positions (x, y, z triplets) and their optional scalars on a worker thread, taking both.
+	* Returns the request handle.
+	*/
+	unsigned start_cluster_request(const ClusterSettings& settings, std::vector<float>&& positions, std::vector<float>&& scalars);
+
+	/**
+	* Return the request for a handle, nullptr if it does not exist or has been released.
+	*/
+	ClusterRequest* find_cluster_request(unsigned handle);
+
+	/**
+	* Cancel if needed, wait for the worker and forget the request.
+	*/
+	void release_cluster_request(unsigned handle);
+
+	/**
+	* Cancel and release all requests, used when the plugin is unloaded.
+	*/
+	void shutdown_cluster_requests();
+}
@@ -0,0 +1,316 @@
+#include "column_set.h"
+
+#include <limits>
+#include <math.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	void Column::set_type(ColumnType new_type)
+	{
+		// Back fill the rows that were pushed as null before the type was known
+		type = new_type;
+		switch (type)
+		{
+			case COLUMN_TYPE_DOUBLE: doubles.assign(size, 0.0); break;
+			case COLUMN_TYPE_INT64: ints.assign(size, 0); break;
+			case COLUMN_TYPE_BOOL: bools.assign(size, 0); break;
+			case COLUMN_TYPE_STRING: offsets.assign(size + 1, 0); break;
+			default: break;
+		}
+	}
+
+	void Column::push_validity(bool valid)
+	{
+		if ((size & 7) == 0)
+			validity.push_back(0);
+		if (valid)
+			validity[size >> 3] |= (uint8_t)(1 << (size & 7));
+		++size;
+	}
+
+	void Column::push_null()
+	{
+		switch (type)
+		{
+			case COLUMN_TYPE_DOUBLE: doubles.push_back(0.0); break;
+			case COLUMN_TYPE_INT64: ints.push_back(0); break;
+			case COLUMN_TYPE_BOOL: bools.push_back(0); break;
+			case COLUMN_TYPE_STRING: offsets.push_back((uint32_t)blob.size()); break;
+			default: break;
+		}
+		push_validity(false);
+	}
+
+	void Column::push_double(double value)
+	{
+		if (type == COLUMN_TYPE_NULL)
+			set_type(COLUMN_TYPE_DOUBLE);
+
+		if (type == COLUMN_TYPE_INT64)
+		{
+			// Promote an integer column as soon as a real number shows up
+			doubles.assign(ints.begin(), ints.end());
+			ints.clear();
+			ints.shrink_to_fit();
+			type = COLUMN_TYPE_DOUBLE;
+		}
+
+		if (type != COLUMN_TYPE_DOUBLE)
+			return push_null();
+
+		doubles.push_back(value);
+		push_validity(true);
+	}
+
+	void Column::push_int64(int64_t value)
+	{
+		if (type == COLUMN_TYPE_NULL)
+			set_type(COLUMN_TYPE_INT64);
+
+		if (type == COLUMN_TYPE_DOUBLE)
+			return push_double((double)value);
+
+		if (type != COLUMN_TYPE_INT64)
+			return push_null();
+
+		ints.push_back(value);
+		push_validity(true);
+	}
+
+	void Column::push_bool(bool value)
+	{
+		if (type == COLUMN_TYPE_NULL)
+			set_type(COLUMN_TYPE_BOOL);
+
+		if (type != COLUMN_TYPE_BOOL)
+			return push_null();
+
+		bools.push_back(value ? 1 : 0);
+		push_validity(true);
+	}
+
+	void Column::push_string(const char* str, uint32_t len)
+	{
+		if (type == COLUMN_TYPE_NULL)
+			set_type(COLUMN_TYPE_STRING);
+
+		if (type != COLUMN_TYPE_STRING)
+			return push_null();
+
+		blob.insert(blob.end(), str, str + len);
+		offsets.push_back((uint32_t)blob.size());
+		push_validity(true);
+	}
+
+	void Column::push_position(const float* xyz)
+	{
+		const float nan = std::numeric_limits<float>::quiet_NaN();
+
+		if (position_state == POSITIONS_NONE)
+			return;
+
+		if (position_state == POSITIONS_UNKNOWN)
+		{
+			// Nothing to record until the first row with a position shows up
+			if (xyz == nullptr)
+				return;
+
+			position_state = POSITIONS_PARSED;
+			positions.assign((size - 1) * 3, nan);
+		}
+
+		if (xyz != nullptr)
+			positions.insert(positions.end(), xyz, xyz + 3);
+		else
+			positions.insert(positions.end(), 3, nan);
+	}
+
+	void Column::reject_positions()
+	{
+		position_state = POSITIONS_NONE;
+		positions.clear();
+	}
+
+	bool Column::is_valid(size_t row) const
+	{
+		return row < size && (validity[row >> 3] & (1 << (row & 7))) != 0;
+	}
+
+	double Column::number_at(size_t row) const
+	{
+		if (!is_valid(row))
+			return NAN;
+
+		switch (type)
+		{
+			case COLUMN_TYPE_DOUBLE: return doubles[row];
+			case COLUMN_TYPE_INT64: return (double)ints[row];
+			case COLUMN_TYPE_BOOL: return bools[row] ? 1.0 : 0.0;
+			default: return NAN;
+		}
+	}
+
+	const void* Column::data() const
+	{
+		switch (type)
+		{
+			case COLUMN_TYPE_DOUBLE: return doubles.data();
+			case COLUMN_TYPE_INT64: return ints.data();
+			case COLUMN_TYPE_BOOL: return bools.data();
+			case COLUMN_TYPE_STRING: return blob.data();
+			default: return nullptr;
+		}
+	}
+
+	size_t Column::data_size() const
+	{
+		switch (type)
+		{
+			case COLUMN_TYPE_DOUBLE: return doubles.size() * sizeof(double);
+			case COLUMN_TYPE_INT64: return ints.size() * sizeof(int64_t);
+			case COLUMN_TYPE_BOOL: return bools.size();
+			case COLUMN_TYPE_STRING: return blob.size();
+			default: return 0;
+		}
+	}
+
+	ColumnView view_column(const Column& column)
+	{
+		ColumnView view;
+		view.name = column.name;
+		view.type = column.type;
+		view.size = column.size;
+		view.data = column.data();
+		view.data_size = column.data_size();
+		view.validity = column.validity.data();
+		view.validity_size = column.validity.size();
+		if (column.type == COLUMN_TYPE_STRING)
+			view.offsets = column.offsets.data();
+		view.position_state = column.position_state;
+		if (column.position_state == POSITIONS_PARSED)
+			view.positions = column.positions.data();
+		return view;
+	}
+
+	void append_rows(Column& column, const ColumnView& source, size_t begin, size_t end)
+	{
+		if (source.position_state == POSITIONS_NONE)
+			column.reject_positions();
+
+		for (auto row = begin; row < end && row < source.size; ++row)
+		{
+			auto valid = (source.validity[row >> 3] & (1 << (row & 7))) != 0;
+			if (!valid)
+			{
+				column.push_null();
+			}
+			else
+			{
+				switch (source.type)
+				{
+					case COLUMN_TYPE_DOUBLE: column.push_double(static_cast<const double*>(source.data)[row]); break;
+					case COLUMN_TYPE_INT64: column.push_int64(static_cast<const int64_t*>(source.data)[row]); break;
+					case COLUMN_TYPE_BOOL: column.push_bool(static_cast<const uint8_t*>(source.data)[row] != 0); break;
+					case COLUMN_TYPE_STRING:
+					{
+						auto str = static_cast<const char*>(source.data) + source.offsets[row];
+						column.push_string(str, source.offsets[row + 1] - source.offsets[row]);
+						break;
+					}
+					default: column.push_null(); break;
+				}
+			}
+
+			if (source.position_state == POSITIONS_PARSED)
+				column.push_position(source.positions + row * 3);
+			else if (source.position_state == POSITIONS_UNKNOWN)
+				column.push_position(nullptr);
+		}
+	}
+
+	const char* column_type_name(ColumnType type)
+	{
+		switch (type)
+		{
+			case COLUMN_TYPE_DOUBLE: return "double";
+			case COLUMN_TYPE_INT64: return "int64";
+			case COLUMN_TYPE_BOOL: return "bool";
+			case COLUMN_TYPE_STRING: return "string";
+			default: return "null";
+		}
+	}
+
+	std::string base64_encode(const void* data, size_t size)
+	{
+		static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		auto bytes = static_cast<const uint8_t*>(data);
+		std::string encoded;
+		encoded.reserve(((size + 2) / 3) * 4);
+
+		size_t i = 0;
+		for (; i + 2 < size; i += 3)
+		{
+			uint32_t triple = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+			encoded.push_back(alphabet[(triple >> 18) & 0x3F]);
+			encoded.push_back(alphabet[(triple >> 12) & 0x3F]);
+			encoded.push_back(alphabet[(triple >> 6) & 0x3F]);
+			encoded.push_back(alphabet[triple & 0x3F]);
+		}
+
+		if (i < size)
+		{
+			uint32_t triple = bytes[i] << 16;
+			if (i + 1 < size)
+				triple |= bytes[i + 1] << 8;
+
+			encoded.push_back(alphabet[(triple >> 18) & 0x3F]);
+			encoded.push_back(alphabet[(triple >> 12) & 0x3F]);
+			encoded.push_back(i + 1 < size ? alphabet[(triple >> 6) & 0x3F] : '=');
+			encoded.push_back('=');
+		}
+
+		return encoded;
+	}
+
+	bool base64_decode(const std::string& encoded, std::vector<uint8_t>& data)
+	{
+		data.clear();
+		if (encoded.size() % 4 != 0)
+			return false;
+
+		auto sextet = [](char c) -> int {
+			if (c >= 'A' && c <= 'Z') return c - 'A';
+			if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+			if (c >= '0' && c <= '9') return c - '0' + 52;
+			if (c == '+') return 62;
+			if (c == '/') return 63;
+			return -1;
+		};
+
+		data.reserve(encoded.size() / 4 * 3);
+		for (size_t i = 0; i < encoded.size(); i += 4)
+		{
+			auto padding = (encoded[i + 3] == '=' ? 1 : 0) + (encoded[i + 2] == '=' ? 1 : 0);
+			if (padding > 0 && i + 4 != encoded.size())
+				return false;
+
+			uint32_t triple = 0;
+			for (auto j = 0; j < 4 - padding; ++j)
+			{
+				auto value = sextet(encoded[i + j]);
+				if (value < 0)
+					return false;
+				triple |= value << (18 - 6 * j);
+			}
+
+			data.push_back((uint8_t)(triple >> 16));
+			if (padding < 2)
+				data.push_back((uint8_t)(triple >> 8));
+			if (padding < 1)
+				data.push_back((uint8_t)triple);
+		}
+
+		return true;
+	}
+}
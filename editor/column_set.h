@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Storage type of a fetched column. A column takes the type of the first
+	* non-null value pushed to it.
+	*/
+	enum ColumnType
+	{
+		COLUMN_TYPE_NULL = 0,
+		COLUMN_TYPE_DOUBLE,
+		COLUMN_TYPE_INT64,
+		COLUMN_TYPE_BOOL,
+		COLUMN_TYPE_STRING
+	};
+
+	/**
+	* Whether a column holds positions, decided by the first non-null value when a position parser is used.
+	*/
+	enum PositionState
+	{
+		POSITIONS_UNKNOWN = 0,
+		POSITIONS_PARSED,
+		POSITIONS_NONE
+	};
+
+	/**
+	* One field of a fetched result set stored as packed contiguous buffers.
+	* Every row has a slot in the typed buffer, null rows are zero/empty and
+	* cleared in the validity bitmap (one bit per row, least significant bit first).
+	*/
+	struct Column
+	{
+		std::string name;
+		ColumnType type = COLUMN_TYPE_NULL;
+		size_t size = 0;
+
+		std::vector<double> doubles;
+		std::vector<int64_t> ints;
+		std::vector<uint8_t> bools;
+		std::vector<uint32_t> offsets; // size + 1 entries into blob for string columns
+		std::vector<char> blob;
+		std::vector<uint8_t> validity;
+
+		// Parsed positions, x, y, z per row (NaN for rows that did not parse)
+		PositionState position_state = POSITIONS_UNKNOWN;
+		std::vector<float> positions;
+
+		void push_null();
+		void push_double(double value);
+		void push_int64(int64_t value);
+		void push_bool(bool value);
+		void push_string(const char* str, uint32_t len);
+
+		/**
+		* Record the parsed position of the last pushed row, or nullptr if it has none.
+		*/
+		void push_position(const float* xyz);
+
+		/**
+		* Give up on parsing positions for this column.
+		*/
+		void reject_positions();
+
+		bool is_valid(size_t row) const;
+
+		/**
+		* Value of a row of a numeric column as a double, NaN for null rows and string columns.
+		*/
+		double number_at(size_t row) const;
+
+		/**
+		* Pointer and byte size of the packed value buffer.
+		*/
+		const void* data() const;
+		size_t data_size() const;
+
+	private:
+		void set_type(ColumnType new_type);
+		void push_validity(bool valid);
+	};
+
+	/**
+	* Read-only view of the packed buffers of a column, either owned by a Column
+	* or pointing straight into a memory mapped cache file.
+	*/
+	struct ColumnView
+	{
+		std::string name;
+		ColumnType type = COLUMN_TYPE_NULL;
+		size_t size = 0;
+
+		const void* data = nullptr;
+		size_t data_size = 0;
+		const uint8_t* validity = nullptr;
+		size_t validity_size = 0;
+		const uint32_t* offsets = nullptr; // size + 1 entries for string columns
+		PositionState position_state = POSITIONS_UNKNOWN;
+		const float* positions = nullptr; // size * 3 floats when position_state is POSITIONS_PARSED
+	};
+
+	/**
+	* View the buffers of a column. The view is valid as long as the column is not modified.
+	*/
+	ColumnView view_column(const Column& column);
+
+	/**
+	* Append rows [begin, end) of a view to a column, as if they were pushed one by one.
+	* Used to merge the columns of parallel scans and multi-chunk cache entries.
+	*/
+	void append_rows(Column& column, const ColumnView& source, size_t begin, size_t end);
+
+	/**
+	* Return the name used for a column type when sent to the viewer.
+	*/
+	const char* column_type_name(ColumnType type);
+
+	/**
+	* Encode a binary buffer as base64 so that it can cross the JavaScript boundary as a single string.
+	*/
+	std::string base64_encode(const void* data, size_t size);
+
+	/**
+	* Decode a base64 string written by base64_encode. Returns false if it is not valid base64.
+	*/
+	bool base64_decode(const std::string& encoded, std::vector<uint8_t>& data);
+}
@@ -0,0 +1,328 @@
+#include "data_store.h"
+#include "profiler.h"
+#include "trajectory_builder.h"
+
+#include <algorithm>
+#include <deque>
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <process.h>
+	#define getpid _getpid
+#else
+	#include <unistd.h>
+#endif
+
+namespace PLUGIN_NAMESPACE
+{
+	// Results are only stored, shared and released from the UI thread.
+	std::deque<std::unique_ptr<StoredResult>> stored_results;
+	std::deque<std::unique_ptr<SharedMemory>> shared_point_sets;
+	unsigned next_shared_point_set = 1;
+
+	StoredResult* find_result(unsigned handle)
+	{
+		for (auto& result : stored_results)
+		{
+			if (result->handle == handle)
+				return result.get();
+		}
+		return nullptr;
+	}
+
+	void create_stored_result(unsigned handle, const std::vector<std::string>& fields)
+	{
+		release_stored_result(handle);
+		if (stored_results.size() == MAX_STORED_RESULTS)
+			stored_results.pop_front();
+
+		stored_results.emplace_back(new StoredResult());
+		auto result = stored_results.back().get();
+		result->handle = handle;
+		result->columns.resize(fields.size());
+		for (auto i = 0; i < fields.size(); ++i)
+			result->columns[i].name = fields[i];
+	}
+
+	void store_result_rows(unsigned handle, const std::vector<ColumnView>& views, size_t rows)
+	{
+		auto result = find_result(handle);
+		if (result == nullptr)
+			return;
+
+		for (auto i = 0; i < result->columns.size() && i < views.size(); ++i)
+			append_rows(result->columns[i], views[i], 0, rows);
+		result->rows += rows;
+	}
+
+	const StoredResult* find_stored_result(unsigned handle)
+	{
+		return find_result(handle);
+	}
+
+	bool release_stored_result(unsigned handle)
+	{
+		for (auto it = stored_results.begin(); it != stored_results.end(); ++it)
+		{
+			if ((*it)->handle == handle)
+			{
+				stored_results.erase(it);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void release_stored_results()
+	{
+		stored_results.clear();
+		shared_point_sets.clear();
+	}
+
+	const Column* find_column(const StoredResult& result, const std::string& name)
+	{
+		for (auto& column : result.columns)
+		{
+			if (column.name == name)
+				return &column;
+		}
+		return nullptr;
+	}
+
+	std::string shared_point_set_name(unsigned index)
+	{
+		char name[96];
+#ifdef _WIN32
+		snprintf(name, sizeof(name), "Local\\TelemetryVisualizerPoints_%d_%u", (int)getpid(), index);
+#else
+		snprintf(name, sizeof(name), "/telemetry_visualizer_points_%d_%u", (int)getpid(), index);
+#endif
+		return name;
+	}
+
+	/**
+	* Create the next shared point set and write its header, nullptr if the block could not be created.
+	*/
+	std::unique_ptr<SharedMemory> create_shared_point_set(size_t size, uint32_t num_points, uint32_t flags, uint32_t num_paths)
+	{
+		std::unique_ptr<SharedMemory> block(new SharedMemory());
+		if (!block->create(shared_point_set_name(next_shared_point_set++), size))
+			return nullptr;
+
+		auto header = (SharedPointsHeader*)block->data;
+		header->magic = SHARED_POINTS_MAGIC;
+		header->version = SHARED_POINTS_VERSION;
+		header->num_points = num_points;
+		header->flags = flags;
+		header->num_paths = num_paths;
+		header->reserved = 0;
+		return block;
+	}
+
+	/**
+	* Keep a shared point set alive for the engine to map, releasing the oldest one.
+	*/
+	void keep_shared_point_set(std::unique_ptr<SharedMemory> block)
+	{
+		if (shared_point_sets.size() == MAX_SHARED_POINT_SETS)
+			shared_point_sets.pop_front();
+		shared_point_sets.push_back(std::move(block));
+	}
+
+	bool share_points(const StoredResult& result, const PointSelection& selection, SharedPointsInfo& info, std::string& error)
+	{
+		ScopedTimer timer("share_points");
+
+		auto positions = find_column(result, selection.position_field);
+		auto scalars = selection.scalar_field.empty() ? nullptr : find_column(result, selection.scalar_field);
+		auto times = selection.time_field.empty() ? nullptr : find_column(result, selection.time_field);
+		if (positions == nullptr || positions->position_state != POSITIONS_PARSED)
+		{
+			error = "No parsed positions in " + selection.position_field;
+			return false;
+		}
+		if (!selection.scalar_field.empty() && scalars == nullptr)
+		{
+			error = "No field " + selection.scalar_field;
+			return false;
+		}
+		if (!selection.time_field.empty() && times == nullptr)
+		{
+			error = "No field " + selection.time_field;
+			return false;
+		}
+
+		// Count first so the block is written in place, rows without a position are not drawn
+		auto rows = std::min(result.rows, positions->positions.size() / 3);
+		uint32_t num_points = 0;
+		for (size_t r = 0; r + 1 < selection.row_ranges.size(); r += 2)
+		{
+			auto end = std::min(selection.row_ranges[r + 1], rows);
+			for (auto row = selection.row_ranges[r]; row < end; ++row)
+			{
+				if (!isnan(positions->positions[row * 3]))
+					++num_points;
+			}
+		}
+
+		// The times start on the next multiple of 8 bytes, after 24 bytes of header and 12 or 16 bytes per point
+		auto times_offset = sizeof(SharedPointsHeader) + num_points * 3 * sizeof(float);
+		times_offset += scalars != nullptr ? num_points * sizeof(float) : 0;
+		times_offset = (times_offset + sizeof(double) - 1) & ~(sizeof(double) - 1);
+		auto size = times != nullptr ? times_offset + num_points * sizeof(double) : times_offset;
+
+		auto flags = (scalars != nullptr ? SHARED_POINTS_SCALARS : 0) | (times != nullptr ? SHARED_POINTS_TIMES : 0);
+		auto block = create_shared_point_set(size, num_points, flags, 0);
+		if (block == nullptr)
+		{
+			error = "Could not create the shared point set";
+			return false;
+		}
+
+		auto out_positions = (float*)(block->data + sizeof(SharedPointsHeader));
+		auto out_scalars = out_positions + num_points * 3;
+		auto out_times = (double*)(block->data + times_offset);
+
+		info.source_points = num_points;
+		info.num_paths = 0;
+		info.time_min = INFINITY;
+		info.time_max = -INFINITY;
+		uint32_t point = 0;
+		for (size_t r = 0; r + 1 < selection.row_ranges.size(); r += 2)
+		{
+			auto end = std::min(selection.row_ranges[r + 1], rows);
+			for (auto row = selection.row_ranges[r]; row < end; ++row)
+			{
+				auto xyz = &positions->positions[row * 3];
+				if (isnan(xyz[0]))
+					continue;
+
+				memcpy(&out_positions[point * 3], xyz, 3 * sizeof(float));
+				if (scalars != nullptr)
+					out_scalars[point] = (float)scalars->number_at(row);
+				if (times != nullptr)
+				{
+					auto time = times->number_at(row);
+					out_times[point] = time;
+					if (time < info.time_min) info.time_min = time;
+					if (time > info.time_max) info.time_max = time;
+				}
+				++point;
+			}
+		}
+
+		timer.documents = num_points;
+		timer.bytes = size;
+
+		info.name = block->name;
+		info.num_points = num_points;
+		info.has_times = times != nullptr && info.time_min <= info.time_max;
+		if (!info.has_times)
+			info.time_min = info.time_max = 0.0;
+
+		keep_shared_point_set(std::move(block));
+		return true;
+	}
+
+	bool gather_points(const StoredResult& result, const PointSelection& selection, std::vector<float>& positions,
+		std::vector<float>& scalars, std::string& error)
+	{
+		ScopedTimer timer("gather_points");
+
+		auto position_column = find_column(result, selection.position_field);
+		auto scalar_column = selection.scalar_field.empty() ? nullptr : find_column(result, selection.scalar_field);
+		if (position_column == nullptr || position_column->position_state != POSITIONS_PARSED)
+		{
+			error = "No parsed positions in " + selection.position_field;
+			return false;
+		}
+		if (!selection.scalar_field.empty() && scalar_column == nullptr)
+		{
+			error = "No field " + selection.scalar_field;
+			return false;
+		}
+
+		positions.clear();
+		scalars.clear();
+		auto rows = std::min(result.rows, position_column->positions.size() / 3);
+		for (size_t r = 0; r + 1 < selection.row_ranges.size(); r += 2)
+		{
+			auto end = std::min(selection.row_ranges[r + 1], rows);
+			for (auto row = selection.row_ranges[r]; row < end; ++row)
+			{
+				auto xyz = &position_column->positions[row * 3];
+				if (isnan(xyz[0]))
+					continue;
+
+				positions.insert(positions.end(), xyz, xyz + 3);
+				if (scalar_column != nullptr)
+					scalars.push_back((float)scalar_column->number_at(row));
+			}
+		}
+
+		timer.documents = positions.size() / 3;
+		timer.bytes = (positions.size() + scalars.size()) * sizeof(float);
+		return true;
+	}
+
+	bool share_trajectories(const StoredResult& result, const TrajectorySelection& selection, SharedPointsInfo& info, std::string& error)
+	{
+		ScopedTimer timer("share_trajectories");
+
+		auto positions = find_column(result, selection.position_field);
+		auto sessions = find_column(result, selection.session_field);
+		auto times = selection.time_field.empty() ? nullptr : find_column(result, selection.time_field);
+		if (positions == nullptr || positions->position_state != POSITIONS_PARSED)
+		{
+			error = "No parsed positions in " + selection.position_field;
+			return false;
+		}
+		if (sessions == nullptr)
+		{
+			error = "No field " + selection.session_field;
+			return false;
+		}
+		if (!selection.time_field.empty() && times == nullptr)
+		{
+			error = "No field " + selection.time_field;
+			return false;
+		}
+
+		Trajectories trajectories;
+		build_trajectories(*positions, *sessions, times, result.rows, selection.row_ranges, selection.tolerance,
+			selection.thread_count, trajectories);
+
+		auto num_points = (uint32_t)trajectories.rows.size();
+		auto num_paths = (uint32_t)trajectories.path_ends.size();
+		auto size = sizeof(SharedPointsHeader) + num_points * 3 * sizeof(float) + num_paths * sizeof(uint32_t);
+
+		auto block = create_shared_point_set(size, num_points, SHARED_POINTS_PATHS, num_paths);
+		if (block == nullptr)
+		{
+			error = "Could not create the shared point set";
+			return false;
+		}
+
+		auto out_positions = (float*)(block->data + sizeof(SharedPointsHeader));
+		for (uint32_t point = 0; point < num_points; ++point)
+			memcpy(&out_positions[point * 3], &positions->positions[trajectories.rows[point] * 3], 3 * sizeof(float));
+		if (num_paths > 0)
+			memcpy(out_positions + num_points * 3, trajectories.path_ends.data(), num_paths * sizeof(uint32_t));
+
+		timer.documents = num_points;
+		timer.bytes = size;
+
+		info.name = block->name;
+		info.num_points = num_points;
+		info.num_paths = num_paths;
+		info.source_points = trajectories.source_points;
+		info.has_times = false;
+		info.time_min = info.time_max = 0.0;
+
+		keep_shared_point_set(std::move(block));
+		return true;
+	}
+}
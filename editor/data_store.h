@@ -0,0 +1,135 @@
+#pragma once
+
+#include "column_set.h"
+#include "mapped_file.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Results kept at the same time, the oldest is released when another is stored.
+	*/
+	const size_t MAX_STORED_RESULTS = 4;
+
+	/**
+	* Point sets shared with the engine kept alive at the same time, so that the engine can still map
+	* the previous one while a new one is shared.
+	*/
+	const size_t MAX_SHARED_POINT_SETS = 2;
+
+	/**
+	* Layout of a shared point set: the header, num_points x, y, z float triplets, then num_points float scalars
+	* if SHARED_POINTS_SCALARS is set, num_points double times if SHARED_POINTS_TIMES is set, starting at the next
+	* multiple of 8 bytes, and num_paths uint32 path ends if SHARED_POINTS_PATHS is set, the points then being the
+	* vertices of polylines.
+	* Read by the engine plugin (engine/shared_points.h), both sides must agree on it.
+	*/
+	const uint32_t SHARED_POINTS_MAGIC = 0x48535654; // "TVSH"
+	const uint32_t SHARED_POINTS_VERSION = 2;
+	const uint32_t SHARED_POINTS_SCALARS = 1;
+	const uint32_t SHARED_POINTS_TIMES = 2;
+	const uint32_t SHARED_POINTS_PATHS = 4;
+
+	struct SharedPointsHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t num_points;
+		uint32_t flags;
+		uint32_t num_paths;
+		uint32_t reserved;
+	};
+
+	/**
+	* The columns of a fetch as delivered to the viewer, rows in delivery order.
+	*/
+	struct StoredResult
+	{
+		unsigned handle = 0;
+		std::vector<Column> columns;
+		size_t rows = 0;
+	};
+
+	/**
+	* Start storing the result of a fetch, one empty column per field.
+	*/
+	void create_stored_result(unsigned handle, const std::vector<std::string>& fields);
+
+	/**
+	* Append delivered rows to the result stored under a handle. Nothing is stored once the result was released.
+	*/
+	void store_result_rows(unsigned handle, const std::vector<ColumnView>& views, size_t rows);
+
+	/**
+	* Stored result of a handle, nullptr if it was never stored or has been released.
+	*/
+	const StoredResult* find_stored_result(unsigned handle);
+
+	bool release_stored_result(unsigned handle);
+	void release_stored_results();
+
+	/**
+	* What to share of a stored result: the columns by name (scalar and time are optional, empty for none)
+	* and the included rows as [begin, end) ranges.
+	*/
+	struct PointSelection
+	{
+		std::string position_field;
+		std::string scalar_field;
+		std::string time_field;
+		std::vector<size_t> row_ranges;
+	};
+
+	/**
+	* Summary of a shared point set, for the viewer to show without reading it back.
+	*/
+	struct SharedPointsInfo
+	{
+		std::string name;
+		uint32_t num_points = 0;
+		uint32_t num_paths = 0;
+		size_t source_points = 0; // Points of the selected rows before trajectories are simplified
+		bool has_times = false;
+		double time_min = 0.0;
+		double time_max = 0.0;
+	};
+
+	/**
+	* Write the parsed positions of the selected rows that have one, with their scalars and times,
+	* straight into a new named shared memory block the engine can map.
+	* Returns false and sets error if the fields are not in the result or the block could not be created.
+	*/
+	bool share_points(const StoredResult& result, const PointSelection& selection, SharedPointsInfo& info, std::string& error);
+
+	/**
+	* Copy the parsed positions of the selected rows that have one into positions (x, y, z triplets) and,
+	* with a scalar field, their scalars (NaN for none). The time field of the selection is not used.
+	* Returns false and sets error if the fields are not in the result.
+	*/
+	bool gather_points(const StoredResult& result, const PointSelection& selection, std::vector<float>& positions,
+		std::vector<float>& scalars, std::string& error);
+
+	/**
+	* What to build trajectories of: the rows of a stored result with a position and a session, ordered by the
+	* optional time field, and the Douglas-Peucker tolerance in world units (0 keeps every point).
+	*/
+	struct TrajectorySelection
+	{
+		std::string position_field;
+		std::string session_field;
+		std::string time_field;
+		std::vector<size_t> row_ranges;
+		float tolerance = 0.0f;
+		unsigned thread_count = 1;
+	};
+
+	/**
+	* Build one simplified path per session of the selected rows (see build_trajectories) and write the path
+	* vertices and ends into a new named shared memory block the engine can map.
+	* Returns false and sets error if the fields are not in the result or the block could not be created.
+	*/
+	bool share_trajectories(const StoredResult& result, const TrajectorySelection& selection, SharedPointsInfo& info, std::string& error);
+}
@@ -0,0 +1,129 @@
+#include "document_decoder.h"
+
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Add the keys of a dotted path to the trie, marking the last one as the field.
+	*/
+	void add_field_path(std::vector<FieldPathNode>& roots, const std::string& path, int field)
+	{
+		auto nodes = &roots;
+		FieldPathNode* node = nullptr;
+		size_t begin = 0;
+
+		for (;;)
+		{
+			auto dot = path.find('.', begin);
+			auto key = path.substr(begin, dot == std::string::npos ? std::string::npos : dot - begin);
+
+			node = nullptr;
+			for (auto& child : *nodes)
+			{
+				if (child.key == key)
+				{
+					node = &child;
+					break;
+				}
+			}
+			if (node == nullptr)
+			{
+				nodes->emplace_back();
+				node = &nodes->back();
+				node->key = key;
+			}
+
+			if (dot == std::string::npos)
+				break;
+			nodes = &node->children;
+			begin = dot + 1;
+		}
+
+		node->fields.push_back(field);
+	}
+
+	DocumentDecoder::DocumentDecoder(const FetchQuery& query)
+		: position_parser(query.position_parser), fields(query.fields.size()), found(query.fields.size(), 0)
+	{
+		for (auto i = 0; i < query.fields.size(); ++i)
+			add_field_path(roots, query.fields[i], i);
+	}
+
+	bool DocumentDecoder::walk_level(bson_iter_t* iter, const std::vector<FieldPathNode>& nodes)
+	{
+		while (bson_iter_next(iter))
+		{
+			auto key = bson_iter_key(iter);
+			auto key_len = bson_iter_key_len(iter);
+
+			for (auto& node : nodes)
+			{
+				if (node.key.size() != key_len || memcmp(node.key.data(), key, key_len) != 0)
+					continue;
+
+				// The first of duplicate keys wins, as with bson_iter_find
+				for (auto field : node.fields)
+				{
+					if (!found[field])
+					{
+						fields[field] = *iter;
+						found[field] = 1;
+						++found_count;
+					}
+				}
+
+				auto type = bson_iter_type(iter);
+				bson_iter_t child;
+				if (!node.children.empty() && (type == BSON_TYPE_DOCUMENT || type == BSON_TYPE_ARRAY) &&
+					bson_iter_recurse(iter, &child) && walk_level(&child, node.children))
+					return true;
+				break;
+			}
+
+			if (found_count == fields.size())
+				return true;
+		}
+		return false;
+	}
+
+	size_t DocumentDecoder::walk(const bson_t* doc)
+	{
+		memset(found.data(), 0, found.size());
+		found_count = 0;
+
+		bson_iter_t iter;
+		if (bson_iter_init(&iter, doc))
+			walk_level(&iter, roots);
+		return found_count;
+	}
+
+	void DocumentDecoder::read(const bson_t* doc, std::vector<Column>& columns)
+	{
+		walk(doc);
+
+		for (auto i = 0; i < columns.size() && i < fields.size(); ++i)
+		{
+			auto& column = columns[i];
+			auto value = field(i);
+
+			if (value == nullptr)
+				column.push_null();
+			else
+				push_bson_value(column, bson_iter_value(value));
+
+			if (position_parser < 0 || column.position_state == POSITIONS_NONE)
+				continue;
+
+			float xyz[3];
+			auto type = value != nullptr ? bson_iter_type(value) : BSON_TYPE_NULL;
+
+			if (value != nullptr && parse_bson_position(value, position_parser, xyz))
+				column.push_position(xyz);
+			else if (column.position_state == POSITIONS_UNKNOWN && type != BSON_TYPE_NULL && type != BSON_TYPE_UNDEFINED)
+				column.reject_positions();
+			else
+				column.push_position(nullptr);
+		}
+	}
+}
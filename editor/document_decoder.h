@@ -0,0 +1,59 @@
+#pragma once
+
+#include "fetch_query.h"
+
+#include <bson.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* One key of the requested field paths. Fields sharing a prefix share its nodes,
+	* fields are the indices of the paths ending at this key.
+	*/
+	struct FieldPathNode
+	{
+		std::string key;
+		std::vector<int> fields;
+		std::vector<FieldPathNode> children;
+	};
+
+	/**
+	* Decodes the requested fields of documents in a single pass. The dotted field paths are compiled
+	* into a trie once, then every document is walked from the start only once, descending into the
+	* nested documents and arrays that lead to a requested field and stopping once all of them are found.
+	* Paths resolve like bson_iter_find_descendant, array elements are reached by index ("hits.0.x").
+	* A decoder keeps the fields found in the last document, so every thread needs its own.
+	*/
+	struct DocumentDecoder
+	{
+		explicit DocumentDecoder(const FetchQuery& query);
+
+		/**
+		* Find the requested fields of a document, returns the number found.
+		*/
+		size_t walk(const bson_t* doc);
+
+		/**
+		* Field of the last walked document, nullptr if it does not have it.
+		*/
+		bson_iter_t* field(size_t index) { return found[index] ? &fields[index] : nullptr; }
+
+		/**
+		* Append the requested fields of a document to the columns, missing fields become null.
+		*/
+		void read(const bson_t* doc, std::vector<Column>& columns);
+
+	private:
+		bool walk_level(bson_iter_t* iter, const std::vector<FieldPathNode>& nodes);
+
+		std::vector<FieldPathNode> roots;
+		int position_parser = -1;
+		std::vector<bson_iter_t> fields;
+		std::vector<uint8_t> found;
+		size_t found_count = 0;
+	};
+}
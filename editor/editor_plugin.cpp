@@ -1,9 +1,28 @@
 #include <editor_plugin_api/editor_plugin_api.h>
 #include <plugin_foundation/string.h>
 
+#include "aggregate_query.h"
+#include "cluster_requests.h"
+#include "column_set.h"
+#include "data_store.h"
+#include "document_decoder.h"
+#include "fetch_query.h"
+#include "fetch_requests.h"
+#include "live_requests.h"
+#include "page_requests.h"
+#include "profiler.h"
+#include "query_cache.h"
+#include "row_filter.h"
+#include "schema_index.h"
+#include "session_filter.h"
+#include "snapshot_file.h"
+
 #include <mongoc.h>
 #include <bson.h>
 
+#include <algorithm>
+#include <chrono>
+#include <math.h>
 #include <string>
 #include <vector>
 
@@ -15,9 +34,11 @@ namespace PLUGIN_NAMESPACE
 	EditorLoggingApi* logging_api = nullptr;
 	EditorEvalApi* eval_api = nullptr;
 
-	mongoc_client_t* client = nullptr;
+	mongoc_client_pool_t* client_pool = nullptr;
+	mongoc_client_t* client = nullptr; // Popped from the pool for the calls made on the UI thread
 	mongoc_database_t* database = nullptr;
 	mongoc_collection_t* collection = nullptr;
+	std::shared_ptr<Snapshot> snapshot; // Opened by connectToDatabase instead of a server, see is_snapshot_address
 
 	/**
 	* Return plugin extension name.
@@ -38,22 +59,59 @@ namespace PLUGIN_NAMESPACE
 	}
 
 	/**
-	* Clean MongoDB before closing.
+	* Create the client pool of a server. Fetch workers and their parallel cursors take their clients from it.
+	* Returns false if the address is not a valid MongoDB URI.
 	*/
-	void clean_mongoc()
+	bool connect_server(const char* server_adress)
+	{
+		auto uri = mongoc_uri_new(server_adress);
+		if (uri == nullptr)
+			return false;
+
+		client_pool = mongoc_client_pool_new(uri);
+		mongoc_client_pool_set_error_api(client_pool, MONGOC_ERROR_API_VERSION_2);
+		client = mongoc_client_pool_pop(client_pool);
+
+		mongoc_uri_destroy(uri);
+		return true;
+	}
+
+	/**
+	* Stop every fetch and release the database, the client and the pool, or the snapshot file.
+	*/
+	void disconnect_server()
 	{
+		shutdown_fetch_requests();
+		shutdown_live_requests();
+		shutdown_page_requests();
+		clear_collection_schemas();
+		snapshot.reset();
+
 		if (database != nullptr)
 			mongoc_database_destroy(database);
+		database = nullptr;
 
 		if (client != nullptr)
-			mongoc_client_destroy(client);
+			mongoc_client_pool_push(client_pool, client);
+		client = nullptr;
+
+		if (client_pool != nullptr)
+			mongoc_client_pool_destroy(client_pool);
+		client_pool = nullptr;
+	}
 
+	/**
+	* Clean MongoDB before closing.
+	*/
+	void clean_mongoc()
+	{
+		disconnect_server();
 		mongoc_cleanup();
 	}
 
 	/**
 	* This will probably only work with a special database structure.
-	* Fetch game sessions associated with a level.
+	* Fetch game sessions associated with a level, at most MAX_SESSIONS or the optional { limit: n }.
 	* Returns an array with session ids.
 	*/
 	ConfigValue fetch_sessions_ids(ConfigValueArgs args, int num)
@@ -61,9 +119,22 @@ namespace PLUGIN_NAMESPACE
 		if (num < 1)
 			return nullptr;
 
-		auto collection_name = "session_start";
+		ScopedTimer timer("fetch_sessions_ids");
+
+		// A snapshot holds the sessions it was exported with, whatever the level
+		if (snapshot != nullptr)
+		{
+			ConfigValue cv_sessions_ids = config_data_api->make(nullptr);
+			for (auto& session_id : snapshot->info.sessions_ids)
+			{
+				ConfigValue item = config_data_api->make(nullptr);
+				config_data_api->set_string(item, session_id.c_str());
+				config_data_api->push(cv_sessions_ids, item);
+			}
+			return cv_sessions_ids;
+		}
 
-		collection = mongoc_database_get_collection(database, collection_name);
+		collection = mongoc_database_get_collection(database, SESSION_START_COLLECTION);
 
 		// Filter by a level key (name of the level)
 		auto level_name = config_data_api->to_string(&args[0]);
@@ -80,7 +151,15 @@ namespace PLUGIN_NAMESPACE
 		bson_init(&filter);
 		bson_init(&existspart);
 
-		BSON_APPEND_INT64(&opts, "limit", 3000); // Limit total amount of documents becasue it becomes too slow otherwise.
+		// Sessions are filtered with batched $in queries, so hundreds of thousands of ids are fine
+		int64_t limit = MAX_SESSIONS;
+		if (num > 1 && config_data_api->type(&args[1]) == CD_TYPE_OBJECT && strequal(config_data_api->object_key(&args[1], 0), "limit"))
+		{
+			auto limit_value = config_data_api->object_value(&args[1], 0);
+			if (config_data_api->type(limit_value) == CD_TYPE_NUMBER)
+				limit = (int64_t)config_data_api->to_number(limit_value);
+		}
+		BSON_APPEND_INT64(&opts, "limit", limit);
 
 		BSON_APPEND_UTF8(&filter, "params.level_key", level_name);
 
@@ -97,6 +176,8 @@ namespace PLUGIN_NAMESPACE
 		{
 			bson_iter_t field;
 
+			timer.bytes += doc->len;
+			++timer.documents;
 			if (!bson_iter_init(&iter, doc) || !bson_iter_find_descendant(&iter, "session_id", &field))
 				continue;
 
@@ -121,26 +202,73 @@ namespace PLUGIN_NAMESPACE
 	}
 
 	/**
-	* Fetch documents from the database with the selected filter from the GUI.
+	* Build the columnar result object sent to the viewer.
+	* Each column carries its packed values, string offsets, validity bitmap and parsed positions
+	* as base64 strings so the viewer can wrap them in typed arrays.
 	*/
-	ConfigValue fetch_documents(ConfigValueArgs args, int num)
+	ConfigValue make_columnar_result(const std::vector<ColumnView>& columns, size_t count)
+	{
+		auto cv_result = config_data_api->make(nullptr);
+		auto cv_columns = config_data_api->make(nullptr);
+
+		for (auto& column : columns)
+		{
+			auto cv_column = config_data_api->make(nullptr);
+
+			config_data_api->add_string(cv_column, "name", column.name.c_str());
+			config_data_api->add_string(cv_column, "type", column_type_name(column.type));
+			config_data_api->add_string(cv_column, "data", base64_encode(column.data, column.data_size).c_str());
+			config_data_api->add_string(cv_column, "validity", base64_encode(column.validity, column.validity_size).c_str());
+			if (column.type == COLUMN_TYPE_STRING && column.offsets != nullptr)
+				config_data_api->add_string(cv_column, "offsets", base64_encode(column.offsets, (column.size + 1) * sizeof(uint32_t)).c_str());
+			if (column.position_state == POSITIONS_PARSED && column.positions != nullptr)
+				config_data_api->add_string(cv_column, "positions", base64_encode(column.positions, column.size * 3 * sizeof(float)).c_str());
+
+			config_data_api->push(cv_columns, cv_column);
+		}
+
+		config_data_api->add_string(cv_result, "format", "columnar");
+		config_data_api->add_number(cv_result, "count", (double)count);
+		config_data_api->add_array(cv_result, "columns", cv_columns);
+
+		return cv_result;
+	}
+
+	ConfigValue make_columnar_result(const std::vector<Column>& columns, size_t count)
+	{
+		std::vector<ColumnView> views;
+		for (auto& column : columns)
+			views.push_back(view_column(column));
+		return make_columnar_result(views, count);
+	}
+
+	/**
+	* Arena allocations made by a query, { allocations, bytes, blocks }.
+	*/
+	ConfigValue make_allocation_stats(const ArenaStats& stats)
+	{
+		auto cv_stats = config_data_api->make(nullptr);
+		config_data_api->add_number(cv_stats, "allocations", (double)stats.allocations);
+		config_data_api->add_number(cv_stats, "bytes", (double)stats.bytes);
+		config_data_api->add_number(cv_stats, "blocks", (double)stats.blocks);
+		return cv_stats;
+	}
+
+	/**
+	* Copy the fetch arguments from the GUI into a query.
+	* Arguments are the collection name followed by single key objects such as { limit: 100 }.
+	* Returns false if no collection was given.
+	*/
+	bool parse_fetch_query(ConfigValueArgs args, int num, FetchQuery& query)
 	{
 		if (num < 1)
-			return nullptr;
+			return false;
 
 		auto collection_name = config_data_api->to_string(&args[0]);
 		if (collection_name == nullptr)
-			return nullptr;
-
-		collection = mongoc_database_get_collection(database, collection_name);
+			return false;
 
-		uint64_t limit, skip;
-		std::vector<const char*> filter_fields;
-		std::vector<uint8_t> sort_fields;
-
-		// filter by session ids
-		bool sessions_ids = false;
-		size_t sessions_ind = -1;
+		query.collection = collection_name;
 
 		for (auto i = 1; i < num; ++i)
 		{
@@ -159,14 +287,14 @@ namespace PLUGIN_NAMESPACE
 					{
 						if (object_item_type == CD_TYPE_NUMBER)
 						{
-							limit = config_data_api->to_number(object_item_value);
+							query.limit = config_data_api->to_number(object_item_value);
 						}
 					}
 					else if (strequal(object_item_key, "skip"))
 					{
 						if (object_item_type == CD_TYPE_NUMBER)
 						{
-							skip = config_data_api->to_number(object_item_value);
+							query.skip = config_data_api->to_number(object_item_value);
 						}
 					}
 					else if (strequal(object_item_key, "fields"))
@@ -174,39 +302,94 @@ namespace PLUGIN_NAMESPACE
 						if (object_item_type == CD_TYPE_ARRAY)
 						{
 							auto length = config_data_api->array_size(object_item_value);
-							filter_fields.resize(length);
+							query.fields.resize(length);
 							for (auto i = 0; i < length; ++i) {
 								auto array_item = config_data_api->array_item(object_item_value, i);
-								filter_fields[i] = config_data_api->to_string(array_item);
+								auto field = config_data_api->to_string(array_item);
+								query.fields[i] = field != nullptr ? field : "";
 							}
 						}
 					}
+					else if (strequal(object_item_key, "columnar"))
+					{
+						query.columnar = config_data_api->to_bool(object_item_value);
+					}
 					else if (strequal(object_item_key, "sort"))
 					{
 						if (object_item_type == CD_TYPE_ARRAY)
 						{
 							auto length = config_data_api->array_size(object_item_value);
-							sort_fields.resize(length);
+							query.sort.resize(length);
 							for (auto i = 0; i < length; ++i) {
 								auto array_item = config_data_api->array_item(object_item_value, i);
-								sort_fields[i] = config_data_api->to_bool(array_item);
+								query.sort[i] = config_data_api->to_bool(array_item);
 							}
 						}
 					}
+					else if (strequal(object_item_key, "position_parser"))
+					{
+						if (object_item_type == CD_TYPE_NUMBER)
+						{
+							query.position_parser = (int)config_data_api->to_number(object_item_value);
+						}
+					}
+					else if (strequal(object_item_key, "chunk_size"))
+					{
+						if (object_item_type == CD_TYPE_NUMBER)
+						{
+							query.chunk_size = (size_t)config_data_api->to_number(object_item_value);
+						}
+					}
+					else if (strequal(object_item_key, "threads"))
+					{
+						if (object_item_type == CD_TYPE_NUMBER)
+						{
+							query.thread_count = (unsigned)config_data_api->to_number(object_item_value);
+						}
+					}
+					else if (strequal(object_item_key, "flush_ms"))
+					{
+						if (object_item_type == CD_TYPE_NUMBER)
+						{
+							query.flush_interval_ms = (unsigned)config_data_api->to_number(object_item_value);
+						}
+					}
+					else if (strequal(object_item_key, "after"))
+					{
+						if (object_item_type == CD_TYPE_STRING)
+						{
+							query.page_after = config_data_api->to_string(object_item_value);
+						}
+					}
+					else if (strequal(object_item_key, "level"))
+					{
+						if (object_item_type == CD_TYPE_STRING)
+						{
+							query.level_key = config_data_api->to_string(object_item_value);
+						}
+					}
+					else if (strequal(object_item_key, "progress"))
+					{
+						if (object_item_type == CD_TYPE_STRING)
+						{
+							query.progress_callback = config_data_api->to_string(object_item_value);
+						}
+					}
 
 					// filter by session ids
 					else if (strequal(object_item_key, "sessions_ids"))
 					{
-						sessions_ids = true;
-						sessions_ind = i;
+						query.filter_sessions = true;
 						if (object_item_type == CD_TYPE_ARRAY)
 						{
 							auto length = config_data_api->array_size(object_item_value);
+							query.sessions_ids.resize(length);
 							for (auto i = 0; i < length; ++i) {
 								auto array_item = config_data_api->array_item(object_item_value, i);
+								auto id = config_data_api->to_string(array_item);
+								query.sessions_ids[i] = id != nullptr ? id : "";
 							}
 						}
-
 					}
 
 					break;
@@ -215,94 +398,159 @@ namespace PLUGIN_NAMESPACE
 			}
 		}
 
-		mongoc_cursor_t* cursor = nullptr;
-		const bson_t* doc = nullptr;
-		bson_iter_t iter;
-		bson_t opts, filter;
-		bson_t project_fields, sort;
-		
-		bson_init(&opts);
-		bson_init(&filter);
+		return true;
+	}
 
-		BSON_APPEND_INT64(&opts, "limit", limit);
-		BSON_APPEND_INT64(&opts, "skip", skip);
+	/**
+	* Join the level of a query to its sessions with the client of the UI thread, see resolve_level_sessions.
+	* Async fetches join on their worker instead, and snapshots on the sessions they were exported with.
+	*/
+	bool join_level_sessions(FetchQuery& query)
+	{
+		if (snapshot != nullptr || client == nullptr || database == nullptr)
+			return true;
+
+		std::string error;
+		if (resolve_level_sessions(client, mongoc_database_get_name(database), query, error))
+			return true;
 
-		/* Temporay solution for unique database */
-		if (sessions_ids)
+		fprintf(stderr, "Fetch sessions of level failed: %s\n", error.c_str());
+		return false;
+	}
+
+	/**
+	* Run a fetch on this thread, with the query cache, session batches and parallel _id ranges,
+	* or read it from the open snapshot file.
+	*/
+	void run_fetch_here(FetchRequest& request, const FetchQuery& query, size_t chunk_size)
+	{
+		request.query = query;
+		request.query.chunk_size = chunk_size;
+		if (snapshot != nullptr)
+		{
+			request.snapshot = snapshot;
+		}
+		else
 		{
-			bson_t or_operand;
-			bson_t exist_field_value;
-			bson_t session_ids;
-			const size_t n_size = 5;
-			char char_ind[n_size];
+			request.pool = client_pool;
+			request.database_name = mongoc_database_get_name(database);
+		}
+		run_fetch_request(&request);
+	}
 
-			// Only include documents with a position
-			bson_init(&exist_field_value);
-			bson_init(&or_operand);
-			BSON_APPEND_BOOL(&exist_field_value, "$exists", 1);
-			BSON_APPEND_DOCUMENT(&filter, "params.position", &exist_field_value);
+	/**
+	* Fetch documents from the database with the selected filter from the GUI.
+	* Pass { columnar: true } to get packed column buffers instead of one value per field and document,
+	* and { position_parser: id } to also get the parsed positions of every field that holds positions.
+	* { level: key } keeps the documents of the sessions of a level, found in session_start by the plugin.
+	* Documents of a snapshot file are always columnar.
+	*/
+	ConfigValue fetch_documents(ConfigValueArgs args, int num)
+	{
+		FetchQuery query;
+		if ((database == nullptr && snapshot == nullptr) || !parse_fetch_query(args, num, query))
+			return nullptr;
 
-			bson_init(&or_operand);
+		ScopedTimer timer("fetch_documents");
 
-			auto arg = &args[sessions_ind];
-			auto object_item_value = config_data_api->object_value(arg, 0);
-			auto length = config_data_api->array_size(object_item_value);
+		if (query.columnar || snapshot != nullptr)
+		{
+			// The same scan as the async fetch, merged in a single column set
+			FetchRequest request;
+			run_fetch_here(request, query, (size_t)-1);
 
+			if (!request.error.empty())
+				fprintf(stderr, "Fetch failed: %s\n", request.error.c_str());
 
-			BSON_APPEND_ARRAY_BEGIN(&filter, "$or", &or_operand);
+			timer.bytes = request.bytes_received;
+			timer.documents = request.documents_scanned;
 
-			for (auto i = 0; i < length; ++i)
+			ScopedTimer marshal_timer("fetch_documents.marshal");
+			ConfigValue cv_result = nullptr;
+			if (request.cached != nullptr && request.cached->chunks.size() == 1)
+			{
+				cv_result = make_columnar_result(request.cached->chunks[0], request.cached->chunk_rows[0]);
+			}
+			else if (request.cached == nullptr && request.chunks.size() == 1)
+			{
+				cv_result = make_columnar_result(request.chunks.front(), request.chunks.front().empty() ? 0 : request.chunks.front()[0].size);
+			}
+			else
 			{
+				std::vector<Column> columns;
+				init_columns(query, columns);
 
-				sprintf(char_ind, "%d", i);
-				auto array_item = config_data_api->array_item(object_item_value, i);
-				auto id = config_data_api->to_string(array_item);
+				if (request.cached != nullptr)
+				{
+					for (auto chunk = 0; chunk < request.cached->chunks.size(); ++chunk)
+					{
+						for (auto i = 0; i < columns.size() && i < request.cached->chunks[chunk].size(); ++i)
+							append_rows(columns[i], request.cached->chunks[chunk][i], 0, request.cached->chunk_rows[chunk]);
+					}
+				}
+				else
+				{
+					for (auto& chunk : request.chunks)
+					{
+						for (auto i = 0; i < columns.size() && i < chunk.size(); ++i)
+							append_rows(columns[i], view_column(chunk[i]), 0, chunk[i].size);
+					}
+				}
 
-				BSON_APPEND_DOCUMENT_BEGIN(&or_operand, char_ind, &session_ids);
-				BSON_APPEND_UTF8(&session_ids, "session_id", id);
-				bson_append_document_end(&or_operand, &session_ids);
+				cv_result = make_columnar_result(columns, columns.empty() ? 0 : columns[0].size);
 			}
 
-			bson_append_array_end(&filter, &or_operand);
-
-			bson_destroy(&or_operand);
-			bson_destroy(&exist_field_value);
+			config_data_api->add_object(cv_result, "allocations", make_allocation_stats(request.allocations));
+			return cv_result;
 		}
-		/* End of temporay solution for unique database */
 
-		BSON_APPEND_DOCUMENT_BEGIN(&opts, "sort", &sort);
-		for (auto i = 0; i < sort_fields.size(); ++i)
-		{
-			if (sort_fields[i])
-				BSON_APPEND_INT32(&sort, filter_fields[i], 1);
-		}
-		bson_append_document_end(&opts, &sort);
+		if (!join_level_sessions(query))
+			return nullptr;
 
-		BSON_APPEND_DOCUMENT_BEGIN(&opts, "projection", &project_fields);
-		BSON_APPEND_BOOL(&project_fields, "_id", false); // Ignore _id
-		for (auto i = 0; i < filter_fields.size(); ++i)
-		{
-			BSON_APPEND_BOOL(&project_fields, filter_fields[i], true);
-		}
-		bson_append_document_end(&opts, &project_fields);
+		collection = mongoc_database_get_collection(database, query.collection.c_str());
+		auto& filter_fields = query.fields;
+
+		mongoc_cursor_t* cursor = nullptr;
+		const bson_t* doc = nullptr;
+		DocumentDecoder decoder(query);
+
+		// Filters and options are built in an arena that is kept between calls, its counts are those of this call
+		static QueryArena arena;
+		arena.clear_stats();
+		auto opts = new_arena_bson(arena);
+		auto filter = new_arena_bson(arena);
+
+		build_fetch_query(query, filter, opts);
+
+		cursor = mongoc_collection_find_with_opts(collection, filter, opts, NULL);
 
 		std::vector<ConfigValue> cv_field_values(filter_fields.size());
 		for (auto i = 0; i < filter_fields.size(); ++i)
 			cv_field_values[i] = config_data_api->make(nullptr);
 
-		cursor = mongoc_collection_find_with_opts(collection, &filter, &opts, NULL);
-
-		while (mongoc_cursor_next(cursor, &doc))
+		// Server round trips and the decode into ConfigValues are timed separately
+		StageClock cursor_clock, marshal_clock;
+		for (;;)
 		{
-			for (auto i = 0; i < filter_fields.size(); ++i) {
+			cursor_clock.begin();
+			auto has_document = mongoc_cursor_next(cursor, &doc);
+			cursor_clock.end();
+			if (!has_document)
+				break;
 
-				bson_iter_t field;
+			timer.bytes += doc->len;
+			++timer.documents;
+			marshal_clock.begin();
+			decoder.walk(doc);
 
-				if (!bson_iter_init(&iter, doc) || !bson_iter_find_descendant(&iter, filter_fields[i], &field))
+			for (auto i = 0; i < filter_fields.size(); ++i) {
+
+				auto field = decoder.field(i);
+				if (field == nullptr)
 					continue; // Push nil and continue
 
 				ConfigValue item = config_data_api->make(nullptr);
-				auto value = bson_iter_value(&field);
+				auto value = bson_iter_value(field);
 
 				switch (value->value_type)
 				{
@@ -334,177 +582,1184 @@ namespace PLUGIN_NAMESPACE
 						config_data_api->set_number(item, value->value.v_timestamp.timestamp);
 						config_data_api->push(cv_field_values[i], item);
 						break;
+					case BSON_TYPE_OID:
+					{
+						char oid[25];
+						bson_oid_to_string(&value->value.v_oid, oid);
+						config_data_api->set_string(item, oid);
+						config_data_api->push(cv_field_values[i], item);
+						break;
+					}
+					case BSON_TYPE_DOCUMENT: case BSON_TYPE_ARRAY:
+					{
+						auto json = nested_bson_as_json(value, nullptr);
+						if (json != nullptr)
+						{
+							config_data_api->set_string(item, json);
+							config_data_api->push(cv_field_values[i], item);
+							bson_free(json);
+						}
+						else
+						{
+							config_data_api->push(cv_field_values[i], config_data_api->nil());
+						}
+						break;
+					}
 					case BSON_TYPE_UNDEFINED: case BSON_TYPE_NULL:
 						config_data_api->push(cv_field_values[i], config_data_api->nil());
 						break;
 					default:
-						config_data_api->push(cv_field_values[i], config_data_api->nil()); // To do
+						config_data_api->push(cv_field_values[i], config_data_api->nil());
 						break;
 				}
 			}
+
+			marshal_clock.end();
 		}
 
+		cursor_clock.record("fetch_documents.cursor", timer.bytes, timer.documents);
+		marshal_clock.record("fetch_documents.marshal", 0, timer.documents);
+
 		auto cv_documents = config_data_api->make(nullptr);
 
 		for (auto i = 0; i < filter_fields.size(); ++i)
-			config_data_api->add_array(cv_documents, filter_fields[i], cv_field_values[i]);
+			config_data_api->add_array(cv_documents, filter_fields[i].c_str(), cv_field_values[i]);
 
 		mongoc_cursor_destroy(cursor);
-		bson_destroy(&opts);
-		bson_destroy(&filter);
+		bson_destroy(opts);
+		bson_destroy(filter);
+
+		// Unless a fetched field has the same name
+		if (std::find(filter_fields.begin(), filter_fields.end(), "allocations") == filter_fields.end())
+			config_data_api->add_object(cv_documents, "allocations", make_allocation_stats(arena.stats()));
+		arena.reset();
 
 		return cv_documents;
 	}
 
 	/**
-	* Fetch and return a list of a collections fields keys.
+	* Start fetching documents on a worker thread so the editor stays responsive.
+	* Takes the same arguments as fetch_documents plus optional { chunk_size: n } and
+	* { progress: "functionName" }, a global function called with (handle, documents_scanned, bytes_received).
+	* Returns a request handle to use with pollFetch and cancelFetch, 0 if the fetch could not be started.
 	*/
-	ConfigValue fetch_field_keys(ConfigValueArgs args, int num)
+	ConfigValue fetch_documents_async(ConfigValueArgs args, int num)
 	{
-		if (num < 1)
-			return nullptr;
-
-		const char* collection_name = nullptr;
-
-		std::vector<std::string> field_keys;
+		auto cv_handle = config_data_api->make(nullptr);
+		config_data_api->set_number(cv_handle, 0);
 
-		auto arg = &args[0];
-		auto cv_field_keys = config_data_api->make(nullptr);
-		auto type = config_data_api->type(arg);
+		FetchQuery query;
+		if (!parse_fetch_query(args, num, query))
+			return cv_handle;
 
-		switch (type)
-		{
-			case CD_TYPE_NULL: return config_data_api->nil();
-			case CD_TYPE_STRING:
-			{
-				collection_name = config_data_api->to_string(arg);
-				break;
-			}
-			default: break;
-		}
+		unsigned handle = 0;
+		if (snapshot != nullptr)
+			handle = start_snapshot_fetch_request(query, snapshot);
+		else if (client != nullptr && database != nullptr)
+			handle = start_fetch_request(query, client_pool, mongoc_database_get_name(database));
 
-		if (collection_name == nullptr)
-			return nullptr;
+		// Delivered chunks are kept for shareWithEngine until the viewer releases them
+		if (handle != 0)
+			create_stored_result(handle, query.fields);
 
-		collection = mongoc_database_get_collection(database, collection_name);
+		config_data_api->set_number(cv_handle, handle);
+		return cv_handle;
+	}
 
-		if (collection == nullptr)
+	/**
+	* Fetch documents and export them to a snapshot file that connectToDatabase opens without a server.
+	* Takes the file path followed by the arguments of fetch_documents. The session_id field is always
+	* exported, a snapshot of a session filter can be filtered again on a subset of its sessions.
+	* Returns { rows, bytes } or { error }.
+	*/
+	ConfigValue export_snapshot(ConfigValueArgs args, int num)
+	{
+		FetchQuery query;
+		if (num < 2 || config_data_api->type(&args[0]) != CD_TYPE_STRING || (database == nullptr && snapshot == nullptr) || !parse_fetch_query(&args[1], num - 1, query))
 			return nullptr;
 
-		mongoc_cursor_t* cursor;
-		bson_iter_t iter;
-		bson_iter_t sub_iter;
-		bson_error_t error;
-		const bson_t* doc;
-		bson_t opts, filter;
-		uint64_t limit = 1;
-		bson_t project_field;
-
-		bson_init(&opts);
-		bson_init(&filter);
-		bson_init(&project_field);
+		ScopedTimer timer("export_snapshot");
+		auto path = config_data_api->to_string(&args[0]);
 
-		// Temporary solution for unique database and the collection tech_performance, to get all keys
-		if (strequal(collection_name, "tech_performance"))
-			BSON_APPEND_INT64(&opts, "skip", 6);
+		if (std::find(query.fields.begin(), query.fields.end(), "session_id") == query.fields.end())
+			query.fields.push_back("session_id");
 
-		BSON_APPEND_INT64(&opts, "limit", limit);
+		// Chunks of snapshot size, written as they are
+		FetchRequest request;
+		run_fetch_here(request, query, SNAPSHOT_CHUNK_ROWS);
 
-		BSON_APPEND_BOOL(&project_field, "_id", false);
-		BSON_APPEND_DOCUMENT(&opts, "projection", &project_field);
+		SnapshotInfo info;
+		info.database = snapshot != nullptr ? snapshot->info.database : mongoc_database_get_name(database);
+		info.collection = query.collection;
+		info.fields = query.fields;
+		info.position_parser = query.position_parser;
+		if (request.query.filter_sessions)
+			info.sessions_ids = request.query.sessions_ids; // Joined from the level by the fetch
+		info.exported_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 
-		auto cv_key = config_data_api->make(nullptr);
+		auto cv_result = config_data_api->make(nullptr);
+		auto error = request.error;
 
-		cursor = mongoc_collection_find_with_opts(collection, &filter, &opts, NULL);
+		SnapshotWriter writer;
+		if (error.empty() && !writer.begin(path, info))
+			error = std::string("Could not create ") + path;
 
-		int field_ind = 0;
-		while (mongoc_cursor_next(cursor, &doc))
+		if (error.empty())
 		{
-
-			if (!bson_iter_init(&iter, doc))
-				continue;
-
-			while (bson_iter_next(&iter))
+			auto ok = true;
+			if (request.cached != nullptr)
 			{
-				if (!bson_iter_recurse(&iter, &sub_iter))
-				{
-					auto key = bson_iter_key(&iter);
-
-					config_data_api->set_string(cv_key, key);
-					config_data_api->push(cv_field_keys, cv_key);
-
-					field_keys.push_back(key);
-				}
-				else
+				for (auto chunk = 0; ok && chunk < request.cached->chunks.size(); ++chunk)
+					ok = writer.write_rows(request.cached->chunks[chunk]);
+			}
+			else
+			{
+				for (auto it = request.chunks.begin(); ok && it != request.chunks.end(); ++it)
 				{
-					while (bson_iter_next(&sub_iter))
-					{
-						auto key = bson_iter_key(&iter);
-						auto sub_key = bson_iter_key(&sub_iter);
-
-						// Concat the full path
-						std::string absolute_path = key;
-						absolute_path += ".";
-						absolute_path += sub_key;
-
-						field_keys.push_back(absolute_path);
-
-						config_data_api->set_string(cv_key, absolute_path.c_str());
-						config_data_api->push(cv_field_keys, cv_key);
-					}
+					std::vector<ColumnView> views;
+					for (auto& column : *it)
+						views.push_back(view_column(column));
+					ok = writer.write_rows(views);
 				}
 			}
 
-			if (mongoc_cursor_error(cursor, &error))
-			{
-				fprintf(stderr, "An error occurred: %s\n", error.message);
-			}
+			if (!ok || !writer.commit())
+				error = std::string("Could not write ") + path;
 		}
 
-		mongoc_cursor_destroy(cursor);
-		bson_destroy(&opts);
-		bson_destroy(&filter);
-		bson_destroy(&project_field);
+		if (!error.empty())
+		{
+			fprintf(stderr, "Export snapshot failed: %s\n", error.c_str());
+			config_data_api->add_string(cv_result, "error", error.c_str());
+			return cv_result;
+		}
 
-		return cv_field_keys;
+		timer.bytes = writer.bytes_written();
+		timer.documents = writer.rows_written();
+		config_data_api->add_number(cv_result, "rows", (double)writer.rows_written());
+		config_data_api->add_number(cv_result, "bytes", (double)writer.bytes_written());
+		return cv_result;
 	}
 
 	/**
-	* Fetch and return a list of the database collections.
+	* Fetch one page of documents as a columnar result, with the arguments of fetch_documents (skip is ignored)
+	* plus { after: token } to continue after a page. Pages are ordered by the sorted fields and _id.
+	* Returns the columns, next (the token of the following page, empty on the last page) and prefetched.
+	* The following page is fetched in the background, so asking for it next is answered right away.
 	*/
-	void fetch_collection_names(ConfigValueArgs& cv)
+	ConfigValue fetch_page_documents(ConfigValueArgs args, int num)
 	{
-		bson_error_t error;
-		char** strv;
-
-		auto temp_cv = config_data_api->make(nullptr);
+		FetchQuery query;
+		if (client == nullptr || database == nullptr || !parse_fetch_query(args, num, query) || !join_level_sessions(query))
+			return nullptr;
 
-		if ((strv = mongoc_database_get_collection_names(database, &error)))
-		{
-			for (auto i = 0; strv[i]; i++)
-			{
-				config_data_api->set_string(temp_cv, strv[i]);
-				config_data_api->push(cv, temp_cv);
-			}
-			bson_strfreev(strv);
-		}
-		else
+		ScopedTimer timer("fetch_page");
+		PageResult page;
+		if (!fetch_page(query, client_pool, mongoc_database_get_name(database), page))
 		{
-			fprintf(stderr, "Fetch 'collection names' failed: %s\n", error.message);
+			fprintf(stderr, "Fetch page failed: %s\n", page.error.c_str());
+			return nullptr;
 		}
+
+		auto rows = page.columns.empty() ? 0 : page.columns[0].size;
+		timer.bytes = page.bytes_received;
+		timer.documents = rows;
+
+		auto cv_page = make_columnar_result(page.columns, rows);
+		config_data_api->add_string(cv_page, "next", page.next_token.c_str());
+		config_data_api->add_bool(cv_page, "prefetched", page.prefetched);
+		return cv_page;
 	}
 
 	/**
-	* Connects to a MongoDB server.
-	* Return false if it failed.
+	* Explain the find that fetch_documents would run with the same arguments.
+	* Returns the winning plan stage, examined keys and documents, execution time, the number of
+	* session batches and an index suggestion when the sessions filter has no session_id index.
 	*/
-	ConfigValue init_server(ConfigValueArgs args, int num)
+	ConfigValue explain_fetch(ConfigValueArgs args, int num)
 	{
-		if (num < 1)
+		FetchQuery query;
+		if (database == nullptr || !parse_fetch_query(args, num, query) || !join_level_sessions(query))
 			return nullptr;
 
-		auto cv_success = config_data_api->make(nullptr);
-
+		bson_t opts, filter;
+		bson_init(&opts);
+		bson_init(&filter);
+
+		// Large session filters are scanned in batches, the first batch is representative
+		auto batch_count = session_batch_count(query);
+		build_fetch_query(query, &filter, &opts, batch_count > 1 ? 0 : ALL_SESSION_BATCHES);
+
+		QueryPlanStats stats;
+		std::string error;
+		auto ok = explain_find(database, query.collection.c_str(), &filter, &opts, stats, error);
+
+		bson_destroy(&opts);
+		bson_destroy(&filter);
+
+		auto cv_explain = config_data_api->make(nullptr);
+		if (!ok)
+		{
+			fprintf(stderr, "Explain failed: %s\n", error.c_str());
+			config_data_api->add_string(cv_explain, "error", error.c_str());
+			return cv_explain;
+		}
+
+		config_data_api->add_string(cv_explain, "stage", stats.winning_stage.c_str());
+		config_data_api->add_string(cv_explain, "index", stats.index_name.c_str());
+		config_data_api->add_bool(cv_explain, "collection_scan", stats.collection_scan);
+		config_data_api->add_number(cv_explain, "returned", (double)stats.returned);
+		config_data_api->add_number(cv_explain, "keys_examined", (double)stats.keys_examined);
+		config_data_api->add_number(cv_explain, "documents_examined", (double)stats.documents_examined);
+		config_data_api->add_number(cv_explain, "execution_ms", (double)stats.execution_ms);
+		config_data_api->add_number(cv_explain, "session_batches", (double)batch_count);
+
+		if (query.filter_sessions)
+		{
+			collection = mongoc_database_get_collection(database, query.collection.c_str());
+
+			std::string suggestion;
+			if (!find_session_index(collection, suggestion))
+			{
+				fprintf(stderr, "Missing session index, consider: %s\n", suggestion.c_str());
+				config_data_api->add_string(cv_explain, "index_suggestion", suggestion.c_str());
+			}
+		}
+
+		return cv_explain;
+	}
+
+	/**
+	* Parse the { aggregate: { position, scalar, cell_size, percentiles: [...], max_cells } } argument of aggregateDocuments.
+	*/
+	bool parse_aggregate_query(ConfigValueArgs args, int num, AggregateQuery& aggregate)
+	{
+		for (auto i = 1; i < num; ++i)
+		{
+			auto arg = &args[i];
+			if (config_data_api->type(arg) != CD_TYPE_OBJECT || !strequal(config_data_api->object_key(arg, 0), "aggregate"))
+				continue;
+
+			auto options = config_data_api->object_value(arg, 0);
+			if (config_data_api->type(options) != CD_TYPE_OBJECT)
+				return false;
+
+			auto position = config_data_api->object_lookup(options, "position");
+			if (position != nullptr && config_data_api->type(position) == CD_TYPE_STRING)
+				aggregate.position_field = config_data_api->to_string(position);
+
+			auto scalar = config_data_api->object_lookup(options, "scalar");
+			if (scalar != nullptr && config_data_api->type(scalar) == CD_TYPE_STRING)
+				aggregate.scalar_field = config_data_api->to_string(scalar);
+
+			auto cell_size = config_data_api->object_lookup(options, "cell_size");
+			if (cell_size != nullptr && config_data_api->type(cell_size) == CD_TYPE_NUMBER)
+				aggregate.cell_size = config_data_api->to_number(cell_size);
+
+			auto max_cells = config_data_api->object_lookup(options, "max_cells");
+			if (max_cells != nullptr && config_data_api->type(max_cells) == CD_TYPE_NUMBER)
+				aggregate.max_cells = (int64_t)config_data_api->to_number(max_cells);
+
+			auto percentiles = config_data_api->object_lookup(options, "percentiles");
+			if (percentiles != nullptr && config_data_api->type(percentiles) == CD_TYPE_ARRAY)
+			{
+				auto length = config_data_api->array_size(percentiles);
+				for (auto j = 0; j < length; ++j)
+					aggregate.percentiles.push_back(config_data_api->to_number(config_data_api->array_item(percentiles, j)));
+			}
+
+			return !aggregate.position_field.empty();
+		}
+
+		return false;
+	}
+
+	/**
+	* Bin and summarize documents on the server instead of fetching them.
+	* Takes the same arguments as fetchDocuments and { aggregate: { position, scalar, cell_size, percentiles, max_cells } }.
+	* Returns { cells: <columnar cells>, summary: { count, min, max, avg, percentiles } }, with an error string on failure.
+	*/
+	ConfigValue aggregate_documents(ConfigValueArgs args, int num)
+	{
+		FetchQuery query;
+		AggregateQuery aggregate;
+		if (database == nullptr || !parse_fetch_query(args, num, query) || !parse_aggregate_query(args, num, aggregate) || !join_level_sessions(query))
+			return nullptr;
+
+		collection = mongoc_database_get_collection(database, query.collection.c_str());
+
+		std::vector<Column> cells;
+		ScalarSummary summary;
+		std::string error;
+
+		auto cv_result = config_data_api->make(nullptr);
+		auto ok = aggregate_cells(collection, query, aggregate, cells, error);
+		if (ok && !aggregate.scalar_field.empty())
+			ok = aggregate_summary(collection, query, aggregate, summary, error);
+
+		if (!ok)
+		{
+			fprintf(stderr, "Aggregation failed: %s\n", error.c_str());
+			config_data_api->add_string(cv_result, "error", error.c_str());
+			return cv_result;
+		}
+
+		auto cell_count = cells.empty() ? 0 : cells[0].size;
+		config_data_api->add_object(cv_result, "cells", make_columnar_result(cells, cell_count));
+
+		auto cv_summary = config_data_api->make(nullptr);
+		config_data_api->add_number(cv_summary, "count", (double)summary.count);
+		config_data_api->add_number(cv_summary, "min", summary.min);
+		config_data_api->add_number(cv_summary, "max", summary.max);
+		config_data_api->add_number(cv_summary, "avg", summary.avg);
+
+		auto cv_percentiles = config_data_api->make(nullptr);
+		for (auto percentile : summary.percentiles)
+		{
+			ConfigValue item = config_data_api->make(nullptr);
+			config_data_api->set_number(item, percentile);
+			config_data_api->push(cv_percentiles, item);
+		}
+		config_data_api->add_array(cv_summary, "percentiles", cv_percentiles);
+		config_data_api->add_object(cv_result, "summary", cv_summary);
+
+		return cv_result;
+	}
+
+	/**
+	* Report progress of a fetch request to its JavaScript callback.
+	*/
+	void report_fetch_progress(FetchRequest* request)
+	{
+		uint64_t documents_scanned = request->documents_scanned;
+		if (request->query.progress_callback.empty() || documents_scanned == request->reported_documents)
+			return;
+
+		request->reported_documents = documents_scanned;
+
+		char call[64];
+		snprintf(call, sizeof(call), "(%u, %llu, %llu);", request->handle,
+			(unsigned long long)documents_scanned, (unsigned long long)request->bytes_received.load());
+
+		auto script = request->query.progress_callback + call;
+		eval_api->eval(script.c_str());
+	}
+
+	/**
+	* Poll a fetch request started with fetchDocumentsAsync.
+	* Returns the progress, whether the request is done and the next chunk of documents in columnar form (or nil).
+	* The last poll also carries the arena allocations of the request, { allocations, bytes, blocks }.
+	* The request is released once it is done and all its chunks have been delivered.
+	*/
+	ConfigValue poll_fetch(ConfigValueArgs args, int num)
+	{
+		if (num < 1)
+			return nullptr;
+
+		auto handle = (unsigned)config_data_api->to_number(&args[0]);
+		auto request = find_fetch_request(handle);
+		if (request == nullptr)
+			return config_data_api->nil();
+
+		// Read finished before popping so the last chunk is never missed
+		bool finished = request->finished;
+
+		report_fetch_progress(request);
+
+		auto cv_state = config_data_api->make(nullptr);
+		config_data_api->add_number(cv_state, "handle", handle);
+		config_data_api->add_number(cv_state, "documents_scanned", (double)request->documents_scanned.load());
+		config_data_api->add_number(cv_state, "bytes_received", (double)request->bytes_received.load());
+		config_data_api->add_bool(cv_state, "cancelled", request->cancelled);
+
+		std::shared_ptr<CachedResult> cached;
+		{
+			std::lock_guard<std::mutex> lock(request->mutex);
+			cached = request->cached;
+		}
+		config_data_api->add_bool(cv_state, "from_cache", cached != nullptr);
+
+		std::vector<Column> columns;
+		if (cached != nullptr && request->cached_chunk < cached->chunks.size())
+		{
+			// Encoded straight from the mapped cache file
+			auto index = request->cached_chunk++;
+			config_data_api->add_object(cv_state, "chunk", make_columnar_result(cached->chunks[index], cached->chunk_rows[index]));
+			store_result_rows(handle, cached->chunks[index], cached->chunk_rows[index]);
+			finished = false;
+		}
+		else if (pop_fetch_chunk(request, columns))
+		{
+			ScopedTimer marshal_timer("fetch_documents_async.marshal");
+			auto count = columns.empty() ? 0 : columns[0].size;
+			config_data_api->add_object(cv_state, "chunk", make_columnar_result(columns, count));
+
+			std::vector<ColumnView> views;
+			for (auto& column : columns)
+				views.push_back(view_column(column));
+			store_result_rows(handle, views, count);
+			finished = false; // More chunks may be waiting
+		}
+
+		if (finished)
+		{
+			std::string error;
+			{
+				std::lock_guard<std::mutex> lock(request->mutex);
+				error = request->error;
+			}
+
+			if (!error.empty())
+			{
+				fprintf(stderr, "Fetch documents failed: %s\n", error.c_str());
+				config_data_api->add_string(cv_state, "error", error.c_str());
+			}
+
+			config_data_api->add_object(cv_state, "allocations", make_allocation_stats(request->allocations));
+			release_fetch_request(handle);
+		}
+
+		config_data_api->add_bool(cv_state, "done", finished);
+
+		return cv_state;
+	}
+
+	/**
+	* Share the points of the rows of an async fetch delivered so far with the engine, without sending them through Lua.
+	* Every chunk returned by pollFetch is also kept by the plugin under the fetch handle, in the same row order.
+	* Takes the fetch handle, the position field, the scalar and time fields ("" for none) and the included rows as
+	* a flat array of [begin, end) pairs. The points with a parsed position are written to a named shared memory block.
+	* Returns { name, points, time_min, time_max } (times only if a time field is given), or { error }.
+	*/
+	ConfigValue share_points_with_engine(ConfigValueArgs args, int num)
+	{
+		if (num < 5 || config_data_api->type(&args[1]) != CD_TYPE_STRING || config_data_api->type(&args[4]) != CD_TYPE_ARRAY)
+			return nullptr;
+
+		auto cv_result = config_data_api->make(nullptr);
+		auto result = find_stored_result((unsigned)config_data_api->to_number(&args[0]));
+		if (result == nullptr)
+		{
+			config_data_api->add_string(cv_result, "error", "The fetch result is no longer stored");
+			return cv_result;
+		}
+
+		PointSelection selection;
+		selection.position_field = config_data_api->to_string(&args[1]);
+		if (config_data_api->type(&args[2]) == CD_TYPE_STRING)
+			selection.scalar_field = config_data_api->to_string(&args[2]);
+		if (config_data_api->type(&args[3]) == CD_TYPE_STRING)
+			selection.time_field = config_data_api->to_string(&args[3]);
+
+		auto length = config_data_api->array_size(&args[4]);
+		selection.row_ranges.resize(length);
+		for (auto i = 0; i < length; ++i)
+			selection.row_ranges[i] = (size_t)config_data_api->to_number(config_data_api->array_item(&args[4], i));
+
+		SharedPointsInfo info;
+		std::string error;
+		if (!share_points(*result, selection, info, error))
+		{
+			fprintf(stderr, "Share points failed: %s\n", error.c_str());
+			config_data_api->add_string(cv_result, "error", error.c_str());
+			return cv_result;
+		}
+
+		config_data_api->add_string(cv_result, "name", info.name.c_str());
+		config_data_api->add_number(cv_result, "points", info.num_points);
+		if (info.has_times)
+		{
+			config_data_api->add_number(cv_result, "time_min", info.time_min);
+			config_data_api->add_number(cv_result, "time_max", info.time_max);
+		}
+		return cv_result;
+	}
+
+	/**
+	* Share one simplified path per session of the rows of an async fetch with the engine, like shareWithEngine.
+	* Takes the fetch handle, the position, session and time fields (time "" to keep the delivery order),
+	* the Douglas-Peucker tolerance in world units (0 keeps every point) and the included rows as [begin, end) pairs.
+	* The sessions are ordered and simplified in parallel.
+	* Returns { name, points, paths, source_points }, or { error }.
+	*/
+	ConfigValue share_trajectories_with_engine(ConfigValueArgs args, int num)
+	{
+		if (num < 6 || config_data_api->type(&args[1]) != CD_TYPE_STRING || config_data_api->type(&args[2]) != CD_TYPE_STRING ||
+			config_data_api->type(&args[5]) != CD_TYPE_ARRAY)
+			return nullptr;
+
+		auto cv_result = config_data_api->make(nullptr);
+		auto result = find_stored_result((unsigned)config_data_api->to_number(&args[0]));
+		if (result == nullptr)
+		{
+			config_data_api->add_string(cv_result, "error", "The fetch result is no longer stored");
+			return cv_result;
+		}
+
+		TrajectorySelection selection;
+		selection.position_field = config_data_api->to_string(&args[1]);
+		selection.session_field = config_data_api->to_string(&args[2]);
+		if (config_data_api->type(&args[3]) == CD_TYPE_STRING)
+			selection.time_field = config_data_api->to_string(&args[3]);
+		if (config_data_api->type(&args[4]) == CD_TYPE_NUMBER)
+			selection.tolerance = (float)config_data_api->to_number(&args[4]);
+		selection.thread_count = std::thread::hardware_concurrency();
+
+		auto length = config_data_api->array_size(&args[5]);
+		selection.row_ranges.resize(length);
+		for (auto i = 0; i < length; ++i)
+			selection.row_ranges[i] = (size_t)config_data_api->to_number(config_data_api->array_item(&args[5], i));
+
+		SharedPointsInfo info;
+		std::string error;
+		if (!share_trajectories(*result, selection, info, error))
+		{
+			fprintf(stderr, "Share trajectories failed: %s\n", error.c_str());
+			config_data_api->add_string(cv_result, "error", error.c_str());
+			return cv_result;
+		}
+
+		config_data_api->add_string(cv_result, "name", info.name.c_str());
+		config_data_api->add_number(cv_result, "points", info.num_points);
+		config_data_api->add_number(cv_result, "paths", info.num_paths);
+		config_data_api->add_number(cv_result, "source_points", (double)info.source_points);
+		return cv_result;
+	}
+
+	/**
+	* Cluster the positions of the rows of an async fetch on a background thread, see pollClusters for the result.
+	* Takes the fetch handle, the position field, the scalar field ("" for none) averaged per cluster, the method
+	* ("dbscan" or "kmeans") and the included rows as [begin, end) pairs, then optional { radius: r }, { min_points: n }
+	* for DBSCAN, { k: n }, { iterations: n } for k-means and { max_clusters: n }, the largest clusters returned.
+	* Returns the request handle, 0 if the fields are not in the fetch result.
+	*/
+	ConfigValue cluster_points(ConfigValueArgs args, int num)
+	{
+		auto cv_handle = config_data_api->make(nullptr);
+		config_data_api->set_number(cv_handle, 0);
+
+		if (num < 5 || config_data_api->type(&args[1]) != CD_TYPE_STRING || config_data_api->type(&args[4]) != CD_TYPE_ARRAY)
+			return cv_handle;
+
+		auto result = find_stored_result((unsigned)config_data_api->to_number(&args[0]));
+		if (result == nullptr)
+			return cv_handle;
+
+		PointSelection selection;
+		selection.position_field = config_data_api->to_string(&args[1]);
+		if (config_data_api->type(&args[2]) == CD_TYPE_STRING)
+			selection.scalar_field = config_data_api->to_string(&args[2]);
+
+		ClusterSettings settings;
+		if (config_data_api->type(&args[3]) == CD_TYPE_STRING && strequal(config_data_api->to_string(&args[3]), "kmeans"))
+			settings.method = CLUSTER_KMEANS;
+		settings.thread_count = std::thread::hardware_concurrency();
+
+		auto length = config_data_api->array_size(&args[4]);
+		selection.row_ranges.resize(length);
+		for (auto i = 0; i < length; ++i)
+			selection.row_ranges[i] = (size_t)config_data_api->to_number(config_data_api->array_item(&args[4], i));
+
+		for (auto i = 5; i < num; ++i)
+		{
+			if (config_data_api->type(&args[i]) != CD_TYPE_OBJECT)
+				continue;
+
+			auto key = config_data_api->object_key(&args[i], 0);
+			auto value = config_data_api->object_value(&args[i], 0);
+			if (config_data_api->type(value) != CD_TYPE_NUMBER)
+				continue;
+
+			auto number = config_data_api->to_number(value);
+			if (strequal(key, "radius"))
+				settings.radius = (float)number;
+			else if (strequal(key, "min_points"))
+				settings.min_points = (unsigned)number;
+			else if (strequal(key, "k"))
+				settings.k = (unsigned)number;
+			else if (strequal(key, "iterations"))
+				settings.max_iterations = (unsigned)number;
+			else if (strequal(key, "max_clusters"))
+				settings.max_clusters = (unsigned)number;
+		}
+
+		std::vector<float> positions, scalars;
+		std::string error;
+		if (!gather_points(*result, selection, positions, scalars, error))
+		{
+			fprintf(stderr, "Cluster points failed: %s\n", error.c_str());
+			return cv_handle;
+		}
+
+		config_data_api->set_number(cv_handle, start_cluster_request(settings, std::move(positions), std::move(scalars)));
+		return cv_handle;
+	}
+
+	/**
+	* Poll a clustering started with clusterPoints. Returns { handle, done } while it runs, and once done the
+	* largest clusters as { x, y, z, min: [x, y, z], max: [x, y, z], size, scalar_mean }, scalar_mean only
+	* for clusters with scalars, with the number of clusters found and of noise points. The request is then released.
+	*/
+	ConfigValue poll_clusters(ConfigValueArgs args, int num)
+	{
+		if (num < 1)
+			return nullptr;
+
+		auto handle = (unsigned)config_data_api->to_number(&args[0]);
+		auto request = find_cluster_request(handle);
+		if (request == nullptr)
+			return config_data_api->nil();
+
+		bool finished = request->finished;
+
+		auto cv_state = config_data_api->make(nullptr);
+		config_data_api->add_number(cv_state, "handle", handle);
+		config_data_api->add_bool(cv_state, "done", finished);
+		if (!finished)
+			return cv_state;
+
+		auto cv_clusters = config_data_api->make(nullptr);
+		for (auto& cluster : request->result.clusters)
+		{
+			auto cv_cluster = config_data_api->make(nullptr);
+			config_data_api->add_number(cv_cluster, "x", cluster.centroid[0]);
+			config_data_api->add_number(cv_cluster, "y", cluster.centroid[1]);
+			config_data_api->add_number(cv_cluster, "z", cluster.centroid[2]);
+
+			auto cv_min = config_data_api->make(nullptr);
+			auto cv_max = config_data_api->make(nullptr);
+			for (auto axis = 0; axis < 3; ++axis)
+			{
+				ConfigValue item = config_data_api->make(nullptr);
+				config_data_api->set_number(item, cluster.bb_min[axis]);
+				config_data_api->push(cv_min, item);
+				item = config_data_api->make(nullptr);
+				config_data_api->set_number(item, cluster.bb_max[axis]);
+				config_data_api->push(cv_max, item);
+			}
+			config_data_api->add_array(cv_cluster, "min", cv_min);
+			config_data_api->add_array(cv_cluster, "max", cv_max);
+
+			config_data_api->add_number(cv_cluster, "size", cluster.size);
+			if (!isnan(cluster.scalar_mean))
+				config_data_api->add_number(cv_cluster, "scalar_mean", cluster.scalar_mean);
+			config_data_api->push(cv_clusters, cv_cluster);
+		}
+		config_data_api->add_array(cv_state, "clusters", cv_clusters);
+		config_data_api->add_number(cv_state, "cluster_count", request->result.cluster_count);
+		config_data_api->add_number(cv_state, "noise_points", request->result.noise_points);
+
+		release_cluster_request(handle);
+		return cv_state;
+	}
+
+	/**
+	* Cancel a clustering started with clusterPoints, waiting for its threads to stop.
+	*/
+	ConfigValue cancel_clusters(ConfigValueArgs args, int num)
+	{
+		if (num < 1)
+			return nullptr;
+
+		release_cluster_request((unsigned)config_data_api->to_number(&args[0]));
+		return config_data_api->nil();
+	}
+
+	/**
+	* Read a filter value into the numbers or strings of a predicate, booleans being 0 and 1.
+	*/
+	bool parse_filter_value(ConfigValue value, RowFilter& filter)
+	{
+		switch (config_data_api->type(value))
+		{
+			case CD_TYPE_NUMBER: filter.numbers.push_back(config_data_api->to_number(value)); return true;
+			case CD_TYPE_TRUE: filter.numbers.push_back(1.0); return true;
+			case CD_TYPE_FALSE: filter.numbers.push_back(0.0); return true;
+			case CD_TYPE_STRING: filter.strings.push_back(config_data_api->to_string(value)); return true;
+			default: return false;
+		}
+	}
+
+	/**
+	* Parse a filter object of filterRows: { and: [filters] }, { or: [filters] }, { range: [field, min, max] } with null
+	* for an open bound, { equals: [field, value] }, { in: [field, [values]] } or { prefix: [field, string] }.
+	*/
+	bool parse_row_filter(ConfigValue cv_filter, RowFilter& filter, std::string& error)
+	{
+		if (config_data_api->type(cv_filter) != CD_TYPE_OBJECT || config_data_api->object_size(cv_filter) != 1)
+		{
+			error = "A filter is an object with a single key";
+			return false;
+		}
+
+		auto key = config_data_api->object_key(cv_filter, 0);
+		auto args = config_data_api->object_value(cv_filter, 0);
+		if (config_data_api->type(args) != CD_TYPE_ARRAY)
+		{
+			error = std::string("The ") + key + " filter takes an array";
+			return false;
+		}
+
+		auto length = config_data_api->array_size(args);
+		if (strequal(key, "and") || strequal(key, "or"))
+		{
+			filter.kind = strequal(key, "and") ? FILTER_AND : FILTER_OR;
+			filter.children.resize(length);
+			for (auto i = 0; i < length; ++i)
+			{
+				if (!parse_row_filter(config_data_api->array_item(args, i), filter.children[i], error))
+					return false;
+			}
+			return true;
+		}
+
+		if (length < 2 || config_data_api->type(config_data_api->array_item(args, 0)) != CD_TYPE_STRING)
+		{
+			error = std::string("The ") + key + " filter takes a field name and a value";
+			return false;
+		}
+		filter.field = config_data_api->to_string(config_data_api->array_item(args, 0));
+		auto value = config_data_api->array_item(args, 1);
+
+		if (strequal(key, "range"))
+		{
+			filter.kind = FILTER_RANGE;
+			auto max = length > 2 ? config_data_api->array_item(args, 2) : nullptr;
+			filter.min = config_data_api->type(value) == CD_TYPE_NUMBER ? config_data_api->to_number(value) : -INFINITY;
+			filter.max = max != nullptr && config_data_api->type(max) == CD_TYPE_NUMBER ? config_data_api->to_number(max) : INFINITY;
+			return true;
+		}
+
+		if (strequal(key, "equals") || strequal(key, "prefix"))
+		{
+			filter.kind = strequal(key, "equals") ? FILTER_EQUALS : FILTER_PREFIX;
+			if (!parse_filter_value(value, filter) || (filter.kind == FILTER_PREFIX && filter.strings.empty()))
+			{
+				error = std::string("Invalid value of the ") + key + " filter on " + filter.field;
+				return false;
+			}
+			return true;
+		}
+
+		if (strequal(key, "in") && config_data_api->type(value) == CD_TYPE_ARRAY)
+		{
+			filter.kind = FILTER_IN;
+			auto count = config_data_api->array_size(value);
+			for (auto i = 0; i < count; ++i)
+				parse_filter_value(config_data_api->array_item(value, i), filter);
+			return true;
+		}
+
+		error = std::string("Unknown filter ") + key;
+		return false;
+	}
+
+	/**
+	* Filter the rows of an async fetch natively, without querying the database again. Takes the fetch handle
+	* and a filter, see parse_row_filter. Returns { rows, ranges } with the number of matching rows and the rows
+	* as [begin, end) pairs, to include them in the document list or pass them to shareWithEngine, or { error }.
+	*/
+	ConfigValue filter_rows(ConfigValueArgs args, int num)
+	{
+		auto cv_result = config_data_api->make(nullptr);
+		if (num < 2)
+		{
+			config_data_api->add_string(cv_result, "error", "filterRows takes a fetch handle and a filter");
+			return cv_result;
+		}
+
+		auto result = find_stored_result((unsigned)config_data_api->to_number(&args[0]));
+		if (result == nullptr)
+		{
+			config_data_api->add_string(cv_result, "error", "The rows of the fetch are not kept");
+			return cv_result;
+		}
+
+		RowFilter filter;
+		RowBitmap bitmap;
+		std::string error;
+		if (!parse_row_filter(&args[1], filter, error) || !evaluate_row_filter(result->columns, result->rows, filter, bitmap, error))
+		{
+			config_data_api->add_string(cv_result, "error", error.c_str());
+			return cv_result;
+		}
+
+		std::vector<size_t> ranges;
+		bitmap_row_ranges(bitmap, result->rows, ranges);
+
+		auto cv_ranges = config_data_api->make(nullptr);
+		for (auto row : ranges)
+		{
+			auto item = config_data_api->make(nullptr);
+			config_data_api->set_number(item, (double)row);
+			config_data_api->push(cv_ranges, item);
+		}
+		config_data_api->add_number(cv_result, "rows", (double)count_bitmap_rows(bitmap));
+		config_data_api->add_array(cv_result, "ranges", cv_ranges);
+		return cv_result;
+	}
+
+	/**
+	* Release the rows of an async fetch kept for shareWithEngine. Return false if none are kept under the handle.
+	*/
+	ConfigValue release_fetch_result(ConfigValueArgs args, int num)
+	{
+		if (num < 1)
+			return nullptr;
+
+		auto cv_success = config_data_api->make(nullptr);
+		config_data_api->set_bool(cv_success, release_stored_result((unsigned)config_data_api->to_number(&args[0])));
+		return cv_success;
+	}
+
+	/**
+	* Cancel a fetch request. The in-flight cursor is destroyed by the worker.
+	* Return false if the request does not exist.
+	*/
+	ConfigValue cancel_fetch(ConfigValueArgs args, int num)
+	{
+		if (num < 1)
+			return nullptr;
+
+		auto cv_success = config_data_api->make(nullptr);
+		config_data_api->set_bool(cv_success, cancel_fetch_request((unsigned)config_data_api->to_number(&args[0])));
+		return cv_success;
+	}
+
+	/**
+	* Watch a collection for inserted documents with a change stream (needs a replica set).
+	* Takes the same arguments as fetch_documents plus an optional { flush_ms: n }, the shortest time between two batches.
+	* Returns a request handle to use with pollLive and stopLive, 0 if the stream could not be started.
+	*/
+	ConfigValue start_live_fetch(ConfigValueArgs args, int num)
+	{
+		auto cv_handle = config_data_api->make(nullptr);
+		config_data_api->set_number(cv_handle, 0);
+
+		FetchQuery query;
+		if (client_pool == nullptr || database == nullptr || !parse_fetch_query(args, num, query) || !join_level_sessions(query))
+			return cv_handle;
+
+		config_data_api->set_number(cv_handle, start_live_request(query, client_pool, mongoc_database_get_name(database)));
+		return cv_handle;
+	}
+
+	/**
+	* Poll a live request started with startLive.
+	* Returns the documents received and dropped so far and the next batch of new documents in columnar form (or nil).
+	* A failed stream is stopped and reports its error with done set.
+	*/
+	ConfigValue poll_live(ConfigValueArgs args, int num)
+	{
+		if (num < 1)
+			return nullptr;
+
+		auto handle = (unsigned)config_data_api->to_number(&args[0]);
+		auto request = find_live_request(handle);
+		if (request == nullptr)
+			return config_data_api->nil();
+
+		bool finished = request->finished;
+
+		auto cv_state = config_data_api->make(nullptr);
+		config_data_api->add_number(cv_state, "handle", handle);
+		config_data_api->add_number(cv_state, "documents_received", (double)request->documents_received.load());
+		config_data_api->add_number(cv_state, "documents_dropped", (double)request->documents_dropped.load());
+
+		std::vector<Column> columns;
+		if (pop_live_batch(request, columns))
+		{
+			auto count = columns.empty() ? 0 : columns[0].size;
+			config_data_api->add_object(cv_state, "chunk", make_columnar_result(columns, count));
+			finished = false;
+		}
+
+		if (finished)
+		{
+			std::string error;
+			{
+				std::lock_guard<std::mutex> lock(request->mutex);
+				error = request->error;
+			}
+
+			if (!error.empty())
+			{
+				fprintf(stderr, "Live fetch failed: %s\n", error.c_str());
+				config_data_api->add_string(cv_state, "error", error.c_str());
+			}
+
+			stop_live_request(handle);
+		}
+
+		config_data_api->add_bool(cv_state, "done", finished);
+
+		return cv_state;
+	}
+
+	/**
+	* Stop a live request, waiting at most one flush interval for its stream to close.
+	*/
+	ConfigValue stop_live_fetch(ConfigValueArgs args, int num)
+	{
+		if (num < 1)
+			return nullptr;
+
+		stop_live_request((unsigned)config_data_api->to_number(&args[0]));
+		return config_data_api->nil();
+	}
+
+	/**
+	* Configure the on-disk query cache: (enabled, max_megabytes, directory).
+	* Only enabled is required, the directory defaults to the local application data folder.
+	*/
+	ConfigValue configure_query_cache(ConfigValueArgs args, int num)
+	{
+		if (num < 1)
+			return nullptr;
+
+		set_query_cache_enabled(config_data_api->to_bool(&args[0]));
+
+		if (num > 1 && config_data_api->type(&args[1]) == CD_TYPE_NUMBER)
+		{
+			auto max_bytes = (uint64_t)(config_data_api->to_number(&args[1]) * 1024 * 1024);
+			const char* directory = nullptr;
+			if (num > 2 && config_data_api->type(&args[2]) == CD_TYPE_STRING)
+				directory = config_data_api->to_string(&args[2]);
+
+			init_query_cache(directory != nullptr ? directory : "", max_bytes);
+		}
+
+		return config_data_api->nil();
+	}
+
+	/**
+	* Return the query cache hit/miss counters and size.
+	*/
+	ConfigValue fetch_query_cache_stats(ConfigValueArgs args, int num)
+	{
+		auto stats = query_cache_stats();
+
+		auto cv_stats = config_data_api->make(nullptr);
+		config_data_api->add_bool(cv_stats, "enabled", query_cache_enabled());
+		config_data_api->add_number(cv_stats, "hits", (double)stats.hits);
+		config_data_api->add_number(cv_stats, "misses", (double)stats.misses);
+		config_data_api->add_number(cv_stats, "stale", (double)stats.stale);
+		config_data_api->add_number(cv_stats, "writes", (double)stats.writes);
+		config_data_api->add_number(cv_stats, "evictions", (double)stats.evictions);
+		config_data_api->add_number(cv_stats, "entries", (double)stats.entries);
+		config_data_api->add_number(cv_stats, "bytes", (double)stats.bytes);
+		config_data_api->add_number(cv_stats, "max_bytes", (double)stats.max_bytes);
+		return cv_stats;
+	}
+
+	/**
+	* Return the timing histograms of every profiled stage:
+	* { stages: [{ name, count, p50_ms, p95_ms, p99_ms, max_ms, total_ms, bytes, documents }] }.
+	*/
+	ConfigValue fetch_profile_stats(ConfigValueArgs args, int num)
+	{
+		auto cv_stages = config_data_api->make(nullptr);
+		for (auto& stats : profile_stages())
+		{
+			auto cv_stage = config_data_api->make(nullptr);
+			config_data_api->add_string(cv_stage, "name", stats.name.c_str());
+			config_data_api->add_number(cv_stage, "count", (double)stats.count);
+			config_data_api->add_number(cv_stage, "p50_ms", stage_percentile_us(stats, 0.50) / 1000.0);
+			config_data_api->add_number(cv_stage, "p95_ms", stage_percentile_us(stats, 0.95) / 1000.0);
+			config_data_api->add_number(cv_stage, "p99_ms", stage_percentile_us(stats, 0.99) / 1000.0);
+			config_data_api->add_number(cv_stage, "max_ms", stats.max_us / 1000.0);
+			config_data_api->add_number(cv_stage, "total_ms", stats.total_us / 1000.0);
+			config_data_api->add_number(cv_stage, "bytes", (double)stats.bytes);
+			config_data_api->add_number(cv_stage, "documents", (double)stats.documents);
+			config_data_api->push(cv_stages, cv_stage);
+		}
+
+		auto cv_profile = config_data_api->make(nullptr);
+		config_data_api->add_array(cv_profile, "stages", cv_stages);
+		return cv_profile;
+	}
+
+	ConfigValue reset_profile_stats(ConfigValueArgs args, int num)
+	{
+		reset_profile();
+		return config_data_api->nil();
+	}
+
+	/**
+	* Write the most recent profiled scopes to a Chrome trace JSON file, takes the file path.
+	* Returns true on success.
+	*/
+	ConfigValue dump_profile_trace(ConfigValueArgs args, int num)
+	{
+		if (num < 1 || config_data_api->type(&args[0]) != CD_TYPE_STRING)
+			return nullptr;
+
+		std::string error;
+		auto ok = write_chrome_trace(config_data_api->to_string(&args[0]), error);
+		if (!ok)
+			fprintf(stderr, "Could not write the profile trace: %s\n", error.c_str());
+
+		auto cv_ok = config_data_api->make(nullptr);
+		config_data_api->set_bool(cv_ok, ok);
+		return cv_ok;
+	}
+
+	/**
+	* Remove all cached query results that are not in use.
+	*/
+	ConfigValue clear_query_cache_entries(ConfigValueArgs args, int num)
+	{
+		clear_query_cache();
+		return config_data_api->nil();
+	}
+
+	/**
+	* Read the optional { sample: n } and { refresh: true } arguments of the schema functions.
+	*/
+	void parse_schema_options(ConfigValueArgs args, int num, int64_t& sample_size, bool& refresh)
+	{
+		for (auto i = 1; i < num; ++i)
+		{
+			auto arg = &args[i];
+			if (config_data_api->type(arg) != CD_TYPE_OBJECT)
+				continue;
+
+			auto object_item_key = config_data_api->object_key(arg, 0);
+			auto object_item_value = config_data_api->object_value(arg, 0);
+
+			if (strequal(object_item_key, "sample") && config_data_api->type(object_item_value) == CD_TYPE_NUMBER)
+				sample_size = (int64_t)config_data_api->to_number(object_item_value);
+			else if (strequal(object_item_key, "refresh"))
+				refresh = config_data_api->to_bool(object_item_value);
+		}
+	}
+
+	/**
+	* Return the cached schema of a collection, sampling it first if needed.
+	*/
+	const CollectionSchema* collection_schema(ConfigValueArgs args, int num)
+	{
+		if (num < 1 || database == nullptr || config_data_api->type(&args[0]) != CD_TYPE_STRING)
+			return nullptr;
+
+		int64_t sample_size = SCHEMA_SAMPLE_SIZE;
+		auto refresh = false;
+		parse_schema_options(args, num, sample_size, refresh);
+
+		collection = mongoc_database_get_collection(database, config_data_api->to_string(&args[0]));
+		return find_collection_schema(collection, mongoc_database_get_name(database), sample_size, refresh);
+	}
+
+	/**
+	* Fetch the field paths of a collection, at any depth, from a sample of its documents.
+	* Takes the collection name and the optional { sample: n } and { refresh: true } of fetchSchema.
+	* Returns an array with the field paths.
+	*/
+	ConfigValue fetch_field_keys(ConfigValueArgs args, int num)
+	{
+		ScopedTimer timer("fetch_field_keys");
+		if (snapshot != nullptr)
+		{
+			auto cv_field_keys = config_data_api->make(nullptr);
+			for (auto& field : snapshot->info.fields)
+			{
+				auto cv_key = config_data_api->make(nullptr);
+				config_data_api->set_string(cv_key, field.c_str());
+				config_data_api->push(cv_field_keys, cv_key);
+			}
+			return cv_field_keys;
+		}
+
+		auto schema = collection_schema(args, num);
+		if (schema == nullptr)
+			return nullptr;
+
+		auto cv_field_keys = config_data_api->make(nullptr);
+		for (auto& key : schema_field_keys(*schema))
+		{
+			auto cv_key = config_data_api->make(nullptr);
+			config_data_api->set_string(cv_key, key.c_str());
+			config_data_api->push(cv_field_keys, cv_key);
+		}
+
+		return cv_field_keys;
+	}
+
+	/**
+	* Fetch the inferred schema of a collection, sampled with $sample and cached until the collection changes.
+	* Takes the collection name, optional { sample: n } documents to sample and { refresh: true } to sample again.
+	* Returns { sampled, incremental, fields: [{ path, presence, types: { type: count } }] }.
+	*/
+	ConfigValue fetch_schema(ConfigValueArgs args, int num)
+	{
+		auto schema = collection_schema(args, num);
+		if (schema == nullptr)
+			return nullptr;
+
+		auto cv_schema = config_data_api->make(nullptr);
+		auto cv_fields = config_data_api->make(nullptr);
+
+		for (auto& field : schema->fields)
+		{
+			auto cv_field = config_data_api->make(nullptr);
+			auto cv_types = config_data_api->make(nullptr);
+
+			for (auto slot = 0; slot < SCHEMA_TYPE_SLOTS; ++slot)
+			{
+				if (field.type_counts[slot] > 0)
+					config_data_api->add_number(cv_types, schema_type_name(slot), (double)field.type_counts[slot]);
+			}
+
+			config_data_api->add_string(cv_field, "path", field.path.c_str());
+			config_data_api->add_number(cv_field, "presence", schema->sampled_documents > 0 ? (double)field.present / schema->sampled_documents : 0.0);
+			config_data_api->add_object(cv_field, "types", cv_types);
+			config_data_api->push(cv_fields, cv_field);
+		}
+
+		config_data_api->add_number(cv_schema, "sampled", (double)schema->sampled_documents);
+		config_data_api->add_bool(cv_schema, "incremental", schema->incremental);
+		config_data_api->add_array(cv_schema, "fields", cv_fields);
+
+		return cv_schema;
+	}
+
+	/**
+	* Fetch and return a list of the database collections.
+	*/
+	void fetch_collection_names(ConfigValueArgs& cv)
+	{
+		bson_error_t error;
+		char** strv;
+
+		auto temp_cv = config_data_api->make(nullptr);
+
+		if ((strv = mongoc_database_get_collection_names(database, &error)))
+		{
+			for (auto i = 0; strv[i]; i++)
+			{
+				config_data_api->set_string(temp_cv, strv[i]);
+				config_data_api->push(cv, temp_cv);
+			}
+			bson_strfreev(strv);
+		}
+		else
+		{
+			fprintf(stderr, "Fetch 'collection names' failed: %s\n", error.message);
+		}
+	}
+
+	/**
+	* Connects to a MongoDB server, or opens a snapshot file given as a file:// URL or a .tvs path.
+	* A snapshot stands in for a server with a single collection, no server is needed to fetch from it.
+	* Return false if it failed.
+	*/
+	ConfigValue init_server(ConfigValueArgs args, int num)
+	{
+		if (num < 1)
+			return nullptr;
+
+		auto cv_success = config_data_api->make(nullptr);
+
 		auto cv_server = &args[0];
 		auto type = config_data_api->type(cv_server);
 		switch (type)
@@ -513,15 +1768,25 @@ namespace PLUGIN_NAMESPACE
 			case CD_TYPE_STRING:
 			{
 				auto server_adress = config_data_api->to_string(cv_server);
-				if (client == nullptr)
+				if (is_snapshot_address(server_adress))
+				{
+					disconnect_server();
+
+					std::string error;
+					snapshot = open_snapshot(server_adress, error);
+					if (snapshot == nullptr)
+						fprintf(stderr, "Open snapshot failed: %s\n", error.c_str());
+					config_data_api->set_bool(cv_success, snapshot != nullptr);
+				}
+				else if (client == nullptr)
 				{
-					client = mongoc_client_new(server_adress);
-					config_data_api->set_bool(cv_success, true);
+					disconnect_server(); // Closes the snapshot file if one is open
+					config_data_api->set_bool(cv_success, connect_server(server_adress));
 				}
 				else if (!strequal(mongoc_uri_get_string(mongoc_client_get_uri(client)), server_adress)) // Will not nothing if a user is tring to select the already chosen server 
 				{
-					mongoc_client_destroy(client);
-					client = mongoc_client_new(server_adress);
+					disconnect_server();
+					connect_server(server_adress);
 				}
 				else
 				{
@@ -555,7 +1820,14 @@ namespace PLUGIN_NAMESPACE
 			case CD_TYPE_STRING:
 			{
 				auto database_name = config_data_api->to_string(cv_database);
-				if (client == nullptr) // return false If no client is set
+				if (snapshot != nullptr) // A snapshot has its collection in any database
+				{
+					auto cv_name = config_data_api->make(nullptr);
+					config_data_api->set_string(cv_name, snapshot->info.collection.c_str());
+					config_data_api->push(cv_result, cv_name);
+					return cv_result;
+				}
+				else if (client == nullptr) // return false If no client is set
 				{
 					config_data_api->set_bool(cv_result, false);
 					succsess = false;
@@ -597,11 +1869,36 @@ namespace PLUGIN_NAMESPACE
 		eval_api = static_cast<EditorEvalApi*>(get_editor_api(EDITOR_EVAL_API_ID));
 
 		init_mongoc();
+		init_query_cache("", 0);
 
 		api->register_native_function("nativeExtension", "connectToDatabase", &init_server);
 		api->register_native_function("nativeExtension", "selectDatabase", &init_database);
 		api->register_native_function("nativeExtension", "fetchFieldKeys", &fetch_field_keys);
+		api->register_native_function("nativeExtension", "fetchSchema", &fetch_schema);
 		api->register_native_function("nativeExtension", "fetchDocuments", &fetch_documents);
+		api->register_native_function("nativeExtension", "fetchDocumentsAsync", &fetch_documents_async);
+		api->register_native_function("nativeExtension", "pollFetch", &poll_fetch);
+		api->register_native_function("nativeExtension", "cancelFetch", &cancel_fetch);
+		api->register_native_function("nativeExtension", "shareWithEngine", &share_points_with_engine);
+		api->register_native_function("nativeExtension", "shareTrajectoriesWithEngine", &share_trajectories_with_engine);
+		api->register_native_function("nativeExtension", "clusterPoints", &cluster_points);
+		api->register_native_function("nativeExtension", "pollClusters", &poll_clusters);
+		api->register_native_function("nativeExtension", "cancelClusters", &cancel_clusters);
+		api->register_native_function("nativeExtension", "filterRows", &filter_rows);
+		api->register_native_function("nativeExtension", "releaseFetchResult", &release_fetch_result);
+		api->register_native_function("nativeExtension", "fetchPage", &fetch_page_documents);
+		api->register_native_function("nativeExtension", "exportSnapshot", &export_snapshot);
+		api->register_native_function("nativeExtension", "startLive", &start_live_fetch);
+		api->register_native_function("nativeExtension", "pollLive", &poll_live);
+		api->register_native_function("nativeExtension", "stopLive", &stop_live_fetch);
+		api->register_native_function("nativeExtension", "explainFetch", &explain_fetch);
+		api->register_native_function("nativeExtension", "aggregateDocuments", &aggregate_documents);
+		api->register_native_function("nativeExtension", "configureQueryCache", &configure_query_cache);
+		api->register_native_function("nativeExtension", "queryCacheStats", &fetch_query_cache_stats);
+		api->register_native_function("nativeExtension", "clearQueryCache", &clear_query_cache_entries);
+		api->register_native_function("nativeExtension", "profileStats", &fetch_profile_stats);
+		api->register_native_function("nativeExtension", "resetProfile", &reset_profile_stats);
+		api->register_native_function("nativeExtension", "dumpProfileTrace", &dump_profile_trace);
 
 		api->register_native_function("nativeExtension", "sessionsIds", &fetch_sessions_ids);
 	}
@@ -614,11 +1911,37 @@ namespace PLUGIN_NAMESPACE
 		auto api = static_cast<EditorApi*>(get_editor_api(EDITOR_API_ID));
 
 		clean_mongoc();
+		shutdown_cluster_requests();
+		release_stored_results();
 
 		api->unregister_native_function("nativeExtension", "connectToDatabase");
 		api->unregister_native_function("nativeExtension", "selectDatabase");
 		api->unregister_native_function("nativeExtension", "fetchFieldNames");
+		api->unregister_native_function("nativeExtension", "fetchSchema");
 		api->unregister_native_function("nativeExtension", "fetchDocuments");
+		api->unregister_native_function("nativeExtension", "fetchDocumentsAsync");
+		api->unregister_native_function("nativeExtension", "pollFetch");
+		api->unregister_native_function("nativeExtension", "cancelFetch");
+		api->unregister_native_function("nativeExtension", "shareWithEngine");
+		api->unregister_native_function("nativeExtension", "shareTrajectoriesWithEngine");
+		api->unregister_native_function("nativeExtension", "clusterPoints");
+		api->unregister_native_function("nativeExtension", "pollClusters");
+		api->unregister_native_function("nativeExtension", "cancelClusters");
+		api->unregister_native_function("nativeExtension", "filterRows");
+		api->unregister_native_function("nativeExtension", "releaseFetchResult");
+		api->unregister_native_function("nativeExtension", "fetchPage");
+		api->unregister_native_function("nativeExtension", "exportSnapshot");
+		api->unregister_native_function("nativeExtension", "startLive");
+		api->unregister_native_function("nativeExtension", "pollLive");
+		api->unregister_native_function("nativeExtension", "stopLive");
+		api->unregister_native_function("nativeExtension", "explainFetch");
+		api->unregister_native_function("nativeExtension", "aggregateDocuments");
+		api->unregister_native_function("nativeExtension", "configureQueryCache");
+		api->unregister_native_function("nativeExtension", "queryCacheStats");
+		api->unregister_native_function("nativeExtension", "clearQueryCache");
+		api->unregister_native_function("nativeExtension", "profileStats");
+		api->unregister_native_function("nativeExtension", "resetProfile");
+		api->unregister_native_function("nativeExtension", "dumpProfileTrace");
 
 		api->unregister_native_function("nativeExtension", "sessionsIds");
 	}
@@ -0,0 +1,152 @@
+#include "fetch_query.h"
+#include "position_parser.h"
+#include "session_filter.h"
+
+#include <stdio.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	void build_fetch_query(const FetchQuery& query, bson_t* filter, bson_t* opts, size_t session_batch)
+	{
+		bson_t project_fields, sort;
+
+		if (session_batch == ALL_SESSION_BATCHES)
+		{
+			BSON_APPEND_INT64(opts, "limit", query.limit);
+			BSON_APPEND_INT64(opts, "skip", query.skip);
+		}
+		else if (query.limit > 0)
+		{
+			// Skip and limit apply to the merged batches, no batch needs more than skip + limit documents
+			BSON_APPEND_INT64(opts, "limit", query.skip + query.limit);
+		}
+
+		if (query.filter_sessions)
+			append_session_filter(filter, query, session_batch);
+
+		BSON_APPEND_DOCUMENT_BEGIN(opts, "sort", &sort);
+		for (auto i = 0; i < query.sort.size() && i < query.fields.size(); ++i)
+		{
+			if (query.sort[i])
+				BSON_APPEND_INT32(&sort, query.fields[i].c_str(), 1);
+		}
+		bson_append_document_end(opts, &sort);
+
+		BSON_APPEND_DOCUMENT_BEGIN(opts, "projection", &project_fields);
+		BSON_APPEND_BOOL(&project_fields, "_id", false); // Ignore _id
+		for (auto i = 0; i < query.fields.size(); ++i)
+		{
+			BSON_APPEND_BOOL(&project_fields, query.fields[i].c_str(), true);
+		}
+		bson_append_document_end(opts, &project_fields);
+	}
+
+	int sort_type_rank(bson_type_t type)
+	{
+		switch (type)
+		{
+			case BSON_TYPE_MINKEY: return 0;
+			case BSON_TYPE_EOD: case BSON_TYPE_UNDEFINED: case BSON_TYPE_NULL: return 1;
+			case BSON_TYPE_INT32: case BSON_TYPE_INT64: case BSON_TYPE_DOUBLE: case BSON_TYPE_DECIMAL128: return 2;
+			case BSON_TYPE_UTF8: return 3;
+			case BSON_TYPE_DOCUMENT: return 4;
+			case BSON_TYPE_ARRAY: return 5;
+			case BSON_TYPE_BINARY: return 6;
+			case BSON_TYPE_OID: return 7;
+			case BSON_TYPE_BOOL: return 8;
+			case BSON_TYPE_DATE_TIME: return 9;
+			case BSON_TYPE_TIMESTAMP: return 10;
+			case BSON_TYPE_REGEX: return 11;
+			case BSON_TYPE_MAXKEY: return 13;
+			default: return 12;
+		}
+	}
+
+	void init_columns(const FetchQuery& query, std::vector<Column>& columns)
+	{
+		columns.clear();
+		columns.resize(query.fields.size());
+		for (auto i = 0; i < query.fields.size(); ++i)
+			columns[i].name = query.fields[i];
+	}
+
+	bool parse_bson_position(const bson_iter_t* field, int parser_id, float* xyz)
+	{
+		switch (bson_iter_type(field))
+		{
+			case BSON_TYPE_UTF8:
+			{
+				auto parser = find_position_parser(parser_id);
+				if (parser == nullptr)
+					return false;
+
+				uint32_t len = 0;
+				auto str = bson_iter_utf8(field, &len);
+				return parser(str, len, xyz);
+			}
+			case BSON_TYPE_ARRAY: case BSON_TYPE_DOCUMENT:
+			{
+				// Take the first three numbers, [x, y, z] or { x: .., y: .., z: .. }
+				bson_iter_t child;
+				if (!bson_iter_recurse(field, &child))
+					return false;
+
+				auto count = 0;
+				while (count < 3 && bson_iter_next(&child))
+				{
+					auto type = bson_iter_type(&child);
+					if (type == BSON_TYPE_DOUBLE || type == BSON_TYPE_INT32 || type == BSON_TYPE_INT64)
+						xyz[count++] = (float)bson_iter_as_double(&child);
+				}
+				return count == 3;
+			}
+			default:
+				return false;
+		}
+	}
+
+	void push_bson_value(Column& column, const bson_value_t* value)
+	{
+		switch (value->value_type)
+		{
+			case BSON_TYPE_DOUBLE: column.push_double(value->value.v_double); break;
+			case BSON_TYPE_UTF8: column.push_string(value->value.v_utf8.str, value->value.v_utf8.len); break;
+			case BSON_TYPE_INT32: column.push_int64(value->value.v_int32); break;
+			case BSON_TYPE_INT64: column.push_int64(value->value.v_int64); break;
+			case BSON_TYPE_BOOL: column.push_bool(value->value.v_bool); break;
+			case BSON_TYPE_DATE_TIME: column.push_int64(value->value.v_datetime); break;
+			case BSON_TYPE_TIMESTAMP: column.push_int64(value->value.v_timestamp.timestamp); break;
+			case BSON_TYPE_OID:
+			{
+				char oid[25];
+				bson_oid_to_string(&value->value.v_oid, oid);
+				column.push_string(oid, 24);
+				break;
+			}
+			case BSON_TYPE_DOCUMENT: case BSON_TYPE_ARRAY:
+			{
+				size_t length = 0;
+				auto json = nested_bson_as_json(value, &length);
+				if (json == nullptr)
+				{
+					column.push_null();
+					break;
+				}
+				column.push_string(json, (uint32_t)length);
+				bson_free(json);
+				break;
+			}
+			default: column.push_null(); break;
+		}
+	}
+
+	char* nested_bson_as_json(const bson_value_t* value, size_t* length)
+	{
+		bson_t nested;
+		if ((value->value_type != BSON_TYPE_DOCUMENT && value->value_type != BSON_TYPE_ARRAY) ||
+			!bson_init_static(&nested, value->value.v_doc.data, value->value.v_doc.data_len))
+			return nullptr;
+
+		return value->value_type == BSON_TYPE_ARRAY ? bson_array_as_json(&nested, length) : bson_as_json(&nested, length);
+	}
+}
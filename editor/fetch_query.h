@@ -0,0 +1,98 @@
+#pragma once
+
+#include "column_set.h"
+
+#include <bson.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Parallel cursors of a fetch unless { threads: n } is given.
+	*/
+	const unsigned DEFAULT_FETCH_THREADS = 4;
+
+	/**
+	* Upper bound of { threads: n }, every cursor holds a client of the pool.
+	*/
+	const unsigned MAX_FETCH_THREADS = 16;
+
+	/**
+	* Everything needed to run a document fetch, copied out of the JavaScript arguments
+	* so it stays valid after the native call returns.
+	*/
+	struct FetchQuery
+	{
+		std::string collection;
+		uint64_t limit = 0;
+		uint64_t skip = 0;
+		std::vector<std::string> fields;
+		std::vector<uint8_t> sort;
+		bool columnar = false;
+
+		// Parse positions out of every field with this parser, -1 to disable (see PositionParserId)
+		int position_parser = -1;
+
+		// filter by session ids
+		bool filter_sessions = false;
+		std::vector<std::string> sessions_ids;
+
+		// Filter by the sessions of a level instead, joined natively before the query runs (see resolve_level_sessions)
+		std::string level_key;
+
+		// Async fetch options
+		size_t chunk_size = 10000;
+		std::string progress_callback;
+
+		// Cursors scanning disjoint _id ranges or session batches at the same time
+		unsigned thread_count = DEFAULT_FETCH_THREADS;
+
+		// Live fetch option, new documents are handed over at most this often
+		unsigned flush_interval_ms = 500;
+
+		// Page option, continuation token of the previous page, empty for the first page
+		std::string page_after;
+	};
+
+	/**
+	* Pass to build_fetch_query to filter on every session id at once.
+	*/
+	const size_t ALL_SESSION_BATCHES = (size_t)-1;
+
+	/**
+	* Build the find filter and options (limit, skip, sort and projection) for a query.
+	* Both documents must be initialized by the caller.
+	* With a session batch (see session_batch_count) only the ids of that batch are filtered on and skip is
+	* left to the caller, the limit is only an upper bound of the documents the batch can contribute.
+	*/
+	void build_fetch_query(const FetchQuery& query, bson_t* filter, bson_t* opts, size_t session_batch = ALL_SESSION_BATCHES);
+
+	/**
+	* Rank of a BSON type in the order MongoDB sorts values of different types, missing fields sort as null.
+	*/
+	int sort_type_rank(bson_type_t type);
+
+	/**
+	* Create one empty column per requested field.
+	*/
+	void init_columns(const FetchQuery& query, std::vector<Column>& columns);
+
+	/**
+	* Parse a position from a string (with the given parser), an [x, y, z] array or an { x, y, z } document.
+	*/
+	bool parse_bson_position(const bson_iter_t* field, int parser_id, float* xyz);
+
+	/**
+	* Append a BSON value to a packed column. Nested documents and arrays are appended as JSON strings
+	* and object ids as hex strings.
+	*/
+	void push_bson_value(Column& column, const bson_value_t* value);
+
+	/**
+	* JSON of a nested document or array value, to be released with bson_free. Returns nullptr for other types.
+	*/
+	char* nested_bson_as_json(const bson_value_t* value, size_t* length);
+}
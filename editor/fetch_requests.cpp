@@ -0,0 +1,884 @@
+#include "fetch_requests.h"
+#include "document_decoder.h"
+#include "id_ranges.h"
+#include "profiler.h"
+#include "session_filter.h"
+
+#include <mongoc.h>
+
+#include <functional>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_set>
+
+namespace PLUGIN_NAMESPACE
+{
+	// Requests are only started, polled and released from the UI thread.
+	std::vector<std::unique_ptr<FetchRequest>> fetch_requests;
+	unsigned next_fetch_handle = 1;
+
+	/**
+	* Where the scanning cursors of a request hand their chunks over.
+	* Chunks are also streamed to the query cache when an entry is being written.
+	*/
+	struct ChunkSink
+	{
+		FetchRequest* request;
+		QueryCacheWriter* cache_writer;
+		std::mutex cache_mutex;
+
+		// Documents accepted so far, used to apply skip and limit over merged sorted session batches
+		std::atomic<uint64_t> accepted{ 0 };
+
+		void push(std::vector<Column>& columns)
+		{
+			if (cache_writer->is_open())
+			{
+				std::lock_guard<std::mutex> lock(cache_mutex);
+				cache_writer->write_chunk(columns);
+			}
+
+			std::lock_guard<std::mutex> lock(request->mutex);
+			request->chunks.push_back(std::move(columns));
+		}
+
+		void fail(const char* message)
+		{
+			std::lock_guard<std::mutex> lock(request->mutex);
+			if (request->error.empty())
+				request->error = message;
+		}
+	};
+
+	/**
+	* Compare the value of a field of two documents the way an ascending sort does, < 0 if a comes first.
+	* Documents, arrays and the rarer types are only ordered by type.
+	*/
+	int compare_sort_field(const bson_t* a, const bson_t* b, const char* field)
+	{
+		bson_iter_t a_iter, b_iter, a_field, b_field;
+		auto a_type = bson_iter_init(&a_iter, a) && bson_iter_find_descendant(&a_iter, field, &a_field) ? bson_iter_type(&a_field) : BSON_TYPE_EOD;
+		auto b_type = bson_iter_init(&b_iter, b) && bson_iter_find_descendant(&b_iter, field, &b_field) ? bson_iter_type(&b_field) : BSON_TYPE_EOD;
+
+		auto a_rank = sort_type_rank(a_type), b_rank = sort_type_rank(b_type);
+		if (a_rank != b_rank)
+			return a_rank < b_rank ? -1 : 1;
+
+		switch (a_rank)
+		{
+			case 2:
+			{
+				auto x = bson_iter_as_double(&a_field), y = bson_iter_as_double(&b_field);
+				return x < y ? -1 : (x > y ? 1 : 0);
+			}
+			case 3:
+			{
+				uint32_t a_length = 0, b_length = 0;
+				auto x = bson_iter_utf8(&a_field, &a_length);
+				auto y = bson_iter_utf8(&b_field, &b_length);
+				auto order = memcmp(x, y, a_length < b_length ? a_length : b_length);
+				return order != 0 ? order : (a_length < b_length ? -1 : (a_length > b_length ? 1 : 0));
+			}
+			case 7: return bson_oid_compare(bson_iter_oid(&a_field), bson_iter_oid(&b_field));
+			case 8: return (int)bson_iter_bool(&a_field) - (int)bson_iter_bool(&b_field);
+			case 9:
+			{
+				auto x = bson_iter_date_time(&a_field), y = bson_iter_date_time(&b_field);
+				return x < y ? -1 : (x > y ? 1 : 0);
+			}
+			default: return 0;
+		}
+	}
+
+	/**
+	* The cursors of the session batches of a sorted query, read as one cursor in the order of the sort.
+	* The server sorts every batch, the next document is the first of the current documents of the batches.
+	* Documents stay valid until the next call, like those of a single cursor.
+	*/
+	struct MergedCursors
+	{
+		std::vector<mongoc_cursor_t*> cursors;
+		std::vector<const bson_t*> heads; // Current document of every cursor, nullptr once it is exhausted
+		std::vector<const char*> sort_fields;
+		size_t current = (size_t)-1;     // Cursor of the last document returned, advanced by the next call
+
+		bool next(const bson_t** doc)
+		{
+			if (heads.empty())
+			{
+				heads.resize(cursors.size(), nullptr);
+				for (size_t c = 0; c < cursors.size(); ++c)
+					advance(c);
+			}
+			else if (current < cursors.size())
+			{
+				advance(current);
+			}
+
+			current = (size_t)-1;
+			for (size_t c = 0; c < heads.size(); ++c)
+			{
+				if (heads[c] != nullptr && (current == (size_t)-1 || compare(heads[c], heads[current]) < 0))
+					current = c;
+			}
+			if (current == (size_t)-1)
+				return false;
+
+			*doc = heads[current];
+			return true;
+		}
+
+		bool error(bson_error_t* error) const
+		{
+			for (auto cursor : cursors)
+			{
+				if (mongoc_cursor_error(cursor, error))
+					return true;
+			}
+			return false;
+		}
+
+	private:
+		void advance(size_t c)
+		{
+			if (!mongoc_cursor_next(cursors[c], &heads[c]))
+				heads[c] = nullptr;
+		}
+
+		int compare(const bson_t* a, const bson_t* b) const
+		{
+			for (auto field : sort_fields)
+			{
+				auto order = compare_sort_field(a, b, field);
+				if (order != 0)
+					return order;
+			}
+			return 0;
+		}
+	};
+
+	inline bool cursor_next(mongoc_cursor_t* cursor, const bson_t** doc) { return mongoc_cursor_next(cursor, doc); }
+	inline bool cursor_error(mongoc_cursor_t* cursor, bson_error_t* error) { return mongoc_cursor_error(cursor, error); }
+	inline bool cursor_next(MergedCursors* cursor, const bson_t** doc) { return cursor->next(doc); }
+	inline bool cursor_error(MergedCursors* cursor, bson_error_t* error) { return cursor->error(error); }
+
+	/**
+	* Walk a cursor, or merged session batch cursors, and hand a chunk over every query.chunk_size documents.
+	* With count_rows, skip and limit are applied here instead of by the server.
+	* Returns false if the cursor failed or the request was cancelled.
+	*/
+	template <typename Cursor>
+	bool scan_cursor(ChunkSink& sink, Cursor* cursor, bool count_rows)
+	{
+		auto request = sink.request;
+		const auto& query = request->query;
+
+		const bson_t* doc = nullptr;
+		bson_error_t error;
+
+		std::vector<Column> columns;
+		init_columns(query, columns);
+		DocumentDecoder decoder(query);
+		size_t chunk_documents = 0;
+
+		StageClock cursor_clock, decode_clock;
+		uint64_t bytes = 0, documents = 0;
+
+		for (;;)
+		{
+			cursor_clock.begin();
+			auto has_document = !request->cancelled && cursor_next(cursor, &doc);
+			cursor_clock.end();
+			if (!has_document)
+				break;
+
+			request->bytes_received += doc->len;
+			++request->documents_scanned;
+			bytes += doc->len;
+			++documents;
+
+			if (count_rows)
+			{
+				auto row = sink.accepted++;
+				if (query.limit > 0 && row >= query.skip + query.limit)
+					break;
+				if (row < query.skip)
+					continue;
+			}
+
+			decode_clock.begin();
+			decoder.read(doc, columns);
+			decode_clock.end();
+
+			if (++chunk_documents >= query.chunk_size)
+			{
+				sink.push(columns);
+				init_columns(query, columns);
+				chunk_documents = 0;
+			}
+		}
+
+		cursor_clock.record("fetch.cursor", bytes, documents);
+		decode_clock.record("fetch.decode", 0, documents);
+
+		if (cursor_error(cursor, &error))
+		{
+			sink.fail(error.message);
+			return false;
+		}
+
+		if (request->cancelled)
+			return false;
+
+		if (chunk_documents > 0)
+			sink.push(columns);
+		return true;
+	}
+
+	void run_on_threads(unsigned thread_count, const std::function<void()>& body)
+	{
+		std::vector<std::thread> threads;
+		for (unsigned i = 1; i < thread_count; ++i)
+			threads.push_back(std::thread(body));
+
+		body();
+
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	unsigned scan_thread_count(const FetchQuery& query, size_t work_count)
+	{
+		auto thread_count = query.thread_count < MAX_FETCH_THREADS ? query.thread_count : MAX_FETCH_THREADS;
+		if (thread_count < 1)
+			thread_count = 1;
+		return work_count < thread_count ? (unsigned)work_count : thread_count;
+	}
+
+	bool is_sorted_query(const FetchQuery& query)
+	{
+		for (auto sorted : query.sort)
+		{
+			if (sorted)
+				return true;
+		}
+		return false;
+	}
+
+	/**
+	* Scan the session batches of a sorted query with one cursor per batch on a single client, merging the
+	* sorted batches so that skip and limit apply to the rows in sort order.
+	* Returns false if any batch failed or the request was cancelled.
+	*/
+	bool scan_sorted_session_batches(ChunkSink& sink, mongoc_collection_t* collection)
+	{
+		auto request = sink.request;
+		const auto& query = request->query;
+		auto batch_count = session_batch_count(query);
+
+		MergedCursors merged;
+		for (auto i = 0; i < query.sort.size() && i < query.fields.size(); ++i)
+		{
+			if (query.sort[i])
+				merged.sort_fields.push_back(query.fields[i].c_str());
+		}
+
+		std::vector<bson_t*> batch_filters, batch_opts;
+		for (size_t batch = 0; batch < batch_count; ++batch)
+		{
+			batch_opts.push_back(new_arena_bson(request->arena));
+			batch_filters.push_back(new_arena_bson(request->arena));
+			build_fetch_query(query, batch_filters.back(), batch_opts.back(), batch);
+			merged.cursors.push_back(mongoc_collection_find_with_opts(collection, batch_filters.back(), batch_opts.back(), NULL));
+		}
+
+		auto complete = scan_cursor(sink, &merged, true);
+
+		for (size_t batch = 0; batch < batch_count; ++batch)
+		{
+			mongoc_cursor_destroy(merged.cursors[batch]);
+			bson_destroy(batch_opts[batch]);
+			bson_destroy(batch_filters[batch]);
+		}
+		return complete;
+	}
+
+	/**
+	* Decide whether an unsorted query is worth splitting in _id ranges and find the split points.
+	* Small collections and small limits are scanned with a single cursor.
+	*/
+	bool split_query_ranges(mongoc_collection_t* collection, const FetchQuery& query, std::vector<bson_value_t>& bounds)
+	{
+		if (scan_thread_count(query, MAX_FETCH_THREADS) < 2)
+			return false;
+
+		if (is_sorted_query(query))
+			return false;
+
+		if (query.limit > 0 && query.skip + query.limit < MIN_RANGE_DOCUMENTS)
+			return false;
+
+		bson_t empty;
+		bson_error_t count_error;
+		bson_init(&empty);
+		auto count = mongoc_collection_count(collection, MONGOC_QUERY_NONE, &empty, 0, 0, nullptr, &count_error);
+		bson_destroy(&empty);
+		if (count < (int64_t)MIN_RANGE_DOCUMENTS)
+			return false;
+
+		std::string error;
+		if (!split_id_ranges(collection, scan_thread_count(query, MAX_FETCH_THREADS), bounds, error))
+		{
+			fprintf(stderr, "Could not split _id ranges, scanning with one cursor: %s\n", error.c_str());
+			return false;
+		}
+
+		return !bounds.empty();
+	}
+
+	/**
+	* Hands the rows of parts scanned in parallel (_id ranges or session batches) over in part order, applying skip and
+	* limit to the merged rows. The first unfinished part streams straight to the sink, later parts are held until every
+	* part before them has finished. Once skip + limit rows are out, full is set so the remaining cursors stop.
+	*/
+	struct OrderedParts
+	{
+		ChunkSink& sink;
+		const FetchQuery& query;
+		std::mutex mutex;
+		std::vector<std::deque<std::vector<Column>>> held; // Rows of parts waiting for the parts before them
+		std::vector<uint8_t> finished;
+		size_t head = 0;                                    // First part that has not finished
+		uint64_t row = 0;                                   // Merged rows so far, skipped ones included
+		uint64_t end_row;
+		std::vector<Column> chunk;
+		size_t chunk_documents = 0;
+		std::atomic<bool> full{ false };
+
+		OrderedParts(ChunkSink& sink, size_t part_count)
+			: sink(sink), query(sink.request->query), held(part_count), finished(part_count, 0),
+			end_row(query.limit > 0 ? query.skip + query.limit : UINT64_MAX)
+		{
+			init_columns(query, chunk);
+		}
+
+		/**
+		* Add rows read by the cursor of a part, moved out of columns.
+		*/
+		void add(size_t part, std::vector<Column>& columns)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (part == head)
+				emit(columns);
+			else
+				held[part].push_back(std::move(columns));
+		}
+
+		/**
+		* Mark a part as read to the end, releasing the held rows of the parts after it.
+		*/
+		void finish(size_t part)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished[part] = 1;
+			while (head < finished.size() && finished[head])
+			{
+				++head;
+				if (head < held.size())
+				{
+					for (auto& columns : held[head])
+						emit(columns);
+					std::deque<std::vector<Column>>().swap(held[head]);
+				}
+			}
+		}
+
+		/**
+		* Push the last partial chunk once every part has finished.
+		*/
+		void flush()
+		{
+			if (chunk_documents > 0)
+				sink.push(chunk);
+			chunk_documents = 0;
+		}
+
+	private:
+		void emit(std::vector<Column>& columns)
+		{
+			uint64_t rows = columns.empty() ? 0 : columns[0].size;
+			auto first = query.skip > row ? query.skip - row : 0;
+			auto last = end_row - row < rows ? end_row - row : rows;
+			row += rows;
+
+			while (first < last)
+			{
+				auto count = last - first < query.chunk_size - chunk_documents ? (size_t)(last - first) : query.chunk_size - chunk_documents;
+				for (auto i = 0; i < columns.size(); ++i)
+					append_rows(chunk[i], view_column(columns[i]), (size_t)first, (size_t)first + count);
+
+				first += count;
+				chunk_documents += count;
+				if (chunk_documents >= query.chunk_size)
+				{
+					sink.push(chunk);
+					init_columns(query, chunk);
+					chunk_documents = 0;
+				}
+			}
+
+			if (row >= end_row)
+				full = true;
+		}
+	};
+
+	/**
+	* Scan part_count parts of a query with parallel cursors, each thread with its own client from the pool.
+	* build_part writes the filter and options of a part, every part fetching up to skip + limit documents.
+	* Rows are handed over in part order as soon as the parts before them are done, see OrderedParts.
+	* Returns false if any part failed or the request was cancelled.
+	*/
+	bool scan_ordered_parts(ChunkSink& sink, size_t part_count, const std::function<void(size_t, bson_t*, bson_t*)>& build_part)
+	{
+		auto request = sink.request;
+		const auto& query = request->query;
+
+		OrderedParts parts(sink, part_count);
+		std::atomic<size_t> next_part{ 0 };
+		std::atomic<bool> failed{ false };
+
+		run_on_threads(scan_thread_count(query, part_count), [&]() {
+			auto part_client = mongoc_client_pool_pop(request->pool);
+			auto part_collection = mongoc_client_get_collection(part_client, request->database_name.c_str(), query.collection.c_str());
+
+			for (auto part = next_part++; part < part_count && !failed && !parts.full && !request->cancelled; part = next_part++)
+			{
+				auto opts = new_arena_bson(request->arena);
+				auto filter = new_arena_bson(request->arena);
+				build_part(part, filter, opts);
+
+				std::vector<Column> columns;
+				init_columns(query, columns);
+				DocumentDecoder decoder(query);
+				size_t chunk_documents = 0;
+
+				const bson_t* doc = nullptr;
+				bson_error_t error;
+
+				StageClock cursor_clock, decode_clock;
+				uint64_t bytes = 0, documents = 0;
+
+				auto cursor = mongoc_collection_find_with_opts(part_collection, filter, opts, NULL);
+				for (;;)
+				{
+					cursor_clock.begin();
+					auto has_document = !request->cancelled && !parts.full && mongoc_cursor_next(cursor, &doc);
+					cursor_clock.end();
+					if (!has_document)
+						break;
+
+					request->bytes_received += doc->len;
+					++request->documents_scanned;
+					bytes += doc->len;
+					++documents;
+
+					decode_clock.begin();
+					decoder.read(doc, columns);
+					decode_clock.end();
+
+					if (++chunk_documents >= query.chunk_size)
+					{
+						parts.add(part, columns);
+						init_columns(query, columns);
+						chunk_documents = 0;
+					}
+				}
+
+				cursor_clock.record("fetch.cursor", bytes, documents);
+				decode_clock.record("fetch.decode", 0, documents);
+
+				if (mongoc_cursor_error(cursor, &error))
+				{
+					sink.fail(error.message);
+					failed = true;
+				}
+				else
+				{
+					if (chunk_documents > 0)
+						parts.add(part, columns);
+					parts.finish(part);
+				}
+
+				// Destroying the cursor also kills it on the server once the rows are complete or the request was cancelled
+				mongoc_cursor_destroy(cursor);
+				bson_destroy(opts);
+				bson_destroy(filter);
+			}
+
+			mongoc_collection_destroy(part_collection);
+			mongoc_client_pool_push(request->pool, part_client);
+		});
+
+		if (failed || request->cancelled)
+			return false;
+
+		parts.flush();
+		return true;
+	}
+
+	/**
+	* Scan disjoint _id ranges with parallel cursors, merged in range order.
+	* Returns false if any range failed or the request was cancelled.
+	*/
+	bool scan_id_ranges(ChunkSink& sink, const std::vector<bson_value_t>& bounds)
+	{
+		const auto& query = sink.request->query;
+		return scan_ordered_parts(sink, bounds.size() + 1, [&](size_t range, bson_t* filter, bson_t* opts) {
+			// Batch 0 holds every session id when there is a single batch, and leaves skip to the merge
+			build_fetch_query(query, filter, opts, 0);
+			append_id_range(filter, bounds, range);
+		});
+	}
+
+	/**
+	* Scan the session batches of an unsorted query with parallel cursors, merged in batch order so that skip
+	* and limit always select the same rows.
+	* Returns false if any batch failed or the request was cancelled.
+	*/
+	bool scan_session_batches(ChunkSink& sink)
+	{
+		const auto& query = sink.request->query;
+		return scan_ordered_parts(sink, session_batch_count(query), [&](size_t batch, bson_t* filter, bson_t* opts) {
+			build_fetch_query(query, filter, opts, batch);
+		});
+	}
+
+	bool has_session(const ColumnView& session_ids, size_t row, const std::unordered_set<std::string>& sessions)
+	{
+		if (session_ids.type != COLUMN_TYPE_STRING || (session_ids.validity[row >> 3] & (1 << (row & 7))) == 0)
+			return false;
+
+		auto str = static_cast<const char*>(session_ids.data) + session_ids.offsets[row];
+		return sessions.count(std::string(str, session_ids.offsets[row + 1] - session_ids.offsets[row])) > 0;
+	}
+
+	/**
+	* Read the rows of a request from its snapshot file, keeping the rows of the requested sessions.
+	* Rows come back in the order they were exported, skip and limit apply to the kept rows.
+	* Returns false if a chunk is corrupt or the request was cancelled.
+	*/
+	bool scan_snapshot(ChunkSink& sink)
+	{
+		auto request = sink.request;
+		const auto& query = request->query;
+		const auto& snapshot = *request->snapshot;
+
+		// A snapshot holds the sessions of the level it was exported for, if it was exported for one
+		if (!query.level_key.empty() && !snapshot.info.sessions_ids.empty())
+		{
+			request->query.filter_sessions = true;
+			request->query.sessions_ids = snapshot.info.sessions_ids;
+		}
+
+		// The session filter reads the session_id column, viewed after the requested fields
+		auto fields = query.fields;
+		std::unordered_set<std::string> sessions;
+		if (query.filter_sessions)
+		{
+			sessions.insert(query.sessions_ids.begin(), query.sessions_ids.end());
+			fields.push_back("session_id");
+		}
+
+		std::vector<Column> columns;
+		init_columns(query, columns);
+		size_t chunk_documents = 0;
+
+		auto end_row = query.limit > 0 ? query.skip + query.limit : UINT64_MAX;
+		uint64_t accepted = 0;
+
+		StageClock read_clock;
+		uint64_t documents = 0;
+
+		for (size_t chunk = 0; chunk < snapshot.chunks.size() && accepted < end_row && !request->cancelled; ++chunk)
+		{
+			read_clock.begin();
+
+			// Decompressed blocks only live while their chunk is read
+			std::deque<std::vector<uint8_t>> buffers;
+			std::vector<ColumnView> views;
+			if (!view_snapshot_chunk(snapshot, chunk, fields, views, buffers))
+			{
+				sink.fail("Corrupt snapshot chunk");
+				return false;
+			}
+
+			auto rows = snapshot.chunks[chunk].rows;
+			request->documents_scanned += rows;
+			documents += rows;
+
+			size_t row = 0;
+			while (row < rows && accepted < end_row)
+			{
+				if (query.filter_sessions && !has_session(views.back(), row, sessions))
+				{
+					++row;
+					continue;
+				}
+
+				if (accepted < query.skip)
+				{
+					++accepted;
+					++row;
+					continue;
+				}
+
+				// Extend the run of kept rows as far as the chunk size and the limit allow, and append it at once
+				auto first = row++;
+				++accepted;
+				while (row < rows && accepted < end_row && chunk_documents + (row - first) < query.chunk_size &&
+					(!query.filter_sessions || has_session(views.back(), row, sessions)))
+				{
+					++row;
+					++accepted;
+				}
+
+				for (size_t i = 0; i < columns.size(); ++i)
+					append_rows(columns[i], views[i], first, row);
+
+				chunk_documents += row - first;
+				if (chunk_documents >= query.chunk_size)
+				{
+					sink.push(columns);
+					init_columns(query, columns);
+					chunk_documents = 0;
+				}
+			}
+
+			read_clock.end();
+		}
+
+		read_clock.record("fetch.snapshot", 0, documents);
+
+		if (request->cancelled)
+			return false;
+
+		if (chunk_documents > 0)
+			sink.push(columns);
+		return true;
+	}
+
+	void run_fetch_request(FetchRequest* request)
+	{
+		ScopedTimer timer("fetch.request");
+		const auto& query = request->query;
+
+		if (request->snapshot != nullptr)
+		{
+			QueryCacheWriter no_cache;
+			ChunkSink sink;
+			sink.request = request;
+			sink.cache_writer = &no_cache;
+			scan_snapshot(sink);
+
+			timer.documents = request->documents_scanned;
+			request->finished = true;
+			return;
+		}
+
+		auto worker_client = mongoc_client_pool_pop(request->pool);
+
+		// The level is joined to its sessions here, the ids never go through the viewer
+		std::string join_error;
+		if (!resolve_level_sessions(worker_client, request->database_name.c_str(), request->query, join_error))
+		{
+			mongoc_client_pool_push(request->pool, worker_client);
+			{
+				std::lock_guard<std::mutex> lock(request->mutex);
+				request->error = join_error;
+			}
+			request->finished = true;
+			return;
+		}
+
+		auto worker_collection = mongoc_client_get_collection(worker_client, request->database_name.c_str(), query.collection.c_str());
+
+		// Filters and options of every cursor of the request are built in its arena
+		request->arena.clear_stats();
+		auto opts = new_arena_bson(request->arena);
+		auto filter = new_arena_bson(request->arena);
+
+		// The whole query, also used as the cache key when it is split into session batches or _id ranges
+		build_fetch_query(query, filter, opts);
+
+		// Serve repeated queries from the on-disk cache while the collection is unchanged
+		QueryCacheWriter cache_writer;
+		CollectionStamp stamp;
+		if (query_cache_enabled() && read_collection_stamp(worker_collection, stamp))
+		{
+			auto fingerprint = query_fingerprint(request->database_name.c_str(), query.collection.c_str(), filter, opts, query.position_parser);
+			auto cached = open_cached_result(fingerprint, stamp);
+			if (cached != nullptr)
+			{
+				request->documents_scanned = cached->rows;
+
+				std::lock_guard<std::mutex> lock(request->mutex);
+				request->cached = cached;
+			}
+			else
+			{
+				cache_writer.begin(fingerprint, stamp);
+			}
+		}
+
+		if (request->cached == nullptr)
+		{
+			ChunkSink sink;
+			sink.request = request;
+			sink.cache_writer = &cache_writer;
+
+			bool complete;
+			std::vector<bson_value_t> bounds;
+			if (session_batch_count(query) > 1 && is_sorted_query(query))
+			{
+				complete = scan_sorted_session_batches(sink, worker_collection);
+			}
+			else if (session_batch_count(query) > 1)
+			{
+				complete = scan_session_batches(sink);
+			}
+			else if (split_query_ranges(worker_collection, query, bounds))
+			{
+				complete = scan_id_ranges(sink, bounds);
+			}
+			else
+			{
+				auto cursor = mongoc_collection_find_with_opts(worker_collection, filter, opts, NULL);
+				complete = scan_cursor(sink, cursor, false);
+
+				// Destroying the cursor also kills it on the server if the request was cancelled
+				mongoc_cursor_destroy(cursor);
+			}
+			destroy_id_bounds(bounds);
+
+			if (complete)
+				cache_writer.commit();
+			else
+				cache_writer.abort();
+		}
+
+		bson_destroy(opts);
+		bson_destroy(filter);
+		mongoc_collection_destroy(worker_collection);
+		mongoc_client_pool_push(request->pool, worker_client);
+
+		timer.bytes = request->bytes_received;
+		timer.documents = request->documents_scanned;
+		request->allocations = request->arena.stats();
+		request->arena.reset();
+
+		request->finished = true;
+	}
+
+	unsigned launch_fetch_request(std::unique_ptr<FetchRequest> request)
+	{
+		request->handle = next_fetch_handle++;
+		if (request->query.chunk_size == 0)
+			request->query.chunk_size = 1;
+
+		request->worker = std::thread(run_fetch_request, request.get());
+
+		fetch_requests.push_back(std::move(request));
+		return fetch_requests.back()->handle;
+	}
+
+	unsigned start_fetch_request(const FetchQuery& query, mongoc_client_pool_t* pool, const char* database_name)
+	{
+		if (pool == nullptr || database_name == nullptr)
+			return 0;
+
+		std::unique_ptr<FetchRequest> request(new FetchRequest());
+		request->query = query;
+		request->pool = pool;
+		request->database_name = database_name;
+		return launch_fetch_request(std::move(request));
+	}
+
+	unsigned start_snapshot_fetch_request(const FetchQuery& query, const std::shared_ptr<Snapshot>& snapshot)
+	{
+		if (snapshot == nullptr)
+			return 0;
+
+		std::unique_ptr<FetchRequest> request(new FetchRequest());
+		request->query = query;
+		request->snapshot = snapshot;
+		return launch_fetch_request(std::move(request));
+	}
+
+	FetchRequest* find_fetch_request(unsigned handle)
+	{
+		for (auto& request : fetch_requests)
+		{
+			if (request->handle == handle)
+				return request.get();
+		}
+		return nullptr;
+	}
+
+	bool pop_fetch_chunk(FetchRequest* request, std::vector<Column>& columns)
+	{
+		std::lock_guard<std::mutex> lock(request->mutex);
+
+		if (request->chunks.empty())
+			return false;
+
+		columns = std::move(request->chunks.front());
+		request->chunks.pop_front();
+		return true;
+	}
+
+	bool cancel_fetch_request(unsigned handle)
+	{
+		auto request = find_fetch_request(handle);
+		if (request == nullptr)
+			return false;
+
+		request->cancelled = true;
+
+		std::lock_guard<std::mutex> lock(request->mutex);
+		request->chunks.clear();
+		request->cached.reset();
+		return true;
+	}
+
+	void release_fetch_request(unsigned handle)
+	{
+		for (auto it = fetch_requests.begin(); it != fetch_requests.end(); ++it)
+		{
+			auto& request = *it;
+			if (request->handle != handle)
+				continue;
+
+			request->cancelled = true;
+			if (request->worker.joinable())
+				request->worker.join();
+
+			fetch_requests.erase(it);
+			return;
+		}
+	}
+
+	void shutdown_fetch_requests()
+	{
+		for (auto& request : fetch_requests)
+			request->cancelled = true;
+
+		for (auto& request : fetch_requests)
+		{
+			if (request->worker.joinable())
+				request->worker.join();
+		}
+
+		fetch_requests.clear();
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "fetch_query.h"
+#include "query_arena.h"
+#include "query_cache.h"
+#include "snapshot_file.h"
+
+#include <mongoc.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* A document fetch running on a worker thread.
+	* The worker and its parallel cursors take clients from the pool and hand results over in chunks of packed columns.
+	*/
+	struct FetchRequest
+	{
+		unsigned handle = 0;
+		FetchQuery query;
+		mongoc_client_pool_t* pool = nullptr;
+		std::string database_name;
+		std::shared_ptr<Snapshot> snapshot; // Set to read the rows from a snapshot file instead of the server
+
+		std::thread worker;
+		std::atomic<bool> cancelled{ false };
+		std::atomic<bool> finished{ false };
+		std::atomic<uint64_t> documents_scanned{ 0 };
+		std::atomic<uint64_t> bytes_received{ 0 };
+
+		std::mutex mutex; // Guards chunks, cached and error
+		std::deque<std::vector<Column>> chunks;
+		std::shared_ptr<CachedResult> cached; // Set instead of chunks when the query cache had a fresh result
+		std::string error;
+
+		QueryArena arena; // BSON filters and options of every cursor, reset once the request finished
+		ArenaStats allocations; // Arena allocations of the finished request
+
+		uint64_t reported_documents = 0; // Last progress sent to the viewer, only touched on the UI thread
+		size_t cached_chunk = 0; // Next cached chunk to deliver, only touched on the UI thread
+	};
+
+	/**
+	* Start fetching documents on a worker thread.
+	* Returns the request handle, 0 if the request could not be started.
+	*/
+	unsigned start_fetch_request(const FetchQuery& query, mongoc_client_pool_t* pool, const char* database_name);
+
+	/**
+	* Start reading documents from a snapshot file on a worker thread, the way start_fetch_request reads them from a collection.
+	* Returns the request handle, 0 if the request could not be started.
+	*/
+	unsigned start_snapshot_fetch_request(const FetchQuery& query, const std::shared_ptr<Snapshot>& snapshot);
+
+	/**
+	* Serve a request from the cache or scan it on the calling thread, the chunks are ready once it returns.
+	* Used by the synchronous fetch, start_fetch_request runs it on a worker.
+	*/
+	void run_fetch_request(FetchRequest* request);
+
+	/**
+	* Return the request for a handle, nullptr if it does not exist or has been released.
+	*/
+	FetchRequest* find_fetch_request(unsigned handle);
+
+	/**
+	* Move the oldest finished chunk out of a request.
+	* Returns false if no chunk is ready.
+	*/
+	bool pop_fetch_chunk(FetchRequest* request, std::vector<Column>& columns);
+
+	/**
+	* Ask the worker to stop reading from the cursor. Chunks that are not yet delivered are dropped.
+	*/
+	bool cancel_fetch_request(unsigned handle);
+
+	/**
+	* Cancel if needed, wait for the worker and forget the request.
+	*/
+	void release_fetch_request(unsigned handle);
+
+	/**
+	* Cancel and release all requests, used when the plugin is unloaded.
+	*/
+	void shutdown_fetch_requests();
+
+	/**
+	* Run body on thread_count threads, the calling thread being one of them, and wait for all of them.
+	*/
+	void run_on_threads(unsigned thread_count, const std::function<void()>& body);
+}
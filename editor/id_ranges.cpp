@@ -0,0 +1,96 @@
+#include "id_ranges.h"
+
+namespace PLUGIN_NAMESPACE
+{
+	bool split_id_ranges(mongoc_collection_t* collection, unsigned range_count, std::vector<bson_value_t>& bounds, std::string& error)
+	{
+		bson_t pipeline, stages, stage, options;
+		bson_error_t bson_error;
+		const bson_t* doc = nullptr;
+
+		bounds.clear();
+		if (range_count < 2)
+			return true;
+
+		// [{ $sample: { size } }, { $project: { _id: 1 } }, { $sort: { _id: 1 } }], sorted by the server so mixed _id types keep BSON order
+		bson_init(&pipeline);
+		BSON_APPEND_ARRAY_BEGIN(&pipeline, "pipeline", &stages);
+
+		BSON_APPEND_DOCUMENT_BEGIN(&stages, "0", &stage);
+		BSON_APPEND_DOCUMENT_BEGIN(&stage, "$sample", &options);
+		BSON_APPEND_INT64(&options, "size", (int64_t)range_count * RANGE_SAMPLES);
+		bson_append_document_end(&stage, &options);
+		bson_append_document_end(&stages, &stage);
+
+		BSON_APPEND_DOCUMENT_BEGIN(&stages, "1", &stage);
+		BSON_APPEND_DOCUMENT_BEGIN(&stage, "$project", &options);
+		BSON_APPEND_INT32(&options, "_id", 1);
+		bson_append_document_end(&stage, &options);
+		bson_append_document_end(&stages, &stage);
+
+		BSON_APPEND_DOCUMENT_BEGIN(&stages, "2", &stage);
+		BSON_APPEND_DOCUMENT_BEGIN(&stage, "$sort", &options);
+		BSON_APPEND_INT32(&options, "_id", 1);
+		bson_append_document_end(&stage, &options);
+		bson_append_document_end(&stages, &stage);
+
+		bson_append_array_end(&pipeline, &stages);
+
+		std::vector<bson_value_t> samples;
+		auto cursor = mongoc_collection_aggregate(collection, MONGOC_QUERY_NONE, &pipeline, NULL, NULL);
+		while (mongoc_cursor_next(cursor, &doc))
+		{
+			bson_iter_t iter;
+			if (!bson_iter_init_find(&iter, doc, "_id"))
+				continue;
+
+			bson_value_t id;
+			bson_value_copy(bson_iter_value(&iter), &id);
+			samples.push_back(id);
+		}
+
+		auto ok = !mongoc_cursor_error(cursor, &bson_error);
+		if (!ok)
+			error = bson_error.message;
+
+		mongoc_cursor_destroy(cursor);
+		bson_destroy(&pipeline);
+
+		// Every range_count-th quantile of the sample, equal bounds only leave some ranges empty
+		if (ok && samples.size() >= range_count)
+		{
+			for (unsigned i = 1; i < range_count; ++i)
+			{
+				auto& sample = samples[i * samples.size() / range_count];
+				bson_value_t bound;
+				bson_value_copy(&sample, &bound);
+				bounds.push_back(bound);
+			}
+		}
+
+		destroy_id_bounds(samples);
+		return ok;
+	}
+
+	void append_id_range(bson_t* filter, const std::vector<bson_value_t>& bounds, size_t range)
+	{
+		bson_t id;
+
+		if (bounds.empty())
+			return;
+
+		BSON_APPEND_DOCUMENT_BEGIN(filter, "_id", &id);
+		if (range > 0)
+			bson_append_value(&id, "$gte", -1, &bounds[range - 1]);
+		if (range < bounds.size())
+			bson_append_value(&id, "$lt", -1, &bounds[range]);
+		bson_append_document_end(filter, &id);
+	}
+
+	void destroy_id_bounds(std::vector<bson_value_t>& bounds)
+	{
+		for (auto& bound : bounds)
+			bson_value_destroy(&bound);
+		bounds.clear();
+	}
+}
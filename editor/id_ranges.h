@@ -0,0 +1,36 @@
+#pragma once
+
+#include <mongoc.h>
+#include <bson.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Collections with fewer documents are scanned with a single cursor.
+	*/
+	const uint64_t MIN_RANGE_DOCUMENTS = 100000;
+
+	/**
+	* Sampled _ids per range when looking for split points, more samples give more even ranges.
+	*/
+	const unsigned RANGE_SAMPLES = 32;
+
+	/**
+	* Split the _id space of a collection into range_count ranges of about the same number of documents.
+	* Returns the range_count - 1 ascending split points from a $sample of the collection,
+	* release them with destroy_id_bounds.
+	*/
+	bool split_id_ranges(mongoc_collection_t* collection, unsigned range_count, std::vector<bson_value_t>& bounds, std::string& error);
+
+	/**
+	* Append { _id: { $gte: bounds[range - 1], $lt: bounds[range] } } to a filter. The first and last ranges are open ended,
+	* so the ranges cover every document even if it was inserted after the split.
+	*/
+	void append_id_range(bson_t* filter, const std::vector<bson_value_t>& bounds, size_t range);
+
+	void destroy_id_bounds(std::vector<bson_value_t>& bounds);
+}
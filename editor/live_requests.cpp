@@ -0,0 +1,266 @@
+#include "live_requests.h"
+#include "document_decoder.h"
+
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	// Requests are only started, polled and stopped from the UI thread.
+	std::vector<std::unique_ptr<LiveRequest>> live_requests;
+	unsigned next_live_handle = 1;
+
+	/**
+	* Append the clauses of a filter to match with their field paths moved under fullDocument.
+	* The clauses of $and, $or and $nor are rewritten the same way, other operators are copied as they are.
+	*/
+	void append_full_document_filter(bson_iter_t* iter, bson_t* match)
+	{
+		while (bson_iter_next(iter))
+		{
+			auto key = bson_iter_key(iter);
+			auto is_logical = strcmp(key, "$and") == 0 || strcmp(key, "$or") == 0 || strcmp(key, "$nor") == 0;
+			if (is_logical && BSON_ITER_HOLDS_ARRAY(iter))
+			{
+				bson_t clauses, clause;
+				bson_iter_t clauses_iter, clause_iter;
+				bson_append_array_begin(match, key, -1, &clauses);
+				bson_iter_recurse(iter, &clauses_iter);
+				while (bson_iter_next(&clauses_iter))
+				{
+					if (BSON_ITER_HOLDS_DOCUMENT(&clauses_iter) && bson_iter_recurse(&clauses_iter, &clause_iter))
+					{
+						bson_append_document_begin(&clauses, bson_iter_key(&clauses_iter), -1, &clause);
+						append_full_document_filter(&clause_iter, &clause);
+						bson_append_document_end(&clauses, &clause);
+					}
+					else
+						bson_append_iter(&clauses, bson_iter_key(&clauses_iter), -1, &clauses_iter);
+				}
+				bson_append_array_end(match, &clauses);
+			}
+			else if (key[0] == '$')
+				bson_append_iter(match, key, -1, iter);
+			else
+			{
+				auto path = std::string("fullDocument.") + key;
+				bson_append_iter(match, path.c_str(), (int)path.size(), iter);
+			}
+		}
+	}
+
+	/**
+	* Build [{ $match: { operationType: "insert", fullDocument.<filter> } }, { $project: { fullDocument.<field>: 1 } }].
+	* The filter of the query applies to the inserted document, see append_full_document_filter.
+	* Without fields the whole inserted document is kept and there is no $project stage.
+	*/
+	void build_live_pipeline(const FetchQuery& query, bson_t* pipeline)
+	{
+		bson_t filter, opts, stages, stage, match, project;
+		bson_iter_t iter;
+
+		bson_init(&filter);
+		bson_init(&opts);
+		build_fetch_query(query, &filter, &opts);
+
+		BSON_APPEND_ARRAY_BEGIN(pipeline, "pipeline", &stages);
+
+		BSON_APPEND_DOCUMENT_BEGIN(&stages, "0", &stage);
+		BSON_APPEND_DOCUMENT_BEGIN(&stage, "$match", &match);
+		BSON_APPEND_UTF8(&match, "operationType", "insert");
+		if (bson_iter_init(&iter, &filter))
+			append_full_document_filter(&iter, &match);
+		bson_append_document_end(&stage, &match);
+		bson_append_document_end(&stages, &stage);
+
+		// The _id of a change is its resume token and is kept
+		if (!query.fields.empty())
+		{
+			BSON_APPEND_DOCUMENT_BEGIN(&stages, "1", &stage);
+			BSON_APPEND_DOCUMENT_BEGIN(&stage, "$project", &project);
+			for (auto& field : query.fields)
+			{
+				auto key = "fullDocument." + field;
+				bson_append_int32(&project, key.c_str(), (int)key.size(), 1);
+			}
+			bson_append_document_end(&stage, &project);
+			bson_append_document_end(&stages, &stage);
+		}
+
+		bson_append_array_end(pipeline, &stages);
+
+		bson_destroy(&opts);
+		bson_destroy(&filter);
+	}
+
+	void push_live_batch(LiveRequest* request, std::vector<Column>& columns)
+	{
+		std::lock_guard<std::mutex> lock(request->mutex);
+
+		// The viewer is not keeping up, drop the oldest batch
+		if (request->batches.size() >= MAX_LIVE_BATCHES)
+		{
+			auto& oldest = request->batches.front();
+			request->documents_dropped += oldest.empty() ? 0 : oldest[0].size;
+			request->batches.pop_front();
+		}
+
+		request->batches.push_back(std::move(columns));
+	}
+
+	/**
+	* Worker thread body. Waits on the change stream at most one flush interval at a time,
+	* so new documents are handed over on time and stopping never takes longer than an interval.
+	*/
+	void run_live_request(LiveRequest* request)
+	{
+		const auto& query = request->query;
+		auto flush_interval = std::chrono::milliseconds(query.flush_interval_ms);
+
+		auto worker_client = mongoc_client_pool_pop(request->pool);
+		auto worker_collection = mongoc_client_get_collection(worker_client, request->database_name.c_str(), query.collection.c_str());
+
+		bson_t pipeline, opts;
+		bson_init(&pipeline);
+		bson_init(&opts);
+		build_live_pipeline(query, &pipeline);
+		BSON_APPEND_INT64(&opts, "maxAwaitTimeMS", query.flush_interval_ms);
+
+		auto stream = mongoc_collection_watch(worker_collection, &pipeline, &opts);
+
+		std::vector<Column> columns;
+		init_columns(query, columns);
+		DocumentDecoder decoder(query);
+		size_t batch_documents = 0;
+		auto last_flush = std::chrono::steady_clock::now();
+
+		while (!request->stopped)
+		{
+			const bson_t* change = nullptr;
+			if (mongoc_change_stream_next(stream, &change))
+			{
+				bson_iter_t iter;
+				uint32_t length = 0;
+				const uint8_t* data = nullptr;
+				bson_t document;
+
+				if (bson_iter_init_find(&iter, change, "fullDocument") && BSON_ITER_HOLDS_DOCUMENT(&iter))
+				{
+					bson_iter_document(&iter, &length, &data);
+					if (bson_init_static(&document, data, length))
+					{
+						decoder.read(&document, columns);
+						++batch_documents;
+						++request->documents_received;
+					}
+				}
+			}
+			else
+			{
+				const bson_t* reply = nullptr;
+				bson_error_t error;
+				if (mongoc_change_stream_error_document(stream, &error, &reply))
+				{
+					std::lock_guard<std::mutex> lock(request->mutex);
+					request->error = error.message;
+					break;
+				}
+			}
+
+			auto now = std::chrono::steady_clock::now();
+			if (batch_documents > 0 && now - last_flush >= flush_interval)
+			{
+				push_live_batch(request, columns);
+				init_columns(query, columns);
+				batch_documents = 0;
+				last_flush = now;
+			}
+		}
+
+		if (batch_documents > 0 && !request->stopped)
+			push_live_batch(request, columns);
+
+		mongoc_change_stream_destroy(stream);
+		bson_destroy(&opts);
+		bson_destroy(&pipeline);
+		mongoc_collection_destroy(worker_collection);
+		mongoc_client_pool_push(request->pool, worker_client);
+
+		request->finished = true;
+	}
+
+	unsigned start_live_request(const FetchQuery& query, mongoc_client_pool_t* pool, const char* database_name)
+	{
+		if (pool == nullptr || database_name == nullptr)
+			return 0;
+
+		std::unique_ptr<LiveRequest> request(new LiveRequest());
+		request->handle = next_live_handle++;
+		request->query = query;
+		request->pool = pool;
+		request->database_name = database_name;
+
+		if (request->query.flush_interval_ms == 0)
+			request->query.flush_interval_ms = 1;
+
+		request->worker = std::thread(run_live_request, request.get());
+
+		live_requests.push_back(std::move(request));
+		return live_requests.back()->handle;
+	}
+
+	LiveRequest* find_live_request(unsigned handle)
+	{
+		for (auto& request : live_requests)
+		{
+			if (request->handle == handle)
+				return request.get();
+		}
+		return nullptr;
+	}
+
+	bool pop_live_batch(LiveRequest* request, std::vector<Column>& columns)
+	{
+		std::lock_guard<std::mutex> lock(request->mutex);
+
+		if (request->batches.empty())
+			return false;
+
+		columns = std::move(request->batches.front());
+		request->batches.pop_front();
+		return true;
+	}
+
+	void stop_live_request(unsigned handle)
+	{
+		for (auto it = live_requests.begin(); it != live_requests.end(); ++it)
+		{
+			auto& request = *it;
+			if (request->handle != handle)
+				continue;
+
+			request->stopped = true;
+			if (request->worker.joinable())
+				request->worker.join();
+
+			live_requests.erase(it);
+			return;
+		}
+	}
+
+	void shutdown_live_requests()
+	{
+		for (auto& request : live_requests)
+			request->stopped = true;
+
+		for (auto& request : live_requests)
+		{
+			if (request->worker.joinable())
+				request->worker.join();
+		}
+
+		live_requests.clear();
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "fetch_query.h"
+
+#include <mongoc.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Batches waiting for the viewer before the oldest ones are dropped.
+	*/
+	const size_t MAX_LIVE_BATCHES = 64;
+
+	/**
+	* A change stream on a collection, run on a worker thread.
+	* Inserted documents that match the query are read into columns and handed over in batches once per flush interval.
+	*/
+	struct LiveRequest
+	{
+		unsigned handle = 0;
+		FetchQuery query;
+		mongoc_client_pool_t* pool = nullptr;
+		std::string database_name;
+
+		std::thread worker;
+		std::atomic<bool> stopped{ false };
+		std::atomic<bool> finished{ false };
+		std::atomic<uint64_t> documents_received{ 0 };
+		std::atomic<uint64_t> documents_dropped{ 0 };
+
+		std::mutex mutex; // Guards batches and error
+		std::deque<std::vector<Column>> batches;
+		std::string error;
+	};
+
+	/**
+	* Start watching a collection for inserted documents on a worker thread.
+	* Returns the request handle, 0 if the request could not be started.
+	*/
+	unsigned start_live_request(const FetchQuery& query, mongoc_client_pool_t* pool, const char* database_name);
+
+	/**
+	* Return the live request for a handle, nullptr if it does not exist or has been stopped.
+	*/
+	LiveRequest* find_live_request(unsigned handle);
+
+	/**
+	* Move the oldest batch out of a live request.
+	* Returns false if no batch is ready.
+	*/
+	bool pop_live_batch(LiveRequest* request, std::vector<Column>& columns);
+
+	/**
+	* Close the change stream, wait for the worker and forget the request.
+	*/
+	void stop_live_request(unsigned handle);
+
+	/**
+	* Stop all live requests, used when the server changes or the plugin is unloaded.
+	*/
+	void shutdown_live_requests();
+}
@@ -0,0 +1,292 @@
+#include "mapped_file.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#include <sys/utime.h>
+#else
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#include <utime.h>
+#endif
+
+namespace PLUGIN_NAMESPACE
+{
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+#ifdef _WIN32
+	bool MappedFile::open(const std::string& path)
+	{
+		close();
+
+		auto handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0)
+		{
+			CloseHandle(handle);
+			return false;
+		}
+
+		auto map = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		auto view = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (view == nullptr)
+		{
+			if (map)
+				CloseHandle(map);
+			CloseHandle(handle);
+			return false;
+		}
+
+		file = handle;
+		mapping = map;
+		data = static_cast<const uint8_t*>(view);
+		size = (size_t)file_size.QuadPart;
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		if (data != nullptr)
+			UnmapViewOfFile(data);
+		if (mapping != nullptr)
+			CloseHandle(mapping);
+		if (file != nullptr)
+			CloseHandle(file);
+
+		data = nullptr;
+		size = 0;
+		mapping = file = nullptr;
+	}
+
+	bool SharedMemory::create(const std::string& shared_name, size_t shared_size)
+	{
+		close();
+
+		auto map = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)shared_size >> 32), (DWORD)shared_size, shared_name.c_str());
+		if (map == nullptr)
+			return false;
+		if (GetLastError() == ERROR_ALREADY_EXISTS)
+		{
+			CloseHandle(map);
+			return false;
+		}
+
+		auto view = MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, shared_size);
+		if (view == nullptr)
+		{
+			CloseHandle(map);
+			return false;
+		}
+
+		name = shared_name;
+		mapping = map;
+		data = static_cast<uint8_t*>(view);
+		size = shared_size;
+		return true;
+	}
+
+	void SharedMemory::close()
+	{
+		if (data != nullptr)
+			UnmapViewOfFile(data);
+		if (mapping != nullptr)
+			CloseHandle(mapping);
+
+		name.clear();
+		data = nullptr;
+		size = 0;
+		mapping = nullptr;
+	}
+
+	bool list_files(const std::string& directory, const char* extension, std::vector<FileInfo>& files)
+	{
+		WIN32_FIND_DATAA find_data;
+		auto pattern = directory + "\\*" + extension;
+		auto find = FindFirstFileA(pattern.c_str(), &find_data);
+		if (find == INVALID_HANDLE_VALUE)
+			return false;
+
+		do
+		{
+			if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+
+			FileInfo info;
+			info.name = find_data.cFileName;
+			info.size = ((uint64_t)find_data.nFileSizeHigh << 32) | find_data.nFileSizeLow;
+			// FILETIME is in 100 ns intervals since 1601
+			auto time = ((uint64_t)find_data.ftLastWriteTime.dwHighDateTime << 32) | find_data.ftLastWriteTime.dwLowDateTime;
+			info.modified = time / 10000000ULL - 11644473600ULL;
+			files.push_back(info);
+		} while (FindNextFileA(find, &find_data));
+
+		FindClose(find);
+		return true;
+	}
+
+	bool make_directories(const std::string& path)
+	{
+		for (size_t i = 1; i <= path.size(); ++i)
+		{
+			if (i < path.size() && path[i] != '\\' && path[i] != '/')
+				continue;
+			CreateDirectoryA(path.substr(0, i).c_str(), nullptr); // Fails for drives and existing parents
+		}
+
+		auto attributes = GetFileAttributesA(path.c_str());
+		return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+	}
+
+	bool touch_file(const std::string& path)
+	{
+		return _utime(path.c_str(), nullptr) == 0;
+	}
+
+	bool replace_file(const std::string& from, const std::string& to)
+	{
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+	}
+#else
+	bool MappedFile::open(const std::string& path)
+	{
+		close();
+
+		auto fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		auto view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd); // The mapping keeps the file alive
+		if (view == MAP_FAILED)
+			return false;
+
+		data = static_cast<const uint8_t*>(view);
+		size = (size_t)st.st_size;
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		if (data != nullptr)
+			munmap(const_cast<uint8_t*>(data), size);
+
+		data = nullptr;
+		size = 0;
+	}
+
+	bool SharedMemory::create(const std::string& shared_name, size_t shared_size)
+	{
+		close();
+
+		auto fd = shm_open(shared_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd < 0)
+			return false;
+
+		auto view = ftruncate(fd, (off_t)shared_size) == 0 ? mmap(nullptr, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+		::close(fd);
+		if (view == MAP_FAILED)
+		{
+			shm_unlink(shared_name.c_str());
+			return false;
+		}
+
+		name = shared_name;
+		data = static_cast<uint8_t*>(view);
+		size = shared_size;
+		return true;
+	}
+
+	void SharedMemory::close()
+	{
+		if (data != nullptr)
+		{
+			munmap(data, size);
+			shm_unlink(name.c_str()); // Processes that mapped it keep their mapping
+		}
+
+		name.clear();
+		data = nullptr;
+		size = 0;
+	}
+
+	bool list_files(const std::string& directory, const char* extension, std::vector<FileInfo>& files)
+	{
+		auto dir = opendir(directory.c_str());
+		if (dir == nullptr)
+			return false;
+
+		auto extension_length = strlen(extension);
+		while (auto entry = readdir(dir))
+		{
+			std::string name = entry->d_name;
+			if (name.size() < extension_length || name.compare(name.size() - extension_length, extension_length, extension) != 0)
+				continue;
+
+			struct stat st;
+			if (stat((directory + "/" + name).c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+				continue;
+
+			FileInfo info;
+			info.name = name;
+			info.size = (uint64_t)st.st_size;
+			info.modified = (uint64_t)st.st_mtime;
+			files.push_back(info);
+		}
+
+		closedir(dir);
+		return true;
+	}
+
+	bool make_directories(const std::string& path)
+	{
+		for (size_t i = 1; i <= path.size(); ++i)
+		{
+			if (i < path.size() && path[i] != '/')
+				continue;
+			mkdir(path.substr(0, i).c_str(), 0755); // Fails for existing parents
+		}
+
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+	}
+
+	bool touch_file(const std::string& path)
+	{
+		return utime(path.c_str(), nullptr) == 0;
+	}
+
+	bool replace_file(const std::string& from, const std::string& to)
+	{
+		return rename(from.c_str(), to.c_str()) == 0;
+	}
+#endif
+
+	SharedMemory::~SharedMemory()
+	{
+		close();
+	}
+
+	bool remove_file(const std::string& path)
+	{
+		return remove(path.c_str()) == 0;
+	}
+}
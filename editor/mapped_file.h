@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* A read-only memory mapping of a whole file.
+	*/
+	struct MappedFile
+	{
+		MappedFile() = default;
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		/**
+		* Map a file, returns false if it does not exist or could not be mapped.
+		*/
+		bool open(const std::string& path);
+		void close();
+
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+
+	private:
+		void* file = nullptr;
+		void* mapping = nullptr;
+	};
+
+	/**
+	* A named block of shared memory created by this process for another one to map by name,
+	* such as the engine of the viewport. It is gone once closed on both sides.
+	*/
+	struct SharedMemory
+	{
+		SharedMemory() = default;
+		~SharedMemory();
+		SharedMemory(const SharedMemory&) = delete;
+		SharedMemory& operator=(const SharedMemory&) = delete;
+
+		/**
+		* Create and map a zeroed block, returns false if the name is taken or it could not be mapped.
+		*/
+		bool create(const std::string& name, size_t size);
+		void close();
+
+		std::string name;
+		uint8_t* data = nullptr;
+		size_t size = 0;
+
+	private:
+		void* mapping = nullptr;
+	};
+
+	/**
+	* Name, size and last modification time (seconds) of a file in a directory.
+	*/
+	struct FileInfo
+	{
+		std::string name;
+		uint64_t size = 0;
+		uint64_t modified = 0;
+	};
+
+	/**
+	* List the regular files of a directory ending with extension (such as ".tvc").
+	*/
+	bool list_files(const std::string& directory, const char* extension, std::vector<FileInfo>& files);
+
+	/**
+	* Create a directory and its missing parents.
+	*/
+	bool make_directories(const std::string& path);
+
+	/**
+	* Set the modification time of a file to now.
+	*/
+	bool touch_file(const std::string& path);
+
+	bool remove_file(const std::string& path);
+
+	/**
+	* Rename a file, replacing the destination if it exists.
+	*/
+	bool replace_file(const std::string& from, const std::string& to);
+}
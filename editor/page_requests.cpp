@@ -0,0 +1,316 @@
+#include "page_requests.h"
+#include "document_decoder.h"
+#include "profiler.h"
+#include "session_filter.h"
+
+#include <atomic>
+#include <memory>
+#include <stdio.h>
+#include <thread>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* The page after the one last returned, fetched while the viewer shows the current one.
+	* Only started and taken from the UI thread, the worker owns the result until it is joined.
+	*/
+	struct PagePrefetch
+	{
+		FetchQuery query;
+		mongoc_client_pool_t* pool = nullptr;
+		std::string database_name;
+		std::thread worker;
+		std::atomic<bool> cancelled{ false };
+		PageResult result;
+	};
+
+	std::unique_ptr<PagePrefetch> page_prefetch;
+
+	/**
+	* Paths of the page key, the sorted fields followed by _id to break ties.
+	*/
+	std::vector<std::string> page_key_paths(const FetchQuery& query)
+	{
+		std::vector<std::string> paths;
+		for (auto i = 0; i < query.sort.size() && i < query.fields.size(); ++i)
+		{
+			if (query.sort[i])
+				paths.push_back(query.fields[i]);
+		}
+		paths.push_back("_id");
+		return paths;
+	}
+
+	/**
+	* $type aliases of the BSON types a sort can order, see sort_type_rank.
+	*/
+	const struct { bson_type_t type; const char* alias; } SORTED_TYPES[] = {
+		{ BSON_TYPE_DOUBLE, "double" }, { BSON_TYPE_INT32, "int" }, { BSON_TYPE_INT64, "long" }, { BSON_TYPE_DECIMAL128, "decimal" },
+		{ BSON_TYPE_UTF8, "string" }, { BSON_TYPE_DOCUMENT, "object" }, { BSON_TYPE_ARRAY, "array" }, { BSON_TYPE_BINARY, "binData" },
+		{ BSON_TYPE_OID, "objectId" }, { BSON_TYPE_BOOL, "bool" }, { BSON_TYPE_DATE_TIME, "date" }, { BSON_TYPE_TIMESTAMP, "timestamp" },
+		{ BSON_TYPE_REGEX, "regex" }, { BSON_TYPE_MAXKEY, "maxKey" }
+	};
+
+	/**
+	* Append $or: [{ path: { $gt: value } }, { path: { $type: [<types sorted after the type of value>] } }].
+	* $gt only matches values of the same type, so values of the types that sort after it are matched by type.
+	* Nothing is greater than null, which only gets the $type alternative.
+	*/
+	void append_greater_than(bson_t* clause, const std::string& path, const bson_iter_t* value)
+	{
+		bson_t alternatives, alternative, condition, types;
+		auto rank = sort_type_rank(bson_iter_type(value));
+		auto has_greater = bson_iter_type(value) != BSON_TYPE_NULL;
+
+		BSON_APPEND_ARRAY_BEGIN(clause, "$or", &alternatives);
+		if (has_greater)
+		{
+			BSON_APPEND_DOCUMENT_BEGIN(&alternatives, "0", &alternative);
+			bson_append_document_begin(&alternative, path.c_str(), (int)path.size(), &condition);
+			bson_append_iter(&condition, "$gt", 3, value);
+			bson_append_document_end(&alternative, &condition);
+			bson_append_document_end(&alternatives, &alternative);
+		}
+
+		uint32_t num_types = 0;
+		for (auto& sorted : SORTED_TYPES)
+			num_types += sort_type_rank(sorted.type) > rank ? 1 : 0;
+		if (num_types > 0)
+		{
+			BSON_APPEND_DOCUMENT_BEGIN(&alternatives, has_greater ? "1" : "0", &alternative);
+			bson_append_document_begin(&alternative, path.c_str(), (int)path.size(), &condition);
+			BSON_APPEND_ARRAY_BEGIN(&condition, "$type", &types);
+			uint32_t i = 0;
+			for (auto& sorted : SORTED_TYPES)
+			{
+				if (sort_type_rank(sorted.type) <= rank)
+					continue;
+				char index[16];
+				const char* index_key = nullptr;
+				auto index_length = bson_uint32_to_string(i++, &index_key, index, sizeof(index));
+				bson_append_utf8(&types, index_key, (int)index_length, sorted.alias, -1);
+			}
+			bson_append_array_end(&condition, &types);
+			bson_append_document_end(&alternative, &condition);
+			bson_append_document_end(&alternatives, &alternative);
+		}
+		bson_append_array_end(clause, &alternatives);
+	}
+
+	/**
+	* Append the keyset condition to a filter: documents whose key (k0, k1, ..., _id) is after the key of the token,
+	* as $or: [{ k0: { $gt: v0 } }, { k0: v0, k1: { $gt: v1 } }, ..., { k0: v0, ..., _id: { $gt: id } }].
+	* Returns false if the token does not decode to one value per key path.
+	*/
+	bool append_page_after(bson_t* filter, const std::vector<std::string>& paths, const std::string& token)
+	{
+		std::vector<uint8_t> data;
+		bson_t key;
+		if (!base64_decode(token, data) || !bson_init_static(&key, data.data(), data.size()) || bson_count_keys(&key) != paths.size())
+			return false;
+
+		bson_t clauses, clause;
+		BSON_APPEND_ARRAY_BEGIN(filter, "$or", &clauses);
+		for (uint32_t i = 0; i < paths.size(); ++i)
+		{
+			char index[16];
+			const char* index_key = nullptr;
+			auto index_length = bson_uint32_to_string(i, &index_key, index, sizeof(index));
+			bson_append_document_begin(&clauses, index_key, (int)index_length, &clause);
+
+			bson_iter_t value;
+			bson_iter_init(&value, &key);
+			for (uint32_t j = 0; j < i && bson_iter_next(&value); ++j)
+			{
+				// Equal to a null value also matches a missing field, the same way the sort orders them
+				bson_append_iter(&clause, paths[j].c_str(), (int)paths[j].size(), &value);
+			}
+
+			if (bson_iter_next(&value))
+				append_greater_than(&clause, paths[i], &value);
+
+			bson_append_document_end(&clauses, &clause);
+		}
+		bson_append_array_end(filter, &clauses);
+		return true;
+	}
+
+	/**
+	* Encode the key of the last document of a page as the token of the next one.
+	*/
+	std::string encode_page_key(const bson_t* doc, const std::vector<std::string>& paths)
+	{
+		bson_t key;
+		bson_init(&key);
+		for (uint32_t i = 0; i < paths.size(); ++i)
+		{
+			char index[16];
+			const char* index_key = nullptr;
+			auto index_length = bson_uint32_to_string(i, &index_key, index, sizeof(index));
+
+			bson_iter_t iter, field;
+			if (bson_iter_init(&iter, doc) && bson_iter_find_descendant(&iter, paths[i].c_str(), &field) && bson_iter_type(&field) != BSON_TYPE_UNDEFINED)
+				bson_append_iter(&key, index_key, (int)index_length, &field);
+			else
+				bson_append_null(&key, index_key, (int)index_length);
+		}
+
+		auto token = base64_encode(bson_get_data(&key), key.len);
+		bson_destroy(&key);
+		return token;
+	}
+
+	/**
+	* Build the filter and options of a page: the query filter and keyset condition, the page limit,
+	* a sort on the key paths and a projection of the fields and the key.
+	*/
+	bool build_page_query(const FetchQuery& query, const std::vector<std::string>& paths, bson_t* filter, bson_t* opts)
+	{
+		bson_t sort, projection;
+
+		if (query.filter_sessions)
+			append_session_filter(filter, query, ALL_SESSION_BATCHES);
+		if (!query.page_after.empty() && !append_page_after(filter, paths, query.page_after))
+			return false;
+
+		BSON_APPEND_INT64(opts, "limit", (int64_t)(query.limit > 0 ? query.limit : DEFAULT_PAGE_SIZE));
+
+		BSON_APPEND_DOCUMENT_BEGIN(opts, "sort", &sort);
+		for (auto& path : paths)
+			bson_append_int32(&sort, path.c_str(), (int)path.size(), 1);
+		bson_append_document_end(opts, &sort);
+
+		BSON_APPEND_DOCUMENT_BEGIN(opts, "projection", &projection);
+		for (auto& field : query.fields)
+			bson_append_bool(&projection, field.c_str(), (int)field.size(), true);
+		BSON_APPEND_BOOL(&projection, "_id", true);
+		bson_append_document_end(opts, &projection);
+		return true;
+	}
+
+	void run_page_query(const FetchQuery& query, mongoc_client_pool_t* pool, const std::string& database_name, const std::atomic<bool>* cancelled, PageResult& page)
+	{
+		ScopedTimer timer("fetch_page.query");
+		auto paths = page_key_paths(query);
+		auto page_size = query.limit > 0 ? query.limit : DEFAULT_PAGE_SIZE;
+
+		bson_t filter, opts, last;
+		bson_init(&filter);
+		bson_init(&opts);
+		bson_init(&last);
+
+		init_columns(query, page.columns);
+		DocumentDecoder decoder(query);
+
+		if (!build_page_query(query, paths, &filter, &opts))
+		{
+			page.error = "Invalid page token";
+		}
+		else
+		{
+			auto client = mongoc_client_pool_pop(pool);
+			auto collection = mongoc_client_get_collection(client, database_name.c_str(), query.collection.c_str());
+			auto cursor = mongoc_collection_find_with_opts(collection, &filter, &opts, nullptr);
+
+			const bson_t* doc = nullptr;
+			uint64_t rows = 0;
+			while ((cancelled == nullptr || !*cancelled) && mongoc_cursor_next(cursor, &doc))
+			{
+				decoder.read(doc, page.columns);
+				page.bytes_received += doc->len;
+				++rows;
+
+				// Only the last document is needed for the next token, copying beats a second query
+				bson_destroy(&last);
+				bson_copy_to(doc, &last);
+			}
+
+			bson_error_t error;
+			if (mongoc_cursor_error(cursor, &error))
+				page.error = error.message;
+			else if (rows == page_size)
+				page.next_token = encode_page_key(&last, paths);
+
+			timer.bytes = page.bytes_received;
+			timer.documents = rows;
+
+			mongoc_cursor_destroy(cursor);
+			mongoc_collection_destroy(collection);
+			mongoc_client_pool_push(pool, client);
+		}
+
+		bson_destroy(&last);
+		bson_destroy(&opts);
+		bson_destroy(&filter);
+	}
+
+	void run_page_prefetch(PagePrefetch* prefetch)
+	{
+		run_page_query(prefetch->query, prefetch->pool, prefetch->database_name, &prefetch->cancelled, prefetch->result);
+	}
+
+	/**
+	* True if two queries select the same pages, whatever page they start after.
+	*/
+	bool same_pages(const FetchQuery& a, const FetchQuery& b)
+	{
+		return a.collection == b.collection && a.limit == b.limit && a.fields == b.fields && a.sort == b.sort &&
+			a.position_parser == b.position_parser && a.filter_sessions == b.filter_sessions && a.sessions_ids == b.sessions_ids;
+	}
+
+	void drop_page_prefetch()
+	{
+		if (page_prefetch == nullptr)
+			return;
+
+		page_prefetch->cancelled = true;
+		if (page_prefetch->worker.joinable())
+			page_prefetch->worker.join();
+		page_prefetch.reset();
+	}
+
+	bool fetch_page(const FetchQuery& query, mongoc_client_pool_t* pool, const char* database_name, PageResult& page)
+	{
+		if (pool == nullptr || database_name == nullptr)
+		{
+			page.error = "Not connected";
+			return false;
+		}
+
+		auto prefetched = page_prefetch != nullptr && page_prefetch->pool == pool && page_prefetch->database_name == database_name &&
+			page_prefetch->query.page_after == query.page_after && same_pages(page_prefetch->query, query);
+
+		if (prefetched)
+		{
+			page_prefetch->worker.join();
+			page = std::move(page_prefetch->result);
+			page.prefetched = true;
+			page_prefetch.reset();
+		}
+		else
+		{
+			drop_page_prefetch();
+			run_page_query(query, pool, database_name, nullptr, page);
+		}
+
+		if (!page.error.empty())
+			return false;
+
+		if (!page.next_token.empty())
+		{
+			page_prefetch.reset(new PagePrefetch());
+			page_prefetch->query = query;
+			page_prefetch->query.page_after = page.next_token;
+			page_prefetch->pool = pool;
+			page_prefetch->database_name = database_name;
+			page_prefetch->worker = std::thread(run_page_prefetch, page_prefetch.get());
+		}
+
+		return true;
+	}
+
+	void shutdown_page_requests()
+	{
+		drop_page_prefetch();
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "fetch_query.h"
+
+#include <mongoc.h>
+
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Page size when the query has no limit.
+	*/
+	const uint64_t DEFAULT_PAGE_SIZE = 1000;
+
+	/**
+	* One page of documents and the token to continue after it.
+	*/
+	struct PageResult
+	{
+		std::vector<Column> columns;
+		std::string next_token; // Empty on the last page
+		std::string error;
+		uint64_t bytes_received = 0;
+		bool prefetched = false; // Served by the prefetch started with the previous page
+	};
+
+	/**
+	* Fetch the page of a query that follows query.page_after, then start prefetching the page after it on a worker.
+	* Pages are ordered by the sorted fields and _id and continue with a range filter on that key instead of a skip,
+	* so any page costs the same as the first one when an index covers the sort. Sorted fields may hold values of
+	* several BSON types, the range filter follows the order MongoDB sorts types in.
+	* Returns false and sets page.error if the query failed or the token is not valid for it.
+	*/
+	bool fetch_page(const FetchQuery& query, mongoc_client_pool_t* pool, const char* database_name, PageResult& page);
+
+	/**
+	* Wait for the prefetch and drop it, used when the server changes or the plugin is unloaded.
+	*/
+	void shutdown_page_requests();
+}
@@ -0,0 +1,593 @@
+#include "point_clustering.h"
+#include "fetch_requests.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <math.h>
+#include <mutex>
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	const uint32_t NO_CLUSTER = 0xFFFFFFFF;
+
+	/**
+	* Points or cells handed to a thread at a time.
+	*/
+	const uint32_t CLUSTER_CHUNK = 1024;
+
+	/**
+	* Points k-means++ picks its seeds from, evenly spread over the input.
+	*/
+	const uint32_t KMEANS_SEED_SAMPLE = 65536;
+
+	/**
+	* Bits of a grid cell coordinate in a cell key, larger grids get larger cells.
+	*/
+	const uint32_t CELL_BITS = 21;
+	const uint32_t MAX_CELL_COORD = (1u << CELL_BITS) - 3;
+
+	/**
+	* Run body over [0, count) in chunks on up to thread_count threads, stopping early once cancelled is set.
+	*/
+	void parallel_for(uint32_t count, uint32_t chunk, unsigned thread_count, const std::atomic<bool>& cancelled,
+		const std::function<void(uint32_t, uint32_t)>& body)
+	{
+		std::atomic<uint32_t> next{ 0 };
+		auto chunks = (count + chunk - 1) / chunk;
+		auto threads = std::max(1u, std::min(std::min(thread_count, MAX_FETCH_THREADS), chunks));
+
+		run_on_threads(threads, [&]() {
+			while (!cancelled)
+			{
+				auto begin = next.fetch_add(chunk);
+				if (begin >= count)
+					return;
+				body(begin, std::min(begin + chunk, count));
+			}
+		});
+	}
+
+	float distance_squared(const float* a, const float* b)
+	{
+		auto dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	/**
+	* Sum the points of every cluster of labels (NO_CLUSTER for noise) into centroids, bounds and scalar means,
+	* and keep the max_clusters largest.
+	*/
+	void summarize_clusters(const float* positions, const float* scalars, uint32_t num_points, const uint32_t* labels,
+		uint32_t cluster_count, uint32_t max_clusters, ClusterResult& result)
+	{
+		std::vector<double> sums(cluster_count * 3, 0.0);
+		std::vector<double> scalar_sums(cluster_count, 0.0);
+		std::vector<uint32_t> scalar_counts(cluster_count, 0);
+
+		PointCluster empty;
+		memset(&empty, 0, sizeof(empty));
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			empty.bb_min[axis] = INFINITY;
+			empty.bb_max[axis] = -INFINITY;
+		}
+		std::vector<PointCluster> clusters(cluster_count, empty);
+
+		result.noise_points = 0;
+		for (uint32_t i = 0; i < num_points; ++i)
+		{
+			auto label = labels[i];
+			if (label == NO_CLUSTER)
+			{
+				++result.noise_points;
+				continue;
+			}
+
+			auto& cluster = clusters[label];
+			auto xyz = &positions[i * 3];
+			for (auto axis = 0; axis < 3; ++axis)
+			{
+				sums[label * 3 + axis] += xyz[axis];
+				cluster.bb_min[axis] = std::min(cluster.bb_min[axis], xyz[axis]);
+				cluster.bb_max[axis] = std::max(cluster.bb_max[axis], xyz[axis]);
+			}
+			++cluster.size;
+
+			if (scalars != nullptr && !isnan(scalars[i]))
+			{
+				scalar_sums[label] += scalars[i];
+				++scalar_counts[label];
+			}
+		}
+
+		for (uint32_t c = 0; c < cluster_count; ++c)
+		{
+			auto& cluster = clusters[c];
+			for (auto axis = 0; axis < 3; ++axis)
+				cluster.centroid[axis] = cluster.size > 0 ? (float)(sums[c * 3 + axis] / cluster.size) : 0.0f;
+			cluster.scalar_mean = scalar_counts[c] > 0 ? scalar_sums[c] / scalar_counts[c] : NAN;
+		}
+
+		clusters.erase(std::remove_if(clusters.begin(), clusters.end(), [](const PointCluster& cluster) { return cluster.size == 0; }), clusters.end());
+		result.cluster_count = (uint32_t)clusters.size();
+
+		auto kept = std::min<size_t>(clusters.size(), max_clusters);
+		std::partial_sort(clusters.begin(), clusters.begin() + kept, clusters.end(), [](const PointCluster& a, const PointCluster& b) {
+			return a.size > b.size;
+		});
+		clusters.resize(kept);
+		result.clusters = std::move(clusters);
+	}
+
+	/**
+	* Points sorted by grid cell, every cell being a run of points. Cells are radius / sqrt(3) wide,
+	* so that any two points of a cell are within the radius of each other, unless the level is too large
+	* for the key bits and the cells had to be widened.
+	*/
+	struct CellGrid
+	{
+		float origin[3];
+		float cell_size;
+		float radius;
+		bool cells_within_radius;      // False once widened, the points of a cell must then be checked by distance
+		std::vector<uint64_t> keys;    // Key of every cell, increasing
+		std::vector<uint32_t> starts;  // First sorted point of every cell, then the point count
+		std::vector<uint32_t> order;   // Input index of every sorted point
+		std::vector<float> positions;  // Sorted positions
+
+		static uint64_t key(uint64_t x, uint64_t y, uint64_t z) { return (z << (CELL_BITS * 2)) | (y << CELL_BITS) | x; }
+
+		uint32_t size(uint32_t c) const { return starts[c + 1] - starts[c]; }
+
+		/**
+		* Write the other cells that can hold points within the radius of a point of cell c to neighbors,
+		* up to two cells away on every axis. Returns how many there are.
+		* Cells along x have consecutive keys, so every row of five cells is found with one search.
+		*/
+		uint32_t neighbor_cells(uint32_t c, uint32_t* neighbors) const
+		{
+			auto mask = (1ull << CELL_BITS) - 1;
+			int64_t cell[3] = { (int64_t)(keys[c] & mask), (int64_t)((keys[c] >> CELL_BITS) & mask), (int64_t)(keys[c] >> (CELL_BITS * 2)) };
+			auto radius_squared = radius * radius;
+			uint32_t count = 0;
+
+			for (auto dz = -2; dz <= 2; ++dz)
+			{
+				for (auto dy = -2; dy <= 2; ++dy)
+				{
+					if (cell[1] + dy < 0 || cell[2] + dz < 0)
+						continue;
+
+					auto row_first = key(std::max<int64_t>(cell[0] - 2, 0), cell[1] + dy, cell[2] + dz);
+					auto row_last = key(cell[0] + 2, cell[1] + dy, cell[2] + dz);
+					for (auto it = std::lower_bound(keys.begin(), keys.end(), row_first); it != keys.end() && *it <= row_last; ++it)
+					{
+						auto n = (uint32_t)(it - keys.begin());
+						if (n == c)
+							continue;
+
+						// Closest distance between the two cells, the corners two cells away are out of reach
+						int64_t offsets[3] = { (int64_t)(*it & mask) - cell[0], dy, dz };
+						float gap_squared = 0.0f;
+						for (auto axis = 0; axis < 3; ++axis)
+						{
+							auto gap = std::max<int64_t>(offsets[axis] < 0 ? -offsets[axis] - 1 : offsets[axis] - 1, 0) * cell_size;
+							gap_squared += gap * gap;
+						}
+						if (gap_squared <= radius_squared)
+							neighbors[count++] = n;
+					}
+				}
+			}
+			return count;
+		}
+	};
+
+	/**
+	* Most cells returned by CellGrid::neighbor_cells, one more is kept for the cell itself.
+	*/
+	const uint32_t MAX_NEIGHBOR_CELLS = 124;
+
+	void build_cell_grid(const float* positions, uint32_t num_points, float radius, CellGrid& grid)
+	{
+		float bb_min[3] = { INFINITY, INFINITY, INFINITY };
+		float bb_max[3] = { -INFINITY, -INFINITY, -INFINITY };
+		for (uint32_t i = 0; i < num_points; ++i)
+		{
+			for (auto axis = 0; axis < 3; ++axis)
+			{
+				bb_min[axis] = std::min(bb_min[axis], positions[i * 3 + axis]);
+				bb_max[axis] = std::max(bb_max[axis], positions[i * 3 + axis]);
+			}
+		}
+
+		// Levels too large for the key bits get larger cells. Two cells around a point still cover the radius,
+		// but the points of a cell may then be farther apart than it.
+		grid.radius = radius;
+		grid.cell_size = radius / sqrtf(3.0f);
+		grid.cells_within_radius = true;
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			grid.origin[axis] = bb_min[axis];
+			auto widened = (bb_max[axis] - bb_min[axis]) / MAX_CELL_COORD;
+			if (widened > grid.cell_size)
+			{
+				grid.cell_size = widened;
+				grid.cells_within_radius = false;
+			}
+		}
+
+		std::vector<std::pair<uint64_t, uint32_t>> keyed(num_points);
+		for (uint32_t i = 0; i < num_points; ++i)
+		{
+			uint64_t coords[3];
+			for (auto axis = 0; axis < 3; ++axis)
+				coords[axis] = std::min((uint64_t)((positions[i * 3 + axis] - grid.origin[axis]) / grid.cell_size), (uint64_t)MAX_CELL_COORD);
+			keyed[i] = std::make_pair(CellGrid::key(coords[0], coords[1], coords[2]), i);
+		}
+		std::sort(keyed.begin(), keyed.end());
+
+		grid.order.resize(num_points);
+		grid.positions.resize(num_points * 3);
+		grid.keys.clear();
+		grid.starts.clear();
+		for (uint32_t i = 0; i < num_points; ++i)
+		{
+			if (i == 0 || keyed[i].first != keyed[i - 1].first)
+			{
+				grid.keys.push_back(keyed[i].first);
+				grid.starts.push_back(i);
+			}
+			grid.order[i] = keyed[i].second;
+			memcpy(&grid.positions[i * 3], &positions[keyed[i].second * 3], 3 * sizeof(float));
+		}
+		grid.starts.push_back(num_points);
+	}
+
+	/**
+	* Root of a cell in a union-find shared by threads.
+	*/
+	uint32_t find_root(const std::vector<std::atomic<uint32_t>>& parents, uint32_t cell)
+	{
+		while (true)
+		{
+			auto parent = parents[cell].load(std::memory_order_relaxed);
+			if (parent == cell)
+				return cell;
+			cell = parent;
+		}
+	}
+
+	/**
+	* Join the sets of two cells, the larger root is linked under the smaller one.
+	* The link only succeeds while the linked cell is still a root, otherwise the roots are looked up again.
+	*/
+	void union_cells(std::vector<std::atomic<uint32_t>>& parents, uint32_t a, uint32_t b)
+	{
+		while (true)
+		{
+			a = find_root(parents, a);
+			b = find_root(parents, b);
+			if (a == b)
+				return;
+			if (a < b)
+				std::swap(a, b);
+
+			auto expected = a;
+			if (parents[a].compare_exchange_weak(expected, b))
+				return;
+		}
+	}
+
+	bool cluster_dbscan(const float* positions, const float* scalars, uint32_t num_points, const ClusterSettings& settings,
+		const std::atomic<bool>& cancelled, ClusterResult& result)
+	{
+		ScopedTimer timer("cluster_dbscan");
+		timer.documents = num_points;
+
+		result = ClusterResult();
+		if (num_points == 0 || settings.radius <= 0.0f)
+			return true;
+
+		CellGrid grid;
+		build_cell_grid(positions, num_points, settings.radius, grid);
+
+		auto cell_count = (uint32_t)grid.keys.size();
+		auto radius_squared = settings.radius * settings.radius;
+		auto min_points = std::max(settings.min_points, 1u);
+		auto whole_cells = grid.cells_within_radius;
+		const float* sorted = grid.positions.data();
+
+		// Cells of widened grids are searched like their neighbors, and the clusters are built from points instead of cells
+		auto search_cells = [&](uint32_t c, uint32_t* neighbors) {
+			auto count = grid.neighbor_cells(c, neighbors);
+			if (!whole_cells)
+				neighbors[count++] = c;
+			return count;
+		};
+
+		// Core points have at least min_points points within the radius. Every point of an unwidened cell is within
+		// the radius of the others, so its cells of min_points points are core as a whole and the others search their neighbors.
+		std::vector<uint8_t> core(num_points, 0);
+		std::vector<uint8_t> core_cells(cell_count, 0);
+		parallel_for(cell_count, CLUSTER_CHUNK, settings.thread_count, cancelled, [&](uint32_t begin, uint32_t end) {
+			uint32_t neighbors[MAX_NEIGHBOR_CELLS + 1];
+			for (auto c = begin; c < end; ++c)
+			{
+				if (whole_cells && grid.size(c) >= min_points)
+				{
+					memset(&core[grid.starts[c]], 1, grid.size(c));
+					core_cells[c] = 1;
+					continue;
+				}
+
+				auto neighbor_count = search_cells(c, neighbors);
+				for (auto p = grid.starts[c]; p < grid.starts[c + 1]; ++p)
+				{
+					auto found = whole_cells ? grid.size(c) : 0;
+					for (uint32_t n = 0; n < neighbor_count && found < min_points; ++n)
+					{
+						for (auto q = grid.starts[neighbors[n]]; q < grid.starts[neighbors[n] + 1] && found < min_points; ++q)
+						{
+							if (distance_squared(&sorted[p * 3], &sorted[q * 3]) <= radius_squared)
+								++found;
+						}
+					}
+					core[p] = found >= min_points ? 1 : 0;
+					core_cells[c] |= core[p];
+				}
+			}
+		});
+		if (cancelled)
+			return false;
+
+		// The core points of a cell share a cluster, cells are joined when a core point of each is within the radius.
+		// Core points of widened cells are joined one pair at a time.
+		auto node_count = whole_cells ? cell_count : num_points;
+		std::vector<std::atomic<uint32_t>> parents(node_count);
+		for (uint32_t i = 0; i < node_count; ++i)
+			parents[i].store(i, std::memory_order_relaxed);
+
+		parallel_for(cell_count, CLUSTER_CHUNK, settings.thread_count, cancelled, [&](uint32_t begin, uint32_t end) {
+			uint32_t neighbors[MAX_NEIGHBOR_CELLS + 1];
+			for (auto c = begin; c < end; ++c)
+			{
+				if (!core_cells[c])
+					continue;
+
+				auto neighbor_count = search_cells(c, neighbors);
+				for (uint32_t n = 0; n < neighbor_count; ++n)
+				{
+					auto other = neighbors[n];
+					if (other < c || !core_cells[other])
+						continue;
+
+					if (!whole_cells)
+					{
+						for (auto p = grid.starts[c]; p < grid.starts[c + 1]; ++p)
+						{
+							if (!core[p])
+								continue;
+							for (auto q = other == c ? p + 1 : grid.starts[other]; q < grid.starts[other + 1]; ++q)
+							{
+								if (core[q] && distance_squared(&sorted[p * 3], &sorted[q * 3]) <= radius_squared)
+									union_cells(parents, p, q);
+							}
+						}
+						continue;
+					}
+
+					if (find_root(parents, c) == find_root(parents, other))
+						continue;
+
+					auto linked = false;
+					for (auto p = grid.starts[c]; p < grid.starts[c + 1] && !linked; ++p)
+					{
+						if (!core[p])
+							continue;
+						for (auto q = grid.starts[other]; q < grid.starts[other + 1] && !linked; ++q)
+							linked = core[q] && distance_squared(&sorted[p * 3], &sorted[q * 3]) <= radius_squared;
+					}
+					if (linked)
+						union_cells(parents, c, other);
+				}
+			}
+		});
+		if (cancelled)
+			return false;
+
+		// Border points join the cluster of a core point within the radius, the others are noise
+		std::vector<uint32_t> roots(num_points, NO_CLUSTER);
+		parallel_for(cell_count, CLUSTER_CHUNK, settings.thread_count, cancelled, [&](uint32_t begin, uint32_t end) {
+			uint32_t neighbors[MAX_NEIGHBOR_CELLS + 1];
+			for (auto c = begin; c < end; ++c)
+			{
+				if (whole_cells && core_cells[c])
+				{
+					auto root = find_root(parents, c);
+					for (auto p = grid.starts[c]; p < grid.starts[c + 1]; ++p)
+						roots[p] = root;
+					continue;
+				}
+
+				auto neighbor_count = search_cells(c, neighbors);
+				for (auto p = grid.starts[c]; p < grid.starts[c + 1]; ++p)
+				{
+					if (core[p])
+					{
+						roots[p] = find_root(parents, whole_cells ? c : p);
+						continue;
+					}
+
+					for (uint32_t n = 0; n < neighbor_count && roots[p] == NO_CLUSTER; ++n)
+					{
+						if (!core_cells[neighbors[n]])
+							continue;
+						for (auto q = grid.starts[neighbors[n]]; q < grid.starts[neighbors[n] + 1]; ++q)
+						{
+							if (core[q] && distance_squared(&sorted[p * 3], &sorted[q * 3]) <= radius_squared)
+							{
+								roots[p] = find_root(parents, whole_cells ? neighbors[n] : q);
+								break;
+							}
+						}
+					}
+				}
+			}
+		});
+		if (cancelled)
+			return false;
+
+		// Number the clusters by root and label the points in input order
+		std::vector<uint32_t> cluster_ids(node_count, NO_CLUSTER);
+		std::vector<uint32_t> labels(num_points, NO_CLUSTER);
+		uint32_t cluster_count = 0;
+		for (uint32_t p = 0; p < num_points; ++p)
+		{
+			auto root = roots[p];
+			if (root == NO_CLUSTER)
+				continue;
+			if (cluster_ids[root] == NO_CLUSTER)
+				cluster_ids[root] = cluster_count++;
+			labels[grid.order[p]] = cluster_ids[root];
+		}
+
+		summarize_clusters(positions, scalars, num_points, labels.data(), cluster_count, settings.max_clusters, result);
+		return true;
+	}
+
+	/**
+	* Pick k seeds from an even sample of the points with k-means++: every next seed is drawn with a probability
+	* proportional to its squared distance to the closest seed. The random sequence is fixed, so runs repeat.
+	*/
+	void seed_kmeans(const float* positions, uint32_t num_points, uint32_t k, std::vector<float>& centroids)
+	{
+		auto stride = std::max(1u, num_points / KMEANS_SEED_SAMPLE);
+		std::vector<uint32_t> sample;
+		for (uint32_t i = 0; i < num_points; i += stride)
+			sample.push_back(i);
+
+		uint64_t state = 0x9E3779B97F4A7C15ull;
+		auto random = [&state]() {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return (state >> 11) * (1.0 / 9007199254740992.0);
+		};
+
+		centroids.resize(k * 3);
+		memcpy(&centroids[0], &positions[sample[sample.size() / 2] * 3], 3 * sizeof(float));
+
+		std::vector<float> closest(sample.size(), INFINITY);
+		for (uint32_t c = 1; c < k; ++c)
+		{
+			double total = 0.0;
+			for (size_t s = 0; s < sample.size(); ++s)
+			{
+				closest[s] = std::min(closest[s], distance_squared(&positions[sample[s] * 3], &centroids[(c - 1) * 3]));
+				total += closest[s];
+			}
+
+			// All sampled points sit on seeds already, the remaining seeds repeat the last one
+			size_t pick = sample.size() - 1;
+			if (total > 0.0)
+			{
+				auto target = random() * total;
+				for (size_t s = 0; s < sample.size(); ++s)
+				{
+					target -= closest[s];
+					if (target <= 0.0)
+					{
+						pick = s;
+						break;
+					}
+				}
+			}
+			memcpy(&centroids[c * 3], &positions[sample[pick] * 3], 3 * sizeof(float));
+		}
+	}
+
+	bool cluster_kmeans(const float* positions, const float* scalars, uint32_t num_points, const ClusterSettings& settings,
+		const std::atomic<bool>& cancelled, ClusterResult& result)
+	{
+		ScopedTimer timer("cluster_kmeans");
+		timer.documents = num_points;
+
+		result = ClusterResult();
+		auto k = std::min(settings.k, num_points);
+		if (k == 0)
+			return true;
+
+		std::vector<float> centroids;
+		seed_kmeans(positions, num_points, k, centroids);
+
+		std::vector<uint32_t> labels(num_points, NO_CLUSTER);
+		std::vector<double> sums(k * 3);
+		std::vector<uint32_t> counts(k);
+		std::mutex sums_mutex;
+
+		for (unsigned iteration = 0; iteration < std::max(settings.max_iterations, 1u); ++iteration)
+		{
+			std::fill(sums.begin(), sums.end(), 0.0);
+			std::fill(counts.begin(), counts.end(), 0);
+			std::atomic<uint32_t> changed{ 0 };
+
+			// Every chunk assigns its points to the closest centroid and adds them to its own sums before merging them
+			parallel_for(num_points, CLUSTER_CHUNK * 16, settings.thread_count, cancelled, [&](uint32_t begin, uint32_t end) {
+				std::vector<double> chunk_sums(k * 3, 0.0);
+				std::vector<uint32_t> chunk_counts(k, 0);
+				uint32_t chunk_changed = 0;
+
+				for (auto i = begin; i < end; ++i)
+				{
+					auto xyz = &positions[i * 3];
+					uint32_t best = 0;
+					auto best_distance = distance_squared(xyz, &centroids[0]);
+					for (uint32_t c = 1; c < k; ++c)
+					{
+						auto distance = distance_squared(xyz, &centroids[c * 3]);
+						if (distance < best_distance)
+						{
+							best_distance = distance;
+							best = c;
+						}
+					}
+
+					if (labels[i] != best)
+					{
+						labels[i] = best;
+						++chunk_changed;
+					}
+					for (auto axis = 0; axis < 3; ++axis)
+						chunk_sums[best * 3 + axis] += xyz[axis];
+					++chunk_counts[best];
+				}
+
+				std::lock_guard<std::mutex> lock(sums_mutex);
+				for (uint32_t c = 0; c < k * 3; ++c)
+					sums[c] += chunk_sums[c];
+				for (uint32_t c = 0; c < k; ++c)
+					counts[c] += chunk_counts[c];
+				changed += chunk_changed;
+			});
+			if (cancelled)
+				return false;
+
+			// Empty clusters keep their centroid
+			for (uint32_t c = 0; c < k; ++c)
+			{
+				if (counts[c] == 0)
+					continue;
+				for (auto axis = 0; axis < 3; ++axis)
+					centroids[c * 3 + axis] = (float)(sums[c * 3 + axis] / counts[c]);
+			}
+
+			if (changed == 0)
+				break;
+		}
+
+		summarize_clusters(positions, scalars, num_points, labels.data(), k, settings.max_clusters, result);
+		return true;
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	enum ClusterMethod
+	{
+		CLUSTER_DBSCAN = 0,
+		CLUSTER_KMEANS
+	};
+
+	struct ClusterSettings
+	{
+		ClusterMethod method = CLUSTER_DBSCAN;
+		float radius = 2.0f;           // DBSCAN neighborhood radius in world units
+		unsigned min_points = 8;       // DBSCAN neighbors (the point included) that make a point a core point
+		unsigned k = 8;                // k-means cluster count
+		unsigned max_iterations = 32;  // k-means iterations, stops earlier once no point changes cluster
+		unsigned max_clusters = 64;    // Largest clusters returned
+		unsigned thread_count = 1;
+	};
+
+	/**
+	* A cluster of points: its centroid, bounds, number of points and the mean of the scalars of its points
+	* (NaN if none of them has one).
+	*/
+	struct PointCluster
+	{
+		float centroid[3];
+		float bb_min[3];
+		float bb_max[3];
+		uint32_t size;
+		double scalar_mean;
+	};
+
+	struct ClusterResult
+	{
+		std::vector<PointCluster> clusters; // Largest first
+		uint32_t cluster_count = 0;         // Clusters found, before keeping the max_clusters largest
+		uint32_t noise_points = 0;          // DBSCAN points in no cluster
+	};
+
+	/**
+	* Cluster num_points x, y, z positions with DBSCAN. The points are bucketed in a grid of radius / sqrt(3) cells,
+	* so dense cells are core as a whole and neighbors are only searched two cells around a point. Cells holding
+	* core points are linked with a lock-free union-find on thread_count threads, border points join the cluster
+	* of a core neighbor. Levels too large for the grid keys get wider cells, whose points are then counted and linked
+	* one by one.
+	* scalars is optional (num_points floats, NaN for none). Returns false if cancelled was set while running.
+	*/
+	bool cluster_dbscan(const float* positions, const float* scalars, uint32_t num_points, const ClusterSettings& settings,
+		const std::atomic<bool>& cancelled, ClusterResult& result);
+
+	/**
+	* Cluster num_points positions with k-means: k-means++ seeds picked from an even sample of the points,
+	* then Lloyd iterations with the assignment and the sums split over thread_count threads.
+	* Returns false if cancelled was set while running.
+	*/
+	bool cluster_kmeans(const float* positions, const float* scalars, uint32_t num_points, const ClusterSettings& settings,
+		const std::atomic<bool>& cancelled, ClusterResult& result);
+}
@@ -0,0 +1,129 @@
+#include "position_parser.h"
+
+#include <math.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	PositionParser position_parsers[MAX_POSITION_PARSERS] = {
+		nullptr,
+		&parse_prefixed_position<Vector3Format>,
+		&parse_prefixed_position<PositionFormat>
+	};
+
+	void register_position_parser(unsigned id, PositionParser parser)
+	{
+		if (id < MAX_POSITION_PARSERS)
+			position_parsers[id] = parser;
+	}
+
+	PositionParser find_position_parser(unsigned id)
+	{
+		return id < MAX_POSITION_PARSERS ? position_parsers[id] : nullptr;
+	}
+
+	inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+	/**
+	* Return true if a number starts at str.
+	*/
+	inline bool starts_number(const char* str, const char* end)
+	{
+		if (is_digit(*str))
+			return true;
+		if (*str == '.')
+			return str + 1 < end && is_digit(str[1]);
+		if (*str == '-' || *str == '+')
+			return str + 1 < end && (is_digit(str[1]) || (str[1] == '.' && str + 2 < end && is_digit(str[2])));
+		return false;
+	}
+
+	/**
+	* Return mantissa * 10^exponent.
+	*/
+	inline double scale_by_power_of_ten(double mantissa, int exponent)
+	{
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+		if (exponent >= 0 && exponent <= 22)
+			return mantissa * powers[exponent];
+		if (exponent < 0 && exponent >= -22)
+			return mantissa / powers[-exponent];
+		return mantissa * pow(10.0, exponent);
+	}
+
+	bool parse_float(const char*& str, const char* end, float& value)
+	{
+		auto p = str;
+		bool negative = false;
+
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		double mantissa = 0.0;
+		int exponent = 0;
+		int digits = 0;
+
+		for (; p < end && is_digit(*p); ++p, ++digits)
+			mantissa = mantissa * 10.0 + (*p - '0');
+
+		if (p < end && *p == '.')
+		{
+			for (++p; p < end && is_digit(*p); ++p, ++digits, --exponent)
+				mantissa = mantissa * 10.0 + (*p - '0');
+		}
+
+		if (digits == 0)
+			return false;
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			auto q = p + 1;
+			bool exponent_negative = false;
+
+			if (q < end && (*q == '-' || *q == '+'))
+				exponent_negative = *q++ == '-';
+
+			if (q < end && is_digit(*q))
+			{
+				int e = 0;
+				for (; q < end && is_digit(*q); ++q)
+				{
+					if (e < 1000)
+						e = e * 10 + (*q - '0');
+				}
+				exponent += exponent_negative ? -e : e;
+				p = q;
+			}
+		}
+
+		auto result = scale_by_power_of_ten(mantissa, exponent);
+		value = (float)(negative ? -result : result);
+		str = p;
+		return true;
+	}
+
+	bool parse_float3(const char* str, const char* end, float* xyz)
+	{
+		auto p = str;
+
+		for (auto i = 0; i < 3; ++i)
+		{
+			while (p < end && !starts_number(p, end))
+				++p;
+
+			if (p == end || !parse_float(p, end, xyz[i]))
+				return false;
+		}
+
+		return true;
+	}
+
+	bool parse_any_position(const char* str, uint32_t len, float* xyz)
+	{
+		auto end = str + len;
+		auto open = static_cast<const char*>(memchr(str, '(', len));
+
+		return parse_float3(open != nullptr ? open + 1 : str, end, xyz);
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Parse a position string into three floats. Must not allocate.
+	* Returns false if the string is not a position in the parser's format.
+	*/
+	typedef bool (*PositionParser)(const char* str, uint32_t len, float* xyz);
+
+	/**
+	* Parser ids, these match the parser modes of the viewer.
+	* To support another string layout, write a PositionParser and register it with a new id
+	* (and add the matching option to Parsers in telemetry-viewer.js).
+	*/
+	enum PositionParserId
+	{
+		POSITION_PARSER_NONE = 0,     // Positions stored as [x, y, z] arrays or { x, y, z } documents
+		POSITION_PARSER_VECTOR3 = 1,  // "Vector3(x, y, z)", Parsers.VECTOR3
+		POSITION_PARSER_POSITION = 2, // "Position(x, y, z)", Parsers.POSITION
+		MAX_POSITION_PARSERS = 16
+	};
+
+	/**
+	* Register a parser for an id, replacing any previous one.
+	*/
+	void register_position_parser(unsigned id, PositionParser parser);
+
+	/**
+	* Return the parser registered for an id, nullptr if there is none.
+	*/
+	PositionParser find_position_parser(unsigned id);
+
+	/**
+	* Parse a decimal number at str, advancing str past it.
+	* Returns false if there is no number at str.
+	*/
+	bool parse_float(const char*& str, const char* end, float& value);
+
+	/**
+	* Parse three numbers separated by anything that is not part of a number, e.g. "(1, 2.5, -3)".
+	*/
+	bool parse_float3(const char* str, const char* end, float* xyz);
+
+	/**
+	* Generic parser for "Anything(x, y, z)", numbers are read after the first parenthesis if there is one.
+	*/
+	bool parse_any_position(const char* str, uint32_t len, float* xyz);
+
+	/**
+	* Fast path for a known "Prefix(x, y, z)" layout. The prefix comparison is
+	* resolved at compile time, strings that do not start with it take the generic path.
+	*/
+	template <typename Format>
+	bool parse_prefixed_position(const char* str, uint32_t len, float* xyz)
+	{
+		if (len >= Format::prefix_length && memcmp(str, Format::prefix(), Format::prefix_length) == 0)
+			return parse_float3(str + Format::prefix_length, str + len, xyz);
+
+		return parse_any_position(str, len, xyz);
+	}
+
+	struct PositionFormat
+	{
+		static const char* prefix() { return "Position("; }
+		static const uint32_t prefix_length = 9;
+	};
+
+	struct Vector3Format
+	{
+		static const char* prefix() { return "Vector3("; }
+		static const uint32_t prefix_length = 8;
+	};
+}
@@ -0,0 +1,147 @@
+#include "profiler.h"
+
+#include <functional>
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+namespace PLUGIN_NAMESPACE
+{
+	struct TraceEvent
+	{
+		const char* stage;
+		uint64_t start_us;
+		uint64_t duration_us;
+		size_t thread;
+	};
+
+	std::mutex profile_mutex; // Guards the stages and the trace
+	std::vector<StageStats> stages;
+	std::vector<TraceEvent> trace;
+	size_t next_trace_event = 0;
+
+	const auto profile_epoch = std::chrono::steady_clock::now();
+
+	uint64_t profile_time_us()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - profile_epoch).count();
+	}
+
+	unsigned duration_bucket(uint64_t duration_us)
+	{
+		if (duration_us <= 1)
+			return 0;
+		auto bucket = (unsigned)ceil(log2((double)duration_us) * 4.0);
+		return bucket < PROFILE_BUCKETS ? bucket : PROFILE_BUCKETS - 1;
+	}
+
+	void record_stage(const char* stage, uint64_t start_us, uint64_t duration_us, uint64_t bytes, uint64_t documents)
+	{
+		std::lock_guard<std::mutex> lock(profile_mutex);
+
+		StageStats* stats = nullptr;
+		for (auto& existing : stages)
+		{
+			if (existing.name == stage)
+			{
+				stats = &existing;
+				break;
+			}
+		}
+		if (stats == nullptr)
+		{
+			stages.push_back(StageStats());
+			stats = &stages.back();
+			stats->name = stage;
+		}
+
+		++stats->count;
+		stats->total_us += duration_us;
+		stats->max_us = duration_us > stats->max_us ? duration_us : stats->max_us;
+		stats->bytes += bytes;
+		stats->documents += documents;
+		++stats->buckets[duration_bucket(duration_us)];
+
+		// Stage names are string literals, so the trace can keep the pointers
+		TraceEvent event = { stage, start_us, duration_us, std::hash<std::thread::id>()(std::this_thread::get_id()) };
+		if (trace.size() < MAX_TRACE_EVENTS)
+			trace.push_back(event);
+		else
+			trace[next_trace_event] = event;
+		next_trace_event = (next_trace_event + 1) % MAX_TRACE_EVENTS;
+	}
+
+	double stage_percentile_us(const StageStats& stats, double fraction)
+	{
+		if (stats.count == 0)
+			return 0.0;
+
+		auto rank = (uint64_t)ceil(fraction * stats.count);
+		uint64_t seen = 0;
+		for (unsigned bucket = 0; bucket < PROFILE_BUCKETS; ++bucket)
+		{
+			seen += stats.buckets[bucket];
+			if (seen >= rank && seen > 0)
+			{
+				auto upper = pow(2.0, bucket / 4.0);
+				return upper < (double)stats.max_us ? upper : (double)stats.max_us;
+			}
+		}
+		return (double)stats.max_us;
+	}
+
+	std::vector<StageStats> profile_stages()
+	{
+		std::lock_guard<std::mutex> lock(profile_mutex);
+		return stages;
+	}
+
+	void reset_profile()
+	{
+		std::lock_guard<std::mutex> lock(profile_mutex);
+		stages.clear();
+		trace.clear();
+		next_trace_event = 0;
+	}
+
+	bool write_chrome_trace(const std::string& path, std::string& error)
+	{
+		std::vector<TraceEvent> events;
+		{
+			std::lock_guard<std::mutex> lock(profile_mutex);
+			events = trace;
+		}
+
+		auto file = fopen(path.c_str(), "wb");
+		if (file == nullptr)
+		{
+			error = "Could not open " + path;
+			return false;
+		}
+
+		// Thread ids are hashed, renumber them so the trace viewer shows small ids
+		std::vector<size_t> threads;
+		fprintf(file, "{\"traceEvents\":[\n");
+		for (size_t i = 0; i < events.size(); ++i)
+		{
+			const auto& event = events[i];
+			size_t tid = 0;
+			while (tid < threads.size() && threads[tid] != event.thread)
+				++tid;
+			if (tid == threads.size())
+				threads.push_back(event.thread);
+
+			fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"telemetry\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%u}",
+				i == 0 ? "" : ",\n", event.stage, (unsigned long long)event.start_us, (unsigned long long)event.duration_us, (unsigned)tid + 1);
+		}
+		fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+		auto ok = ferror(file) == 0;
+		fclose(file);
+		if (!ok)
+			error = "Could not write " + path;
+		return ok;
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Buckets of the duration histogram of a stage. Bucket i covers durations up to 2^(i / 4) microseconds,
+	* so percentiles are within 19% of the true value from 1 us to about 4.5 hours.
+	*/
+	const unsigned PROFILE_BUCKETS = 128;
+
+	/**
+	* Most recent scopes kept for the Chrome trace, older ones are overwritten.
+	*/
+	const size_t MAX_TRACE_EVENTS = 65536;
+
+	/**
+	* Aggregated samples of one named stage.
+	*/
+	struct StageStats
+	{
+		std::string name;
+		uint64_t count = 0;
+		uint64_t total_us = 0;
+		uint64_t max_us = 0;
+		uint64_t bytes = 0;
+		uint64_t documents = 0;
+		uint32_t buckets[PROFILE_BUCKETS] = {};
+	};
+
+	/**
+	* Add a sample to a stage and to the trace. Thread safe, fetch workers record their own stages.
+	* start_us is the time the stage started on the profile clock, see profile_time_us.
+	*/
+	void record_stage(const char* stage, uint64_t start_us, uint64_t duration_us, uint64_t bytes = 0, uint64_t documents = 0);
+
+	/**
+	* Microseconds since the plugin was loaded.
+	*/
+	uint64_t profile_time_us();
+
+	/**
+	* Duration below which the given fraction ([0, 1]) of the samples of a stage fall, read from its histogram.
+	*/
+	double stage_percentile_us(const StageStats& stats, double fraction);
+
+	/**
+	* Copy the stats of every stage, in the order the stages were first recorded.
+	*/
+	std::vector<StageStats> profile_stages();
+
+	void reset_profile();
+
+	/**
+	* Write the recorded scopes as a Chrome trace (chrome://tracing, Perfetto).
+	*/
+	bool write_chrome_trace(const std::string& path, std::string& error);
+
+	/**
+	* Times a scope and records it as a stage when it ends. Bytes and documents can be added while it runs.
+	*/
+	struct ScopedTimer
+	{
+		explicit ScopedTimer(const char* stage) : stage(stage), start_us(profile_time_us()) {}
+		~ScopedTimer() { record_stage(stage, start_us, profile_time_us() - start_us, bytes, documents); }
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+		const char* stage;
+		uint64_t start_us;
+		uint64_t bytes = 0;
+		uint64_t documents = 0;
+	};
+
+	/**
+	* Accumulates the time of many short intervals, such as the decode of every document of a cursor,
+	* and records them as a single stage sample.
+	*/
+	struct StageClock
+	{
+		uint64_t start_us = profile_time_us();
+		uint64_t total_us = 0;
+		uint64_t interval_start_us = 0;
+
+		void begin() { interval_start_us = profile_time_us(); }
+		void end() { total_us += profile_time_us() - interval_start_us; }
+		void record(const char* stage, uint64_t bytes = 0, uint64_t documents = 0) const { record_stage(stage, start_us, total_us, bytes, documents); }
+	};
+}
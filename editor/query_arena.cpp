@@ -0,0 +1,133 @@
+#include "query_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Every allocation is preceded by its size so that reallocate knows how much to copy.
+	*/
+	const size_t ALLOCATION_HEADER = 16;
+
+	QueryArena::~QueryArena()
+	{
+		for (auto& block : blocks)
+			free(block.data);
+	}
+
+	void* QueryArena::allocate(size_t size, size_t align)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return allocate_locked(size, align);
+	}
+
+	void* QueryArena::allocate_locked(size_t size, size_t align)
+	{
+		if (align < ALLOCATION_HEADER)
+			align = ALLOCATION_HEADER;
+		auto needed = size + ALLOCATION_HEADER + align;
+
+		// Look for room in the current block, then in the blocks kept from before the last reset
+		while (current_block < blocks.size())
+		{
+			auto& block = blocks[current_block];
+			auto start = ((uintptr_t)block.data + offset + ALLOCATION_HEADER + align - 1) & ~(uintptr_t)(align - 1);
+			if (start + size <= (uintptr_t)block.data + block.size)
+			{
+				offset = start + size - (uintptr_t)block.data;
+				last = (uint8_t*)start;
+				*(size_t*)(start - ALLOCATION_HEADER) = size;
+				++counters.allocations;
+				counters.bytes += size;
+				return (void*)start;
+			}
+
+			++current_block;
+			offset = 0;
+		}
+
+		Block block;
+		block.size = needed > QUERY_ARENA_BLOCK_SIZE ? needed : QUERY_ARENA_BLOCK_SIZE;
+		block.data = (uint8_t*)malloc(block.size);
+		if (block.data == nullptr)
+			return nullptr;
+
+		blocks.push_back(block);
+		++counters.blocks;
+		current_block = blocks.size() - 1;
+		offset = 0;
+		return allocate_locked(size, align);
+	}
+
+	void* QueryArena::reallocate(void* memory, size_t size)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// The latest allocation ends at the offset of the current block, it grows without a copy while the block has room
+		if (memory != nullptr && memory == last)
+		{
+			auto& block = blocks[current_block];
+			auto start = (uint8_t*)memory - block.data;
+			if (start + size <= block.size)
+			{
+				auto& old_size = *(size_t*)((uint8_t*)memory - ALLOCATION_HEADER);
+				if (size > old_size)
+					counters.bytes += size - old_size;
+				old_size = size;
+				offset = start + size;
+				return memory;
+			}
+		}
+
+		auto grown = allocate_locked(size, ALLOCATION_HEADER);
+		if (memory != nullptr && grown != nullptr)
+		{
+			auto old_size = *(size_t*)((uint8_t*)memory - ALLOCATION_HEADER);
+			memcpy(grown, memory, old_size < size ? old_size : size);
+		}
+		return grown;
+	}
+
+	void QueryArena::reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		current_block = 0;
+		offset = 0;
+		last = nullptr;
+	}
+
+	ArenaStats QueryArena::stats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return counters;
+	}
+
+	void QueryArena::clear_stats()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		counters = ArenaStats();
+	}
+
+	/**
+	* Growable buffer of a BSON document in an arena, libbson keeps pointers to both fields.
+	*/
+	struct ArenaBuffer
+	{
+		uint8_t* data;
+		size_t size;
+	};
+
+	void* arena_bson_realloc(void* memory, size_t size, void* context)
+	{
+		return ((QueryArena*)context)->reallocate(memory, size);
+	}
+
+	bson_t* new_arena_bson(QueryArena& arena)
+	{
+		auto buffer = (ArenaBuffer*)arena.allocate(sizeof(ArenaBuffer));
+		buffer->data = nullptr;
+		buffer->size = 0;
+		return bson_new_from_buffer(&buffer->data, &buffer->size, arena_bson_realloc, &arena);
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <bson.h>
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Size of the blocks a query arena takes from the heap, larger allocations get a block of their own.
+	*/
+	const size_t QUERY_ARENA_BLOCK_SIZE = 64 * 1024;
+
+	/**
+	* Allocations served by an arena since its counters were cleared.
+	* blocks is the number of heap allocations the arena itself made.
+	*/
+	struct ArenaStats
+	{
+		uint64_t allocations = 0;
+		uint64_t bytes = 0;
+		uint64_t blocks = 0;
+	};
+
+	/**
+	* Monotonic allocator for the intermediate state of one query (BSON filters and options of every cursor).
+	* Nothing is freed until reset, which keeps the blocks for the next query. Allocation is thread safe
+	* so that parallel cursors of a request can share the arena of the request.
+	*/
+	struct QueryArena
+	{
+		QueryArena() = default;
+		~QueryArena();
+		QueryArena(const QueryArena&) = delete;
+		QueryArena& operator=(const QueryArena&) = delete;
+
+		void* allocate(size_t size, size_t align = 16);
+
+		/**
+		* Grow an allocation of this arena. The latest allocation grows in place while its block has room,
+		* others are copied and their old space is only reclaimed on reset.
+		*/
+		void* reallocate(void* memory, size_t size);
+
+		/**
+		* Forget every allocation and keep the blocks, the counters are kept.
+		*/
+		void reset();
+
+		ArenaStats stats() const;
+		void clear_stats();
+
+	private:
+		struct Block
+		{
+			uint8_t* data;
+			size_t size;
+		};
+
+		void* allocate_locked(size_t size, size_t align);
+
+		mutable std::mutex mutex;
+		std::vector<Block> blocks;
+		size_t current_block = 0;
+		size_t offset = 0;
+		uint8_t* last = nullptr; // Latest allocation, the one that can grow in place
+		ArenaStats counters;
+	};
+
+	/**
+	* Create an empty BSON document whose buffer grows in the arena.
+	* bson_destroy must still be called, it only frees the bson_t itself.
+	*/
+	bson_t* new_arena_bson(QueryArena& arena);
+}
@@ -0,0 +1,555 @@
+#include "query_cache.h"
+
+#include <algorithm>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	const uint32_t QUERY_CACHE_MAGIC = 0x43515654; // "TVQC"
+	const uint32_t QUERY_CACHE_VERSION = 1;
+	const char* QUERY_CACHE_EXTENSION = ".tvc";
+	const char* QUERY_CACHE_TEMP_EXTENSION = ".tmp";
+	const uint64_t QUERY_CACHE_DEFAULT_MAX_BYTES = 1024ull * 1024 * 1024;
+
+	/*
+	* Cache file layout, every block is padded to 8 bytes so the buffers can be read in place:
+	*   QueryCacheFileHeader
+	*   chunk_count x { QueryCacheChunkHeader, column_count x { QueryCacheColumnHeader, name, data, validity, offsets, positions } }
+	*/
+	struct QueryCacheFileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t fingerprint;
+		uint64_t document_count;
+		uint64_t max_id_hash;
+		uint64_t rows;
+		uint32_t chunk_count;
+		uint32_t reserved;
+	};
+
+	struct QueryCacheChunkHeader
+	{
+		uint64_t rows;
+		uint32_t column_count;
+		uint32_t reserved;
+	};
+
+	struct QueryCacheColumnHeader
+	{
+		uint32_t type;
+		uint32_t position_state;
+		uint32_t name_size;
+		uint32_t reserved;
+		uint64_t data_size;
+		uint64_t validity_size;
+		uint64_t offsets_size;
+		uint64_t positions_size;
+	};
+
+	struct QueryCacheEntry
+	{
+		uint64_t fingerprint;
+		uint64_t size;
+		uint64_t last_used;
+		std::weak_ptr<CachedResult> reader; // Mapped entries are never evicted
+	};
+
+	// Entries are shared between the UI thread and the fetch workers.
+	std::mutex query_cache_mutex;
+	std::string query_cache_directory;
+	uint64_t query_cache_max_bytes = QUERY_CACHE_DEFAULT_MAX_BYTES;
+	bool query_cache_on = true;
+	uint64_t query_cache_clock = 0;
+	uint64_t query_cache_temp_counter = 0;
+	std::vector<QueryCacheEntry> query_cache_entries;
+	QueryCacheStats query_cache_counters;
+
+	uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+	{
+		// FNV-1a
+		auto bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	size_t pad8(size_t size)
+	{
+		return (size + 7) & ~(size_t)7;
+	}
+
+	std::string default_query_cache_directory()
+	{
+		auto root = getenv("LOCALAPPDATA");
+		if (root == nullptr)
+			root = getenv("TMP");
+		if (root == nullptr)
+			root = getenv("TMPDIR");
+		if (root == nullptr)
+			return "telemetry_query_cache";
+
+		return std::string(root) + "/TelemetryVisualizer/query_cache";
+	}
+
+	std::string query_cache_path(uint64_t fingerprint, const char* extension)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "/%016llx", (unsigned long long)fingerprint);
+		return query_cache_directory + name + extension;
+	}
+
+	QueryCacheEntry* find_query_cache_entry(uint64_t fingerprint)
+	{
+		for (auto& entry : query_cache_entries)
+		{
+			if (entry.fingerprint == fingerprint)
+				return &entry;
+		}
+		return nullptr;
+	}
+
+	/**
+	* Forget an entry and delete its file, the cache mutex must be held.
+	*/
+	void remove_query_cache_entry(uint64_t fingerprint)
+	{
+		for (auto it = query_cache_entries.begin(); it != query_cache_entries.end(); ++it)
+		{
+			if (it->fingerprint != fingerprint)
+				continue;
+
+			if (remove_file(query_cache_path(fingerprint, QUERY_CACHE_EXTENSION)))
+			{
+				query_cache_counters.bytes -= it->size;
+				query_cache_entries.erase(it);
+			}
+			return;
+		}
+	}
+
+	/**
+	* Evict the least recently used entries that are not mapped until the cache fits its bound.
+	* The cache mutex must be held.
+	*/
+	void evict_query_cache()
+	{
+		while (query_cache_counters.bytes > query_cache_max_bytes)
+		{
+			QueryCacheEntry* oldest = nullptr;
+			for (auto& entry : query_cache_entries)
+			{
+				if (entry.reader.expired() && (oldest == nullptr || entry.last_used < oldest->last_used))
+					oldest = &entry;
+			}
+
+			if (oldest == nullptr)
+				return;
+
+			auto count = query_cache_entries.size();
+			remove_query_cache_entry(oldest->fingerprint);
+			if (query_cache_entries.size() == count)
+				return; // Could not delete the file
+
+			++query_cache_counters.evictions;
+		}
+	}
+
+	void init_query_cache(const std::string& directory, uint64_t max_bytes)
+	{
+		std::lock_guard<std::mutex> lock(query_cache_mutex);
+
+		query_cache_directory = directory.empty() ? default_query_cache_directory() : directory;
+		query_cache_max_bytes = max_bytes > 0 ? max_bytes : QUERY_CACHE_DEFAULT_MAX_BYTES;
+		query_cache_entries.clear();
+		query_cache_counters.bytes = 0;
+
+		if (!make_directories(query_cache_directory))
+		{
+			fprintf(stderr, "Could not create the query cache directory %s\n", query_cache_directory.c_str());
+			return;
+		}
+
+		// Left over by a crash during a write
+		std::vector<FileInfo> files;
+		list_files(query_cache_directory, QUERY_CACHE_TEMP_EXTENSION, files);
+		for (auto& file : files)
+			remove_file(query_cache_directory + "/" + file.name);
+
+		// Restore the LRU order from the modification times, hits touch the file
+		files.clear();
+		list_files(query_cache_directory, QUERY_CACHE_EXTENSION, files);
+		std::sort(files.begin(), files.end(), [](const FileInfo& a, const FileInfo& b) { return a.modified < b.modified; });
+
+		for (auto& file : files)
+		{
+			char* end = nullptr;
+			auto fingerprint = strtoull(file.name.c_str(), &end, 16);
+			if (end == file.name.c_str())
+				continue;
+
+			QueryCacheEntry entry;
+			entry.fingerprint = fingerprint;
+			entry.size = file.size;
+			entry.last_used = ++query_cache_clock;
+			query_cache_entries.push_back(entry);
+			query_cache_counters.bytes += file.size;
+		}
+
+		evict_query_cache();
+	}
+
+	void set_query_cache_enabled(bool enabled)
+	{
+		std::lock_guard<std::mutex> lock(query_cache_mutex);
+		query_cache_on = enabled;
+	}
+
+	bool query_cache_enabled()
+	{
+		std::lock_guard<std::mutex> lock(query_cache_mutex);
+		return query_cache_on && !query_cache_directory.empty();
+	}
+
+	uint64_t query_fingerprint(const char* database_name, const char* collection_name, const bson_t* filter, const bson_t* opts, int position_parser)
+	{
+		auto hash = hash_bytes(&QUERY_CACHE_VERSION, sizeof(QUERY_CACHE_VERSION));
+		hash = hash_bytes(database_name, strlen(database_name) + 1, hash);
+		hash = hash_bytes(collection_name, strlen(collection_name) + 1, hash);
+		hash = hash_bytes(bson_get_data(filter), filter->len, hash);
+		hash = hash_bytes(bson_get_data(opts), opts->len, hash);
+		return hash_bytes(&position_parser, sizeof(position_parser), hash);
+	}
+
+	bool read_collection_stamp(mongoc_collection_t* collection, CollectionStamp& stamp)
+	{
+		bson_error_t error;
+		bson_t empty, opts, sort, projection;
+		const bson_t* doc = nullptr;
+
+		bson_init(&empty);
+		auto count = mongoc_collection_count(collection, MONGOC_QUERY_NONE, &empty, 0, 0, nullptr, &error);
+		if (count < 0)
+		{
+			bson_destroy(&empty);
+			fprintf(stderr, "Query cache count failed: %s\n", error.message);
+			return false;
+		}
+
+		bson_init(&opts);
+		BSON_APPEND_INT64(&opts, "limit", 1);
+		BSON_APPEND_DOCUMENT_BEGIN(&opts, "sort", &sort);
+		BSON_APPEND_INT32(&sort, "_id", -1);
+		bson_append_document_end(&opts, &sort);
+		BSON_APPEND_DOCUMENT_BEGIN(&opts, "projection", &projection);
+		BSON_APPEND_BOOL(&projection, "_id", true);
+		bson_append_document_end(&opts, &projection);
+
+		stamp.document_count = (uint64_t)count;
+		stamp.max_id_hash = 0;
+
+		auto cursor = mongoc_collection_find_with_opts(collection, &empty, &opts, NULL);
+		if (mongoc_cursor_next(cursor, &doc))
+			stamp.max_id_hash = hash_bytes(bson_get_data(doc), doc->len);
+
+		auto ok = !mongoc_cursor_error(cursor, &error);
+		if (!ok)
+			fprintf(stderr, "Query cache stamp failed: %s\n", error.message);
+
+		mongoc_cursor_destroy(cursor);
+		bson_destroy(&opts);
+		bson_destroy(&empty);
+		return ok;
+	}
+
+	/**
+	* Build the column views of a mapped cache file. Returns false if the file is truncated or malformed.
+	*/
+	bool read_cached_chunks(CachedResult& result, const QueryCacheFileHeader& header)
+	{
+		auto cursor = result.file.data + sizeof(QueryCacheFileHeader);
+		auto end = result.file.data + result.file.size;
+
+		auto take = [&](uint64_t size) -> const uint8_t* {
+			if ((uint64_t)(end - cursor) < size)
+				return nullptr;
+			auto block = cursor;
+			cursor += std::min((uint64_t)(end - cursor), (uint64_t)pad8((size_t)size));
+			return block;
+		};
+
+		for (uint32_t c = 0; c < header.chunk_count; ++c)
+		{
+			auto chunk = reinterpret_cast<const QueryCacheChunkHeader*>(take(sizeof(QueryCacheChunkHeader)));
+			if (chunk == nullptr)
+				return false;
+
+			std::vector<ColumnView> columns(chunk->column_count);
+			for (auto& view : columns)
+			{
+				auto column = reinterpret_cast<const QueryCacheColumnHeader*>(take(sizeof(QueryCacheColumnHeader)));
+				if (column == nullptr)
+					return false;
+
+				auto name = take(column->name_size);
+				view.data = take(column->data_size);
+				view.validity = take(column->validity_size);
+				auto offsets = take(column->offsets_size);
+				auto positions = take(column->positions_size);
+				if (name == nullptr || view.data == nullptr || view.validity == nullptr || offsets == nullptr || positions == nullptr)
+					return false;
+
+				view.name.assign(reinterpret_cast<const char*>(name), column->name_size);
+				view.type = (ColumnType)column->type;
+				view.size = (size_t)chunk->rows;
+				view.data_size = (size_t)column->data_size;
+				view.validity_size = (size_t)column->validity_size;
+				view.offsets = column->offsets_size > 0 ? reinterpret_cast<const uint32_t*>(offsets) : nullptr;
+				view.position_state = (PositionState)column->position_state;
+				view.positions = column->positions_size > 0 ? reinterpret_cast<const float*>(positions) : nullptr;
+
+				if (view.validity_size < (view.size + 7) / 8)
+					return false;
+			}
+
+			result.chunks.push_back(std::move(columns));
+			result.chunk_rows.push_back((size_t)chunk->rows);
+		}
+
+		result.rows = header.rows;
+		return true;
+	}
+
+	std::shared_ptr<CachedResult> open_cached_result(uint64_t fingerprint, const CollectionStamp& stamp)
+	{
+		std::lock_guard<std::mutex> lock(query_cache_mutex);
+
+		auto entry = find_query_cache_entry(fingerprint);
+		if (entry == nullptr)
+		{
+			++query_cache_counters.misses;
+			return nullptr;
+		}
+
+		auto path = query_cache_path(fingerprint, QUERY_CACHE_EXTENSION);
+		std::shared_ptr<CachedResult> result(new CachedResult());
+		if (!result->file.open(path) || result->file.size < sizeof(QueryCacheFileHeader))
+		{
+			++query_cache_counters.misses;
+			remove_query_cache_entry(fingerprint);
+			return nullptr;
+		}
+
+		auto header = reinterpret_cast<const QueryCacheFileHeader*>(result->file.data);
+		if (header->magic != QUERY_CACHE_MAGIC || header->version != QUERY_CACHE_VERSION || header->fingerprint != fingerprint)
+		{
+			result.reset();
+			++query_cache_counters.misses;
+			remove_query_cache_entry(fingerprint);
+			return nullptr;
+		}
+
+		if (header->document_count != stamp.document_count || header->max_id_hash != stamp.max_id_hash)
+		{
+			result.reset();
+			++query_cache_counters.misses;
+			++query_cache_counters.stale;
+			if (entry->reader.expired())
+				remove_query_cache_entry(fingerprint);
+			return nullptr;
+		}
+
+		if (!read_cached_chunks(*result, *header))
+		{
+			result.reset();
+			++query_cache_counters.misses;
+			remove_query_cache_entry(fingerprint);
+			return nullptr;
+		}
+
+		++query_cache_counters.hits;
+		entry->last_used = ++query_cache_clock;
+		entry->reader = result;
+		touch_file(path);
+		return result;
+	}
+
+	void clear_query_cache()
+	{
+		std::lock_guard<std::mutex> lock(query_cache_mutex);
+
+		std::vector<uint64_t> fingerprints;
+		for (auto& entry : query_cache_entries)
+		{
+			if (entry.reader.expired())
+				fingerprints.push_back(entry.fingerprint);
+		}
+
+		for (auto fingerprint : fingerprints)
+			remove_query_cache_entry(fingerprint);
+	}
+
+	QueryCacheStats query_cache_stats()
+	{
+		std::lock_guard<std::mutex> lock(query_cache_mutex);
+
+		auto stats = query_cache_counters;
+		stats.entries = query_cache_entries.size();
+		stats.max_bytes = query_cache_max_bytes;
+		return stats;
+	}
+
+	QueryCacheWriter::~QueryCacheWriter()
+	{
+		abort();
+	}
+
+	bool QueryCacheWriter::begin(uint64_t query_fingerprint, const CollectionStamp& collection_stamp)
+	{
+		abort();
+
+		{
+			std::lock_guard<std::mutex> lock(query_cache_mutex);
+			if (!query_cache_on || query_cache_directory.empty())
+				return false;
+
+			char suffix[32];
+			snprintf(suffix, sizeof(suffix), ".%llu", (unsigned long long)++query_cache_temp_counter);
+			temp_path = query_cache_path(query_fingerprint, suffix) + QUERY_CACHE_TEMP_EXTENSION;
+		}
+
+		file = fopen(temp_path.c_str(), "wb");
+		if (file == nullptr)
+			return false;
+
+		fingerprint = query_fingerprint;
+		stamp = collection_stamp;
+		chunk_count = 0;
+		rows = 0;
+
+		// Written again with the final counts on commit
+		QueryCacheFileHeader header = {};
+		if (fwrite(&header, sizeof(header), 1, file) != 1)
+		{
+			abort();
+			return false;
+		}
+		return true;
+	}
+
+	bool QueryCacheWriter::write_chunk(const std::vector<Column>& columns)
+	{
+		if (file == nullptr)
+			return false;
+
+		static const uint8_t padding[8] = {};
+		auto ok = true;
+		auto write_block = [&](const void* data, size_t size) {
+			if (size > 0)
+				ok = ok && fwrite(data, 1, size, file) == size;
+			if (pad8(size) != size)
+				ok = ok && fwrite(padding, 1, pad8(size) - size, file) == pad8(size) - size;
+		};
+
+		QueryCacheChunkHeader chunk = {};
+		chunk.rows = columns.empty() ? 0 : columns[0].size;
+		chunk.column_count = (uint32_t)columns.size();
+		write_block(&chunk, sizeof(chunk));
+
+		for (auto& column : columns)
+		{
+			auto view = view_column(column);
+
+			QueryCacheColumnHeader header = {};
+			header.type = view.type;
+			header.position_state = view.position_state;
+			header.name_size = (uint32_t)view.name.size();
+			header.data_size = view.data_size;
+			header.validity_size = view.validity_size;
+			header.offsets_size = view.offsets ? (view.size + 1) * sizeof(uint32_t) : 0;
+			header.positions_size = view.positions ? view.size * 3 * sizeof(float) : 0;
+
+			write_block(&header, sizeof(header));
+			write_block(view.name.data(), header.name_size);
+			write_block(view.data, (size_t)header.data_size);
+			write_block(view.validity, (size_t)header.validity_size);
+			write_block(view.offsets, (size_t)header.offsets_size);
+			write_block(view.positions, (size_t)header.positions_size);
+		}
+
+		if (!ok)
+		{
+			abort();
+			return false;
+		}
+
+		++chunk_count;
+		rows += chunk.rows;
+		return true;
+	}
+
+	bool QueryCacheWriter::commit()
+	{
+		if (file == nullptr)
+			return false;
+
+		QueryCacheFileHeader header = {};
+		header.magic = QUERY_CACHE_MAGIC;
+		header.version = QUERY_CACHE_VERSION;
+		header.fingerprint = fingerprint;
+		header.document_count = stamp.document_count;
+		header.max_id_hash = stamp.max_id_hash;
+		header.rows = rows;
+		header.chunk_count = chunk_count;
+
+		auto size = (uint64_t)ftell(file);
+		auto ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+		ok = fclose(file) == 0 && ok;
+		file = nullptr;
+
+		std::lock_guard<std::mutex> lock(query_cache_mutex);
+
+		// Fails on Windows if the current entry is mapped by a reader, the old entry is kept then
+		auto entry = find_query_cache_entry(fingerprint);
+		if (!ok || (entry != nullptr && !entry->reader.expired()) || !replace_file(temp_path, query_cache_path(fingerprint, QUERY_CACHE_EXTENSION)))
+		{
+			remove_file(temp_path);
+			temp_path.clear();
+			return false;
+		}
+		temp_path.clear();
+
+		if (entry == nullptr)
+		{
+			query_cache_entries.push_back(QueryCacheEntry());
+			entry = &query_cache_entries.back();
+			entry->fingerprint = fingerprint;
+			entry->size = 0;
+		}
+
+		query_cache_counters.bytes += size - entry->size;
+		entry->size = size;
+		entry->last_used = ++query_cache_clock;
+		entry->reader.reset();
+		++query_cache_counters.writes;
+
+		evict_query_cache();
+		return true;
+	}
+
+	void QueryCacheWriter::abort()
+	{
+		if (file == nullptr)
+			return;
+
+		fclose(file);
+		file = nullptr;
+		remove_file(temp_path);
+		temp_path.clear();
+	}
+}
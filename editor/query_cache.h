@@ -0,0 +1,112 @@
+#pragma once
+
+#include "column_set.h"
+#include "mapped_file.h"
+
+#include <mongoc.h>
+#include <bson.h>
+
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Cheap freshness check of a collection. A cached result is only served if the
+	* collection still has the same document count and the same largest _id.
+	*/
+	struct CollectionStamp
+	{
+		uint64_t document_count = 0;
+		uint64_t max_id_hash = 0;
+	};
+
+	/**
+	* A cached query result mapped from disk. The column views point straight into the mapping,
+	* one set of columns per chunk as they were written.
+	*/
+	struct CachedResult
+	{
+		MappedFile file;
+		std::vector<std::vector<ColumnView>> chunks;
+		std::vector<size_t> chunk_rows;
+		uint64_t rows = 0;
+	};
+
+	/**
+	* Streams the chunks of a result to a temporary cache file. The file only replaces the
+	* cache entry once committed, so an aborted or failed fetch never leaves a partial entry behind.
+	*/
+	struct QueryCacheWriter
+	{
+		QueryCacheWriter() = default;
+		~QueryCacheWriter();
+		QueryCacheWriter(const QueryCacheWriter&) = delete;
+		QueryCacheWriter& operator=(const QueryCacheWriter&) = delete;
+
+		bool begin(uint64_t query_fingerprint, const CollectionStamp& collection_stamp);
+		bool write_chunk(const std::vector<Column>& columns);
+		bool commit();
+		void abort();
+
+		bool is_open() const { return file != nullptr; }
+
+	private:
+		FILE* file = nullptr;
+		uint64_t fingerprint = 0;
+		CollectionStamp stamp;
+		uint32_t chunk_count = 0;
+		uint64_t rows = 0;
+		std::string temp_path;
+	};
+
+	/**
+	* Hit and miss counters of the query cache since the plugin was loaded.
+	*/
+	struct QueryCacheStats
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t stale = 0; // Misses where an entry existed but the collection had changed
+		uint64_t writes = 0;
+		uint64_t evictions = 0;
+		uint64_t entries = 0;
+		uint64_t bytes = 0;
+		uint64_t max_bytes = 0;
+	};
+
+	/**
+	* Set the cache directory and size bound and load the existing entries.
+	* Pass an empty directory to use the default one.
+	*/
+	void init_query_cache(const std::string& directory, uint64_t max_bytes);
+
+	void set_query_cache_enabled(bool enabled);
+	bool query_cache_enabled();
+
+	/**
+	* Fingerprint of a query: database, collection, the built BSON filter and options and the position parser.
+	*/
+	uint64_t query_fingerprint(const char* database_name, const char* collection_name, const bson_t* filter, const bson_t* opts, int position_parser);
+
+	/**
+	* Read the document count and largest _id of a collection.
+	*/
+	bool read_collection_stamp(mongoc_collection_t* collection, CollectionStamp& stamp);
+
+	/**
+	* Map the cached result of a query if there is one and it is still fresh.
+	* Updates the hit/miss counters and the LRU order. Returns nullptr on a miss.
+	*/
+	std::shared_ptr<CachedResult> open_cached_result(uint64_t fingerprint, const CollectionStamp& stamp);
+
+	/**
+	* Remove every entry that is not currently mapped.
+	*/
+	void clear_query_cache();
+
+	QueryCacheStats query_cache_stats();
+}
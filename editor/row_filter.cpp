@@ -0,0 +1,500 @@
+#include "row_filter.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define ROW_FILTER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define ROW_FILTER_SSE2
+#endif
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Largest sets of doubles compared member by member in one SIMD pass, larger sets are searched row by row.
+	*/
+	const size_t FILTER_SIMD_SET = 8;
+
+	/**
+	* Integer sets spanning at most this many values are matched with a lookup table.
+	*/
+	const uint64_t FILTER_LOOKUP_SPAN = 65536;
+
+	const double INT64_LIMIT = 9223372036854775808.0;
+
+	size_t bitmap_words(size_t rows)
+	{
+		return (rows + 63) / 64;
+	}
+
+	/**
+	* Clear the bits past the last row, so whole words can be counted and complemented.
+	*/
+	void clear_bitmap_tail(RowBitmap& bitmap, size_t rows)
+	{
+		if ((rows & 63) != 0 && !bitmap.empty())
+			bitmap.back() &= (1ull << (rows & 63)) - 1;
+	}
+
+	/**
+	* Index of the lowest set bit of a non-zero word.
+	*/
+	unsigned lowest_bit(uint64_t word)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward64(&index, word);
+		return (unsigned)index;
+#else
+		return (unsigned)__builtin_ctzll(word);
+#endif
+	}
+
+	/**
+	* Set the bits of rows [begin, rows) for which match(row) is true, begin being a multiple of 64.
+	* Every word is built in a register and written once.
+	*/
+	template <typename Match>
+	void match_rows(size_t begin, size_t rows, uint64_t* words, Match match)
+	{
+		for (auto row = begin; row < rows; row += 64)
+		{
+			uint64_t word = 0;
+			auto count = std::min<size_t>(64, rows - row);
+			for (size_t j = 0; j < count; ++j)
+				word |= (uint64_t)match(row + j) << j;
+			words[row / 64] |= word;
+		}
+	}
+
+	void and_validity(const Column& column, size_t rows, RowBitmap& bitmap)
+	{
+		auto bytes = std::min(column.validity.size(), (rows + 7) / 8);
+		for (size_t w = 0; w < bitmap.size(); ++w)
+		{
+			uint64_t valid = 0;
+			for (size_t b = 0; b < 8 && w * 8 + b < bytes; ++b)
+				valid |= (uint64_t)column.validity[w * 8 + b] << (b * 8);
+			bitmap[w] &= valid;
+		}
+	}
+
+	/**
+	* Set the bits of the rows with lo <= value <= hi, NaN values never match.
+	*/
+	void match_double_range(const double* values, size_t rows, double lo, double hi, uint64_t* words)
+	{
+		size_t row = 0;
+#if defined(ROW_FILTER_AVX2)
+		const auto lo4 = _mm256_set1_pd(lo);
+		const auto hi4 = _mm256_set1_pd(hi);
+		for (; row + 64 <= rows; row += 64)
+		{
+			uint64_t word = 0;
+			for (unsigned j = 0; j < 64; j += 4)
+			{
+				auto value = _mm256_loadu_pd(values + row + j);
+				auto in = _mm256_and_pd(_mm256_cmp_pd(value, lo4, _CMP_GE_OQ), _mm256_cmp_pd(value, hi4, _CMP_LE_OQ));
+				word |= (uint64_t)_mm256_movemask_pd(in) << j;
+			}
+			words[row / 64] |= word;
+		}
+#elif defined(ROW_FILTER_SSE2)
+		const auto lo2 = _mm_set1_pd(lo);
+		const auto hi2 = _mm_set1_pd(hi);
+		for (; row + 64 <= rows; row += 64)
+		{
+			uint64_t word = 0;
+			for (unsigned j = 0; j < 64; j += 2)
+			{
+				auto value = _mm_loadu_pd(values + row + j);
+				auto in = _mm_and_pd(_mm_cmpge_pd(value, lo2), _mm_cmple_pd(value, hi2));
+				word |= (uint64_t)_mm_movemask_pd(in) << j;
+			}
+			words[row / 64] |= word;
+		}
+#endif
+		match_rows(row, rows, words, [=](size_t r) { return values[r] >= lo && values[r] <= hi; });
+	}
+
+	/**
+	* Set the bits of the rows with lo <= value <= hi. SSE2 has no 64 bit compare, so only AVX2 compares four at a time.
+	*/
+	void match_int64_range(const int64_t* values, size_t rows, int64_t lo, int64_t hi, uint64_t* words)
+	{
+		size_t row = 0;
+#if defined(ROW_FILTER_AVX2)
+		const auto lo4 = _mm256_set1_epi64x(lo);
+		const auto hi4 = _mm256_set1_epi64x(hi);
+		for (; row + 64 <= rows; row += 64)
+		{
+			uint64_t word = 0;
+			for (unsigned j = 0; j < 64; j += 4)
+			{
+				auto value = _mm256_loadu_si256((const __m256i*)(values + row + j));
+				auto out = _mm256_or_si256(_mm256_cmpgt_epi64(lo4, value), _mm256_cmpgt_epi64(value, hi4));
+				word |= (uint64_t)(~_mm256_movemask_pd(_mm256_castsi256_pd(out)) & 0xF) << j;
+			}
+			words[row / 64] |= word;
+		}
+#endif
+		// One unsigned compare of the offset from lo, which also holds for spans past INT64_MAX
+		auto span = (uint64_t)hi - (uint64_t)lo;
+		match_rows(row, rows, words, [=](size_t r) { return (uint64_t)values[r] - (uint64_t)lo <= span; });
+	}
+
+	/**
+	* Set the bits of the rows whose byte equals value.
+	*/
+	void match_bytes(const uint8_t* values, size_t rows, uint8_t value, uint64_t* words)
+	{
+		size_t row = 0;
+#if defined(ROW_FILTER_AVX2)
+		const auto value32 = _mm256_set1_epi8((char)value);
+		for (; row + 64 <= rows; row += 64)
+		{
+			auto low = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(values + row)), value32));
+			auto high = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(values + row + 32)), value32));
+			words[row / 64] |= (uint64_t)high << 32 | low;
+		}
+#elif defined(ROW_FILTER_SSE2)
+		const auto value16 = _mm_set1_epi8((char)value);
+		for (; row + 64 <= rows; row += 64)
+		{
+			uint64_t word = 0;
+			for (unsigned j = 0; j < 64; j += 16)
+				word |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(values + row + j)), value16)) << j;
+			words[row / 64] |= word;
+		}
+#endif
+		match_rows(row, rows, words, [=](size_t r) { return values[r] == value; });
+	}
+
+	/**
+	* Whether a number matches a leaf filter, used for bool columns and the rows of large sets.
+	*/
+	bool number_matches(const RowFilter& filter, double value)
+	{
+		switch (filter.kind)
+		{
+			case FILTER_RANGE:
+				return value >= filter.min && value <= filter.max;
+			case FILTER_EQUALS:
+				return !filter.numbers.empty() && value == filter.numbers[0];
+			case FILTER_IN:
+				return std::find(filter.numbers.begin(), filter.numbers.end(), value) != filter.numbers.end();
+			default:
+				return false;
+		}
+	}
+
+	/**
+	* Integer bounds of the integers within [lo, hi], false if there are none.
+	*/
+	bool int64_bounds(double lo, double hi, int64_t& lo_int, int64_t& hi_int)
+	{
+		lo = ceil(lo);
+		hi = floor(hi);
+		if (!(lo <= hi) || lo >= INT64_LIMIT || hi < -INT64_LIMIT)
+			return false;
+
+		lo_int = lo < -INT64_LIMIT ? INT64_MIN : (int64_t)lo;
+		hi_int = hi >= INT64_LIMIT ? INT64_MAX : (int64_t)hi;
+		return true;
+	}
+
+	/**
+	* Set the bits of the rows equal to a member of a small set, comparing every member in one pass over the values.
+	*/
+	void match_double_set(const double* values, size_t rows, const std::vector<double>& set, uint64_t* words)
+	{
+		size_t row = 0;
+#if defined(ROW_FILTER_AVX2)
+		for (; row + 64 <= rows; row += 64)
+		{
+			uint64_t word = 0;
+			for (unsigned j = 0; j < 64; j += 4)
+			{
+				auto value = _mm256_loadu_pd(values + row + j);
+				auto in = _mm256_setzero_pd();
+				for (auto member : set)
+					in = _mm256_or_pd(in, _mm256_cmp_pd(value, _mm256_set1_pd(member), _CMP_EQ_OQ));
+				word |= (uint64_t)_mm256_movemask_pd(in) << j;
+			}
+			words[row / 64] |= word;
+		}
+#elif defined(ROW_FILTER_SSE2)
+		for (; row + 64 <= rows; row += 64)
+		{
+			uint64_t word = 0;
+			for (unsigned j = 0; j < 64; j += 2)
+			{
+				auto value = _mm_loadu_pd(values + row + j);
+				auto in = _mm_setzero_pd();
+				for (auto member : set)
+					in = _mm_or_pd(in, _mm_cmpeq_pd(value, _mm_set1_pd(member)));
+				word |= (uint64_t)_mm_movemask_pd(in) << j;
+			}
+			words[row / 64] |= word;
+		}
+#endif
+		match_rows(row, rows, words, [&](size_t r) { return std::find(set.begin(), set.end(), values[r]) != set.end(); });
+	}
+
+	/**
+	* Set the bits of the rows equal to a member of a sorted set of integers. Sets spanning few values are
+	* looked up in a table, others are searched.
+	*/
+	void match_int64_set(const int64_t* values, size_t rows, const std::vector<int64_t>& set, uint64_t* words)
+	{
+		if (set.empty())
+			return;
+		if (set.size() == 1)
+		{
+			match_int64_range(values, rows, set[0], set[0], words);
+			return;
+		}
+
+		auto first = set.front();
+		auto span = (uint64_t)set.back() - (uint64_t)first + 1;
+		if (span > FILTER_LOOKUP_SPAN)
+		{
+			match_rows(0, rows, words, [&](size_t r) { return std::binary_search(set.begin(), set.end(), values[r]); });
+			return;
+		}
+
+		std::vector<uint8_t> table(span, 0);
+		for (auto member : set)
+			table[(uint64_t)member - (uint64_t)first] = 1;
+
+		const uint8_t* lookup = table.data();
+		match_rows(0, rows, words, [=](size_t r) {
+			auto offset = (uint64_t)values[r] - (uint64_t)first;
+			return offset < span && lookup[offset] != 0;
+		});
+	}
+
+	void match_numbers(const Column& column, size_t rows, const RowFilter& filter, uint64_t* words)
+	{
+		if (filter.kind == FILTER_PREFIX)
+			return;
+
+		if (column.type == COLUMN_TYPE_BOOL)
+		{
+			auto match_false = number_matches(filter, 0.0);
+			auto match_true = number_matches(filter, 1.0);
+			if (match_false && match_true)
+				memset(words, 0xFF, bitmap_words(rows) * sizeof(uint64_t));
+			else if (match_false || match_true)
+				match_bytes(column.bools.data(), rows, match_true ? 1 : 0, words);
+			return;
+		}
+
+		if (filter.kind == FILTER_RANGE)
+		{
+			int64_t lo, hi;
+			if (column.type == COLUMN_TYPE_DOUBLE)
+				match_double_range(column.doubles.data(), rows, filter.min, filter.max, words);
+			else if (column.type == COLUMN_TYPE_INT64 && int64_bounds(filter.min, filter.max, lo, hi))
+				match_int64_range(column.ints.data(), rows, lo, hi, words);
+			return;
+		}
+
+		std::vector<double> set(filter.numbers.begin(), filter.kind == FILTER_IN ? filter.numbers.end() : filter.numbers.begin() + std::min<size_t>(filter.numbers.size(), 1));
+		std::sort(set.begin(), set.end());
+		set.erase(std::unique(set.begin(), set.end()), set.end());
+
+		if (column.type == COLUMN_TYPE_INT64)
+		{
+			// Members that are not integers never match
+			std::vector<int64_t> members;
+			for (auto value : set)
+			{
+				int64_t member, unused;
+				if (int64_bounds(value, value, member, unused))
+					members.push_back(member);
+			}
+			match_int64_set(column.ints.data(), rows, members, words);
+		}
+		else if (column.type == COLUMN_TYPE_DOUBLE)
+		{
+			if (set.size() <= FILTER_SIMD_SET)
+				match_double_set(column.doubles.data(), rows, set, words);
+			else
+				match_rows(0, rows, words, [&](size_t r) { return std::binary_search(set.begin(), set.end(), column.doubles[r]); });
+		}
+	}
+
+	int compare_bytes(const char* a, size_t a_size, const char* b, size_t b_size)
+	{
+		auto result = memcmp(a, b, std::min(a_size, b_size));
+		if (result != 0)
+			return result;
+		return a_size < b_size ? -1 : (a_size > b_size ? 1 : 0);
+	}
+
+	void match_strings(const Column& column, size_t rows, const RowFilter& filter, uint64_t* words)
+	{
+		if (filter.strings.empty() || (filter.kind != FILTER_EQUALS && filter.kind != FILTER_IN && filter.kind != FILTER_PREFIX))
+			return;
+
+		std::vector<std::string> set(filter.strings.begin(), filter.kind == FILTER_IN ? filter.strings.end() : filter.strings.begin() + 1);
+		std::sort(set.begin(), set.end(), [](const std::string& a, const std::string& b) {
+			return compare_bytes(a.data(), a.size(), b.data(), b.size()) < 0;
+		});
+
+		// Small sets are compared in order, most rows failing on the size, larger ones are searched
+		const char* blob = column.blob.data();
+		const uint32_t* offsets = column.offsets.data();
+		if (filter.kind == FILTER_PREFIX)
+		{
+			auto& prefix = set[0];
+			match_rows(0, rows, words, [&](size_t r) {
+				return offsets[r + 1] - offsets[r] >= prefix.size() && memcmp(blob + offsets[r], prefix.data(), prefix.size()) == 0;
+			});
+		}
+		else if (set.size() <= FILTER_SIMD_SET)
+		{
+			match_rows(0, rows, words, [&](size_t r) {
+				size_t size = offsets[r + 1] - offsets[r];
+				for (auto& member : set)
+				{
+					if (member.size() == size && memcmp(blob + offsets[r], member.data(), size) == 0)
+						return true;
+				}
+				return false;
+			});
+		}
+		else
+		{
+			match_rows(0, rows, words, [&](size_t r) {
+				auto str = blob + offsets[r];
+				size_t size = offsets[r + 1] - offsets[r];
+				auto it = std::lower_bound(set.begin(), set.end(), str, [size](const std::string& member, const char* value) {
+					return compare_bytes(member.data(), member.size(), value, size) < 0;
+				});
+				return it != set.end() && compare_bytes(it->data(), it->size(), str, size) == 0;
+			});
+		}
+	}
+
+	const Column* find_filter_column(const std::vector<Column>& columns, const std::string& field)
+	{
+		for (auto& column : columns)
+		{
+			if (column.name == field)
+				return &column;
+		}
+		return nullptr;
+	}
+
+	bool evaluate_filter_node(const std::vector<Column>& columns, size_t rows, const RowFilter& filter, RowBitmap& bitmap, std::string& error)
+	{
+		auto words = bitmap_words(rows);
+
+		if (filter.kind == FILTER_AND || filter.kind == FILTER_OR)
+		{
+			auto is_and = filter.kind == FILTER_AND;
+			bitmap.assign(words, is_and ? ~0ull : 0ull);
+
+			RowBitmap child_bitmap;
+			for (auto& child : filter.children)
+			{
+				if (!evaluate_filter_node(columns, rows, child, child_bitmap, error))
+					return false;
+
+				uint64_t any = 0;
+				for (size_t w = 0; w < words; ++w)
+				{
+					bitmap[w] = is_and ? bitmap[w] & child_bitmap[w] : bitmap[w] | child_bitmap[w];
+					any |= bitmap[w];
+				}
+
+				// Nothing is left for the other children to keep
+				if (is_and && any == 0)
+					break;
+			}
+			clear_bitmap_tail(bitmap, rows);
+			return true;
+		}
+
+		auto column = find_filter_column(columns, filter.field);
+		if (column == nullptr)
+		{
+			error = "No field " + filter.field + " in the fetch result";
+			return false;
+		}
+
+		bitmap.assign(words, 0);
+		rows = std::min(rows, column->size);
+		if (column->type == COLUMN_TYPE_STRING)
+			match_strings(*column, rows, filter, bitmap.data());
+		else if (column->type != COLUMN_TYPE_NULL)
+			match_numbers(*column, rows, filter, bitmap.data());
+
+		and_validity(*column, rows, bitmap);
+		clear_bitmap_tail(bitmap, rows);
+		return true;
+	}
+
+	bool evaluate_row_filter(const std::vector<Column>& columns, size_t rows, const RowFilter& filter, RowBitmap& bitmap, std::string& error)
+	{
+		ScopedTimer timer("row_filter");
+		timer.documents = rows;
+
+		return evaluate_filter_node(columns, rows, filter, bitmap, error);
+	}
+
+	size_t count_bitmap_rows(const RowBitmap& bitmap)
+	{
+		size_t count = 0;
+		for (auto word : bitmap)
+		{
+			word = word - ((word >> 1) & 0x5555555555555555ull);
+			word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+			word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+			count += (size_t)((word * 0x0101010101010101ull) >> 56);
+		}
+		return count;
+	}
+
+	void bitmap_row_ranges(const RowBitmap& bitmap, size_t rows, std::vector<size_t>& ranges)
+	{
+		ranges.clear();
+		size_t row = 0;
+		while (row < rows)
+		{
+			// Find the first set bit, then the first clear bit after it, skipping whole words
+			auto set = bitmap[row / 64] >> (row & 63);
+			if (set == 0)
+			{
+				row = (row / 64 + 1) * 64;
+				continue;
+			}
+			row += lowest_bit(set);
+
+			auto begin = row;
+			while (row < rows)
+			{
+				auto clear = ~bitmap[row / 64] >> (row & 63);
+				if (clear != 0)
+				{
+					row += lowest_bit(clear);
+					break;
+				}
+				row = (row / 64 + 1) * 64;
+			}
+			ranges.push_back(begin);
+			ranges.push_back(std::min(row, rows));
+		}
+	}
+}
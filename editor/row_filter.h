@@ -0,0 +1,57 @@
+#pragma once
+
+#include "column_set.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	enum FilterKind
+	{
+		FILTER_AND = 0,
+		FILTER_OR,
+		FILTER_RANGE,   // min <= value <= max
+		FILTER_EQUALS,  // value == numbers[0] or strings[0]
+		FILTER_IN,      // value in numbers or strings
+		FILTER_PREFIX   // string value starts with strings[0]
+	};
+
+	/**
+	* A predicate over one column, or the AND / OR of child filters. Numbers compare with numeric and bool columns
+	* (true is 1), strings with string columns. Null rows and values of the other kind never match.
+	*/
+	struct RowFilter
+	{
+		FilterKind kind = FILTER_AND;
+		std::string field;
+		double min = 0.0;
+		double max = 0.0;
+		std::vector<double> numbers;
+		std::vector<std::string> strings;
+		std::vector<RowFilter> children; // An AND without children matches every row, an OR without children none
+	};
+
+	/**
+	* One bit per row, least significant bit first, like the validity bitmap of a column.
+	*/
+	typedef std::vector<uint64_t> RowBitmap;
+
+	/**
+	* Evaluate a filter over the first rows of columns into a bitmap of the matching rows. Comparisons run on
+	* 2 to 32 rows at a time with SSE2 or AVX2 when the plugin is compiled for them, children are combined a word at a time.
+	* Returns false and sets error if a predicate names a field that is not in columns.
+	*/
+	bool evaluate_row_filter(const std::vector<Column>& columns, size_t rows, const RowFilter& filter, RowBitmap& bitmap, std::string& error);
+
+	/**
+	* Number of rows set in a bitmap.
+	*/
+	size_t count_bitmap_rows(const RowBitmap& bitmap);
+
+	/**
+	* Write the rows set in a bitmap as [begin, end) pairs, the form taken by the row ranges of a point selection.
+	*/
+	void bitmap_row_ranges(const RowBitmap& bitmap, size_t rows, std::vector<size_t>& ranges);
+}
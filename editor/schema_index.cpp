@@ -0,0 +1,271 @@
+#include "schema_index.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* A schema and the index of its paths, kept while the plugin is loaded.
+	*/
+	struct SchemaEntry
+	{
+		CollectionSchema schema;
+		std::map<std::string, size_t> path_index;
+
+		~SchemaEntry()
+		{
+			if (schema.has_max_id)
+				bson_value_destroy(&schema.max_id);
+		}
+	};
+
+	std::map<std::string, std::unique_ptr<SchemaEntry>> collection_schemas;
+
+	FieldSchema& find_field(SchemaEntry& entry, const std::string& path)
+	{
+		auto it = entry.path_index.find(path);
+		if (it != entry.path_index.end())
+			return entry.schema.fields[it->second];
+
+		entry.path_index[path] = entry.schema.fields.size();
+		entry.schema.fields.push_back(FieldSchema());
+		entry.schema.fields.back().path = path;
+		return entry.schema.fields.back();
+	}
+
+	/**
+	* Record every path of a document, recursing into embedded documents.
+	*/
+	void walk_document(SchemaEntry& entry, bson_iter_t* iter, const std::string& prefix, int depth)
+	{
+		while (bson_iter_next(iter))
+		{
+			// Fetches leave _id out of their projection
+			if (depth == 0 && strcmp(bson_iter_key(iter), "_id") == 0)
+				continue;
+
+			auto path = prefix + bson_iter_key(iter);
+			auto type = bson_iter_type(iter);
+
+			auto& field = find_field(entry, path);
+			++field.present;
+			++field.type_counts[type < SCHEMA_TYPE_SLOTS ? type : 0];
+
+			bson_iter_t child;
+			if (type == BSON_TYPE_DOCUMENT && depth + 1 < SCHEMA_MAX_DEPTH && bson_iter_recurse(iter, &child))
+				walk_document(entry, &child, path + ".", depth + 1);
+		}
+	}
+
+	/**
+	* Walk the documents of a cursor, keeping track of the largest _id when track_max_id is set.
+	*/
+	bool walk_cursor(SchemaEntry& entry, mongoc_cursor_t* cursor, bool track_max_id)
+	{
+		const bson_t* doc = nullptr;
+		bson_error_t error;
+
+		while (mongoc_cursor_next(cursor, &doc))
+		{
+			bson_iter_t iter;
+			if (!bson_iter_init(&iter, doc))
+				continue;
+
+			walk_document(entry, &iter, "", 0);
+			++entry.schema.sampled_documents;
+
+			// The cursor is sorted by _id, the last document has the largest one
+			if (track_max_id && bson_iter_init_find(&iter, doc, "_id"))
+			{
+				if (entry.schema.has_max_id)
+					bson_value_destroy(&entry.schema.max_id);
+				bson_value_copy(bson_iter_value(&iter), &entry.schema.max_id);
+				entry.schema.has_max_id = true;
+			}
+		}
+
+		if (mongoc_cursor_error(cursor, &error))
+		{
+			fprintf(stderr, "Schema scan failed: %s\n", error.message);
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	* Sample the whole collection and read the largest _id.
+	*/
+	bool sample_schema(SchemaEntry& entry, mongoc_collection_t* collection, int64_t sample_size)
+	{
+		bson_t pipeline, stages, stage, sample, empty, opts, sort, projection;
+
+		bson_init(&pipeline);
+		BSON_APPEND_ARRAY_BEGIN(&pipeline, "pipeline", &stages);
+		BSON_APPEND_DOCUMENT_BEGIN(&stages, "0", &stage);
+		BSON_APPEND_DOCUMENT_BEGIN(&stage, "$sample", &sample);
+		BSON_APPEND_INT64(&sample, "size", sample_size);
+		bson_append_document_end(&stage, &sample);
+		bson_append_document_end(&stages, &stage);
+		bson_append_array_end(&pipeline, &stages);
+
+		auto cursor = mongoc_collection_aggregate(collection, MONGOC_QUERY_NONE, &pipeline, NULL, NULL);
+		auto ok = walk_cursor(entry, cursor, false);
+		mongoc_cursor_destroy(cursor);
+		bson_destroy(&pipeline);
+
+		if (!ok)
+			return false;
+
+		bson_init(&empty);
+		bson_init(&opts);
+		BSON_APPEND_INT64(&opts, "limit", 1);
+		BSON_APPEND_DOCUMENT_BEGIN(&opts, "sort", &sort);
+		BSON_APPEND_INT32(&sort, "_id", -1);
+		bson_append_document_end(&opts, &sort);
+		BSON_APPEND_DOCUMENT_BEGIN(&opts, "projection", &projection);
+		BSON_APPEND_BOOL(&projection, "_id", true);
+		bson_append_document_end(&opts, &projection);
+
+		const bson_t* doc = nullptr;
+		bson_iter_t iter;
+		cursor = mongoc_collection_find_with_opts(collection, &empty, &opts, NULL);
+		if (mongoc_cursor_next(cursor, &doc) && bson_iter_init_find(&iter, doc, "_id"))
+		{
+			bson_value_copy(bson_iter_value(&iter), &entry.schema.max_id);
+			entry.schema.has_max_id = true;
+		}
+
+		mongoc_cursor_destroy(cursor);
+		bson_destroy(&opts);
+		bson_destroy(&empty);
+		return true;
+	}
+
+	/**
+	* Walk the documents inserted after the largest _id seen so far, at most sample_size of them.
+	*/
+	bool refresh_schema(SchemaEntry& entry, mongoc_collection_t* collection, int64_t sample_size)
+	{
+		bson_t filter, id, opts, sort;
+
+		bson_init(&filter);
+		BSON_APPEND_DOCUMENT_BEGIN(&filter, "_id", &id);
+		BSON_APPEND_VALUE(&id, "$gt", &entry.schema.max_id);
+		bson_append_document_end(&filter, &id);
+
+		bson_init(&opts);
+		BSON_APPEND_INT64(&opts, "limit", sample_size);
+		BSON_APPEND_DOCUMENT_BEGIN(&opts, "sort", &sort);
+		BSON_APPEND_INT32(&sort, "_id", 1);
+		bson_append_document_end(&opts, &sort);
+
+		auto cursor = mongoc_collection_find_with_opts(collection, &filter, &opts, NULL);
+		auto ok = walk_cursor(entry, cursor, true);
+
+		mongoc_cursor_destroy(cursor);
+		bson_destroy(&opts);
+		bson_destroy(&filter);
+		return ok;
+	}
+
+	const CollectionSchema* find_collection_schema(mongoc_collection_t* collection, const char* database_name, int64_t sample_size, bool force)
+	{
+		CollectionStamp stamp;
+		if (collection == nullptr || !read_collection_stamp(collection, stamp))
+			return nullptr;
+
+		if (sample_size <= 0)
+			sample_size = SCHEMA_SAMPLE_SIZE;
+
+		auto key = std::string(database_name) + "." + mongoc_collection_get_name(collection);
+		auto& entry = collection_schemas[key];
+
+		if (entry != nullptr && !force)
+		{
+			auto& cached = entry->schema;
+			if (cached.stamp.document_count == stamp.document_count && cached.stamp.max_id_hash == stamp.max_id_hash)
+				return &cached;
+
+			// Only documents were appended, merge the new ones in
+			if (cached.has_max_id && stamp.document_count > cached.stamp.document_count && refresh_schema(*entry, collection, sample_size))
+			{
+				cached.stamp = stamp;
+				cached.incremental = true;
+				return &cached;
+			}
+		}
+
+		entry.reset(new SchemaEntry());
+		if (!sample_schema(*entry, collection, sample_size))
+		{
+			collection_schemas.erase(key);
+			return nullptr;
+		}
+
+		entry->schema.stamp = stamp;
+		return &entry->schema;
+	}
+
+	std::vector<std::string> schema_field_keys(const CollectionSchema& schema)
+	{
+		std::set<std::string> paths;
+		for (auto& field : schema.fields)
+			paths.insert(field.path);
+
+		std::vector<std::string> keys;
+
+		for (auto& field : schema.fields)
+		{
+			if (field.type_counts[BSON_TYPE_DOCUMENT] < field.present)
+			{
+				keys.push_back(field.path);
+				continue;
+			}
+
+			auto has_axes = true;
+			for (auto axis : { ".x", ".y", ".z" })
+				has_axes = has_axes && paths.count(field.path + axis) > 0;
+
+			if (has_axes)
+				keys.push_back(field.path);
+		}
+
+		return keys;
+	}
+
+	void clear_collection_schemas()
+	{
+		collection_schemas.clear();
+	}
+
+	const char* schema_type_name(int slot)
+	{
+		switch (slot)
+		{
+			case BSON_TYPE_DOUBLE: return "double";
+			case BSON_TYPE_UTF8: return "string";
+			case BSON_TYPE_DOCUMENT: return "document";
+			case BSON_TYPE_ARRAY: return "array";
+			case BSON_TYPE_BINARY: return "binary";
+			case BSON_TYPE_UNDEFINED: return "undefined";
+			case BSON_TYPE_OID: return "objectId";
+			case BSON_TYPE_BOOL: return "bool";
+			case BSON_TYPE_DATE_TIME: return "date";
+			case BSON_TYPE_NULL: return "null";
+			case BSON_TYPE_REGEX: return "regex";
+			case BSON_TYPE_DBPOINTER: return "dbPointer";
+			case BSON_TYPE_CODE: return "code";
+			case BSON_TYPE_SYMBOL: return "symbol";
+			case BSON_TYPE_CODEWSCOPE: return "codeWithScope";
+			case BSON_TYPE_INT32: return "int32";
+			case BSON_TYPE_TIMESTAMP: return "timestamp";
+			case BSON_TYPE_INT64: return "int64";
+			case BSON_TYPE_DECIMAL128: return "decimal128";
+			default: return "other";
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "query_cache.h"
+
+#include <mongoc.h>
+#include <bson.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Documents read by $sample when a schema is built, and at most read again on every incremental refresh.
+	*/
+	const int64_t SCHEMA_SAMPLE_SIZE = 1000;
+
+	/**
+	* Deepest nesting of documents walked, paths below it are not recorded.
+	*/
+	const int SCHEMA_MAX_DEPTH = 32;
+
+	/**
+	* Type histogram slots, one per BSON type up to decimal128. Other types (min and max key) share slot 0.
+	*/
+	const int SCHEMA_TYPE_SLOTS = BSON_TYPE_DECIMAL128 + 1;
+
+	/**
+	* One dotted path seen in the sampled documents. Arrays are leaves, so [x, y, z] positions
+	* show up as a single field, embedded documents are recorded themselves and recursed into.
+	*/
+	struct FieldSchema
+	{
+		std::string path;
+		uint64_t present = 0; // Sampled documents that have the path
+		uint64_t type_counts[SCHEMA_TYPE_SLOTS] = {};
+	};
+
+	/**
+	* Inferred schema of a collection, with paths in the order they were first seen.
+	*/
+	struct CollectionSchema
+	{
+		std::vector<FieldSchema> fields;
+		uint64_t sampled_documents = 0;
+		CollectionStamp stamp; // Collection state the schema was last refreshed against
+		bson_value_t max_id; // Largest _id seen, documents above it are read on an incremental refresh
+		bool has_max_id = false;
+		bool incremental = false; // Whether the last refresh only read new documents
+	};
+
+	/**
+	* Return the cached schema of a collection, building or refreshing it first if the collection changed.
+	* New documents are merged in when documents were only appended, otherwise the schema is sampled again.
+	* Pass force to sample again anyway. Returns nullptr if the collection could not be read.
+	* Schemas are cached per database and collection, and only used on the UI thread.
+	*/
+	const CollectionSchema* find_collection_schema(mongoc_collection_t* collection, const char* database_name, int64_t sample_size, bool force);
+
+	/**
+	* Paths the viewer can pick: every path that is not only an embedded document,
+	* and the embedded documents with x, y and z fields since they can be read as positions.
+	*/
+	std::vector<std::string> schema_field_keys(const CollectionSchema& schema);
+
+	/**
+	* Forget every cached schema, used when the server changes.
+	*/
+	void clear_collection_schemas();
+
+	/**
+	* Return the name used for a BSON type slot when sent to the viewer.
+	*/
+	const char* schema_type_name(int slot);
+}
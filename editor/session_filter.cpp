@@ -0,0 +1,219 @@
+#include "session_filter.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unordered_set>
+
+namespace PLUGIN_NAMESPACE
+{
+	size_t session_batch_count(const FetchQuery& query)
+	{
+		if (!query.filter_sessions || query.sessions_ids.size() <= SESSION_BATCH_SIZE)
+			return 1;
+		return (query.sessions_ids.size() + SESSION_BATCH_SIZE - 1) / SESSION_BATCH_SIZE;
+	}
+
+	void append_session_filter(bson_t* filter, const FetchQuery& query, size_t batch)
+	{
+		bson_t exists_position, session_id, ids;
+
+		// Only include documents with a position
+		BSON_APPEND_DOCUMENT_BEGIN(filter, "params.position", &exists_position);
+		BSON_APPEND_BOOL(&exists_position, "$exists", true);
+		bson_append_document_end(filter, &exists_position);
+
+		auto begin = (size_t)0;
+		auto end = query.sessions_ids.size();
+		if (batch != ALL_SESSION_BATCHES)
+		{
+			begin = batch * SESSION_BATCH_SIZE;
+			end = begin + SESSION_BATCH_SIZE < end ? begin + SESSION_BATCH_SIZE : end;
+		}
+
+		BSON_APPEND_DOCUMENT_BEGIN(filter, "session_id", &session_id);
+		BSON_APPEND_ARRAY_BEGIN(&session_id, "$in", &ids);
+		for (auto i = begin; i < end; ++i)
+		{
+			char index[16];
+			const char* key = nullptr;
+			auto key_length = bson_uint32_to_string((uint32_t)(i - begin), &key, index, sizeof(index));
+			bson_append_utf8(&ids, key, (int)key_length, query.sessions_ids[i].c_str(), (int)query.sessions_ids[i].size());
+		}
+		bson_append_array_end(&session_id, &ids);
+		bson_append_document_end(filter, &session_id);
+	}
+
+	bool resolve_level_sessions(mongoc_client_t* client, const char* database_name, FetchQuery& query, std::string& error)
+	{
+		if (query.level_key.empty())
+			return true;
+
+		ScopedTimer timer("fetch.join_level");
+
+		// Ids given along with the level narrow it down
+		std::unordered_set<std::string> allowed;
+		if (query.filter_sessions)
+			allowed.insert(query.sessions_ids.begin(), query.sessions_ids.end());
+
+		bson_t filter, opts, projection;
+		bson_init(&filter);
+		bson_init(&opts);
+
+		BSON_APPEND_UTF8(&filter, "params.level_key", query.level_key.c_str());
+		BSON_APPEND_DOCUMENT_BEGIN(&opts, "projection", &projection);
+		BSON_APPEND_BOOL(&projection, "_id", false);
+		BSON_APPEND_BOOL(&projection, "session_id", true);
+		bson_append_document_end(&opts, &projection);
+
+		auto collection = mongoc_client_get_collection(client, database_name, SESSION_START_COLLECTION);
+		auto cursor = mongoc_collection_find_with_opts(collection, &filter, &opts, NULL);
+
+		// A session can start more than once, ids are kept in the order they are first seen
+		std::vector<std::string> sessions_ids;
+		std::unordered_set<std::string> seen;
+		const bson_t* doc = nullptr;
+		while (mongoc_cursor_next(cursor, &doc))
+		{
+			timer.bytes += doc->len;
+			++timer.documents;
+
+			bson_iter_t iter;
+			uint32_t length = 0;
+			if (!bson_iter_init_find(&iter, doc, "session_id") || bson_iter_type(&iter) != BSON_TYPE_UTF8)
+				continue;
+
+			std::string id(bson_iter_utf8(&iter, &length), length);
+			if ((!query.filter_sessions || allowed.count(id) > 0) && seen.insert(id).second)
+				sessions_ids.push_back(std::move(id));
+		}
+
+		bson_error_t cursor_error;
+		auto ok = !mongoc_cursor_error(cursor, &cursor_error);
+		if (!ok)
+			error = cursor_error.message;
+
+		mongoc_cursor_destroy(cursor);
+		mongoc_collection_destroy(collection);
+		bson_destroy(&opts);
+		bson_destroy(&filter);
+
+		if (!ok)
+			return false;
+
+		query.filter_sessions = true;
+		query.sessions_ids = std::move(sessions_ids);
+		query.level_key.clear();
+		return true;
+	}
+
+	bool find_session_index(mongoc_collection_t* collection, std::string& suggestion)
+	{
+		bson_error_t error;
+		const bson_t* doc = nullptr;
+		auto found = false;
+
+		auto cursor = mongoc_collection_find_indexes(collection, &error);
+		while (cursor != nullptr && !found && mongoc_cursor_next(cursor, &doc))
+		{
+			bson_iter_t iter, key;
+			if (bson_iter_init_find(&iter, doc, "key") && bson_iter_recurse(&iter, &key) && bson_iter_next(&key))
+				found = strcmp(bson_iter_key(&key), "session_id") == 0;
+		}
+
+		if (cursor != nullptr)
+			mongoc_cursor_destroy(cursor);
+
+		if (!found)
+		{
+			suggestion = "db.";
+			suggestion += mongoc_collection_get_name(collection);
+			suggestion += ".createIndex({ \"session_id\": 1, \"params.position\": 1 })";
+		}
+
+		return found;
+	}
+
+	/**
+	* Walk down the inputStage chain of a plan stage, keeping the top stage name and the index or collection scan it ends with.
+	*/
+	void read_plan_stage(bson_iter_t* stage, QueryPlanStats& stats)
+	{
+		bson_iter_t child;
+		if (!bson_iter_recurse(stage, &child))
+			return;
+
+		while (bson_iter_next(&child))
+		{
+			auto key = bson_iter_key(&child);
+			if (strcmp(key, "stage") == 0 && bson_iter_type(&child) == BSON_TYPE_UTF8)
+			{
+				auto name = bson_iter_utf8(&child, nullptr);
+				if (stats.winning_stage.empty())
+					stats.winning_stage = name;
+				if (strcmp(name, "COLLSCAN") == 0)
+					stats.collection_scan = true;
+			}
+			else if (strcmp(key, "indexName") == 0 && bson_iter_type(&child) == BSON_TYPE_UTF8)
+			{
+				stats.index_name = bson_iter_utf8(&child, nullptr);
+			}
+			else if (strcmp(key, "inputStage") == 0)
+			{
+				read_plan_stage(&child, stats);
+			}
+			else if (strcmp(key, "inputStages") == 0)
+			{
+				bson_iter_t stages;
+				if (bson_iter_recurse(&child, &stages))
+				{
+					while (bson_iter_next(&stages))
+						read_plan_stage(&stages, stats);
+				}
+			}
+		}
+	}
+
+	bool explain_find(mongoc_database_t* database, const char* collection_name, const bson_t* filter, const bson_t* opts, QueryPlanStats& stats, std::string& error)
+	{
+		bson_t command, find, reply;
+		bson_error_t bson_error;
+		bson_iter_t iter, field;
+
+		bson_init(&command);
+		BSON_APPEND_DOCUMENT_BEGIN(&command, "explain", &find);
+		BSON_APPEND_UTF8(&find, "find", collection_name);
+		BSON_APPEND_DOCUMENT(&find, "filter", filter);
+		if (bson_iter_init(&iter, opts))
+		{
+			while (bson_iter_next(&iter))
+				bson_append_iter(&find, bson_iter_key(&iter), -1, &iter);
+		}
+		bson_append_document_end(&command, &find);
+		BSON_APPEND_UTF8(&command, "verbosity", "executionStats");
+
+		auto ok = mongoc_database_command_simple(database, &command, nullptr, &reply, &bson_error);
+		if (!ok)
+		{
+			error = bson_error.message;
+		}
+		else
+		{
+			if (bson_iter_init(&iter, &reply) && bson_iter_find_descendant(&iter, "queryPlanner.winningPlan", &field))
+				read_plan_stage(&field, stats);
+
+			if (bson_iter_init(&iter, &reply) && bson_iter_find_descendant(&iter, "executionStats.nReturned", &field))
+				stats.returned = bson_iter_as_int64(&field);
+			if (bson_iter_init(&iter, &reply) && bson_iter_find_descendant(&iter, "executionStats.totalKeysExamined", &field))
+				stats.keys_examined = bson_iter_as_int64(&field);
+			if (bson_iter_init(&iter, &reply) && bson_iter_find_descendant(&iter, "executionStats.totalDocsExamined", &field))
+				stats.documents_examined = bson_iter_as_int64(&field);
+			if (bson_iter_init(&iter, &reply) && bson_iter_find_descendant(&iter, "executionStats.executionTimeMillis", &field))
+				stats.execution_ms = bson_iter_as_int64(&field);
+		}
+
+		bson_destroy(&reply);
+		bson_destroy(&command);
+		return ok;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "fetch_query.h"
+
+#include <mongoc.h>
+#include <bson.h>
+
+#include <stdint.h>
+#include <string>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Largest number of session ids sent in one $in. Bigger id sets are split into batches that are scanned
+	* by parallel cursors, or merged in sort order when the query is sorted, which also keeps every filter far
+	* below the 16 MB BSON limit.
+	*/
+	const size_t SESSION_BATCH_SIZE = 20000;
+
+	/**
+	* Upper bound of session ids returned by sessionsIds.
+	*/
+	const int64_t MAX_SESSIONS = 500000;
+
+	/**
+	* Collection of the session start events, holding the session_id and params.level_key of every session.
+	*/
+	const char* const SESSION_START_COLLECTION = "session_start";
+
+	/**
+	* Number of session batches of a query, 1 if it does not filter on sessions.
+	*/
+	size_t session_batch_count(const FetchQuery& query);
+
+	/**
+	* Append { params.position: { $exists: true }, session_id: { $in: [...] } } to a filter,
+	* with the ids of one batch or ALL_SESSION_BATCHES.
+	*/
+	void append_session_filter(bson_t* filter, const FetchQuery& query, size_t batch);
+
+	/**
+	* Join the level of a query to its sessions: stream the session ids of the session_start documents
+	* of query.level_key and filter the query on them, intersected with query.sessions_ids if it already
+	* filters on sessions. Does nothing if the query has no level, the level is cleared once joined.
+	* Returns false and sets error if the cursor failed.
+	*/
+	bool resolve_level_sessions(mongoc_client_t* client, const char* database_name, FetchQuery& query, std::string& error);
+
+	/**
+	* Look for an index starting with session_id on a collection.
+	* Returns false and sets suggestion to the index to create if there is none.
+	*/
+	bool find_session_index(mongoc_collection_t* collection, std::string& suggestion);
+
+	/**
+	* Query plan statistics of a find, read from explain with the executionStats verbosity.
+	*/
+	struct QueryPlanStats
+	{
+		std::string winning_stage; // Such as IXSCAN, COLLSCAN
+		std::string index_name;
+		bool collection_scan = false;
+		int64_t returned = 0;
+		int64_t keys_examined = 0;
+		int64_t documents_examined = 0;
+		int64_t execution_ms = 0;
+	};
+
+	/**
+	* Explain a find with the filter and options built by build_fetch_query.
+	*/
+	bool explain_find(mongoc_database_t* database, const char* collection_name, const bson_t* filter, const bson_t* opts, QueryPlanStats& stats, std::string& error);
+}
@@ -0,0 +1,586 @@
+#include "snapshot_file.h"
+#include "block_codec.h"
+
+#include <bson.h>
+
+#include <algorithm>
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE
+{
+	const uint32_t SNAPSHOT_MAGIC = 0x4E535654; // "TVSN"
+	const uint32_t SNAPSHOT_VERSION = 1;
+	const char* SNAPSHOT_EXTENSION = ".tvs";
+	const char* SNAPSHOT_TEMP_EXTENSION = ".tmp";
+	const char* SNAPSHOT_URL_PREFIX = "file://";
+
+	// Smaller blocks are always stored raw
+	const size_t SNAPSHOT_MIN_COMPRESSED_SIZE = 256;
+
+	enum SnapshotCodec
+	{
+		SNAPSHOT_CODEC_RAW = 0,
+		SNAPSHOT_CODEC_LZ
+	};
+
+	/*
+	* Snapshot file layout, every block is padded to 8 bytes so that raw buffers can be read in place:
+	*   SnapshotFileHeader, info (a BSON document, see SnapshotInfo)
+	*   chunk_count x { SnapshotChunkHeader, column_count x { SnapshotColumnHeader, name, 4 x { SnapshotBlockHeader, stored bytes } } }
+	* The four blocks of a column are its data, validity, offsets and positions buffers as in ColumnView.
+	* Compressed blocks hold the lz_compress output of the buffer, byte shuffled first when width is above 1.
+	*/
+	struct SnapshotFileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t rows;
+		uint32_t chunk_count;
+		uint32_t info_size;
+	};
+
+	struct SnapshotChunkHeader
+	{
+		uint64_t rows;
+		uint32_t column_count;
+		uint32_t reserved;
+	};
+
+	struct SnapshotColumnHeader
+	{
+		uint32_t type;
+		uint32_t position_state;
+		uint32_t name_size;
+		uint32_t reserved;
+	};
+
+	struct SnapshotBlockHeader
+	{
+		uint64_t size;
+		uint64_t stored_size;
+		uint32_t codec;
+		uint32_t width;
+	};
+
+	size_t snapshot_pad8(size_t size)
+	{
+		return (size + 7) & ~(size_t)7;
+	}
+
+	void append_string_array(bson_t* doc, const char* key, const std::vector<std::string>& values)
+	{
+		bson_t array;
+		BSON_APPEND_ARRAY_BEGIN(doc, key, &array);
+		for (uint32_t i = 0; i < values.size(); ++i)
+		{
+			char index[16];
+			const char* index_key = nullptr;
+			auto index_length = bson_uint32_to_string(i, &index_key, index, sizeof(index));
+			bson_append_utf8(&array, index_key, (int)index_length, values[i].c_str(), (int)values[i].size());
+		}
+		bson_append_array_end(doc, &array);
+	}
+
+	void read_string_array(const bson_iter_t* iter, std::vector<std::string>& values)
+	{
+		bson_iter_t child;
+		if (!bson_iter_recurse(iter, &child))
+			return;
+
+		while (bson_iter_next(&child))
+		{
+			uint32_t length = 0;
+			if (bson_iter_type(&child) == BSON_TYPE_UTF8)
+			{
+				auto str = bson_iter_utf8(&child, &length);
+				values.push_back(std::string(str, length));
+			}
+		}
+	}
+
+	void write_snapshot_info(const SnapshotInfo& info, bson_t* doc)
+	{
+		BSON_APPEND_UTF8(doc, "database", info.database.c_str());
+		BSON_APPEND_UTF8(doc, "collection", info.collection.c_str());
+		append_string_array(doc, "fields", info.fields);
+		BSON_APPEND_INT32(doc, "position_parser", info.position_parser);
+		append_string_array(doc, "sessions_ids", info.sessions_ids);
+		BSON_APPEND_DATE_TIME(doc, "exported_ms", info.exported_ms);
+	}
+
+	bool read_snapshot_info(const uint8_t* data, size_t size, SnapshotInfo& info)
+	{
+		bson_t doc;
+		bson_iter_t iter;
+		if (!bson_init_static(&doc, data, size) || !bson_iter_init(&iter, &doc))
+			return false;
+
+		while (bson_iter_next(&iter))
+		{
+			auto key = bson_iter_key(&iter);
+			auto type = bson_iter_type(&iter);
+			uint32_t length = 0;
+
+			if (strcmp(key, "database") == 0 && type == BSON_TYPE_UTF8)
+				info.database = bson_iter_utf8(&iter, &length);
+			else if (strcmp(key, "collection") == 0 && type == BSON_TYPE_UTF8)
+				info.collection = bson_iter_utf8(&iter, &length);
+			else if (strcmp(key, "fields") == 0 && type == BSON_TYPE_ARRAY)
+				read_string_array(&iter, info.fields);
+			else if (strcmp(key, "position_parser") == 0 && type == BSON_TYPE_INT32)
+				info.position_parser = bson_iter_int32(&iter);
+			else if (strcmp(key, "sessions_ids") == 0 && type == BSON_TYPE_ARRAY)
+				read_string_array(&iter, info.sessions_ids);
+			else if (strcmp(key, "exported_ms") == 0 && type == BSON_TYPE_DATE_TIME)
+				info.exported_ms = bson_iter_date_time(&iter);
+		}
+		return true;
+	}
+
+	/**
+	* Bytes per row of the data buffer of a fixed width column, 0 for null and string columns.
+	*/
+	uint32_t value_size(ColumnType type)
+	{
+		switch (type)
+		{
+			case COLUMN_TYPE_DOUBLE: return sizeof(double);
+			case COLUMN_TYPE_INT64: return sizeof(int64_t);
+			case COLUMN_TYPE_BOOL: return 1;
+			default: return 0;
+		}
+	}
+
+	SnapshotWriter::~SnapshotWriter()
+	{
+		abort();
+	}
+
+	bool SnapshotWriter::begin(const std::string& destination, const SnapshotInfo& info)
+	{
+		abort();
+
+		path = destination;
+		temp_path = destination + SNAPSHOT_TEMP_EXTENSION;
+		file = fopen(temp_path.c_str(), "wb");
+		if (file == nullptr)
+			return false;
+
+		chunk_count = 0;
+		rows = 0;
+		bytes = 0;
+
+		bson_t doc;
+		bson_init(&doc);
+		write_snapshot_info(info, &doc);
+
+		// Written again with the final counts on commit
+		SnapshotFileHeader header = {};
+		info_size = doc.len;
+		header.info_size = info_size;
+		auto ok = write_padded(&header, sizeof(header)) && write_padded(bson_get_data(&doc), doc.len);
+		bson_destroy(&doc);
+
+		if (!ok)
+		{
+			abort();
+			return false;
+		}
+		return true;
+	}
+
+	bool SnapshotWriter::write_padded(const void* data, size_t size)
+	{
+		static const uint8_t padding[8] = {};
+		auto ok = size == 0 || fwrite(data, 1, size, file) == size;
+		if (snapshot_pad8(size) != size)
+			ok = ok && fwrite(padding, 1, snapshot_pad8(size) - size, file) == snapshot_pad8(size) - size;
+		bytes += snapshot_pad8(size);
+		return ok;
+	}
+
+	bool SnapshotWriter::write_block(const void* data, size_t size, uint32_t width)
+	{
+		SnapshotBlockHeader header = {};
+		header.size = size;
+		header.stored_size = size;
+		header.codec = SNAPSHOT_CODEC_RAW;
+		header.width = 1;
+		const void* stored = data;
+
+		if (size >= SNAPSHOT_MIN_COMPRESSED_SIZE)
+		{
+			auto source = static_cast<const uint8_t*>(data);
+			if (width > 1)
+			{
+				shuffled.resize(size);
+				shuffle_bytes(source, size, width, shuffled.data());
+				source = shuffled.data();
+			}
+
+			compressed.clear();
+			lz_compress(source, size, compressed);
+
+			// Keep the raw block unless compression saves at least an eighth, raw blocks are read without a copy
+			if (compressed.size() < size - size / 8)
+			{
+				header.stored_size = compressed.size();
+				header.codec = SNAPSHOT_CODEC_LZ;
+				header.width = width;
+				stored = compressed.data();
+			}
+		}
+
+		return write_padded(&header, sizeof(header)) && write_padded(stored, (size_t)header.stored_size);
+	}
+
+	bool SnapshotWriter::write_chunk(const std::vector<ColumnView>& columns, size_t begin, size_t end)
+	{
+		auto ok = true;
+		auto rows_in_chunk = end - begin;
+
+		SnapshotChunkHeader chunk = {};
+		chunk.rows = rows_in_chunk;
+		chunk.column_count = (uint32_t)columns.size();
+		ok = write_padded(&chunk, sizeof(chunk));
+
+		std::vector<uint32_t> offsets;
+		for (auto& view : columns)
+		{
+			SnapshotColumnHeader header = {};
+			header.type = view.type;
+			header.position_state = view.position_state;
+			header.name_size = (uint32_t)view.name.size();
+			ok = ok && write_padded(&header, sizeof(header)) && write_padded(view.name.data(), header.name_size);
+
+			// begin is a multiple of 8, the validity bits of the chunk start on a byte
+			auto validity = view.validity + begin / 8;
+			auto validity_size = (rows_in_chunk + 7) / 8;
+
+			if (view.type == COLUMN_TYPE_STRING)
+			{
+				// Offsets are rebased on the first string of the chunk
+				offsets.resize(rows_in_chunk + 1);
+				for (size_t i = 0; i <= rows_in_chunk; ++i)
+					offsets[i] = view.offsets[begin + i] - view.offsets[begin];
+
+				auto blob = static_cast<const char*>(view.data) + view.offsets[begin];
+				ok = ok && write_block(blob, offsets[rows_in_chunk], 1);
+				ok = ok && write_block(validity, validity_size, 1);
+				ok = ok && write_block(offsets.data(), offsets.size() * sizeof(uint32_t), sizeof(uint32_t));
+			}
+			else
+			{
+				auto width = value_size(view.type);
+				auto data = static_cast<const uint8_t*>(view.data) + begin * width;
+				ok = ok && write_block(data, rows_in_chunk * width, width > 1 ? width : 1);
+				ok = ok && write_block(validity, validity_size, 1);
+				ok = ok && write_block(nullptr, 0, 1);
+			}
+
+			if (view.position_state == POSITIONS_PARSED)
+				ok = ok && write_block(view.positions + begin * 3, rows_in_chunk * 3 * sizeof(float), sizeof(float));
+			else
+				ok = ok && write_block(nullptr, 0, 1);
+		}
+
+		if (ok)
+		{
+			++chunk_count;
+			rows += rows_in_chunk;
+		}
+		return ok;
+	}
+
+	bool SnapshotWriter::write_rows(const std::vector<ColumnView>& columns)
+	{
+		if (file == nullptr)
+			return false;
+
+		auto size = columns.empty() ? 0 : columns[0].size;
+		for (size_t begin = 0; begin < size; begin += SNAPSHOT_CHUNK_ROWS)
+		{
+			auto end = begin + SNAPSHOT_CHUNK_ROWS < size ? begin + SNAPSHOT_CHUNK_ROWS : size;
+			if (!write_chunk(columns, begin, end))
+			{
+				abort();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool SnapshotWriter::commit()
+	{
+		if (file == nullptr)
+			return false;
+
+		SnapshotFileHeader header = {};
+		header.magic = SNAPSHOT_MAGIC;
+		header.version = SNAPSHOT_VERSION;
+		header.rows = rows;
+		header.chunk_count = chunk_count;
+		header.info_size = info_size;
+
+		auto ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+		ok = fclose(file) == 0 && ok;
+		file = nullptr;
+
+		if (!ok || !replace_file(temp_path, path))
+		{
+			remove_file(temp_path);
+			temp_path.clear();
+			return false;
+		}
+
+		temp_path.clear();
+		return true;
+	}
+
+	void SnapshotWriter::abort()
+	{
+		if (file == nullptr)
+			return;
+
+		fclose(file);
+		file = nullptr;
+		remove_file(temp_path);
+		temp_path.clear();
+	}
+
+	bool ends_with(const std::string& str, const char* suffix)
+	{
+		auto length = strlen(suffix);
+		return str.size() >= length && str.compare(str.size() - length, length, suffix) == 0;
+	}
+
+	bool is_snapshot_address(const std::string& address)
+	{
+		return address.compare(0, strlen(SNAPSHOT_URL_PREFIX), SNAPSHOT_URL_PREFIX) == 0 || ends_with(address, SNAPSHOT_EXTENSION);
+	}
+
+	std::string snapshot_path(const std::string& address)
+	{
+		auto prefix_length = strlen(SNAPSHOT_URL_PREFIX);
+		if (address.compare(0, prefix_length, SNAPSHOT_URL_PREFIX) != 0)
+			return address;
+
+		// file:///C:/data.tvs names C:/data.tvs on Windows
+		auto path = address.substr(prefix_length);
+		if (path.size() > 2 && path[0] == '/' && path[2] == ':')
+			path.erase(0, 1);
+		return path;
+	}
+
+	/**
+	* Check the size of a block against the size its column and row count call for.
+	*/
+	bool valid_snapshot_block(const SnapshotBlock& block, uint64_t expected_size)
+	{
+		if (block.size != expected_size)
+			return false;
+		if (block.codec == SNAPSHOT_CODEC_RAW)
+			return block.stored_size == block.size && block.width == 1;
+		// A match never codes more than 255 bytes per stored byte, anything above is corrupt
+		return block.codec == SNAPSHOT_CODEC_LZ && block.width >= 1 && block.width <= 8 && block.size / 255 <= block.stored_size;
+	}
+
+	/**
+	* Build the chunk and column headers of a mapped snapshot file. Returns false if the file is truncated or malformed.
+	*/
+	bool read_snapshot_chunks(Snapshot& snapshot, const SnapshotFileHeader& header)
+	{
+		auto cursor = snapshot.file.data + sizeof(SnapshotFileHeader);
+		auto end = snapshot.file.data + snapshot.file.size;
+
+		auto take = [&](uint64_t size) -> const uint8_t* {
+			if ((uint64_t)(end - cursor) < size)
+				return nullptr;
+			auto block = cursor;
+			cursor += std::min((uint64_t)(end - cursor), (uint64_t)snapshot_pad8((size_t)size));
+			return block;
+		};
+
+		auto take_block = [&](SnapshotBlock& block) -> bool {
+			auto block_header = reinterpret_cast<const SnapshotBlockHeader*>(take(sizeof(SnapshotBlockHeader)));
+			if (block_header == nullptr)
+				return false;
+
+			block.size = block_header->size;
+			block.stored_size = block_header->stored_size;
+			block.codec = block_header->codec;
+			block.width = block_header->width;
+			block.stored = take(block.stored_size);
+			return block.stored != nullptr;
+		};
+
+		auto info = take(header.info_size);
+		if (info == nullptr || !read_snapshot_info(info, header.info_size, snapshot.info))
+			return false;
+
+		uint64_t rows = 0;
+		for (uint32_t c = 0; c < header.chunk_count; ++c)
+		{
+			auto chunk_header = reinterpret_cast<const SnapshotChunkHeader*>(take(sizeof(SnapshotChunkHeader)));
+			if (chunk_header == nullptr || chunk_header->rows > SNAPSHOT_CHUNK_ROWS || chunk_header->column_count > (uint64_t)(end - cursor) / sizeof(SnapshotColumnHeader))
+				return false;
+
+			SnapshotChunk chunk;
+			chunk.rows = (size_t)chunk_header->rows;
+			chunk.columns.resize(chunk_header->column_count);
+			for (auto& column : chunk.columns)
+			{
+				auto column_header = reinterpret_cast<const SnapshotColumnHeader*>(take(sizeof(SnapshotColumnHeader)));
+				if (column_header == nullptr || column_header->type > COLUMN_TYPE_STRING || column_header->position_state > POSITIONS_NONE)
+					return false;
+
+				auto name = take(column_header->name_size);
+				if (name == nullptr || !take_block(column.data) || !take_block(column.validity) || !take_block(column.offsets) || !take_block(column.positions))
+					return false;
+
+				column.name.assign(reinterpret_cast<const char*>(name), column_header->name_size);
+				column.type = (ColumnType)column_header->type;
+				column.position_state = (PositionState)column_header->position_state;
+
+				auto is_string = column.type == COLUMN_TYPE_STRING;
+				auto data_size = is_string ? column.data.size : chunk.rows * value_size(column.type);
+				auto positions_size = column.position_state == POSITIONS_PARSED ? chunk.rows * 3 * sizeof(float) : 0;
+
+				if (!valid_snapshot_block(column.data, data_size) ||
+					!valid_snapshot_block(column.validity, (chunk.rows + 7) / 8) ||
+					!valid_snapshot_block(column.offsets, is_string ? (chunk.rows + 1) * sizeof(uint32_t) : 0) ||
+					!valid_snapshot_block(column.positions, positions_size))
+					return false;
+			}
+
+			rows += chunk.rows;
+			snapshot.chunks.push_back(std::move(chunk));
+		}
+
+		snapshot.rows = header.rows;
+		return rows == header.rows;
+	}
+
+	std::shared_ptr<Snapshot> open_snapshot(const std::string& address, std::string& error)
+	{
+		std::shared_ptr<Snapshot> snapshot(new Snapshot());
+		snapshot->path = snapshot_path(address);
+
+		if (!snapshot->file.open(snapshot->path))
+		{
+			error = "Could not open " + snapshot->path;
+			return nullptr;
+		}
+
+		auto header = reinterpret_cast<const SnapshotFileHeader*>(snapshot->file.data);
+		if (snapshot->file.size < sizeof(SnapshotFileHeader) || header->magic != SNAPSHOT_MAGIC)
+		{
+			error = snapshot->path + " is not a snapshot file";
+			return nullptr;
+		}
+
+		if (header->version != SNAPSHOT_VERSION)
+		{
+			error = snapshot->path + " was written by another version of the plugin";
+			return nullptr;
+		}
+
+		if (!read_snapshot_chunks(*snapshot, *header))
+		{
+			error = snapshot->path + " is truncated or corrupt";
+			return nullptr;
+		}
+
+		return snapshot;
+	}
+
+	/**
+	* Pointer to the bytes of a block, in the mapping if it is raw or decompressed into a new buffer.
+	*/
+	const uint8_t* read_snapshot_block(const SnapshotBlock& block, std::deque<std::vector<uint8_t>>& buffers, std::vector<uint8_t>& scratch)
+	{
+		if (block.codec == SNAPSHOT_CODEC_RAW)
+			return block.stored;
+
+		buffers.push_back(std::vector<uint8_t>((size_t)block.size));
+		auto& buffer = buffers.back();
+		if (block.width <= 1)
+			return lz_decompress(block.stored, (size_t)block.stored_size, buffer.data(), buffer.size()) ? buffer.data() : nullptr;
+
+		scratch.resize((size_t)block.size);
+		if (!lz_decompress(block.stored, (size_t)block.stored_size, scratch.data(), scratch.size()))
+			return nullptr;
+
+		unshuffle_bytes(scratch.data(), scratch.size(), block.width, buffer.data());
+		return buffer.data();
+	}
+
+	bool view_snapshot_chunk(const Snapshot& snapshot, size_t chunk, const std::vector<std::string>& fields, std::vector<ColumnView>& views, std::deque<std::vector<uint8_t>>& buffers)
+	{
+		const auto& source = snapshot.chunks[chunk];
+		std::vector<uint8_t> scratch;
+
+		views.clear();
+		views.resize(fields.size());
+		for (size_t i = 0; i < fields.size(); ++i)
+		{
+			auto& view = views[i];
+			view.name = fields[i];
+			view.size = source.rows;
+
+			const SnapshotColumn* column = nullptr;
+			for (auto& candidate : source.columns)
+			{
+				if (candidate.name == fields[i])
+				{
+					column = &candidate;
+					break;
+				}
+			}
+
+			if (column == nullptr)
+			{
+				// Not exported, every row is null
+				buffers.push_back(std::vector<uint8_t>((source.rows + 7) / 8, 0));
+				view.validity = buffers.back().data();
+				view.validity_size = buffers.back().size();
+				continue;
+			}
+
+			view.type = column->type;
+			view.position_state = column->position_state;
+			view.data_size = (size_t)column->data.size;
+			view.validity_size = (size_t)column->validity.size;
+
+			view.data = read_snapshot_block(column->data, buffers, scratch);
+			view.validity = read_snapshot_block(column->validity, buffers, scratch);
+			if (view.data == nullptr || view.validity == nullptr)
+				return false;
+
+			if (column->type == COLUMN_TYPE_STRING)
+			{
+				view.offsets = reinterpret_cast<const uint32_t*>(read_snapshot_block(column->offsets, buffers, scratch));
+				if (view.offsets == nullptr || view.offsets[0] != 0)
+					return false;
+
+				// Offsets index the blob straight away, they have to stay inside of it
+				for (size_t row = 0; row < source.rows; ++row)
+				{
+					if (view.offsets[row + 1] < view.offsets[row])
+						return false;
+				}
+				if (view.offsets[source.rows] > view.data_size)
+					return false;
+			}
+
+			if (column->position_state == POSITIONS_PARSED)
+			{
+				view.positions = reinterpret_cast<const float*>(read_snapshot_block(column->positions, buffers, scratch));
+				if (view.positions == nullptr)
+					return false;
+			}
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "column_set.h"
+#include "mapped_file.h"
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Rows per chunk of a snapshot file, a multiple of 8 so that the validity bitmap of every chunk starts on a byte.
+	*/
+	const size_t SNAPSHOT_CHUNK_ROWS = 65536;
+
+	/**
+	* Where a snapshot was exported from, stored with it so that it can stand in for the collection.
+	*/
+	struct SnapshotInfo
+	{
+		std::string database;
+		std::string collection;
+		std::vector<std::string> fields;
+		int position_parser = -1;
+		std::vector<std::string> sessions_ids;
+		int64_t exported_ms = 0;
+	};
+
+	/**
+	* One buffer of a snapshot column as stored in the file, either raw or compressed.
+	*/
+	struct SnapshotBlock
+	{
+		const uint8_t* stored = nullptr;
+		uint64_t size = 0; // Size once decompressed
+		uint64_t stored_size = 0;
+		uint32_t codec = 0;
+		uint32_t width = 1; // Byte width of the shuffled values
+	};
+
+	struct SnapshotColumn
+	{
+		std::string name;
+		ColumnType type = COLUMN_TYPE_NULL;
+		PositionState position_state = POSITIONS_UNKNOWN;
+		SnapshotBlock data;
+		SnapshotBlock validity;
+		SnapshotBlock offsets;
+		SnapshotBlock positions;
+	};
+
+	struct SnapshotChunk
+	{
+		size_t rows = 0;
+		std::vector<SnapshotColumn> columns;
+	};
+
+	/**
+	* A snapshot file mapped from disk. Opening only reads the headers, the blocks of a chunk
+	* are viewed in place or decompressed when the chunk is read.
+	*/
+	struct Snapshot
+	{
+		std::string path;
+		MappedFile file;
+		SnapshotInfo info;
+		std::vector<SnapshotChunk> chunks;
+		uint64_t rows = 0;
+	};
+
+	/**
+	* Streams result columns to a snapshot file, compressing every block that gets smaller.
+	* The file is written next to its destination and only replaces it once committed.
+	*/
+	struct SnapshotWriter
+	{
+		SnapshotWriter() = default;
+		~SnapshotWriter();
+		SnapshotWriter(const SnapshotWriter&) = delete;
+		SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+		bool begin(const std::string& destination, const SnapshotInfo& info);
+
+		/**
+		* Write rows of columns, split in chunks of at most SNAPSHOT_CHUNK_ROWS rows.
+		*/
+		bool write_rows(const std::vector<ColumnView>& columns);
+		bool commit();
+		void abort();
+
+		uint64_t rows_written() const { return rows; }
+		uint64_t bytes_written() const { return bytes; }
+
+	private:
+		bool write_chunk(const std::vector<ColumnView>& columns, size_t begin, size_t end);
+		bool write_block(const void* data, size_t size, uint32_t width);
+		bool write_padded(const void* data, size_t size);
+
+		FILE* file = nullptr;
+		uint32_t chunk_count = 0;
+		uint32_t info_size = 0;
+		uint64_t rows = 0;
+		uint64_t bytes = 0;
+		std::string path;
+		std::string temp_path;
+		std::vector<uint8_t> shuffled;
+		std::vector<uint8_t> compressed;
+	};
+
+	/**
+	* True if a server address names a snapshot file, a file:// URL or a path ending with .tvs.
+	*/
+	bool is_snapshot_address(const std::string& address);
+
+	/**
+	* Map a snapshot file from a path or file:// URL. Returns nullptr and sets error if it is missing or malformed.
+	*/
+	std::shared_ptr<Snapshot> open_snapshot(const std::string& address, std::string& error);
+
+	/**
+	* View the requested fields of a chunk, in field order. Fields the snapshot does not have are null.
+	* Compressed blocks are decompressed into buffers, which must outlive the views.
+	* Returns false if a block of the chunk is corrupt.
+	*/
+	bool view_snapshot_chunk(const Snapshot& snapshot, size_t chunk, const std::vector<std::string>& fields, std::vector<ColumnView>& views, std::deque<std::vector<uint8_t>>& buffers);
+}
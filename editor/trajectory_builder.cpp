@@ -0,0 +1,208 @@
+#include "trajectory_builder.h"
+#include "fetch_requests.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <string.h>
+#include <utility>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Squared distance from point p to the segment [a, b].
+	*/
+	float segment_distance_squared(const float* p, const float* a, const float* b)
+	{
+		float ab[3], ap[3];
+		float ab_length_squared = 0.0f, projection = 0.0f;
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			ab[axis] = b[axis] - a[axis];
+			ap[axis] = p[axis] - a[axis];
+			ab_length_squared += ab[axis] * ab[axis];
+			projection += ab[axis] * ap[axis];
+		}
+
+		auto t = ab_length_squared > 0.0f ? projection / ab_length_squared : 0.0f;
+		t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+
+		float distance_squared = 0.0f;
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			auto delta = ap[axis] - t * ab[axis];
+			distance_squared += delta * delta;
+		}
+		return distance_squared;
+	}
+
+	uint32_t simplify_polyline(const float* positions, uint32_t count, float tolerance, std::vector<uint8_t>& keep)
+	{
+		if (tolerance <= 0.0f || count <= 2)
+		{
+			keep.assign(count, 1);
+			return count;
+		}
+		keep.assign(count, 0);
+
+		// Iterative, long sessions would overflow the stack when recursing on every split
+		auto tolerance_squared = tolerance * tolerance;
+		std::vector<std::pair<uint32_t, uint32_t>> spans;
+		spans.push_back(std::make_pair(0u, count - 1));
+		keep[0] = keep[count - 1] = 1;
+		uint32_t kept = 2;
+
+		while (!spans.empty())
+		{
+			auto first = spans.back().first;
+			auto last = spans.back().second;
+			spans.pop_back();
+
+			float farthest_squared = 0.0f;
+			uint32_t farthest = first;
+			for (auto i = first + 1; i < last; ++i)
+			{
+				auto distance_squared = segment_distance_squared(&positions[i * 3], &positions[first * 3], &positions[last * 3]);
+				if (distance_squared > farthest_squared)
+				{
+					farthest_squared = distance_squared;
+					farthest = i;
+				}
+			}
+
+			if (farthest_squared <= tolerance_squared)
+				continue;
+
+			keep[farthest] = 1;
+			++kept;
+			if (farthest - first > 1)
+				spans.push_back(std::make_pair(first, farthest));
+			if (last - farthest > 1)
+				spans.push_back(std::make_pair(farthest, last));
+		}
+		return kept;
+	}
+
+	/**
+	* Compare the session of two valid rows, sessions of any column type only need a strict order.
+	*/
+	int compare_sessions(const Column& sessions, uint32_t a, uint32_t b)
+	{
+		switch (sessions.type)
+		{
+			case COLUMN_TYPE_STRING:
+			{
+				auto a_length = sessions.offsets[a + 1] - sessions.offsets[a];
+				auto b_length = sessions.offsets[b + 1] - sessions.offsets[b];
+				if (a_length != b_length)
+					return a_length < b_length ? -1 : 1;
+				return memcmp(&sessions.blob[sessions.offsets[a]], &sessions.blob[sessions.offsets[b]], a_length);
+			}
+			case COLUMN_TYPE_INT64:
+				return sessions.ints[a] < sessions.ints[b] ? -1 : (sessions.ints[a] > sessions.ints[b] ? 1 : 0);
+			case COLUMN_TYPE_DOUBLE:
+				return sessions.doubles[a] < sessions.doubles[b] ? -1 : (sessions.doubles[a] > sessions.doubles[b] ? 1 : 0);
+			case COLUMN_TYPE_BOOL:
+				return (int)sessions.bools[a] - (int)sessions.bools[b];
+			default:
+				return 0;
+		}
+	}
+
+	void build_trajectories(const Column& positions, const Column& sessions, const Column* times, size_t rows,
+		const std::vector<size_t>& row_ranges, float tolerance, unsigned thread_count, Trajectories& trajectories)
+	{
+		ScopedTimer timer("build_trajectories");
+
+		trajectories.rows.clear();
+		trajectories.path_ends.clear();
+
+		// Rows that can be drawn, grouped by session in delivery order
+		rows = std::min(rows, positions.positions.size() / 3);
+		std::vector<uint32_t> candidates;
+		for (size_t r = 0; r + 1 < row_ranges.size(); r += 2)
+		{
+			auto end = std::min(row_ranges[r + 1], rows);
+			for (auto row = row_ranges[r]; row < end; ++row)
+			{
+				if (!isnan(positions.positions[row * 3]) && sessions.is_valid(row))
+					candidates.push_back((uint32_t)row);
+			}
+		}
+		trajectories.source_points = candidates.size();
+
+		std::sort(candidates.begin(), candidates.end(), [&sessions](uint32_t a, uint32_t b) {
+			auto order = compare_sessions(sessions, a, b);
+			return order != 0 ? order < 0 : a < b;
+		});
+
+		std::vector<size_t> session_starts;
+		for (size_t i = 0; i < candidates.size(); ++i)
+		{
+			if (i == 0 || compare_sessions(sessions, candidates[i - 1], candidates[i]) != 0)
+				session_starts.push_back(i);
+		}
+		session_starts.push_back(candidates.size());
+		auto session_count = session_starts.size() - 1;
+
+		// Every session is ordered and simplified in place, its kept rows moved to the start of its span
+		std::vector<uint32_t> kept_counts(session_count, 0);
+		std::atomic<size_t> next_session{ 0 };
+
+		auto body = [&]() {
+			std::vector<std::pair<double, uint32_t>> timed;
+			std::vector<float> path;
+			std::vector<uint8_t> keep;
+
+			for (auto s = next_session++; s < session_count; s = next_session++)
+			{
+				auto span = &candidates[session_starts[s]];
+				auto count = (uint32_t)(session_starts[s + 1] - session_starts[s]);
+
+				if (times != nullptr)
+				{
+					timed.resize(count);
+					for (uint32_t i = 0; i < count; ++i)
+						timed[i] = std::make_pair(times->number_at(span[i]), span[i]);
+					std::sort(timed.begin(), timed.end(), [](const std::pair<double, uint32_t>& a, const std::pair<double, uint32_t>& b) {
+						if (isnan(a.first) || isnan(b.first))
+							return isnan(a.first) != isnan(b.first) ? !isnan(a.first) : a.second < b.second;
+						return a.first != b.first ? a.first < b.first : a.second < b.second;
+					});
+					for (uint32_t i = 0; i < count; ++i)
+						span[i] = timed[i].second;
+				}
+
+				path.resize(count * 3);
+				for (uint32_t i = 0; i < count; ++i)
+					memcpy(&path[i * 3], &positions.positions[span[i] * 3], 3 * sizeof(float));
+				simplify_polyline(path.data(), count, tolerance, keep);
+
+				uint32_t kept = 0;
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					if (keep[i])
+						span[kept++] = span[i];
+				}
+				kept_counts[s] = kept;
+			}
+		};
+
+		auto threads = std::max(1u, std::min(thread_count, (unsigned)std::min<size_t>(session_count, MAX_FETCH_THREADS)));
+		run_on_threads(threads, body);
+
+		for (size_t s = 0; s < session_count; ++s)
+		{
+			if (kept_counts[s] < 2)
+				continue;
+
+			auto span = &candidates[session_starts[s]];
+			trajectories.rows.insert(trajectories.rows.end(), span, span + kept_counts[s]);
+			trajectories.path_ends.push_back((uint32_t)trajectories.rows.size());
+		}
+
+		timer.documents = trajectories.source_points;
+		timer.bytes = trajectories.rows.size() * 3 * sizeof(float);
+	}
+}
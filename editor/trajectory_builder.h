@@ -0,0 +1,37 @@
+#pragma once
+
+#include "column_set.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	/**
+	* Polylines built from rows of parsed positions: path p is rows[path_ends[p - 1]] to rows[path_ends[p] - 1]
+	* (from 0 for the first path), in time order.
+	*/
+	struct Trajectories
+	{
+		std::vector<uint32_t> rows;
+		std::vector<uint32_t> path_ends;
+		size_t source_points = 0; // Rows with a position and a session before simplification
+	};
+
+	/**
+	* Mark the points of a polyline that Douglas-Peucker keeps for a tolerance in world units:
+	* points closer than tolerance to the simplified polyline are dropped, the ends are always kept.
+	* positions holds count x, y, z triplets, keep gets count flags. A tolerance of 0 or less keeps every point.
+	* Returns the number of points kept.
+	*/
+	uint32_t simplify_polyline(const float* positions, uint32_t count, float tolerance, std::vector<uint8_t>& keep);
+
+	/**
+	* Build one path per session of the rows in row_ranges ([begin, end) pairs) that have a position and a session.
+	* The rows of a session are ordered by time (rows without a time last, in delivery order), or kept in delivery order
+	* without a time column, then simplified with simplify_polyline. Sessions are processed in parallel on up to
+	* thread_count threads, sessions left with less than two points are not paths.
+	*/
+	void build_trajectories(const Column& positions, const Column& sessions, const Column* times, size_t rows,
+		const std::vector<size_t>& row_ranges, float tolerance, unsigned thread_count, Trajectories& trajectories);
+}
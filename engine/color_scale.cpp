@@ -0,0 +1,200 @@
+#include "color_scale.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define COLOR_SCALE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define COLOR_SCALE_SSE2
+#endif
+
+namespace PLUGIN_NAMESPACE {
+
+bool make_color_scale(const float* values, const uint32_t* colors, unsigned num_stops, ColorScale& scale)
+{
+	if (num_stops == 0 || num_stops > MAX_COLOR_STOPS)
+		return false;
+
+	for (unsigned i = 0; i < num_stops; ++i) {
+		if (isnan(values[i]) || (i > 0 && values[i] < values[i - 1]))
+			return false;
+		scale.values[i] = values[i];
+		scale.colors[i] = colors[i];
+	}
+	scale.num_stops = num_stops;
+	return true;
+}
+
+void make_three_stop_color_scale(float min, float desired, float max, ColorScale& scale)
+{
+	scale.num_stops = 3;
+	scale.values[0] = min;
+	scale.values[1] = desired > min ? desired : min;
+	scale.values[2] = max > scale.values[1] ? max : scale.values[1];
+	scale.colors[0] = 0xFFFF0000;
+	scale.colors[1] = 0xFF000000;
+	scale.colors[2] = 0xFF00FF00;
+}
+
+bool color_scales_equal(const ColorScale& a, const ColorScale& b)
+{
+	return a.num_stops == b.num_stops
+		&& memcmp(a.values, b.values, a.num_stops * sizeof(float)) == 0
+		&& memcmp(a.colors, b.colors, a.num_stops * sizeof(uint32_t)) == 0;
+}
+
+/**
+ * A gradient as a sum of clamped ramps: color(v) = base + sum over segments of saturate((v - start) * inverse_width) * delta.
+ * Every scalar walks all segments without branching, which is what lets the kernel run on whole vectors.
+ */
+struct ColorRamps
+{
+	unsigned num_segments;
+	float base[4];
+	float start[MAX_COLOR_STOPS];
+	float inverse_width[MAX_COLOR_STOPS];
+	float delta[MAX_COLOR_STOPS][4];
+};
+
+// Width used for segments with equal start and end values, makes the step immediate
+const float STEP_INVERSE_WIDTH = 1e30f;
+
+float color_channel(uint32_t color, unsigned channel)
+{
+	return (float)((color >> (channel * 8)) & 0xFF);
+}
+
+void make_color_ramps(const ColorScale& scale, ColorRamps& ramps)
+{
+	ramps.num_segments = scale.num_stops - 1;
+	for (unsigned channel = 0; channel < 4; ++channel)
+		ramps.base[channel] = color_channel(scale.colors[0], channel);
+
+	for (unsigned s = 0; s < ramps.num_segments; ++s) {
+		auto width = scale.values[s + 1] - scale.values[s];
+		ramps.start[s] = scale.values[s];
+		ramps.inverse_width[s] = width > 0.0f ? 1.0f / width : STEP_INVERSE_WIDTH;
+		for (unsigned channel = 0; channel < 4; ++channel)
+			ramps.delta[s][channel] = color_channel(scale.colors[s + 1], channel) - color_channel(scale.colors[s], channel);
+	}
+}
+
+uint32_t map_scalar_to_color(float scalar, const ColorRamps& ramps)
+{
+	if (isnan(scalar))
+		return 0;
+
+	float channels[4] = { ramps.base[0], ramps.base[1], ramps.base[2], ramps.base[3] };
+	for (unsigned s = 0; s < ramps.num_segments; ++s) {
+		auto t = (scalar - ramps.start[s]) * ramps.inverse_width[s];
+		t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+		for (unsigned channel = 0; channel < 4; ++channel)
+			channels[channel] += t * ramps.delta[s][channel];
+	}
+
+	// Clamped and rounded to nearest like the vector paths
+	uint32_t color = 0;
+	for (unsigned channel = 0; channel < 4; ++channel) {
+		auto value = channels[channel] < 0.0f ? 0.0f : (channels[channel] > 255.0f ? 255.0f : channels[channel]);
+		color |= (uint32_t)lrintf(value) << (channel * 8);
+	}
+	return color;
+}
+
+#if defined(COLOR_SCALE_AVX2)
+
+unsigned map_scalars_to_colors_simd(const float* scalars, unsigned num_scalars, const ColorRamps& ramps, uint32_t* colors)
+{
+	const auto zero = _mm256_setzero_ps();
+	const auto one = _mm256_set1_ps(1.0f);
+	const auto max_channel = _mm256_set1_ps(255.0f);
+
+	unsigned i = 0;
+	for (; i + 8 <= num_scalars; i += 8) {
+		auto scalar = _mm256_loadu_ps(scalars + i);
+		auto valid = _mm256_castps_si256(_mm256_cmp_ps(scalar, scalar, _CMP_ORD_Q));
+
+		__m256 channels[4];
+		for (unsigned channel = 0; channel < 4; ++channel)
+			channels[channel] = _mm256_set1_ps(ramps.base[channel]);
+
+		for (unsigned s = 0; s < ramps.num_segments; ++s) {
+			auto t = _mm256_mul_ps(_mm256_sub_ps(scalar, _mm256_set1_ps(ramps.start[s])), _mm256_set1_ps(ramps.inverse_width[s]));
+			t = _mm256_min_ps(_mm256_max_ps(t, zero), one);
+			for (unsigned channel = 0; channel < 4; ++channel)
+				channels[channel] = _mm256_add_ps(channels[channel], _mm256_mul_ps(t, _mm256_set1_ps(ramps.delta[s][channel])));
+		}
+
+		auto color = _mm256_setzero_si256();
+		for (unsigned channel = 0; channel < 4; ++channel) {
+			auto value = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(channels[channel], zero), max_channel));
+			color = _mm256_or_si256(color, _mm256_slli_epi32(value, (int)(channel * 8)));
+		}
+		_mm256_storeu_si256((__m256i*)(colors + i), _mm256_and_si256(color, valid));
+	}
+	return i;
+}
+
+#elif defined(COLOR_SCALE_SSE2)
+
+unsigned map_scalars_to_colors_simd(const float* scalars, unsigned num_scalars, const ColorRamps& ramps, uint32_t* colors)
+{
+	const auto zero = _mm_setzero_ps();
+	const auto one = _mm_set1_ps(1.0f);
+	const auto max_channel = _mm_set1_ps(255.0f);
+
+	unsigned i = 0;
+	for (; i + 4 <= num_scalars; i += 4) {
+		auto scalar = _mm_loadu_ps(scalars + i);
+		auto valid = _mm_castps_si128(_mm_cmpord_ps(scalar, scalar));
+
+		__m128 channels[4];
+		for (unsigned channel = 0; channel < 4; ++channel)
+			channels[channel] = _mm_set1_ps(ramps.base[channel]);
+
+		for (unsigned s = 0; s < ramps.num_segments; ++s) {
+			auto t = _mm_mul_ps(_mm_sub_ps(scalar, _mm_set1_ps(ramps.start[s])), _mm_set1_ps(ramps.inverse_width[s]));
+			t = _mm_min_ps(_mm_max_ps(t, zero), one);
+			for (unsigned channel = 0; channel < 4; ++channel)
+				channels[channel] = _mm_add_ps(channels[channel], _mm_mul_ps(t, _mm_set1_ps(ramps.delta[s][channel])));
+		}
+
+		// SSE2 has no 32 bit integer min/max, clamp before converting with rounding to nearest
+		auto color = _mm_setzero_si128();
+		for (unsigned channel = 0; channel < 4; ++channel) {
+			auto value = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(channels[channel], zero), max_channel));
+			color = _mm_or_si128(color, _mm_slli_epi32(value, (int)(channel * 8)));
+		}
+		_mm_storeu_si128((__m128i*)(colors + i), _mm_and_si128(color, valid));
+	}
+	return i;
+}
+
+#else
+
+unsigned map_scalars_to_colors_simd(const float*, unsigned, const ColorRamps&, uint32_t*)
+{
+	return 0;
+}
+
+#endif
+
+void map_scalars_to_colors(const float* scalars, unsigned num_scalars, const ColorScale& scale, uint32_t* colors)
+{
+	if (scale.num_stops == 0) {
+		memset(colors, 0, num_scalars * sizeof(uint32_t));
+		return;
+	}
+
+	ColorRamps ramps;
+	make_color_ramps(scale, ramps);
+
+	auto i = map_scalars_to_colors_simd(scalars, num_scalars, ramps, colors);
+	for (; i < num_scalars; ++i)
+		colors[i] = map_scalar_to_color(scalars[i], ramps);
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace PLUGIN_NAMESPACE {
+
+/**
+ * Most stops of a color gradient.
+ */
+const unsigned MAX_COLOR_STOPS = 16;
+
+/**
+ * Piecewise linear color gradient. Values below the first stop get the first color,
+ * values above the last stop the last color. Colors are packed as 0xAARRGGBB.
+ */
+struct ColorScale
+{
+	unsigned num_stops;
+	float values[MAX_COLOR_STOPS];
+	uint32_t colors[MAX_COLOR_STOPS];
+};
+
+/**
+ * Build a color scale from stops sorted by value, returns false if there are no stops,
+ * too many stops or the values are not increasing.
+ */
+bool make_color_scale(const float* values, const uint32_t* colors, unsigned num_stops, ColorScale& scale);
+
+/**
+ * The red (min) - black (desired) - green (max) scale of the point cloud view.
+ */
+void make_three_stop_color_scale(float min, float desired, float max, ColorScale& scale);
+
+bool color_scales_equal(const ColorScale& a, const ColorScale& b);
+
+/**
+ * Map scalars to packed colors in one pass. NaN scalars have no color and get 0.
+ * Uses AVX2 or SSE2 when the plugin is compiled for them, four or eight scalars at a time.
+ */
+void map_scalars_to_colors(const float* scalars, unsigned num_scalars, const ColorScale& scale, uint32_t* colors);
+
+}
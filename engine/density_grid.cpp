@@ -0,0 +1,151 @@
+#include "density_grid.h"
+#include "engine_plugin.h"
+#include "scratch_arena.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE {
+
+using namespace stingray_plugin_foundation;
+
+/**
+ * Bin the positions [begin, end) into a histogram of the grid's size.
+ */
+void bin_positions(const float* positions, unsigned begin, unsigned end, const DensityGrid& grid, bool flat, float* histogram)
+{
+	auto inverse_size = 1.0f / grid.cell_size;
+	for (unsigned i = begin; i < end; ++i) {
+		const float* position = positions + i * 3;
+		unsigned index[3] = { 0, 0, 0 };
+		for (unsigned axis = 0; axis < (flat ? 2u : 3u); ++axis) {
+			auto cell = (int)((position[axis] - grid.origin[axis]) * inverse_size);
+			index[axis] = cell < 0 ? 0 : ((unsigned)cell >= grid.dims[axis] ? grid.dims[axis] - 1 : (unsigned)cell);
+		}
+		histogram[(index[2] * grid.dims[1] + index[1]) * grid.dims[0] + index[0]] += 1.0f;
+	}
+}
+
+void build_density_grid(const float* positions, unsigned num_positions, const DensitySettings& settings, DensityGrid& grid)
+{
+	grid.density.resize(0);
+	grid.max_density = 0.0f;
+	if (num_positions == 0)
+		return;
+
+	float bb_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float bb_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (unsigned i = 0; i < num_positions; ++i) {
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			auto value = positions[i * 3 + axis];
+			if (value < bb_min[axis]) bb_min[axis] = value;
+			if (value > bb_max[axis]) bb_max[axis] = value;
+		}
+	}
+
+	// Grow the cells until the grid fits the bounds, a flat grid has one layer at the lowest height
+	auto cell_size = settings.cell_size > 0.0f ? settings.cell_size : 1.0f;
+	for (;;) {
+		for (unsigned axis = 0; axis < 3; ++axis)
+			grid.dims[axis] = (axis == 2 && settings.flat) ? 1 : (unsigned)((bb_max[axis] - bb_min[axis]) / cell_size) + 1;
+		if (grid.dims[0] <= DENSITY_MAX_CELLS_PER_AXIS && grid.dims[1] <= DENSITY_MAX_CELLS_PER_AXIS && grid.dims[2] <= DENSITY_MAX_CELLS_PER_AXIS
+			&& (uint64_t)grid.dims[0] * grid.dims[1] * grid.dims[2] <= DENSITY_MAX_CELLS)
+			break;
+		cell_size *= 1.25f;
+	}
+
+	for (unsigned axis = 0; axis < 3; ++axis)
+		grid.origin[axis] = bb_min[axis];
+	grid.cell_size = cell_size;
+
+	auto num_cells = grid.dims[0] * grid.dims[1] * grid.dims[2];
+	auto num_threads = num_positions / DENSITY_POINTS_PER_THREAD + 1;
+	auto hardware_threads = std::thread::hardware_concurrency();
+	if (hardware_threads > 0 && num_threads > hardware_threads)
+		num_threads = hardware_threads;
+	if (num_threads > DENSITY_MAX_THREADS)
+		num_threads = DENSITY_MAX_THREADS;
+
+	// One histogram per thread so that the binning needs no atomics, the first one is the grid itself
+	Array<float> histograms(_scratch_allocator);
+	histograms.resize(num_cells * (num_threads - 1));
+	grid.density.resize(num_cells);
+	memset(grid.density.begin(), 0, num_cells * sizeof(float));
+	if (histograms.size() > 0)
+		memset(histograms.begin(), 0, histograms.size() * sizeof(float));
+
+	auto per_thread = (num_positions + num_threads - 1) / num_threads;
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < num_threads; ++t) {
+		auto begin = t * per_thread < num_positions ? t * per_thread : num_positions;
+		auto end = begin + per_thread < num_positions ? begin + per_thread : num_positions;
+		auto histogram = &histograms[(t - 1) * num_cells];
+		threads.emplace_back([=, &grid]() { bin_positions(positions, begin, end, grid, settings.flat, histogram); });
+	}
+	bin_positions(positions, 0, per_thread < num_positions ? per_thread : num_positions, grid, settings.flat, grid.density.begin());
+	for (auto& thread : threads)
+		thread.join();
+
+	for (unsigned t = 1; t < num_threads; ++t) {
+		const float* histogram = &histograms[(t - 1) * num_cells];
+		for (unsigned c = 0; c < num_cells; ++c)
+			grid.density[c] += histogram[c];
+	}
+
+	if (settings.blur_sigma > 0.0f)
+		blur_density_grid(grid, settings.blur_sigma);
+
+	for (unsigned c = 0; c < num_cells; ++c) {
+		if (grid.density[c] > grid.max_density)
+			grid.max_density = grid.density[c];
+	}
+}
+
+void blur_density_grid(DensityGrid& grid, float sigma)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto num_cells = grid.density.size();
+	if (num_cells == 0 || sigma <= 0.0f)
+		return;
+
+	// Normalized kernel cut at three sigmas
+	auto radius = (int)ceilf(sigma * 3.0f);
+	Array<float> kernel(_scratch_allocator);
+	kernel.resize(radius * 2 + 1);
+	float sum = 0.0f;
+	for (int i = -radius; i <= radius; ++i) {
+		kernel[i + radius] = expf(-(float)(i * i) / (2.0f * sigma * sigma));
+		sum += kernel[i + radius];
+	}
+	for (unsigned i = 0; i < kernel.size(); ++i)
+		kernel[i] /= sum;
+
+	Array<float> blurred(_scratch_allocator);
+	blurred.resize(num_cells);
+
+	unsigned strides[3] = { 1, grid.dims[0], grid.dims[0] * grid.dims[1] };
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		auto length = (int)grid.dims[axis];
+		if (length <= 1)
+			continue;
+
+		auto stride = strides[axis];
+		for (unsigned c = 0; c < num_cells; ++c) {
+			auto position = (int)((c / stride) % grid.dims[axis]);
+			float value = 0.0f;
+			for (int k = -radius; k <= radius; ++k) {
+				auto p = position + k;
+				if (p >= 0 && p < length)
+					value += kernel[k + radius] * grid.density[c + (int)stride * k];
+			}
+			blurred[c] = value;
+		}
+		memcpy(grid.density.begin(), blurred.begin(), num_cells * sizeof(float));
+	}
+}
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <plugin_foundation/array.h>
+
+#include <stdint.h>
+
+namespace PLUGIN_NAMESPACE {
+
+/**
+ * Upper bound of cells per axis and in total of a density grid, the cell size grows to stay below it.
+ */
+const unsigned DENSITY_MAX_CELLS_PER_AXIS = 512;
+const unsigned DENSITY_MAX_CELLS = 1 << 22;
+
+/**
+ * Positions binned by each thread, fewer positions are binned on fewer threads.
+ */
+const unsigned DENSITY_POINTS_PER_THREAD = 65536;
+const unsigned DENSITY_MAX_THREADS = 8;
+
+/**
+ * How positions are accumulated. A flat grid ignores the height (z) of the positions.
+ * blur_sigma is the standard deviation of the Gaussian blur in cells, 0 turns the blur off.
+ */
+struct DensitySettings
+{
+	float cell_size;
+	float blur_sigma;
+	bool flat;
+};
+
+/**
+ * Number of positions per cell, cell (x, y, z) is at index (z * dims[1] + y) * dims[0] + x.
+ */
+struct DensityGrid
+{
+	DensityGrid(stingray_plugin_foundation::Allocator& allocator) : density(allocator), cell_size(0.0f), max_density(0.0f)
+	{
+		dims[0] = dims[1] = dims[2] = 0;
+		origin[0] = origin[1] = origin[2] = 0.0f;
+	}
+
+	stingray_plugin_foundation::Array<float> density;
+	unsigned dims[3];
+	float origin[3];
+	float cell_size;
+	float max_density;
+};
+
+/**
+ * Accumulate flat x, y, z positions in a density grid. The positions are split between threads
+ * that bin into their own histogram, the histograms are summed afterwards. The grid is blurred
+ * if the settings have a blur sigma.
+ */
+void build_density_grid(const float* positions, unsigned num_positions, const DensitySettings& settings, DensityGrid& grid);
+
+/**
+ * Separable Gaussian blur of a density grid along each axis with more than one cell.
+ */
+void blur_density_grid(DensityGrid& grid, float sigma);
+
+}
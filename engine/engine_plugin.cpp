@@ -1,3 +1,7 @@
+#include "engine_plugin.h"
+#include "point_cloud.h"
+#include "profiler.h"
+
 #include <engine_plugin_api/plugin_api.h>
 #include <plugin_foundation/platform.h>
 #include <plugin_foundation/id_string.h>
@@ -27,6 +31,8 @@ ErrorApi *error = nullptr;
 UnitApi* unit = nullptr;
 ResourceManagerApi* resource_manager = nullptr;
 RenderBufferApi* render_buffer = nullptr;
+MeshObjectApi* mesh_object = nullptr;
+LuaApi* lua = nullptr;
 
 // C Scripting API
 namespace stingray {
@@ -97,11 +103,16 @@ void setup_plugin(GetApiFunction get_engine_api)
 
 	unit = (UnitApi*)get_engine_api(UNIT_API_ID);
 	render_buffer = (RenderBufferApi*)get_engine_api(RENDER_BUFFER_API_ID);
+	mesh_object = (MeshObjectApi*)get_engine_api(MESH_API_ID);
+	lua = (LuaApi*)get_engine_api(LUA_API_ID);
 	auto c_api = (ScriptApi*)get_engine_api(C_API_ID);
 	stingray::Unit = c_api->Unit;
 	stingray::Mesh = c_api->Mesh;
 	stingray::Material = c_api->Material;
 	stingray::Data = c_api->DynamicScriptData;
+
+	register_point_cloud_lua_api();
+	register_profiler_lua_api();
 }
 
 /**
@@ -137,6 +148,11 @@ void setup_resources(GetApiFunction get_engine_api)
 void update_plugin(float dt)
 {
 	//log->info(get_name(), error->eprintf("Updating %f", dt));
+
+	// Frame times, so the plugin stages can be compared against the frame budget
+	auto frame_us = (uint64_t)(dt * 1000000.0f);
+	auto now_us = profile_time_us();
+	record_stage("frame", now_us > frame_us ? now_us - frame_us : 0, frame_us);
 }
 
 /**
@@ -144,6 +160,9 @@ void update_plugin(float dt)
  */
 void shutdown_plugin()
 {
+	if (render_buffer != nullptr)
+		destroy_point_clouds();
+
 	if (allocator_object != nullptr) {
 		XENSURE(_allocator.api());
 		_allocator = ApiAllocator(nullptr, nullptr);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <engine_plugin_api/plugin_api.h>
+#include <plugin_foundation/allocator.h>
+
+namespace PLUGIN_NAMESPACE {
+
+// Common constants
+extern unsigned int INVALID_HANDLE;
+
+// Engine APIs shared by the plugin modules
+extern stingray_plugin_foundation::ApiAllocator _allocator;
+extern LoggingApi *log;
+extern ErrorApi *error;
+extern ResourceManagerApi* resource_manager;
+extern RenderBufferApi* render_buffer;
+extern MeshObjectApi* mesh_object;
+extern LuaApi* lua;
+
+// C Scripting API
+namespace stingray {
+	extern struct UnitCApi* Unit;
+	extern struct MeshCApi* Mesh;
+	extern struct MaterialCApi* Material;
+	extern struct DynamicScriptDataCApi* Data;
+}
+
+/**
+ * Returns the plugin name.
+ */
+const char* get_name();
+
+}
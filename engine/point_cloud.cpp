@@ -0,0 +1,1469 @@
+#include "point_cloud.h"
+#include "engine_plugin.h"
+#include "spatial_grid.h"
+#include "color_scale.h"
+#include "density_grid.h"
+#include "scratch_arena.h"
+#include "shared_points.h"
+#include "profiler.h"
+#include "timeline_index.h"
+
+#include <plugin_foundation/array.h>
+
+#include <float.h>
+#include <math.h>
+#include <new>
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE {
+
+using namespace stingray_plugin_foundation;
+
+/**
+ * Render resources of a block of the ring of a live point cloud, each block is its own mesh object
+ * so that appending only re-uploads the blocks it wrote to, see append_point_cloud_points.
+ */
+struct LiveBlock
+{
+	unsigned mesh;
+	unsigned vertex_buffer;
+	unsigned index_buffer;
+	unsigned vertex_description;
+	unsigned capacity;
+	float bb_min[3];
+	float bb_max[3];
+	bool dirty;
+};
+
+/**
+ * Render resources of one point cloud. Every point is expanded to the eight corners
+ * of a box drawn as a line list, so the whole cloud is a single batch of one mesh object.
+ */
+struct PointCloud
+{
+	bool used;
+	CApiUnit* host_unit;
+	void* material;
+	unsigned mesh;
+	unsigned vertex_buffer;
+	unsigned index_buffer;
+	unsigned vertex_description;
+	unsigned num_points;
+
+	// Live point clouds keep the latest capacity points in a ring of expanded boxes, see reserve_point_cloud
+	PointCloudPoint* live_vertices;
+	LiveBlock* live_blocks;
+	unsigned num_live_blocks;
+	unsigned capacity;
+	unsigned next_point;
+	float box_size;
+	float bb_min[3];
+	float bb_max[3];
+
+	// Large static point clouds are bucketed in a grid, see update_point_cloud_view
+	PointGrid* grid;
+	float last_view[20];
+
+	// Point clouds colored by a scalar keep their points and scalars to recolor them, see set_point_cloud_color_scale
+	PointCloudPoint* points;
+	float* scalars;
+	ColorScale color_scale;
+
+	// Hash of the positions and settings of a density point cloud, see set_point_cloud_density
+	uint64_t density_key;
+
+	// Time of every point of a timed point cloud, sorted along with the points, see set_point_cloud_time_window
+	double* times;
+};
+
+PointCloud point_clouds[MAX_POINT_CLOUDS];
+
+const unsigned BOX_CORNERS = 8;
+const unsigned BOX_LINE_INDICES = 24;
+
+/**
+ * Points per block of the ring of a live point cloud, 512 KB of expanded boxes.
+ */
+const unsigned LIVE_BLOCK_POINTS = 4096;
+
+/**
+ * Point clouds with fewer points are always drawn whole and get no grid.
+ */
+const unsigned MIN_GRID_POINTS = 4096;
+
+/**
+ * Cells further away than this many cell sizes are drawn as one box.
+ */
+const float LOD_CELL_DISTANCE = 6.0f;
+
+/**
+ * Heatmap cells with less than this part of the densest cell's density are not drawn.
+ */
+const float DENSITY_MIN_RATIO = 0.02f;
+
+/**
+ * Step between the color scale keys of consecutive paths, the fractional part of the golden ratio.
+ */
+const double PATH_COLOR_STEP = 0.6180339887498949;
+
+/**
+ * Color of volumes without a scalar.
+ */
+const uint32_t VOLUME_NO_SCALAR_COLOR = 0xFFFFFFFF;
+
+// Corner i of the box is at (i & 1, (i >> 1) & 1, (i >> 2) & 1), edges are pairs of corners
+const uint32_t BOX_EDGES[BOX_LINE_INDICES] = {
+	0, 1, 2, 3, 4, 5, 6, 7, // x
+	0, 2, 1, 3, 4, 6, 5, 7, // y
+	0, 4, 1, 5, 2, 6, 3, 7  // z
+};
+
+PointCloud* find_point_cloud(unsigned handle)
+{
+	if (handle >= MAX_POINT_CLOUDS || !point_clouds[handle].used)
+		return nullptr;
+	return &point_clouds[handle];
+}
+
+/**
+ * Release the render buffers of a point cloud, the mesh object is kept.
+ */
+void release_point_cloud_buffers(PointCloud& cloud)
+{
+	mesh_object->clear_resources(cloud.mesh);
+	mesh_object->set_batch_info(cloud.mesh, 0, nullptr);
+
+	if (cloud.vertex_buffer != INVALID_HANDLE)
+		render_buffer->destroy_buffer(cloud.vertex_buffer);
+	if (cloud.index_buffer != INVALID_HANDLE)
+		render_buffer->destroy_buffer(cloud.index_buffer);
+	if (cloud.vertex_description != INVALID_HANDLE)
+		render_buffer->destroy_description(cloud.vertex_description);
+
+	cloud.vertex_buffer = cloud.index_buffer = cloud.vertex_description = INVALID_HANDLE;
+	cloud.num_points = 0;
+
+	for (unsigned b = 0; b < cloud.num_live_blocks; ++b) {
+		auto& block = cloud.live_blocks[b];
+		mesh_object->destroy(block.mesh);
+		render_buffer->destroy_buffer(block.vertex_buffer);
+		render_buffer->destroy_buffer(block.index_buffer);
+		render_buffer->destroy_description(block.vertex_description);
+	}
+	if (cloud.live_blocks != nullptr)
+		_allocator.deallocate(cloud.live_blocks);
+	cloud.live_blocks = nullptr;
+	cloud.num_live_blocks = 0;
+
+	if (cloud.live_vertices != nullptr)
+		_allocator.deallocate(cloud.live_vertices);
+	cloud.live_vertices = nullptr;
+	cloud.capacity = cloud.next_point = 0;
+
+	if (cloud.grid != nullptr) {
+		cloud.grid->~PointGrid();
+		_allocator.deallocate(cloud.grid);
+	}
+	cloud.grid = nullptr;
+
+	if (cloud.points != nullptr)
+		_allocator.deallocate(cloud.points);
+	if (cloud.scalars != nullptr)
+		_allocator.deallocate(cloud.scalars);
+	cloud.points = nullptr;
+	cloud.scalars = nullptr;
+	cloud.color_scale.num_stops = 0;
+	cloud.density_key = 0;
+
+	if (cloud.times != nullptr)
+		_allocator.deallocate(cloud.times);
+	cloud.times = nullptr;
+}
+
+/**
+ * Write the eight corners of the box around a point and grow the bounding box to contain it.
+ */
+void expand_point(const PointCloudPoint& point, float half_size, PointCloudPoint* corners, float* bb_min, float* bb_max)
+{
+	for (unsigned c = 0; c < BOX_CORNERS; ++c) {
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			auto offset = ((c >> axis) & 1) ? half_size : -half_size;
+			corners[c].position[axis] = point.position[axis] + offset;
+		}
+		corners[c].color = point.color;
+	}
+
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		if (point.position[axis] - half_size < bb_min[axis]) bb_min[axis] = point.position[axis] - half_size;
+		if (point.position[axis] + half_size > bb_max[axis]) bb_max[axis] = point.position[axis] + half_size;
+	}
+}
+
+/**
+ * Write the line indices of box into indices.
+ */
+void write_box_indices(unsigned box, uint32_t* indices)
+{
+	for (unsigned e = 0; e < BOX_LINE_INDICES; ++e)
+		indices[e] = box * BOX_CORNERS + BOX_EDGES[e];
+}
+
+/**
+ * Create a vertex buffer, a line index buffer and a vertex description and add them to a mesh object.
+ */
+void create_line_buffers(unsigned mesh, const PointCloudPoint* vertices, unsigned num_vertices, const uint32_t* indices, unsigned num_indices,
+	RB_Validity vertex_validity, RB_Validity index_validity, unsigned& vertex_buffer, unsigned& index_buffer, unsigned& vertex_description)
+{
+	RB_VertexBufferView vertex_view = { sizeof(PointCloudPoint) };
+	vertex_buffer = render_buffer->create_buffer(num_vertices * sizeof(PointCloudPoint),
+		vertex_validity, RB_View::RB_VERTEX_BUFFER_VIEW, &vertex_view, vertices);
+
+	RB_IndexBufferView index_view = { RB_IndexFormat::RB_INDEX_FORMAT_32BIT };
+	index_buffer = render_buffer->create_buffer(num_indices * sizeof(uint32_t),
+		index_validity, RB_View::RB_INDEX_BUFFER_VIEW, &index_view, indices);
+
+	RB_VertexDescription description = { 0 };
+	description.stride = sizeof(PointCloudPoint);
+	description.n_components = 2;
+	description.components[0].semantic = RB_VertexSemantic::RB_POSITION_SEMANTIC;
+	description.components[0].format = render_buffer->format(RB_FLOAT_COMPONENT, true, false, 32, 32, 32, 0);
+	description.components[1].semantic = RB_VertexSemantic::RB_COLOR_SEMANTIC;
+	description.components[1].format = render_buffer->format(RB_INTEGER_COMPONENT, false, true, 8, 8, 8, 8);
+	vertex_description = render_buffer->create_description(RB_Description::RB_VERTEX_DESCRIPTION, &description);
+
+	mesh_object->add_resource(mesh, vertex_buffer);
+	mesh_object->add_resource(mesh, index_buffer);
+	mesh_object->add_resource(mesh, vertex_description);
+}
+
+/**
+ * Create the line buffers of a point cloud on its mesh object, see create_line_buffers.
+ */
+void create_line_buffers(PointCloud& cloud, const PointCloudPoint* vertices, unsigned num_vertices, const uint32_t* indices, unsigned num_indices,
+	RB_Validity vertex_validity, RB_Validity index_validity)
+{
+	create_line_buffers(cloud.mesh, vertices, num_vertices, indices, num_indices, vertex_validity, index_validity,
+		cloud.vertex_buffer, cloud.index_buffer, cloud.vertex_description);
+}
+
+/**
+ * Create the line buffers of num_boxes boxes on a mesh object, see create_line_buffers.
+ */
+void create_box_buffers(unsigned mesh, const PointCloudPoint* vertices, unsigned num_boxes, RB_Validity vertex_validity, RB_Validity index_validity,
+	unsigned& vertex_buffer, unsigned& index_buffer, unsigned& vertex_description)
+{
+	Array<uint32_t> indices(_scratch_allocator);
+	indices.resize(num_boxes * BOX_LINE_INDICES);
+	for (unsigned i = 0; i < num_boxes; ++i)
+		write_box_indices(i, &indices[i * BOX_LINE_INDICES]);
+
+	create_line_buffers(mesh, vertices, num_boxes * BOX_CORNERS, indices.begin(), indices.size(), vertex_validity, index_validity,
+		vertex_buffer, index_buffer, vertex_description);
+}
+
+/**
+ * Create the render buffers of num_boxes boxes of a point cloud, see create_line_buffers.
+ */
+void create_point_cloud_buffers(PointCloud& cloud, const PointCloudPoint* vertices, unsigned num_boxes, RB_Validity vertex_validity, RB_Validity index_validity)
+{
+	create_box_buffers(cloud.mesh, vertices, num_boxes, vertex_validity, index_validity,
+		cloud.vertex_buffer, cloud.index_buffer, cloud.vertex_description);
+}
+
+/**
+ * Draw num_boxes boxes of the index buffer of a mesh object, starting at box first_box.
+ */
+void set_mesh_box_range(unsigned mesh, unsigned first_box, unsigned num_boxes, const float* bb_min, const float* bb_max)
+{
+	MO_BatchInfo batch = { 0 };
+	batch.primitive_type = MO_PrimitiveType::MO_LINES;
+	batch.primitives = num_boxes * BOX_LINE_INDICES / 2;
+	batch.index_offset = first_box * BOX_LINE_INDICES;
+	batch.instances = 1;
+	mesh_object->set_batch_info(mesh, 1, &batch);
+	mesh_object->set_bounding_box(mesh, bb_min, bb_max);
+}
+
+/**
+ * Draw num_boxes boxes of the index buffer of a point cloud, starting at box first_box.
+ */
+void set_point_cloud_box_range(PointCloud& cloud, unsigned first_box, unsigned num_boxes, const float* bb_min, const float* bb_max)
+{
+	set_mesh_box_range(cloud.mesh, first_box, num_boxes, bb_min, bb_max);
+}
+
+/**
+ * Draw the first num_points boxes of a point cloud.
+ */
+void set_point_cloud_batch(PointCloud& cloud, unsigned num_points, const float* bb_min, const float* bb_max)
+{
+	set_point_cloud_box_range(cloud, 0, num_points, bb_min, bb_max);
+	cloud.num_points = num_points;
+}
+
+unsigned create_point_cloud(CApiUnit* host_unit)
+{
+	if (host_unit == nullptr)
+		return INVALID_HANDLE;
+
+	unsigned handle = 0;
+	while (handle < MAX_POINT_CLOUDS && point_clouds[handle].used)
+		++handle;
+	if (handle == MAX_POINT_CLOUDS) {
+		log->error(get_name(), "Too many point clouds");
+		return INVALID_HANDLE;
+	}
+
+	auto host_mesh = stingray::Unit->mesh(host_unit, 0, nullptr);
+	auto material = host_mesh ? stingray::Mesh->material(host_mesh, 0, nullptr) : nullptr;
+	if (material == nullptr) {
+		log->error(get_name(), "The point cloud host unit has no material");
+		return INVALID_HANDLE;
+	}
+
+	auto& cloud = point_clouds[handle];
+	cloud.used = true;
+	cloud.host_unit = host_unit;
+	cloud.material = material;
+	cloud.mesh = mesh_object->create(host_unit, 0, MO_VIEWPORT_VISIBLE_FLAGS);
+	cloud.vertex_buffer = cloud.index_buffer = cloud.vertex_description = INVALID_HANDLE;
+	cloud.num_points = 0;
+	cloud.live_vertices = nullptr;
+	cloud.live_blocks = nullptr;
+	cloud.num_live_blocks = 0;
+	cloud.capacity = cloud.next_point = 0;
+	cloud.grid = nullptr;
+	cloud.points = nullptr;
+	cloud.scalars = nullptr;
+	cloud.color_scale.num_stops = 0;
+	cloud.density_key = 0;
+	cloud.times = nullptr;
+	mesh_object->set_materials(cloud.mesh, 1, (void**)&material);
+	return handle;
+}
+
+/**
+ * Bucket the points of a point cloud in a grid if there are enough of them, reordering them by cell.
+ */
+void build_point_cloud_grid(PointCloud& cloud, PointCloudPoint* points, unsigned num_points, float box_size)
+{
+	if (num_points < MIN_GRID_POINTS)
+		return;
+
+	cloud.grid = new (_allocator.allocate(sizeof(PointGrid))) PointGrid(_allocator);
+	build_point_grid(points, num_points, box_size, *cloud.grid);
+}
+
+/**
+ * Sort points by time in place and keep the sorted times in the point cloud.
+ */
+void sort_point_cloud_by_time(PointCloud& cloud, PointCloudPoint* points, const double* times, unsigned num_points)
+{
+	ScopedTimer timer("point_cloud.sort_times");
+	timer.items = num_points;
+
+	Array<uint32_t> order(_scratch_allocator);
+	order.resize(num_points);
+	build_time_order(times, num_points, order.begin());
+
+	Array<PointCloudPoint> unsorted(_scratch_allocator);
+	unsorted.resize(num_points);
+	memcpy(unsorted.begin(), points, num_points * sizeof(PointCloudPoint));
+
+	cloud.times = (double*)_allocator.allocate(num_points * sizeof(double));
+	for (unsigned i = 0; i < num_points; ++i) {
+		points[i] = unsorted[order[i]];
+		cloud.times[i] = times[order[i]];
+	}
+}
+
+/**
+ * Expand the points of a point cloud to boxes, followed by one box per grid cell covering its points.
+ */
+void expand_point_cloud(const PointCloud& cloud, const PointCloudPoint* points, unsigned num_points, float box_size,
+	Array<PointCloudPoint>& vertices, float* bb_min, float* bb_max)
+{
+	auto num_cells = cloud.grid != nullptr ? cloud.grid->cells.size() : 0;
+	vertices.resize((num_points + num_cells) * BOX_CORNERS);
+
+	const float half_size = box_size * 0.5f;
+	for (unsigned i = 0; i < num_points; ++i)
+		expand_point(points[i], half_size, &vertices[i * BOX_CORNERS], bb_min, bb_max);
+
+	for (unsigned c = 0; c < num_cells; ++c) {
+		const auto& cell = cloud.grid->cells[c];
+		auto corners = &vertices[(num_points + c) * BOX_CORNERS];
+		for (unsigned corner = 0; corner < BOX_CORNERS; ++corner) {
+			for (unsigned axis = 0; axis < 3; ++axis)
+				corners[corner].position[axis] = ((corner >> axis) & 1) ? cell.bb_max[axis] : cell.bb_min[axis];
+			corners[corner].color = cell.color;
+		}
+	}
+}
+
+/**
+ * Create the render buffers of a point cloud from its points. Point clouds with a grid get an updatable
+ * index buffer and draw everything until the first update_point_cloud_view.
+ */
+void upload_point_cloud(PointCloud& cloud, const PointCloudPoint* points, unsigned num_points, float box_size, RB_Validity vertex_validity)
+{
+	float bb_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float bb_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	ScopedTimer timer("point_cloud.upload");
+	timer.items = num_points;
+	timer.bytes = num_points * BOX_CORNERS * sizeof(PointCloudPoint);
+
+	Array<PointCloudPoint> vertices(_scratch_allocator);
+	expand_point_cloud(cloud, points, num_points, box_size, vertices, bb_min, bb_max);
+
+	auto index_validity = cloud.grid != nullptr ? RB_Validity::RB_VALIDITY_UPDATABLE : RB_Validity::RB_VALIDITY_STATIC;
+	create_point_cloud_buffers(cloud, vertices.begin(), num_points, vertex_validity, index_validity);
+	set_point_cloud_batch(cloud, num_points, bb_min, bb_max);
+
+	cloud.box_size = box_size;
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		cloud.bb_min[axis] = bb_min[axis];
+		cloud.bb_max[axis] = bb_max[axis];
+	}
+	memset(cloud.last_view, 0, sizeof(cloud.last_view));
+}
+
+bool set_point_cloud_points(unsigned handle, const PointCloudPoint* points, unsigned num_points, float box_size, const double* times)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr)
+		return false;
+
+	release_point_cloud_buffers(*cloud);
+	if (num_points == 0)
+		return true;
+
+	Array<PointCloudPoint> sorted(_scratch_allocator);
+	sorted.resize(num_points);
+	memcpy(sorted.begin(), points, num_points * sizeof(PointCloudPoint));
+
+	if (times != nullptr)
+		sort_point_cloud_by_time(*cloud, sorted.begin(), times, num_points);
+	else
+		build_point_cloud_grid(*cloud, sorted.begin(), num_points, box_size);
+	upload_point_cloud(*cloud, sorted.begin(), num_points, box_size, RB_Validity::RB_VALIDITY_STATIC);
+	return true;
+}
+
+/**
+ * Color the kept points of a scalar point cloud with its color scale and update the cell colors.
+ */
+void color_point_cloud_points(PointCloud& cloud)
+{
+	ScopedTimer timer("point_cloud.color");
+	timer.items = cloud.num_points;
+
+	Array<uint32_t> colors(_scratch_allocator);
+	colors.resize(cloud.num_points);
+	map_scalars_to_colors(cloud.scalars, cloud.num_points, cloud.color_scale, colors.begin());
+
+	for (unsigned i = 0; i < cloud.num_points; ++i)
+		cloud.points[i].color = colors[i];
+	if (cloud.grid != nullptr)
+		average_grid_cell_colors(cloud.points, *cloud.grid);
+}
+
+bool set_point_cloud_scalar_points(unsigned handle, const PointCloudPoint* points, const float* scalars, unsigned num_points,
+	float box_size, const ColorScale& scale, const double* times)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr)
+		return false;
+
+	release_point_cloud_buffers(*cloud);
+
+	// Points without a scalar never get a color, the scalar rides in the color field while the points are sorted
+	Array<PointCloudPoint> kept(_scratch_allocator);
+	Array<double> kept_times(_scratch_allocator);
+	kept.resize(num_points);
+	kept_times.resize(times != nullptr ? num_points : 0);
+	unsigned num_kept = 0;
+	for (unsigned i = 0; i < num_points; ++i) {
+		if (isnan(scalars[i]))
+			continue;
+		kept[num_kept] = points[i];
+		memcpy(&kept[num_kept].color, &scalars[i], sizeof(float));
+		if (times != nullptr)
+			kept_times[num_kept] = times[i];
+		++num_kept;
+	}
+	if (num_kept == 0)
+		return true;
+
+	if (times != nullptr)
+		sort_point_cloud_by_time(*cloud, kept.begin(), kept_times.begin(), num_kept);
+	else
+		build_point_cloud_grid(*cloud, kept.begin(), num_kept, box_size);
+
+	cloud->points = (PointCloudPoint*)_allocator.allocate(num_kept * sizeof(PointCloudPoint));
+	cloud->scalars = (float*)_allocator.allocate(num_kept * sizeof(float));
+	for (unsigned i = 0; i < num_kept; ++i) {
+		cloud->points[i] = kept[i];
+		memcpy(&cloud->scalars[i], &kept[i].color, sizeof(float));
+	}
+
+	cloud->num_points = num_kept;
+	cloud->color_scale = scale;
+	color_point_cloud_points(*cloud);
+
+	upload_point_cloud(*cloud, cloud->points, num_kept, box_size, RB_Validity::RB_VALIDITY_UPDATABLE);
+	return true;
+}
+
+bool set_point_cloud_color_scale(unsigned handle, const ColorScale& scale)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr || cloud->scalars == nullptr)
+		return false;
+	if (color_scales_equal(scale, cloud->color_scale))
+		return true;
+
+	cloud->color_scale = scale;
+	color_point_cloud_points(*cloud);
+
+	float bb_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float bb_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	Array<PointCloudPoint> vertices(_scratch_allocator);
+	expand_point_cloud(*cloud, cloud->points, cloud->num_points, cloud->box_size, vertices, bb_min, bb_max);
+	render_buffer->update_buffer(cloud->vertex_buffer, vertices.size() * sizeof(PointCloudPoint), vertices.begin());
+	return true;
+}
+
+/**
+ * FNV-1a hash of a block of memory, continuing from hash.
+ */
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash)
+{
+	auto bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	return hash;
+}
+
+bool set_point_cloud_density(unsigned handle, const float* positions, unsigned num_positions, const DensitySettings& settings, const ColorScale& scale)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr)
+		return false;
+
+	auto key = hash_bytes(positions, num_positions * 3 * sizeof(float), 14695981039346656037ULL);
+	key = hash_bytes(&settings.cell_size, sizeof(settings.cell_size), key);
+	key = hash_bytes(&settings.blur_sigma, sizeof(settings.blur_sigma), key);
+	key = hash_bytes(&settings.flat, sizeof(settings.flat), key);
+	if (key == cloud->density_key && cloud->scalars != nullptr)
+		return set_point_cloud_color_scale(handle, scale);
+
+	DensityGrid grid(_scratch_allocator);
+	{
+		ScopedTimer timer("point_cloud.density");
+		timer.items = num_positions;
+		build_density_grid(positions, num_positions, settings, grid);
+	}
+
+	// Every cell above the threshold becomes a box of the cell size, colored by its density relative to the densest cell
+	Array<PointCloudPoint> cells(_scratch_allocator);
+	Array<float> densities(_scratch_allocator);
+	auto threshold = grid.max_density * DENSITY_MIN_RATIO;
+	for (unsigned z = 0; z < grid.dims[2]; ++z) {
+		for (unsigned y = 0; y < grid.dims[1]; ++y) {
+			for (unsigned x = 0; x < grid.dims[0]; ++x) {
+				auto density = grid.density[(z * grid.dims[1] + y) * grid.dims[0] + x];
+				if (density <= 0.0f || density < threshold)
+					continue;
+
+				PointCloudPoint cell;
+				cell.position[0] = grid.origin[0] + (x + 0.5f) * grid.cell_size;
+				cell.position[1] = grid.origin[1] + (y + 0.5f) * grid.cell_size;
+				cell.position[2] = settings.flat ? grid.origin[2] : grid.origin[2] + (z + 0.5f) * grid.cell_size;
+				cell.color = 0;
+				cells.push_back(cell);
+				densities.push_back(density / grid.max_density);
+			}
+		}
+	}
+
+	if (!set_point_cloud_scalar_points(handle, cells.begin(), densities.begin(), cells.size(), grid.cell_size, scale))
+		return false;
+	cloud->density_key = key;
+	return true;
+}
+
+bool set_point_cloud_paths(unsigned handle, const float* positions, unsigned num_points, const uint32_t* path_ends, unsigned num_paths, const ColorScale& scale)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr)
+		return false;
+
+	// Path ends index the vertices, a block that decreases or runs past them would be read out of bounds
+	for (unsigned p = 0; p < num_paths; ++p) {
+		if (path_ends[p] > num_points || (p > 0 && path_ends[p] < path_ends[p - 1]))
+			return false;
+	}
+
+	release_point_cloud_buffers(*cloud);
+
+	ScopedTimer timer("point_cloud.paths");
+	timer.items = num_points;
+
+	// Paths are spread over the scale by the golden ratio, so that paths next to each other get distinct colors
+	Array<float> path_keys(_scratch_allocator);
+	Array<uint32_t> path_colors(_scratch_allocator);
+	path_keys.resize(num_paths);
+	path_colors.resize(num_paths);
+	for (unsigned p = 0; p < num_paths; ++p)
+		path_keys[p] = (float)fmod(p * PATH_COLOR_STEP, 1.0);
+	map_scalars_to_colors(path_keys.begin(), num_paths, scale, path_colors.begin());
+
+	float bb_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float bb_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	Array<PointCloudPoint> vertices(_scratch_allocator);
+	Array<uint32_t> indices(_scratch_allocator);
+	vertices.resize(num_points);
+	indices.resize(num_points * 2);
+	unsigned num_indices = 0;
+
+	// One line per pair of consecutive points of a path, points after the last path end are not drawn
+	unsigned start = 0;
+	for (unsigned p = 0; p < num_paths; ++p) {
+		for (auto i = start; i < path_ends[p]; ++i) {
+			memcpy(vertices[i].position, &positions[i * 3], 3 * sizeof(float));
+			vertices[i].color = path_colors[p];
+			for (unsigned axis = 0; axis < 3; ++axis) {
+				if (positions[i * 3 + axis] < bb_min[axis]) bb_min[axis] = positions[i * 3 + axis];
+				if (positions[i * 3 + axis] > bb_max[axis]) bb_max[axis] = positions[i * 3 + axis];
+			}
+			if (i > start) {
+				indices[num_indices++] = i - 1;
+				indices[num_indices++] = i;
+			}
+		}
+		start = path_ends[p];
+	}
+	if (num_indices == 0)
+		return true;
+
+	timer.bytes = num_points * sizeof(PointCloudPoint) + num_indices * sizeof(uint32_t);
+	create_line_buffers(*cloud, vertices.begin(), num_points, indices.begin(), num_indices, RB_Validity::RB_VALIDITY_STATIC, RB_Validity::RB_VALIDITY_STATIC);
+
+	MO_BatchInfo batch = { 0 };
+	batch.primitive_type = MO_PrimitiveType::MO_LINES;
+	batch.primitives = num_indices / 2;
+	batch.instances = 1;
+	mesh_object->set_batch_info(cloud->mesh, 1, &batch);
+	mesh_object->set_bounding_box(cloud->mesh, bb_min, bb_max);
+
+	cloud->num_points = num_points;
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		cloud->bb_min[axis] = bb_min[axis];
+		cloud->bb_max[axis] = bb_max[axis];
+	}
+	return true;
+}
+
+bool set_point_cloud_volumes(unsigned handle, const float* bb_mins, const float* bb_maxs, const float* scalars, unsigned num_volumes, const ColorScale& scale)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr)
+		return false;
+
+	release_point_cloud_buffers(*cloud);
+	if (num_volumes == 0)
+		return true;
+
+	ScopedTimer timer("point_cloud.volumes");
+	timer.items = num_volumes;
+
+	Array<uint32_t> colors(_scratch_allocator);
+	colors.resize(num_volumes);
+	map_scalars_to_colors(scalars, num_volumes, scale, colors.begin());
+
+	// Every volume is a box from its minimum to its maximum corner, see expand_point for the corner order
+	float bb_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float bb_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	Array<PointCloudPoint> vertices(_scratch_allocator);
+	vertices.resize(num_volumes * BOX_CORNERS);
+	for (unsigned v = 0; v < num_volumes; ++v) {
+		auto color = isnan(scalars[v]) ? VOLUME_NO_SCALAR_COLOR : colors[v];
+		for (unsigned c = 0; c < BOX_CORNERS; ++c) {
+			auto& corner = vertices[v * BOX_CORNERS + c];
+			for (unsigned axis = 0; axis < 3; ++axis)
+				corner.position[axis] = ((c >> axis) & 1) ? bb_maxs[v * 3 + axis] : bb_mins[v * 3 + axis];
+			corner.color = color;
+		}
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			if (bb_mins[v * 3 + axis] < bb_min[axis]) bb_min[axis] = bb_mins[v * 3 + axis];
+			if (bb_maxs[v * 3 + axis] > bb_max[axis]) bb_max[axis] = bb_maxs[v * 3 + axis];
+		}
+	}
+
+	timer.bytes = num_volumes * BOX_CORNERS * sizeof(PointCloudPoint);
+	create_point_cloud_buffers(*cloud, vertices.begin(), num_volumes, RB_Validity::RB_VALIDITY_STATIC, RB_Validity::RB_VALIDITY_STATIC);
+	set_point_cloud_batch(*cloud, num_volumes, bb_min, bb_max);
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		cloud->bb_min[axis] = bb_min[axis];
+		cloud->bb_max[axis] = bb_max[axis];
+	}
+	return true;
+}
+
+bool update_point_cloud_view(unsigned handle, const float* pose, float vertical_fov, float aspect, float near_range, float far_range)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr || cloud->grid == nullptr)
+		return false;
+
+	float view[20];
+	memcpy(view, pose, 16 * sizeof(float));
+	view[16] = vertical_fov;
+	view[17] = aspect;
+	view[18] = near_range;
+	view[19] = far_range;
+	if (memcmp(view, cloud->last_view, sizeof(view)) == 0)
+		return true;
+	memcpy(cloud->last_view, view, sizeof(view));
+
+	ScopedTimer timer("point_cloud.update_view");
+
+	ViewFrustum frustum;
+	make_view_frustum(pose, vertical_fov, aspect, near_range, far_range, frustum);
+
+	const auto& grid = *cloud->grid;
+	auto lod_distance = LOD_CELL_DISTANCE * grid.cell_size;
+	auto lod_distance_squared = lod_distance * lod_distance;
+
+	// The index buffer was created for every point, that is also the most a view can draw
+	Array<uint32_t> indices(_scratch_allocator);
+	indices.resize(cloud->num_points * BOX_LINE_INDICES);
+	unsigned num_boxes = 0;
+
+	for (unsigned c = 0; c < grid.cells.size(); ++c) {
+		const auto& cell = grid.cells[c];
+		if (!frustum_intersects_box(frustum, cell.bb_min, cell.bb_max))
+			continue;
+
+		float distance_squared = 0.0f;
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			auto delta = cell.center[axis] - frustum.position[axis];
+			distance_squared += delta * delta;
+		}
+
+		if (cell.num_points == 1 || distance_squared < lod_distance_squared) {
+			for (unsigned i = 0; i < cell.num_points; ++i)
+				write_box_indices(cell.first_point + i, &indices[num_boxes++ * BOX_LINE_INDICES]);
+		} else {
+			write_box_indices(cloud->num_points + c, &indices[num_boxes++ * BOX_LINE_INDICES]);
+		}
+	}
+
+	auto num_points = cloud->num_points;
+	if (num_boxes > 0)
+		render_buffer->update_buffer(cloud->index_buffer, num_boxes * BOX_LINE_INDICES * sizeof(uint32_t), indices.begin());
+	set_point_cloud_batch(*cloud, num_boxes, cloud->bb_min, cloud->bb_max);
+
+	// num_points stays the size of the point set, not the number of boxes drawn
+	cloud->num_points = num_points;
+	return true;
+}
+
+bool set_point_cloud_time_window(unsigned handle, double t0, double t1, unsigned& first, unsigned& count)
+{
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr || cloud->times == nullptr)
+		return false;
+
+	// Without bounds the points without a time are drawn too, as they were before any window was set
+	if (isnan(t0) && isnan(t1)) {
+		first = 0;
+		count = cloud->num_points;
+	} else {
+		find_time_range(cloud->times, cloud->num_points, t0, t1, first, count);
+	}
+
+	set_point_cloud_box_range(*cloud, first, count, cloud->bb_min, cloud->bb_max);
+	return true;
+}
+
+bool get_point_cloud_time_range(unsigned handle, double& min_time, double& max_time)
+{
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr || cloud->times == nullptr)
+		return false;
+
+	auto timed = count_timed(cloud->times, cloud->num_points);
+	if (timed == 0)
+		return false;
+
+	min_time = cloud->times[0];
+	max_time = cloud->times[timed - 1];
+	return true;
+}
+
+bool reserve_point_cloud(unsigned handle, unsigned capacity, float box_size)
+{
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr)
+		return false;
+
+	release_point_cloud_buffers(*cloud);
+	if (capacity == 0)
+		return true;
+
+	auto bytes = capacity * BOX_CORNERS * sizeof(PointCloudPoint);
+	cloud->live_vertices = (PointCloudPoint*)_allocator.allocate(bytes);
+	memset(cloud->live_vertices, 0, bytes);
+	cloud->capacity = capacity;
+	cloud->next_point = 0;
+	cloud->box_size = box_size;
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		cloud->bb_min[axis] = FLT_MAX;
+		cloud->bb_max[axis] = -FLT_MAX;
+	}
+
+	// update_buffer always uploads a whole buffer, so the ring is split in blocks that each have their own buffers
+	ScratchScope scratch_scope(_scratch_allocator);
+	cloud->num_live_blocks = (capacity + LIVE_BLOCK_POINTS - 1) / LIVE_BLOCK_POINTS;
+	cloud->live_blocks = (LiveBlock*)_allocator.allocate(cloud->num_live_blocks * sizeof(LiveBlock));
+	for (unsigned b = 0; b < cloud->num_live_blocks; ++b) {
+		auto& block = cloud->live_blocks[b];
+		auto first = b * LIVE_BLOCK_POINTS;
+		block.capacity = capacity - first < LIVE_BLOCK_POINTS ? capacity - first : LIVE_BLOCK_POINTS;
+		block.dirty = false;
+		block.mesh = mesh_object->create(cloud->host_unit, 0, MO_VIEWPORT_VISIBLE_FLAGS);
+		mesh_object->set_materials(block.mesh, 1, &cloud->material);
+		create_box_buffers(block.mesh, &cloud->live_vertices[first * BOX_CORNERS], block.capacity, RB_Validity::RB_VALIDITY_UPDATABLE,
+			RB_Validity::RB_VALIDITY_STATIC, block.vertex_buffer, block.index_buffer, block.vertex_description);
+	}
+	return true;
+}
+
+/**
+ * Bounding box of the corners of num_boxes expanded boxes.
+ */
+void box_corner_bounds(const PointCloudPoint* corners, unsigned num_boxes, float* bb_min, float* bb_max)
+{
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		bb_min[axis] = FLT_MAX;
+		bb_max[axis] = -FLT_MAX;
+	}
+	for (unsigned i = 0; i < num_boxes * BOX_CORNERS; ++i) {
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			if (corners[i].position[axis] < bb_min[axis]) bb_min[axis] = corners[i].position[axis];
+			if (corners[i].position[axis] > bb_max[axis]) bb_max[axis] = corners[i].position[axis];
+		}
+	}
+}
+
+bool append_point_cloud_points(unsigned handle, const PointCloudPoint* points, unsigned num_points)
+{
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr || cloud->capacity == 0)
+		return false;
+	if (num_points == 0)
+		return true;
+
+	ScopedTimer timer("point_cloud.append");
+	timer.items = num_points;
+
+	// Only the latest capacity points can be kept
+	if (num_points > cloud->capacity) {
+		points += num_points - cloud->capacity;
+		num_points = cloud->capacity;
+	}
+
+	// Overwritten boxes may have held the extremes, so the bounds of every written block are recomputed below
+	const float half_size = cloud->box_size * 0.5f;
+	float point_bb_min[3], point_bb_max[3];
+	for (unsigned i = 0; i < num_points; ++i) {
+		expand_point(points[i], half_size, &cloud->live_vertices[cloud->next_point * BOX_CORNERS], point_bb_min, point_bb_max);
+		cloud->live_blocks[cloud->next_point / LIVE_BLOCK_POINTS].dirty = true;
+		cloud->next_point = (cloud->next_point + 1) % cloud->capacity;
+	}
+
+	// The ring fills from the start, so the drawn boxes are always the first num_points ones
+	auto drawn = cloud->num_points + num_points < cloud->capacity ? cloud->num_points + num_points : cloud->capacity;
+	cloud->num_points = drawn;
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		cloud->bb_min[axis] = FLT_MAX;
+		cloud->bb_max[axis] = -FLT_MAX;
+	}
+
+	for (unsigned b = 0; b < cloud->num_live_blocks; ++b) {
+		auto& block = cloud->live_blocks[b];
+		auto first = b * LIVE_BLOCK_POINTS;
+		if (first >= drawn)
+			break;
+
+		if (block.dirty) {
+			auto block_drawn = drawn - first < block.capacity ? drawn - first : block.capacity;
+			auto corners = &cloud->live_vertices[first * BOX_CORNERS];
+			box_corner_bounds(corners, block_drawn, block.bb_min, block.bb_max);
+			render_buffer->update_buffer(block.vertex_buffer, block.capacity * BOX_CORNERS * sizeof(PointCloudPoint), corners);
+			set_mesh_box_range(block.mesh, 0, block_drawn, block.bb_min, block.bb_max);
+			block.dirty = false;
+		}
+
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			if (block.bb_min[axis] < cloud->bb_min[axis]) cloud->bb_min[axis] = block.bb_min[axis];
+			if (block.bb_max[axis] > cloud->bb_max[axis]) cloud->bb_max[axis] = block.bb_max[axis];
+		}
+	}
+	return true;
+}
+
+void destroy_point_cloud(unsigned handle)
+{
+	auto cloud = find_point_cloud(handle);
+	if (cloud == nullptr)
+		return;
+
+	release_point_cloud_buffers(*cloud);
+	mesh_object->destroy(cloud->mesh);
+	cloud->used = false;
+}
+
+void destroy_point_clouds()
+{
+	for (unsigned handle = 0; handle < MAX_POINT_CLOUDS; ++handle)
+		destroy_point_cloud(handle);
+	_scratch_allocator.release();
+}
+
+/**
+ * Read a Lua array of numbers at the stack index into the output array.
+ */
+void read_lua_numbers(lua_State* L, int index, Array<float>& numbers)
+{
+	auto count = (unsigned)lua->objlen(L, index);
+	ScopedTimer timer("point_cloud.read_lua");
+	timer.items = count;
+
+	numbers.resize(count);
+	for (unsigned i = 0; i < count; ++i) {
+		lua->rawgeti(L, index, i + 1);
+		numbers[i] = (float)lua->tonumber(L, -1);
+		lua->settop(L, -2);
+	}
+}
+
+/**
+ * TelemetryPointCloud.create(unit) -> handle or nil
+ */
+int lua_create_point_cloud(lua_State* L)
+{
+	auto handle = create_point_cloud(lua->getunit(L, 1));
+	if (handle == INVALID_HANDLE)
+		lua->pushnil(L);
+	else
+		lua->pushinteger(L, handle);
+	return 1;
+}
+
+/**
+ * Read flat x, y, z positions and optional packed colors at the stack indices into points, white if there is no color.
+ * Pass a colors index of 0 to only read positions.
+ */
+void read_lua_points(lua_State* L, int positions_index, int colors_index, Array<PointCloudPoint>& points)
+{
+	Array<float> positions(_scratch_allocator);
+	read_lua_numbers(L, positions_index, positions);
+
+	auto num_points = positions.size() / 3;
+	auto has_colors = colors_index != 0 && lua->type(L, colors_index) == LUA_TTABLE;
+
+	points.resize(num_points);
+	for (unsigned i = 0; i < num_points; ++i) {
+		points[i].position[0] = positions[i * 3];
+		points[i].position[1] = positions[i * 3 + 1];
+		points[i].position[2] = positions[i * 3 + 2];
+		points[i].color = 0xFFFFFFFF;
+		if (has_colors) {
+			lua->rawgeti(L, colors_index, i + 1);
+			if (lua->isnumber(L, -1))
+				points[i].color = (uint32_t)lua->tonumber(L, -1);
+			lua->settop(L, -2);
+		}
+	}
+}
+
+/**
+ * Read an optional Lua array of times at the stack index, anything that is not a number becomes NaN.
+ * Returns nullptr if there is no table at the index.
+ */
+const double* read_lua_times(lua_State* L, int index, unsigned count, Array<double>& times)
+{
+	if (lua->type(L, index) != LUA_TTABLE)
+		return nullptr;
+
+	times.resize(count);
+	for (unsigned i = 0; i < count; ++i) {
+		lua->rawgeti(L, index, i + 1);
+		times[i] = lua->isnumber(L, -1) ? lua->tonumber(L, -1) : NAN;
+		lua->settop(L, -2);
+	}
+	return times.begin();
+}
+
+/**
+ * TelemetryPointCloud.set_points(handle, positions, colors, box_size, times)
+ * positions are flat x, y, z triplets, colors (optional) one packed 0xAARRGGBB number per point,
+ * times (optional) one number per point, in any unit, for set_time_window.
+ */
+int lua_set_point_cloud_points(lua_State* L)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto handle = (unsigned)lua->tointeger(L, 1);
+	auto box_size = lua->isnumber(L, 4) ? (float)lua->tonumber(L, 4) : 1.0f;
+
+	Array<PointCloudPoint> points(_scratch_allocator);
+	read_lua_points(L, 2, 3, points);
+	Array<double> times(_scratch_allocator);
+	auto point_times = read_lua_times(L, 5, points.size(), times);
+
+	lua->pushboolean(L, set_point_cloud_points(handle, points.begin(), points.size(), box_size, point_times));
+	return 1;
+}
+
+/**
+ * Read a Lua array of scalars at the stack index, anything that is not a number becomes NaN.
+ */
+void read_lua_scalars(lua_State* L, int index, unsigned count, Array<float>& scalars)
+{
+	scalars.resize(count);
+	for (unsigned i = 0; i < count; ++i) {
+		lua->rawgeti(L, index, i + 1);
+		scalars[i] = lua->isnumber(L, -1) ? (float)lua->tonumber(L, -1) : NAN;
+		lua->settop(L, -2);
+	}
+}
+
+/**
+ * Read color stops given as a flat Lua array of value, packed color pairs sorted by value.
+ */
+bool read_lua_color_scale(lua_State* L, int index, ColorScale& scale)
+{
+	if (lua->type(L, index) != LUA_TTABLE)
+		return false;
+
+	// Packed colors do not fit in a float, so the stops are read one by one
+	auto num_stops = (unsigned)lua->objlen(L, index) / 2;
+	if (num_stops > MAX_COLOR_STOPS)
+		return false;
+
+	float values[MAX_COLOR_STOPS];
+	uint32_t colors[MAX_COLOR_STOPS];
+	for (unsigned i = 0; i < num_stops; ++i) {
+		lua->rawgeti(L, index, i * 2 + 1);
+		values[i] = lua->isnumber(L, -1) ? (float)lua->tonumber(L, -1) : NAN;
+		lua->rawgeti(L, index, i * 2 + 2);
+		colors[i] = (uint32_t)lua->tonumber(L, -1);
+		lua->settop(L, -3);
+	}
+	return make_color_scale(values, colors, num_stops, scale);
+}
+
+/**
+ * TelemetryPointCloud.set_scalar_points(handle, positions, scalars, box_size, stops, times)
+ * Colors the points natively from one scalar per point and color stops { value, color, value, color, ... },
+ * points without a number scalar are left out. times is optional, as for set_points.
+ */
+int lua_set_point_cloud_scalar_points(lua_State* L)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto handle = (unsigned)lua->tointeger(L, 1);
+	auto box_size = lua->isnumber(L, 4) ? (float)lua->tonumber(L, 4) : 1.0f;
+
+	ColorScale scale;
+	if (!read_lua_color_scale(L, 5, scale)) {
+		log->warning(get_name(), "Invalid point cloud color stops");
+		lua->pushboolean(L, false);
+		return 1;
+	}
+
+	Array<PointCloudPoint> points(_scratch_allocator);
+	read_lua_points(L, 2, 0, points);
+	Array<float> scalars(_scratch_allocator);
+	read_lua_scalars(L, 3, points.size(), scalars);
+	Array<double> times(_scratch_allocator);
+	auto point_times = read_lua_times(L, 6, points.size(), times);
+
+	lua->pushboolean(L, set_point_cloud_scalar_points(handle, points.begin(), scalars.begin(), points.size(), box_size, scale, point_times));
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.set_shared_points(handle, name, box_size, stops) -> number of points or nil
+ * Draws a point set the editor plugin shared by name, read straight from shared memory instead of Lua tables.
+ * The points are colored with the stops if they are given and the set has scalars, and sorted by time if it has times.
+ */
+int lua_set_point_cloud_shared_points(lua_State* L)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto handle = (unsigned)lua->tointeger(L, 1);
+	auto name = lua->tolstring(L, 2, nullptr);
+	auto box_size = lua->isnumber(L, 3) ? (float)lua->tonumber(L, 3) : 1.0f;
+
+	SharedPoints shared;
+	if (name == nullptr || !shared.open(name)) {
+		log->warning(get_name(), "The shared point set is gone");
+		lua->pushnil(L);
+		return 1;
+	}
+
+	ColorScale scale;
+	auto use_scalars = shared.scalars != nullptr && lua->type(L, 4) == LUA_TTABLE;
+	if (use_scalars && !read_lua_color_scale(L, 4, scale)) {
+		log->warning(get_name(), "Invalid point cloud color stops");
+		lua->pushnil(L);
+		return 1;
+	}
+
+	Array<PointCloudPoint> points(_scratch_allocator);
+	points.resize(shared.num_points);
+	for (unsigned i = 0; i < shared.num_points; ++i) {
+		memcpy(points[i].position, &shared.positions[i * 3], 3 * sizeof(float));
+		points[i].color = 0xFFFFFFFF;
+	}
+
+	auto ok = use_scalars
+		? set_point_cloud_scalar_points(handle, points.begin(), shared.scalars, shared.num_points, box_size, scale, shared.times)
+		: set_point_cloud_points(handle, points.begin(), shared.num_points, box_size, shared.times);
+	if (!ok)
+		lua->pushnil(L);
+	else
+		lua->pushinteger(L, shared.num_points);
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.set_shared_paths(handle, name, stops) -> number of paths or nil
+ * Draws the polylines of a trajectory set the editor plugin shared by name as lines, every path colored
+ * from the stops over [0, 1] by its index.
+ */
+int lua_set_point_cloud_shared_paths(lua_State* L)
+{
+	auto handle = (unsigned)lua->tointeger(L, 1);
+	auto name = lua->tolstring(L, 2, nullptr);
+
+	SharedPoints shared;
+	if (name == nullptr || !shared.open(name) || shared.path_ends == nullptr) {
+		log->warning(get_name(), "The shared trajectory set is gone");
+		lua->pushnil(L);
+		return 1;
+	}
+
+	ColorScale scale;
+	if (!read_lua_color_scale(L, 3, scale)) {
+		log->warning(get_name(), "Invalid trajectory color stops");
+		lua->pushnil(L);
+		return 1;
+	}
+
+	if (!set_point_cloud_paths(handle, shared.positions, shared.num_points, shared.path_ends, shared.num_paths, scale))
+		lua->pushnil(L);
+	else
+		lua->pushinteger(L, shared.num_paths);
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.set_volumes(handle, mins, maxs, scalars, stops) -> number of volumes or nil
+ * Draws one box per volume from flat x, y, z minimum and maximum corners, colored from its scalar and the
+ * color stops. Volumes without a number scalar are drawn white.
+ */
+int lua_set_point_cloud_volumes(lua_State* L)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto handle = (unsigned)lua->tointeger(L, 1);
+
+	ColorScale scale;
+	if (!read_lua_color_scale(L, 5, scale)) {
+		log->warning(get_name(), "Invalid volume color stops");
+		lua->pushnil(L);
+		return 1;
+	}
+
+	Array<float> mins(_scratch_allocator);
+	Array<float> maxs(_scratch_allocator);
+	Array<float> scalars(_scratch_allocator);
+	read_lua_numbers(L, 2, mins);
+	read_lua_numbers(L, 3, maxs);
+	auto num_volumes = (mins.size() < maxs.size() ? mins.size() : maxs.size()) / 3;
+	read_lua_scalars(L, 4, num_volumes, scalars);
+
+	if (!set_point_cloud_volumes(handle, mins.begin(), maxs.begin(), scalars.begin(), num_volumes, scale))
+		lua->pushnil(L);
+	else
+		lua->pushinteger(L, num_volumes);
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.set_time_window(handle, t0, t1) -> first, count or nil
+ * Only draw the points of a timed point cloud within [t0, t1], a nil bound is open. Returns the range of drawn points
+ * in time order, nil if the point cloud was set without times.
+ */
+int lua_set_point_cloud_time_window(lua_State* L)
+{
+	auto handle = (unsigned)lua->tointeger(L, 1);
+	auto t0 = lua->isnumber(L, 2) ? lua->tonumber(L, 2) : NAN;
+	auto t1 = lua->isnumber(L, 3) ? lua->tonumber(L, 3) : NAN;
+
+	unsigned first = 0, count = 0;
+	if (!set_point_cloud_time_window(handle, t0, t1, first, count)) {
+		lua->pushnil(L);
+		return 1;
+	}
+
+	lua->pushinteger(L, first);
+	lua->pushinteger(L, count);
+	return 2;
+}
+
+/**
+ * TelemetryPointCloud.time_range(handle) -> min, max or nil
+ */
+int lua_point_cloud_time_range(lua_State* L)
+{
+	double min_time = 0.0, max_time = 0.0;
+	if (!get_point_cloud_time_range((unsigned)lua->tointeger(L, 1), min_time, max_time)) {
+		lua->pushnil(L);
+		return 1;
+	}
+
+	lua->pushnumber(L, min_time);
+	lua->pushnumber(L, max_time);
+	return 2;
+}
+
+/**
+ * TelemetryPointCloud.set_color_scale(handle, stops)
+ * Recolors a point cloud set with set_scalar_points, nothing is done if the stops did not change.
+ */
+int lua_set_point_cloud_color_scale(lua_State* L)
+{
+	auto handle = (unsigned)lua->tointeger(L, 1);
+
+	ColorScale scale;
+	lua->pushboolean(L, read_lua_color_scale(L, 2, scale) && set_point_cloud_color_scale(handle, scale));
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.scale_colors(positions, scalars, stops) -> positions, colors
+ * Colors points with the native kernel without uploading them, the returned positions skip points without a number scalar.
+ */
+int lua_scale_point_colors(lua_State* L)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	ColorScale scale;
+	if (!read_lua_color_scale(L, 3, scale)) {
+		lua->pushnil(L);
+		lua->pushnil(L);
+		return 2;
+	}
+
+	Array<PointCloudPoint> points(_scratch_allocator);
+	read_lua_points(L, 1, 0, points);
+	Array<float> scalars(_scratch_allocator);
+	read_lua_scalars(L, 2, points.size(), scalars);
+
+	Array<uint32_t> colors(_scratch_allocator);
+	colors.resize(points.size());
+	map_scalars_to_colors(scalars.begin(), scalars.size(), scale, colors.begin());
+
+	lua->createtable(L, points.size() * 3, 0);
+	lua->createtable(L, points.size(), 0);
+	int drawn = 0;
+	for (unsigned i = 0; i < points.size(); ++i) {
+		if (isnan(scalars[i]))
+			continue;
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			lua->pushnumber(L, points[i].position[axis]);
+			lua->rawseti(L, -3, drawn * 3 + axis + 1);
+		}
+		lua->pushnumber(L, colors[i]);
+		lua->rawseti(L, -2, drawn + 1);
+		++drawn;
+	}
+	return 2;
+}
+
+/**
+ * TelemetryPointCloud.set_density(handle, positions, cell_size, blur_sigma, flat, stops)
+ * Draws a density heatmap of flat x, y, z positions, stops map the density relative to the densest cell ([0, 1]) to colors.
+ * The density is only computed again when the positions or the grid settings changed.
+ */
+int lua_set_point_cloud_density(lua_State* L)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto handle = (unsigned)lua->tointeger(L, 1);
+
+	DensitySettings settings;
+	settings.cell_size = lua->isnumber(L, 3) ? (float)lua->tonumber(L, 3) : 1.0f;
+	settings.blur_sigma = lua->isnumber(L, 4) ? (float)lua->tonumber(L, 4) : 0.0f;
+	settings.flat = lua->toboolean(L, 5) != 0;
+
+	ColorScale scale;
+	if (!read_lua_color_scale(L, 6, scale)) {
+		log->warning(get_name(), "Invalid heatmap color stops");
+		lua->pushboolean(L, false);
+		return 1;
+	}
+
+	Array<float> positions(_scratch_allocator);
+	read_lua_numbers(L, 2, positions);
+
+	lua->pushboolean(L, set_point_cloud_density(handle, positions.begin(), positions.size() / 3, settings, scale));
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.set_shared_density(handle, name, cell_size, blur_sigma, flat, stops)
+ * Same as set_density, with the positions of a point set the editor plugin shared by name.
+ */
+int lua_set_point_cloud_shared_density(lua_State* L)
+{
+	auto handle = (unsigned)lua->tointeger(L, 1);
+	auto name = lua->tolstring(L, 2, nullptr);
+
+	DensitySettings settings;
+	settings.cell_size = lua->isnumber(L, 3) ? (float)lua->tonumber(L, 3) : 1.0f;
+	settings.blur_sigma = lua->isnumber(L, 4) ? (float)lua->tonumber(L, 4) : 0.0f;
+	settings.flat = lua->toboolean(L, 5) != 0;
+
+	SharedPoints shared;
+	if (name == nullptr || !shared.open(name)) {
+		log->warning(get_name(), "The shared point set is gone");
+		lua->pushboolean(L, false);
+		return 1;
+	}
+
+	ColorScale scale;
+	if (!read_lua_color_scale(L, 6, scale)) {
+		log->warning(get_name(), "Invalid heatmap color stops");
+		lua->pushboolean(L, false);
+		return 1;
+	}
+
+	lua->pushboolean(L, set_point_cloud_density(handle, shared.positions, shared.num_points, settings, scale));
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.reserve(handle, capacity, box_size)
+ */
+int lua_reserve_point_cloud(lua_State* L)
+{
+	auto handle = (unsigned)lua->tointeger(L, 1);
+	auto capacity = (unsigned)lua->tointeger(L, 2);
+	auto box_size = lua->isnumber(L, 3) ? (float)lua->tonumber(L, 3) : 1.0f;
+
+	lua->pushboolean(L, reserve_point_cloud(handle, capacity, box_size));
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.append(handle, positions, colors)
+ * Same positions and colors as set_points, added to the ring of a reserved point cloud.
+ */
+int lua_append_point_cloud_points(lua_State* L)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	auto handle = (unsigned)lua->tointeger(L, 1);
+
+	Array<PointCloudPoint> points(_scratch_allocator);
+	read_lua_points(L, 2, 3, points);
+
+	lua->pushboolean(L, append_point_cloud_points(handle, points.begin(), points.size()));
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.update_view(handle, camera_pose, vertical_fov, aspect, near_range, far_range)
+ * Cull the grid cells of a large point cloud against the camera and draw distant cells as one box.
+ */
+int lua_update_point_cloud_view(lua_State* L)
+{
+	auto handle = (unsigned)lua->tointeger(L, 1);
+	auto pose = lua->getmatrix4x4(L, 2);
+
+	lua->pushboolean(L, update_point_cloud_view(handle, pose, (float)lua->tonumber(L, 3), (float)lua->tonumber(L, 4),
+		(float)lua->tonumber(L, 5), (float)lua->tonumber(L, 6)));
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.scratch_stats() -> { allocations, bytes, blocks }
+ * Scratch allocations of the last upload, blocks counts the allocations made from the plugin allocator.
+ */
+int lua_point_cloud_scratch_stats(lua_State* L)
+{
+	const auto& stats = _scratch_allocator.stats();
+	lua->createtable(L, 0, 3);
+	lua->pushnumber(L, (double)stats.allocations);
+	lua->setfield(L, -2, "allocations");
+	lua->pushnumber(L, (double)stats.bytes);
+	lua->setfield(L, -2, "bytes");
+	lua->pushnumber(L, (double)stats.blocks);
+	lua->setfield(L, -2, "blocks");
+	return 1;
+}
+
+/**
+ * TelemetryPointCloud.destroy(handle)
+ */
+int lua_destroy_point_cloud(lua_State* L)
+{
+	destroy_point_cloud((unsigned)lua->tointeger(L, 1));
+	return 0;
+}
+
+void register_point_cloud_lua_api()
+{
+	lua->add_module_function("TelemetryPointCloud", "create", lua_create_point_cloud);
+	lua->add_module_function("TelemetryPointCloud", "set_points", lua_set_point_cloud_points);
+	lua->add_module_function("TelemetryPointCloud", "set_scalar_points", lua_set_point_cloud_scalar_points);
+	lua->add_module_function("TelemetryPointCloud", "set_color_scale", lua_set_point_cloud_color_scale);
+	lua->add_module_function("TelemetryPointCloud", "set_shared_points", lua_set_point_cloud_shared_points);
+	lua->add_module_function("TelemetryPointCloud", "set_shared_paths", lua_set_point_cloud_shared_paths);
+	lua->add_module_function("TelemetryPointCloud", "set_volumes", lua_set_point_cloud_volumes);
+	lua->add_module_function("TelemetryPointCloud", "set_time_window", lua_set_point_cloud_time_window);
+	lua->add_module_function("TelemetryPointCloud", "time_range", lua_point_cloud_time_range);
+	lua->add_module_function("TelemetryPointCloud", "scale_colors", lua_scale_point_colors);
+	lua->add_module_function("TelemetryPointCloud", "set_density", lua_set_point_cloud_density);
+	lua->add_module_function("TelemetryPointCloud", "set_shared_density", lua_set_point_cloud_shared_density);
+	lua->add_module_function("TelemetryPointCloud", "reserve", lua_reserve_point_cloud);
+	lua->add_module_function("TelemetryPointCloud", "append", lua_append_point_cloud_points);
+	lua->add_module_function("TelemetryPointCloud", "update_view", lua_update_point_cloud_view);
+	lua->add_module_function("TelemetryPointCloud", "scratch_stats", lua_point_cloud_scratch_stats);
+	lua->add_module_function("TelemetryPointCloud", "destroy", lua_destroy_point_cloud);
+}
+
+}
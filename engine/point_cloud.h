@@ -0,0 +1,123 @@
+#pragma once
+
+#include "color_scale.h"
+#include "density_grid.h"
+
+#include <engine_plugin_api/plugin_api.h>
+
+#include <stdint.h>
+
+namespace PLUGIN_NAMESPACE {
+
+/**
+ * Number of point clouds that can be alive at the same time.
+ */
+const unsigned MAX_POINT_CLOUDS = 64;
+
+/**
+ * Per point data uploaded to the render buffer, color is packed as 0xAARRGGBB.
+ */
+struct PointCloudPoint
+{
+	float position[3];
+	uint32_t color;
+};
+
+/**
+ * Create an empty point cloud drawn by a mesh object on node 0 of the host unit,
+ * using the first material of the unit's first mesh.
+ * Returns the point cloud handle, INVALID_HANDLE on failure.
+ */
+unsigned create_point_cloud(CApiUnit* host_unit);
+
+/**
+ * Replace the points of a point cloud. The render buffers are rebuilt and uploaded once,
+ * nothing is sent to the renderer again until the next call.
+ * With times (one per point, NaN if unknown) the points are sorted by time for set_point_cloud_time_window
+ * and get no grid, since bucketing them would lose the time order.
+ */
+bool set_point_cloud_points(unsigned handle, const PointCloudPoint* points, unsigned num_points, float box_size, const double* times = nullptr);
+
+/**
+ * Replace the points of a point cloud with points colored from one scalar each. Points with a NaN scalar are left out.
+ * The points and scalars are kept so that set_point_cloud_color_scale can recolor them without a new upload from Lua.
+ */
+bool set_point_cloud_scalar_points(unsigned handle, const PointCloudPoint* points, const float* scalars, unsigned num_points,
+	float box_size, const ColorScale& scale, const double* times = nullptr);
+
+/**
+ * Only draw the points of a point cloud set with times whose time is within [t0, t1], NaN bounds are open.
+ * The points are sorted by time when set, so the window is found by binary search and drawn as one range
+ * of the index buffer without touching the vertices. Returns false for point clouds without times.
+ */
+bool set_point_cloud_time_window(unsigned handle, double t0, double t1, unsigned& first, unsigned& count);
+
+/**
+ * Earliest and latest time of a point cloud set with times. Returns false if none of its points has a time.
+ */
+bool get_point_cloud_time_range(unsigned handle, double& min_time, double& max_time);
+
+/**
+ * Recolor a point cloud set with set_point_cloud_scalar_points and update its vertex buffer.
+ * Nothing is done if the scale did not change.
+ */
+bool set_point_cloud_color_scale(unsigned handle, const ColorScale& scale);
+
+/**
+ * Replace the points of a point cloud with a density heatmap of positions: one box per grid cell,
+ * colored by its density relative to the densest cell. Returns early, only applying the scale,
+ * when the positions and settings are the same as in the last call.
+ */
+bool set_point_cloud_density(unsigned handle, const float* positions, unsigned num_positions, const DensitySettings& settings, const ColorScale& scale);
+
+/**
+ * Replace the points of a point cloud with polylines drawn as lines between consecutive points of every path.
+ * positions holds num_points x, y, z triplets, path p ends before point path_ends[p] (increasing).
+ * Every path gets one color of the scale, read at keys spread over [0, 1]. Paths get no grid and no time window.
+ * Returns false, leaving the cloud as it was, if the path ends decrease or run past num_points.
+ */
+bool set_point_cloud_paths(unsigned handle, const float* positions, unsigned num_points, const uint32_t* path_ends, unsigned num_paths, const ColorScale& scale);
+
+/**
+ * Replace the points of a point cloud with num_volumes boxes, volume v spanning from bb_mins[v * 3] to bb_maxs[v * 3].
+ * Every box gets the color of its scalar in the scale, volumes with a NaN scalar are drawn white.
+ */
+bool set_point_cloud_volumes(unsigned handle, const float* bb_mins, const float* bb_maxs, const float* scalars, unsigned num_volumes, const ColorScale& scale);
+
+/**
+ * Cull a point cloud against a camera and pick a level of detail per grid cell. Point clouds of at least
+ * MIN_GRID_POINTS points are bucketed in a uniform grid by set_point_cloud_points, cells outside the frustum
+ * are skipped and distant cells are drawn as a single box in the average color of their points.
+ * The pose is the camera world pose, nothing is uploaded when the view did not change since the last call.
+ * Returns false for point clouds without a grid, which are always drawn whole.
+ */
+bool update_point_cloud_view(unsigned handle, const float* pose, float vertical_fov, float aspect, float near_range, float far_range);
+
+/**
+ * Switch a point cloud to live mode, keeping the latest capacity points appended with append_point_cloud_points.
+ * The boxes are kept expanded in a ring of updatable blocks, a capacity of 0 clears the point cloud.
+ */
+bool reserve_point_cloud(unsigned handle, unsigned capacity, float box_size);
+
+/**
+ * Add points to a reserved point cloud, overwriting the oldest ones once it is full.
+ * Every block written to is uploaded once per call, so points should be appended in batches.
+ */
+bool append_point_cloud_points(unsigned handle, const PointCloudPoint* points, unsigned num_points);
+
+/**
+ * Release the render buffers and the mesh object of a point cloud.
+ */
+void destroy_point_cloud(unsigned handle);
+
+/**
+ * Release every point cloud, called when the plugin shuts down.
+ */
+void destroy_point_clouds();
+
+/**
+ * Register the TelemetryPointCloud Lua module.
+ */
+void register_point_cloud_lua_api();
+
+}
@@ -0,0 +1,165 @@
+#include "profiler.h"
+#include "engine_plugin.h"
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace PLUGIN_NAMESPACE {
+
+struct TraceEvent
+{
+	const char* stage;
+	uint64_t start_us;
+	uint64_t duration_us;
+};
+
+StageStats profile_stages[MAX_PROFILE_STAGES];
+unsigned num_profile_stages = 0;
+
+TraceEvent trace_events[MAX_TRACE_EVENTS];
+unsigned num_trace_events = 0;
+unsigned next_trace_event = 0;
+
+const auto profile_epoch = std::chrono::steady_clock::now();
+
+uint64_t profile_time_us()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - profile_epoch).count();
+}
+
+void record_stage(const char* stage, uint64_t start_us, uint64_t duration_us, uint64_t bytes, uint64_t items)
+{
+	StageStats* stats = nullptr;
+	for (unsigned i = 0; i < num_profile_stages && stats == nullptr; ++i) {
+		if (strcmp(profile_stages[i].name, stage) == 0)
+			stats = &profile_stages[i];
+	}
+	if (stats == nullptr) {
+		if (num_profile_stages == MAX_PROFILE_STAGES)
+			return;
+		stats = &profile_stages[num_profile_stages++];
+		memset(stats, 0, sizeof(StageStats));
+		stats->name = stage;
+	}
+
+	auto bucket = duration_us <= 1 ? 0u : (unsigned)ceil(log2((double)duration_us) * 4.0);
+	++stats->buckets[bucket < PROFILE_BUCKETS ? bucket : PROFILE_BUCKETS - 1];
+	++stats->count;
+	stats->total_us += duration_us;
+	stats->max_us = duration_us > stats->max_us ? duration_us : stats->max_us;
+	stats->bytes += bytes;
+	stats->items += items;
+
+	trace_events[next_trace_event].stage = stage;
+	trace_events[next_trace_event].start_us = start_us;
+	trace_events[next_trace_event].duration_us = duration_us;
+	next_trace_event = (next_trace_event + 1) % MAX_TRACE_EVENTS;
+	if (num_trace_events < MAX_TRACE_EVENTS)
+		++num_trace_events;
+}
+
+double stage_percentile_us(const StageStats& stats, double fraction)
+{
+	if (stats.count == 0)
+		return 0.0;
+
+	auto rank = (uint64_t)ceil(fraction * stats.count);
+	uint64_t seen = 0;
+	for (unsigned bucket = 0; bucket < PROFILE_BUCKETS; ++bucket) {
+		seen += stats.buckets[bucket];
+		if (seen >= rank && seen > 0) {
+			auto upper = pow(2.0, bucket / 4.0);
+			return upper < (double)stats.max_us ? upper : (double)stats.max_us;
+		}
+	}
+	return (double)stats.max_us;
+}
+
+void reset_profile()
+{
+	num_profile_stages = 0;
+	num_trace_events = 0;
+	next_trace_event = 0;
+}
+
+bool write_chrome_trace(const char* path)
+{
+	auto file = fopen(path, "wb");
+	if (file == nullptr)
+		return false;
+
+	// Oldest event first
+	auto first = num_trace_events < MAX_TRACE_EVENTS ? 0 : next_trace_event;
+	fprintf(file, "{\"traceEvents\":[\n");
+	for (unsigned i = 0; i < num_trace_events; ++i) {
+		const auto& event = trace_events[(first + i) % MAX_TRACE_EVENTS];
+		fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"engine\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":2,\"tid\":1}",
+			i == 0 ? "" : ",\n", event.stage, (unsigned long long)event.start_us, (unsigned long long)event.duration_us);
+	}
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	auto ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+/**
+ * TelemetryProfiler.stats() -> { { name, count, p50_ms, p95_ms, p99_ms, max_ms, total_ms, bytes, items }, ... }
+ */
+int lua_profile_stats(lua_State* L)
+{
+	lua->createtable(L, num_profile_stages, 0);
+	for (unsigned i = 0; i < num_profile_stages; ++i) {
+		const auto& stats = profile_stages[i];
+		lua->createtable(L, 0, 9);
+		lua->pushstring(L, stats.name);
+		lua->setfield(L, -2, "name");
+		lua->pushnumber(L, (double)stats.count);
+		lua->setfield(L, -2, "count");
+		lua->pushnumber(L, stage_percentile_us(stats, 0.50) / 1000.0);
+		lua->setfield(L, -2, "p50_ms");
+		lua->pushnumber(L, stage_percentile_us(stats, 0.95) / 1000.0);
+		lua->setfield(L, -2, "p95_ms");
+		lua->pushnumber(L, stage_percentile_us(stats, 0.99) / 1000.0);
+		lua->setfield(L, -2, "p99_ms");
+		lua->pushnumber(L, stats.max_us / 1000.0);
+		lua->setfield(L, -2, "max_ms");
+		lua->pushnumber(L, stats.total_us / 1000.0);
+		lua->setfield(L, -2, "total_ms");
+		lua->pushnumber(L, (double)stats.bytes);
+		lua->setfield(L, -2, "bytes");
+		lua->pushnumber(L, (double)stats.items);
+		lua->setfield(L, -2, "items");
+		lua->rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+/**
+ * TelemetryProfiler.reset()
+ */
+int lua_reset_profile(lua_State*)
+{
+	reset_profile();
+	return 0;
+}
+
+/**
+ * TelemetryProfiler.dump_trace(path) -> true if the trace was written
+ */
+int lua_dump_profile_trace(lua_State* L)
+{
+	lua->pushboolean(L, write_chrome_trace(lua->tolstring(L, 1, nullptr)));
+	return 1;
+}
+
+void register_profiler_lua_api()
+{
+	lua->add_module_function("TelemetryProfiler", "stats", lua_profile_stats);
+	lua->add_module_function("TelemetryProfiler", "reset", lua_reset_profile);
+	lua->add_module_function("TelemetryProfiler", "dump_trace", lua_dump_profile_trace);
+}
+
+}
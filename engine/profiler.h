@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace PLUGIN_NAMESPACE {
+
+/**
+ * Most stages that can be profiled, and buckets of their duration histograms.
+ * Bucket i covers durations up to 2^(i / 4) microseconds.
+ */
+const unsigned MAX_PROFILE_STAGES = 32;
+const unsigned PROFILE_BUCKETS = 128;
+
+/**
+ * Most recent scopes kept for the Chrome trace.
+ */
+const unsigned MAX_TRACE_EVENTS = 8192;
+
+/**
+ * Aggregated samples of one named stage, names are string literals.
+ */
+struct StageStats
+{
+	const char* name;
+	uint64_t count;
+	uint64_t total_us;
+	uint64_t max_us;
+	uint64_t bytes;
+	uint64_t items;
+	uint32_t buckets[PROFILE_BUCKETS];
+};
+
+/**
+ * Microseconds since the plugin was loaded.
+ */
+uint64_t profile_time_us();
+
+/**
+ * Add a sample to a stage and to the trace. Only called from the main thread.
+ */
+void record_stage(const char* stage, uint64_t start_us, uint64_t duration_us, uint64_t bytes = 0, uint64_t items = 0);
+
+/**
+ * Duration below which the given fraction ([0, 1]) of the samples of a stage fall.
+ */
+double stage_percentile_us(const StageStats& stats, double fraction);
+
+void reset_profile();
+
+/**
+ * Write the recorded scopes as a Chrome trace (chrome://tracing, Perfetto). Returns false if the file could not be written.
+ */
+bool write_chrome_trace(const char* path);
+
+/**
+ * Times a scope and records it as a stage when it ends.
+ */
+struct ScopedTimer
+{
+	explicit ScopedTimer(const char* stage) : stage(stage), start_us(profile_time_us()), bytes(0), items(0) {}
+	~ScopedTimer() { record_stage(stage, start_us, profile_time_us() - start_us, bytes, items); }
+
+	const char* stage;
+	uint64_t start_us;
+	uint64_t bytes;
+	uint64_t items;
+};
+
+/**
+ * Register the TelemetryProfiler Lua module.
+ */
+void register_profiler_lua_api();
+
+}
@@ -0,0 +1,83 @@
+#include "scratch_arena.h"
+#include "engine_plugin.h"
+
+namespace PLUGIN_NAMESPACE {
+
+using namespace stingray_plugin_foundation;
+
+ScratchArena _scratch_allocator(_allocator);
+
+ScratchArena::ScratchArena(Allocator& backing) : _backing(backing), _blocks(backing), _current_block(0), _offset(0), _depth(0)
+{
+	_stats.allocations = _stats.bytes = _stats.blocks = 0;
+}
+
+ScratchArena::~ScratchArena()
+{
+	release();
+}
+
+void* ScratchArena::allocate(size_t size, unsigned align)
+{
+	if (align == 0)
+		align = 4;
+
+	// Look for room in the current block, then in the blocks kept from earlier uploads
+	while (_current_block < _blocks.size()) {
+		auto& block = _blocks[_current_block];
+		auto start = ((uintptr_t)block.data + _offset + align - 1) & ~(uintptr_t)(align - 1);
+		if (start + size <= (uintptr_t)block.data + block.size) {
+			_offset = start + size - (uintptr_t)block.data;
+			++_stats.allocations;
+			_stats.bytes += size;
+			return (void*)start;
+		}
+
+		++_current_block;
+		_offset = 0;
+	}
+
+	Block block;
+	block.size = size + align > SCRATCH_BLOCK_SIZE ? size + align : SCRATCH_BLOCK_SIZE;
+	block.data = (uint8_t*)_backing.allocate(block.size, 16);
+	_blocks.push_back(block);
+	++_stats.blocks;
+
+	_current_block = _blocks.size() - 1;
+	_offset = 0;
+	return allocate(size, align);
+}
+
+void ScratchArena::deallocate(void*)
+{
+	// Reclaimed when the scope closes
+}
+
+size_t ScratchArena::allocated_size(void*)
+{
+	return 0;
+}
+
+void ScratchArena::release()
+{
+	for (unsigned i = 0; i < _blocks.size(); ++i)
+		_backing.deallocate(_blocks[i].data);
+	_blocks.resize(0);
+	_current_block = 0;
+	_offset = 0;
+}
+
+ScratchScope::ScratchScope(ScratchArena& arena) : _arena(arena), _block(arena._current_block), _offset(arena._offset)
+{
+	if (_arena._depth++ == 0)
+		_arena._stats.allocations = _arena._stats.bytes = _arena._stats.blocks = 0;
+}
+
+ScratchScope::~ScratchScope()
+{
+	--_arena._depth;
+	_arena._current_block = _block;
+	_arena._offset = _offset;
+}
+
+}
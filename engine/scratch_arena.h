@@ -0,0 +1,85 @@
+#pragma once
+
+#include <plugin_foundation/allocator.h>
+#include <plugin_foundation/array.h>
+
+#include <stdint.h>
+
+namespace PLUGIN_NAMESPACE {
+
+/**
+ * Size of the blocks a scratch arena takes from its backing allocator.
+ */
+const unsigned SCRATCH_BLOCK_SIZE = 1024 * 1024;
+
+/**
+ * Allocations served by a scratch arena since the outermost scratch scope was opened.
+ * blocks is the number of allocations the arena made from its backing allocator.
+ */
+struct ScratchStats
+{
+	uint64_t allocations;
+	uint64_t bytes;
+	uint64_t blocks;
+};
+
+/**
+ * Stack-like allocator for the temporary arrays of a point cloud upload. Memory is only reclaimed
+ * when the scope that allocated it closes, and the blocks are kept for the next upload.
+ * Not thread safe, only used from the main thread.
+ */
+class ScratchArena : public stingray_plugin_foundation::Allocator
+{
+public:
+	ScratchArena(stingray_plugin_foundation::Allocator& backing);
+	~ScratchArena();
+
+	void* allocate(size_t size, unsigned align = 16);
+	void deallocate(void* p);
+	size_t allocated_size(void* p);
+
+	/**
+	 * Return every block to the backing allocator, used when the plugin shuts down.
+	 */
+	void release();
+
+	const ScratchStats& stats() const { return _stats; }
+
+private:
+	friend class ScratchScope;
+
+	struct Block
+	{
+		uint8_t* data;
+		size_t size;
+	};
+
+	stingray_plugin_foundation::Allocator& _backing;
+	stingray_plugin_foundation::Array<Block> _blocks;
+	unsigned _current_block;
+	size_t _offset;
+	unsigned _depth;
+	ScratchStats _stats;
+};
+
+/**
+ * Scratch memory of point cloud uploads, backed by the plugin allocator.
+ */
+extern ScratchArena _scratch_allocator;
+
+/**
+ * Rewinds a scratch arena to where it was when the scope was opened. Opening the outermost scope clears the stats.
+ */
+class ScratchScope
+{
+public:
+	ScratchScope(ScratchArena& arena);
+	~ScratchScope();
+
+private:
+	ScratchArena& _arena;
+	unsigned _block;
+	size_t _offset;
+};
+
+}
@@ -0,0 +1,124 @@
+#include "shared_points.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace PLUGIN_NAMESPACE {
+
+SharedPoints::SharedPoints() : num_points(0), positions(nullptr), scalars(nullptr), times(nullptr), num_paths(0), path_ends(nullptr), view(nullptr), size(0), mapping(nullptr)
+{
+}
+
+SharedPoints::~SharedPoints()
+{
+	close();
+}
+
+/**
+ * Map the whole block of a name read-only into view and size.
+ */
+bool map_shared_block(const char* name, void*& view, size_t& size, void*& mapping)
+{
+#ifdef _WIN32
+	mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+	view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+	// Rounded up to pages, the header is checked against it
+	MEMORY_BASIC_INFORMATION region;
+	if (view == nullptr || VirtualQuery(view, &region, sizeof(region)) == 0)
+		return false;
+	size = region.RegionSize;
+	return true;
+#else
+	auto fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	auto mapped = fstat(fd, &st) == 0 && st.st_size > 0 ? mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	::close(fd); // The mapping keeps the block alive
+	if (mapped == MAP_FAILED)
+		return false;
+
+	view = mapped;
+	size = (size_t)st.st_size;
+	mapping = nullptr; // Only Windows keeps a handle besides the view
+	return true;
+#endif
+}
+
+bool SharedPoints::open(const char* name)
+{
+	close();
+
+	if (!map_shared_block(name, view, size, mapping)) {
+		close();
+		return false;
+	}
+
+	const auto header = (const SharedPointsHeader*)view;
+	if (size < sizeof(SharedPointsHeader) || header->magic != SHARED_POINTS_MAGIC || header->version != SHARED_POINTS_VERSION) {
+		close();
+		return false;
+	}
+
+	auto has_scalars = (header->flags & SHARED_POINTS_SCALARS) != 0;
+	auto has_times = (header->flags & SHARED_POINTS_TIMES) != 0;
+	auto has_paths = (header->flags & SHARED_POINTS_PATHS) != 0;
+	// The times start at the next multiple of 8 bytes after the positions and scalars
+	auto points_size = sizeof(SharedPointsHeader) + (size_t)header->num_points * (has_scalars ? 4 : 3) * sizeof(float);
+	auto times_offset = (points_size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+	if (has_times)
+		points_size = times_offset + (size_t)header->num_points * sizeof(double);
+	auto needed = points_size + (has_paths ? (size_t)header->num_paths * sizeof(uint32_t) : 0);
+	if (needed > size) {
+		close();
+		return false;
+	}
+
+	num_points = header->num_points;
+	positions = (const float*)(header + 1);
+	scalars = has_scalars ? positions + num_points * 3 : nullptr;
+	times = has_times ? (const double*)((const char*)view + times_offset) : nullptr;
+	num_paths = has_paths ? header->num_paths : 0;
+	path_ends = has_paths ? (const uint32_t*)((const char*)view + points_size) : nullptr;
+
+	// Path ends index the points, they must not run past them
+	for (unsigned p = 0; p < num_paths; ++p) {
+		if (path_ends[p] > num_points || (p > 0 && path_ends[p] < path_ends[p - 1])) {
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void SharedPoints::close()
+{
+#ifdef _WIN32
+	if (view != nullptr)
+		UnmapViewOfFile(view);
+	if (mapping != nullptr)
+		CloseHandle(mapping);
+#else
+	if (view != nullptr)
+		munmap(view, size);
+#endif
+
+	view = mapping = nullptr;
+	size = 0;
+	num_points = 0;
+	positions = scalars = nullptr;
+	times = nullptr;
+	num_paths = 0;
+	path_ends = nullptr;
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace PLUGIN_NAMESPACE {
+
+/**
+ * Layout of a point set shared by the editor plugin (editor/data_store.h), both sides must agree on it:
+ * the header, num_points x, y, z float triplets, then num_points float scalars if SHARED_POINTS_SCALARS is set,
+ * num_points double times if SHARED_POINTS_TIMES is set, starting at the next multiple of 8 bytes, and num_paths
+ * uint32 path ends if SHARED_POINTS_PATHS is set.
+ */
+const uint32_t SHARED_POINTS_MAGIC = 0x48535654; // "TVSH"
+const uint32_t SHARED_POINTS_VERSION = 2;
+const uint32_t SHARED_POINTS_SCALARS = 1;
+const uint32_t SHARED_POINTS_TIMES = 2;
+const uint32_t SHARED_POINTS_PATHS = 4;
+
+struct SharedPointsHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_points;
+	uint32_t flags;
+	uint32_t num_paths;
+	uint32_t reserved;
+};
+
+/**
+ * A shared point set mapped read-only from the editor process. The arrays point into the mapping,
+ * scalars, times and path_ends are nullptr when the set has none. The points of a set with paths are
+ * the vertices of polylines, path p ending before point path_ends[p].
+ */
+struct SharedPoints
+{
+	SharedPoints();
+	~SharedPoints();
+	SharedPoints(const SharedPoints&) = delete;
+	SharedPoints& operator=(const SharedPoints&) = delete;
+
+	/**
+	 * Map a shared point set by name. Returns false if it does not exist (anymore) or is malformed.
+	 */
+	bool open(const char* name);
+	void close();
+
+	unsigned num_points;
+	const float* positions;
+	const float* scalars;
+	const double* times;
+	unsigned num_paths;
+	const uint32_t* path_ends;
+
+private:
+	void* view;
+	size_t size;
+	void* mapping;
+};
+
+}
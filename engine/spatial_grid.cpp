@@ -0,0 +1,202 @@
+#include "spatial_grid.h"
+#include "engine_plugin.h"
+#include "scratch_arena.h"
+
+#include <float.h>
+#include <math.h>
+
+namespace PLUGIN_NAMESPACE {
+
+using namespace stingray_plugin_foundation;
+
+void build_point_grid(PointCloudPoint* points, unsigned num_points, float box_size, PointGrid& grid)
+{
+	ScratchScope scratch_scope(_scratch_allocator);
+
+	grid.cells.resize(0);
+	if (num_points == 0)
+		return;
+
+	float bb_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float bb_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (unsigned i = 0; i < num_points; ++i) {
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			if (points[i].position[axis] < bb_min[axis]) bb_min[axis] = points[i].position[axis];
+			if (points[i].position[axis] > bb_max[axis]) bb_max[axis] = points[i].position[axis];
+		}
+	}
+
+	// Cubic cells sized so that the bounding volume holds about num_points / target cells,
+	// flat axes (most levels are) count as one box thick
+	float extent[3];
+	float volume = 1.0f;
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		extent[axis] = bb_max[axis] - bb_min[axis];
+		volume *= extent[axis] > box_size ? extent[axis] : box_size;
+	}
+
+	auto target_cells = (float)(num_points / GRID_TARGET_POINTS_PER_CELL + 1);
+	auto cell_size = cbrtf(volume / target_cells);
+	if (cell_size < box_size)
+		cell_size = box_size;
+
+	unsigned dims[3];
+	for (;;) {
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			dims[axis] = (unsigned)(extent[axis] / cell_size) + 1;
+			if (dims[axis] > GRID_MAX_CELLS_PER_AXIS)
+				dims[axis] = GRID_MAX_CELLS_PER_AXIS;
+		}
+		if ((uint64_t)dims[0] * dims[1] * dims[2] <= GRID_MAX_CELLS)
+			break;
+		cell_size *= 1.25f;
+	}
+
+	// Per axis scale so that the largest coordinate still lands in the last cell when dims were clamped
+	float scale[3];
+	for (unsigned axis = 0; axis < 3; ++axis)
+		scale[axis] = extent[axis] > 0.0f ? (dims[axis] - 0.001f) / extent[axis] : 0.0f;
+
+	auto cell_of = [&](const PointCloudPoint& point) {
+		unsigned index[3];
+		for (unsigned axis = 0; axis < 3; ++axis)
+			index[axis] = (unsigned)((point.position[axis] - bb_min[axis]) * scale[axis]);
+		return (index[2] * dims[1] + index[1]) * dims[0] + index[0];
+	};
+
+	// Counting sort of the points by cell
+	auto num_dense = dims[0] * dims[1] * dims[2];
+	Array<unsigned> offsets(_scratch_allocator);
+	offsets.resize(num_dense + 1);
+	for (unsigned i = 0; i <= num_dense; ++i)
+		offsets[i] = 0;
+
+	Array<unsigned> point_cells(_scratch_allocator);
+	point_cells.resize(num_points);
+	for (unsigned i = 0; i < num_points; ++i) {
+		point_cells[i] = cell_of(points[i]);
+		++offsets[point_cells[i] + 1];
+	}
+	for (unsigned i = 0; i < num_dense; ++i)
+		offsets[i + 1] += offsets[i];
+
+	Array<PointCloudPoint> sorted(_scratch_allocator);
+	sorted.resize(num_points);
+	for (unsigned i = 0; i < num_points; ++i)
+		sorted[offsets[point_cells[i]]++] = points[i];
+
+	// offsets[c] is now the end of cell c
+	const float half_size = box_size * 0.5f;
+	unsigned first = 0;
+	for (unsigned c = 0; c < num_dense; ++c) {
+		auto end = offsets[c];
+		if (end == first)
+			continue;
+
+		GridCell cell;
+		cell.first_point = first;
+		cell.num_points = end - first;
+
+		float sum[3] = { 0.0f, 0.0f, 0.0f };
+		for (unsigned axis = 0; axis < 3; ++axis) {
+			cell.bb_min[axis] = FLT_MAX;
+			cell.bb_max[axis] = -FLT_MAX;
+		}
+
+		for (unsigned i = first; i < end; ++i) {
+			const auto& point = sorted[i];
+			points[i] = point;
+			for (unsigned axis = 0; axis < 3; ++axis) {
+				sum[axis] += point.position[axis];
+				if (point.position[axis] - half_size < cell.bb_min[axis]) cell.bb_min[axis] = point.position[axis] - half_size;
+				if (point.position[axis] + half_size > cell.bb_max[axis]) cell.bb_max[axis] = point.position[axis] + half_size;
+			}
+		}
+
+		for (unsigned axis = 0; axis < 3; ++axis)
+			cell.center[axis] = sum[axis] / cell.num_points;
+
+		grid.cells.push_back(cell);
+		first = end;
+	}
+
+	grid.cell_size = cell_size;
+	average_grid_cell_colors(points, grid);
+}
+
+void average_grid_cell_colors(const PointCloudPoint* points, PointGrid& grid)
+{
+	for (unsigned c = 0; c < grid.cells.size(); ++c) {
+		auto& cell = grid.cells[c];
+		uint64_t channel_sum[4] = { 0, 0, 0, 0 };
+		for (unsigned i = cell.first_point; i < cell.first_point + cell.num_points; ++i) {
+			for (unsigned channel = 0; channel < 4; ++channel)
+				channel_sum[channel] += (points[i].color >> (channel * 8)) & 0xFF;
+		}
+
+		cell.color = 0;
+		for (unsigned channel = 0; channel < 4; ++channel)
+			cell.color |= (uint32_t)(channel_sum[channel] / cell.num_points) << (channel * 8);
+	}
+}
+
+/**
+ * Set a plane from a normal and a point on it.
+ */
+void set_plane(float* plane, const float* normal, const float* point)
+{
+	plane[0] = normal[0];
+	plane[1] = normal[1];
+	plane[2] = normal[2];
+	plane[3] = -(normal[0] * point[0] + normal[1] * point[1] + normal[2] * point[2]);
+}
+
+void make_view_frustum(const float* pose, float vertical_fov, float aspect, float near_range, float far_range, ViewFrustum& frustum)
+{
+	const float* right = pose;
+	const float* forward = pose + 4;
+	const float* up = pose + 8;
+	const float* position = pose + 12;
+
+	auto tan_v = tanf(vertical_fov * 0.5f);
+	auto tan_h = tan_v * aspect;
+
+	float near_point[3], far_point[3], back[3], normal[3];
+	for (unsigned axis = 0; axis < 3; ++axis) {
+		near_point[axis] = position[axis] + forward[axis] * near_range;
+		far_point[axis] = position[axis] + forward[axis] * far_range;
+		back[axis] = -forward[axis];
+		frustum.position[axis] = position[axis];
+	}
+
+	set_plane(frustum.planes[0], forward, near_point);
+	set_plane(frustum.planes[1], back, far_point);
+
+	// Side planes go through the camera position, inside when the offset along the side axis is within tan * depth
+	for (unsigned axis = 0; axis < 3; ++axis) normal[axis] = forward[axis] * tan_h - right[axis];
+	set_plane(frustum.planes[2], normal, position);
+	for (unsigned axis = 0; axis < 3; ++axis) normal[axis] = forward[axis] * tan_h + right[axis];
+	set_plane(frustum.planes[3], normal, position);
+	for (unsigned axis = 0; axis < 3; ++axis) normal[axis] = forward[axis] * tan_v - up[axis];
+	set_plane(frustum.planes[4], normal, position);
+	for (unsigned axis = 0; axis < 3; ++axis) normal[axis] = forward[axis] * tan_v + up[axis];
+	set_plane(frustum.planes[5], normal, position);
+}
+
+bool frustum_intersects_box(const ViewFrustum& frustum, const float* bb_min, const float* bb_max)
+{
+	for (unsigned p = 0; p < 6; ++p) {
+		const float* plane = frustum.planes[p];
+
+		// The box corner furthest along the plane normal
+		float distance = plane[3];
+		for (unsigned axis = 0; axis < 3; ++axis)
+			distance += plane[axis] * (plane[axis] >= 0.0f ? bb_max[axis] : bb_min[axis]);
+
+		if (distance < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "point_cloud.h"
+
+#include <plugin_foundation/array.h>
+
+#include <stdint.h>
+
+namespace PLUGIN_NAMESPACE {
+
+/**
+ * Points per occupied cell the grid resolution aims for.
+ */
+const unsigned GRID_TARGET_POINTS_PER_CELL = 64;
+
+/**
+ * Upper bound of cells per axis and of cells in the dense grid used while building.
+ */
+const unsigned GRID_MAX_CELLS_PER_AXIS = 256;
+const unsigned GRID_MAX_CELLS = 1 << 21;
+
+/**
+ * One occupied cell of a point grid. Its points are stored contiguously from first_point,
+ * bounds cover the boxes of those points and color is their average.
+ */
+struct GridCell
+{
+	float bb_min[3];
+	float bb_max[3];
+	float center[3];
+	uint32_t color;
+	unsigned first_point;
+	unsigned num_points;
+};
+
+/**
+ * Uniform grid over the points of a cloud, only the occupied cells are kept in a flat array.
+ */
+struct PointGrid
+{
+	PointGrid(stingray_plugin_foundation::Allocator& allocator) : cells(allocator), cell_size(0.0f) {}
+
+	stingray_plugin_foundation::Array<GridCell> cells;
+	float cell_size;
+};
+
+/**
+ * Bucket points in a uniform grid. The points are reordered so that every cell's points are contiguous.
+ */
+void build_point_grid(PointCloudPoint* points, unsigned num_points, float box_size, PointGrid& grid);
+
+/**
+ * Set the color of every cell to the average color of its points, used again when the points are recolored.
+ */
+void average_grid_cell_colors(const PointCloudPoint* points, PointGrid& grid);
+
+/**
+ * Planes of a camera frustum, a point x is inside a plane when dot(normal, x) + d >= 0.
+ */
+struct ViewFrustum
+{
+	float planes[6][4];
+	float position[3];
+};
+
+/**
+ * Build the frustum of a camera from its world pose (Stingray Matrix4x4 layout: x, y (forward), z (up), translation rows),
+ * vertical field of view in radians, aspect ratio and near and far ranges.
+ */
+void make_view_frustum(const float* pose, float vertical_fov, float aspect, float near_range, float far_range, ViewFrustum& frustum);
+
+/**
+ * Conservative box test, true if the box is at least partly inside the frustum.
+ */
+bool frustum_intersects_box(const ViewFrustum& frustum, const float* bb_min, const float* bb_max);
+
+}
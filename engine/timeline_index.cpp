@@ -0,0 +1,35 @@
+#include "timeline_index.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace PLUGIN_NAMESPACE {
+
+void build_time_order(const double* times, unsigned num_times, uint32_t* order)
+{
+	for (unsigned i = 0; i < num_times; ++i)
+		order[i] = i;
+
+	std::stable_sort(order, order + num_times, [times](uint32_t a, uint32_t b) {
+		if (isnan(times[b]))
+			return !isnan(times[a]);
+		return times[a] < times[b];
+	});
+}
+
+unsigned count_timed(const double* times, unsigned num_times)
+{
+	return (unsigned)(std::partition_point(times, times + num_times, [](double t) { return !isnan(t); }) - times);
+}
+
+void find_time_range(const double* times, unsigned num_times, double t0, double t1, unsigned& first, unsigned& count)
+{
+	auto timed = count_timed(times, num_times);
+	auto begin = isnan(t0) ? times : std::lower_bound(times, times + timed, t0);
+	auto end = isnan(t1) ? times + timed : std::upper_bound(times, times + timed, t1);
+
+	first = (unsigned)(begin - times);
+	count = end > begin ? (unsigned)(end - begin) : 0;
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace PLUGIN_NAMESPACE {
+
+/**
+ * Write the order of times from earliest to latest into order, ties keep their input order
+ * and NaN times (points without a time) go last.
+ */
+void build_time_order(const double* times, unsigned num_times, uint32_t* order);
+
+/**
+ * Number of times before the first NaN of times sorted by build_time_order.
+ */
+unsigned count_timed(const double* times, unsigned num_times);
+
+/**
+ * Find the contiguous range of sorted times within [t0, t1] with two binary searches.
+ * NaN bounds are open, so a NaN t0 starts at the earliest time and a NaN t1 ends at the latest.
+ */
+void find_time_range(const double* times, unsigned num_times, double t0, double t1, unsigned& first, unsigned& count);
+
+}
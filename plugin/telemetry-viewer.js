@@ -26,9 +26,20 @@ define(function (require) {
     const DEFAULT_PORT = '27017';
     const DEFAULT_DB = '';
     const DEFAULT_DLL_PATH = 'telemetry_visualizer/binaries/editor/win64/release/editor_plugin_w64_release.dll';
+    const FETCH_POLL_INTERVAL = 100; // ms
+    const CLUSTER_POLL_INTERVAL = 100; // ms
+    const TIMELINE_FRAME_INTERVAL = 33; // ms
+    const TIMELINE_PLAY_FRAMES = 300;
+    const FETCH_PROGRESS_CALLBACK = 'telemetryFetchProgress';
+    const LIVE_POLL_INTERVAL = 250; // ms
+    const DEFAULT_LIVE_FLUSH_INTERVAL = 500; // ms
+    const DEFAULT_LIVE_MAX_POINTS = 100000;
 
     const Visualizations = {
         POINTCLOUD: 1,
+        HEATMAP: 2,
+        TRAJECTORY: 3,
+        CLUSTERS: 4,
         // More visualization types can be added here.
     }
 
@@ -39,6 +50,80 @@ define(function (require) {
         // More Parsers can be added here.
     }
 
+    /**
+     * Decodes a base64 string from the native plugin into a byte buffer.
+     * @param {string} encoded
+     * @return {ArrayBuffer}
+     */
+    function decodeBase64(encoded) {
+        const binary = atob(encoded || '');
+        const bytes = new Uint8Array(binary.length);
+        for (let i = 0; i < binary.length; ++i)
+            bytes[i] = binary.charCodeAt(i);
+        return bytes.buffer;
+    }
+
+    /**
+     * Wraps one packed column from a columnar fetch in typed arrays.
+     * Int64 columns are widened to doubles since they only hold ids, counters and timestamps.
+     * Columns holding positions also carry them parsed as x, y, z float triplets.
+     * @param {object} column
+     * @param {number} count
+     * @return {{name: string, type: string, values: *, validity: Uint8Array, positions: Float32Array}}
+     */
+    function decodeColumn(column, count) {
+        const data = decodeBase64(column.data);
+        let values = null;
+
+        switch (column.type) {
+            case 'double':
+                values = new Float64Array(data);
+                break;
+            case 'int64': {
+                const words = new Uint32Array(data);
+                values = new Float64Array(count);
+                for (let i = 0; i < count; ++i)
+                    values[i] = (words[2 * i + 1] | 0) * 4294967296 + words[2 * i];
+                break;
+            }
+            case 'bool':
+                values = new Uint8Array(data);
+                break;
+            case 'string': {
+                const offsets = new Uint32Array(decodeBase64(column.offsets));
+                const blob = new Uint8Array(data);
+                const decoder = new TextDecoder('utf-8');
+                values = new Array(count);
+                for (let i = 0; i < count; ++i)
+                    values[i] = decoder.decode(blob.subarray(offsets[i], offsets[i + 1]));
+                break;
+            }
+            default:
+                values = new Array(count).fill(null);
+                break;
+        }
+
+        return {
+            name: column.name,
+            type: column.type,
+            values: values,
+            validity: new Uint8Array(decodeBase64(column.validity)),
+            positions: column.positions ? new Float32Array(decodeBase64(column.positions)) : null
+        };
+    }
+
+    /**
+     * Returns the value of a decoded column at a row, or null if the document had no value.
+     * @param {object} column
+     * @param {number} row
+     * @return {*}
+     */
+    function columnValue(column, row) {
+        if ((column.validity[row >> 3] & (1 << (row & 7))) === 0)
+            return null;
+        return column.type === 'bool' ? column.values[row] !== 0 : column.values[row];
+    }
+
     class TelemetryViewer {
 
         constructor() {
@@ -61,6 +146,7 @@ define(function (require) {
             this.ip = m.prop(DEFAULT_IP);
             this.port = m.prop(DEFAULT_PORT);
             this.dataBase = m.prop(DEFAULT_DB);
+            this.snapshotPath = m.prop('');
 
             this.databaseAccordion = Accordion.component([
                 {
@@ -87,6 +173,14 @@ define(function (require) {
                                 { img: 'undo.svg', title: 'Default', action: () => { this.dataBase(DEFAULT_DB) } },
                                 { img: 'play.svg', title: 'Connect', action: () => this.selectDatabase() }
                             ]
+                        }),
+                        Toolbar.component({
+                            items: [
+                                { component: "Snapshot" },
+                                { component: Textbox.component({ model: this.snapshotPath, placeholder: "Snapshot file (.tvs)", clearable: true }) },
+                                { img: 'play.svg', title: 'Open snapshot', action: () => this.openSnapshot() },
+                                { component: Button.component({ text: "Export", onclick: () => this.exportSnapshot() }) }
+                            ]
                         })];
                     }
                 }
@@ -225,6 +319,18 @@ define(function (require) {
 
             this.fetchSkip = m.prop(0);
             this.fetchLimit = m.prop(1000);
+            this.fetchHandle = null;
+            this.fetchStatus = m.prop('');
+            this.pageToken = '';
+            this.pageNumber = 0;
+
+            // Called by the native plugin while a fetch is running.
+            window[FETCH_PROGRESS_CALLBACK] = (handle, documentsScanned, bytesReceived) => {
+                if (handle === this.fetchHandle) {
+                    this.fetchStatus("Fetching... " + documentsScanned + " documents, " + (bytesReceived / 1048576).toFixed(1) + " MB");
+                    m.redraw();
+                }
+            };
 
             this.fetchDataButton = Button.component({
                 text: "Fetch data", onclick: () =>
@@ -324,7 +430,11 @@ define(function (require) {
                                             decimal: 0,
                                         })
                                     },
-                                    { component: this.fetchDataButton }
+                                    { component: this.fetchDataButton },
+                                    { component: Button.component({ text: "First page", onclick: () => this.fetchPage(false) }) },
+                                    { component: Button.component({ text: "Next page", onclick: () => this.fetchPage(true) }) },
+                                    { img: 'tab_close_normal.svg', title: 'Cancel fetch', action: () => this.cancelFetch() },
+                                    { component: this.fetchStatus() }
                                 ]
                             })];
                     }
@@ -335,11 +445,22 @@ define(function (require) {
 
             this.documentDiv = null;
 
+            this.rowFilter = m.prop('');
+            this.filterStatus = m.prop('');
+
             this.documentAccordion = Accordion.component([{
                 title: "Documents",
                 isExpanded: true,
                 content: () => {
-                    return [this.documentDiv];
+                    return [
+                        Toolbar.component({
+                            items: [
+                                { component: Textbox.component({ model: this.rowFilter, placeholder: '{ "and": [{ "range": ["health", 0, 50] }, { "in": ["weapon", ["rifle", "smg"]] }] }', clearable: true }) },
+                                { component: Button.component({ text: "Filter", onclick: () => this.applyRowFilter() }) },
+                                { component: this.filterStatus() }
+                            ]
+                        }),
+                        this.documentDiv];
                 }
             }]);
 
@@ -350,11 +471,19 @@ define(function (require) {
             this.visualizationOptions = () => {
                 return {
                     'Point Cloud': Visualizations.POINTCLOUD,
+                    'Heatmap': Visualizations.HEATMAP,
+                    'Trajectory': Visualizations.TRAJECTORY,
+                    'Clusters': Visualizations.CLUSTERS,
                     // more options can be added here
                 };
             };
 
-            this.pointCloud = new PointCloud();
+            this.pointCloud = new PointCloud(() => this.suggestColorRange(), () => this.updateColorScale(),
+                () => this.updateTimeWindow(), () => this.playTimeline());
+            this.heatmap = new Heatmap();
+            this.trajectory = new Trajectory();
+            this.clusters = new Clusters();
+            this.clusterHandle = 0;
 
             // This variable keeps track of what visualization is chosen and displayed.
             this.activeVisualization = this.pointCloud;
@@ -367,6 +496,15 @@ define(function (require) {
                         console.log("This is a scatter plot");
                         this.activeVisualization = this.pointCloud;
                         break;
+                    case Visualizations.HEATMAP:
+                        this.activeVisualization = this.heatmap;
+                        break;
+                    case Visualizations.TRAJECTORY:
+                        this.activeVisualization = this.trajectory;
+                        break;
+                    case Visualizations.CLUSTERS:
+                        this.activeVisualization = this.clusters;
+                        break;
                     default:
                         break;
                 }
@@ -375,13 +513,52 @@ define(function (require) {
                 return chosen;
             });
 
+            // ------ LIVE MODE ------
+
+            this.liveHandle = null;
+            this.liveStatus = m.prop('');
+            this.liveMaxPoints = m.prop(DEFAULT_LIVE_MAX_POINTS);
+            this.liveFlushInterval = m.prop(DEFAULT_LIVE_FLUSH_INTERVAL);
+
+            this.startLiveButton = Button.component({ text: "Start live", onclick: () => this.startLive() });
+            this.stopLiveButton = Button.component({ text: "Stop live", onclick: () => this.stopLive() });
+
+            let liveComponent = () => [
+                { component: "Max points: " },
+                { component: Spinner.component({ model: this.liveMaxPoints, increment: 1000, min: 1, showLabel: false, decimal: 0 }) },
+                { component: "Flush (ms): " },
+                { component: Spinner.component({ model: this.liveFlushInterval, increment: 100, min: 1, showLabel: false, decimal: 0 }) },
+                { component: this.startLiveButton },
+                { component: this.stopLiveButton },
+                { component: this.liveStatus() }
+            ];
+
             this.visualizationAccordion = Accordion.component([{
                 title: "Visualization",
                 collapsible: true,
                 isExpanded: true,
                 content: () => {
                     return [Choice.component({ model: this.visualizationMethodModel, getOptions: this.visualizationOptions }),
-                    this.activeVisualization.component, this.visualizeButton];
+                    this.activeVisualization.component, this.visualizeButton, Toolbar.component({ items: liveComponent() })];
+                }
+            }]);
+
+            // ------ TIMINGS ------
+
+            this.profileStages = [];
+            this.tracePath = m.prop('');
+
+            this.timingsAccordion = Accordion.component([{
+                title: "Timings",
+                collapsible: true,
+                isExpanded: false,
+                content: () => {
+                    return [Toolbar.component({ items: [
+                        { component: Button.component({ text: "Refresh", onclick: () => this.refreshTimings() }) },
+                        { component: Button.component({ text: "Reset", onclick: () => this.resetTimings() }) },
+                        { component: Textbox.component({ model: this.tracePath, placeholder: "Trace file path" }) },
+                        { component: Button.component({ text: "Dump trace", onclick: () => this.dumpTimings() }) }
+                    ] }), this.timingsTable()];
                 }
             }]);
 
@@ -442,6 +619,58 @@ define(function (require) {
             }
         }
 
+        /**
+         * Opens a snapshot file in place of a server, its collection is then selected like a database one.
+         */
+        openSnapshot() {
+            let path = this.snapshotPath();
+            if (!path) {
+                console.warn("No snapshot file path.");
+                return;
+            }
+
+            if (!path.endsWith(".tvs") && !path.startsWith("file://"))
+                path = "file://" + path;
+
+            if (!window.nativeExtension.connectToDatabase(path)) {
+                console.warn("Could not open the snapshot " + path);
+                return;
+            }
+
+            this.databaseAdress = path;
+            this.selectDatabase();
+        }
+
+        /**
+         * Exports the documents the current selection would fetch to the snapshot file,
+         * which can then be opened without a database.
+         */
+        exportSnapshot() {
+            let path = this.snapshotPath();
+            let collection = this.selectedCollection;
+            let fields = { fields: this.getIsIncludedFields() };
+
+            if (!path || collection == null || fields.fields.length == 0) {
+                console.warn("Select a collection, field(s) and a snapshot file path first");
+                return;
+            }
+
+            let args = [path, collection, { skip: this.fetchSkip() }, { limit: this.fetchLimit() }, fields,
+                { sort: this.getSortFields() }, { position_parser: this.selectedMode }];
+
+            if (this.selectedMode == Parsers.POSITION)
+                args.push(this.levelSessions());
+
+            let result = window.nativeExtension.exportSnapshot(...args);
+            if (!result || result.error) {
+                console.warn("Could not export the snapshot" + (result ? ": " + result.error : ""));
+                return;
+            }
+
+            this.fetchStatus("Exported " + result.rows + " documents, " + (result.bytes / 1048576).toFixed(1) + " MB");
+            m.redraw();
+        }
+
         /**
          * Behavior of the drop-down component for selecting
          * what collection to display fields from.
@@ -517,31 +746,121 @@ define(function (require) {
         }
 
         /**
-         * Function that returns an array with documents that have properties which
-         * include-checkbox have been marked.
-         * @return {Array}
+         * Returns the positions parsed by the native plugin for the included documents, flattened
+         * as x, y, z triplets, along with the matching values of an optional scalar field and an optional time field.
+         * @param {string} positionKey
+         * @param {string} scalarKey
+         * @param {string} timeKey
+         * @return {{positions: Array, scalars: Array, times: Array}}
          */
-        getSelectedDataFields(key) {
-            let values = [];
+        getSelectedPositions(positionKey, scalarKey, timeKey) {
+            let positions = [];
+            let scalars = [];
+            let times = [];
 
             this.documentsConfig.items.forEach(item => {
+                let position = item.isIncluded ? item.positions[positionKey] : null;
+
+                if (position) {
+                    positions.push(position[0], position[1], position[2]);
+                    if (scalarKey)
+                        scalars.push(item[scalarKey]);
+                    if (timeKey)
+                        times.push(item[timeKey]);
+                }
+            });
 
-                if (item.isIncluded) {
-                    if (item[key] != null)
-                        values.push(item[key]);
+            return { positions: positions, scalars: scalars, times: times };
+        }
+
+        /**
+         * Fetch argument keeping the documents of the sessions of the desired level.
+         * Follows the special mode's database structure, the sessions are looked up by the native plugin.
+         * @return {Object}
+         */
+        levelSessions() {
+            return { level: this.levelKey() };
+        }
+
+        /**
+         * Sets the color scale of the point cloud from the 5th, 50th and 95th percentile of the scalar,
+         * computed by the database over the last fetched query instead of the fetched documents.
+         */
+        suggestColorRange() {
+            if (!this.lastFetchArgs) {
+                console.warn("Fetch documents before suggesting a range");
+                return;
+            }
+
+            let aggregate = {
+                aggregate: {
+                    position: this.pointCloud.getPositionKey(),
+                    scalar: this.pointCloud.getScalarKey(),
+                    percentiles: [5, 50, 95]
                 }
+            };
+
+            let result = window.nativeExtension.aggregateDocuments(...this.lastFetchArgs, aggregate);
+            if (!result || result.error || result.summary.percentiles.length != 3) {
+                console.warn("Could not compute the scalar range", result ? result.error : "");
+                return;
+            }
+
+            let percentiles = result.summary.percentiles;
+            this.pointCloud.min(percentiles[0]);
+            this.pointCloud.desired(percentiles[1]);
+            this.pointCloud.max(percentiles[2]);
+            this.updateColorScale();
+        }
+
+        /**
+         * Only draw the points of the shown point cloud within the time window. The points were sorted by time
+         * natively when they were shown, so moving the window sends nothing but its bounds.
+         */
+        updateTimeWindow() {
+            this.viewportHandle.ready.then((viewportController) => {
+                viewportController.raise("set_point_cloud_time_window", this.pointCloud.windowStart(), this.pointCloud.windowEnd());
             });
+        }
+
+        /**
+         * Play the shown points back in time order, moving the end of the window from its start to the latest point.
+         * Playing again stops the playback.
+         */
+        playTimeline() {
+            if (this.timelineTimer) {
+                clearInterval(this.timelineTimer);
+                this.timelineTimer = null;
+                return;
+            }
+
+            let start = this.pointCloud.windowStart();
+            let end = this.pointCloud.timeMax();
+            let step = (end - start) / TIMELINE_PLAY_FRAMES;
+            if (!(step > 0))
+                return;
 
-            return values;
+            this.pointCloud.windowEnd(start);
+            this.timelineTimer = setInterval(() => {
+                let next = Math.min(this.pointCloud.windowEnd() + step, end);
+                this.pointCloud.windowEnd(next);
+                this.updateTimeWindow();
+                m.redraw();
+
+                if (next >= end) {
+                    clearInterval(this.timelineTimer);
+                    this.timelineTimer = null;
+                }
+            }, TIMELINE_FRAME_INTERVAL);
         }
 
         /**
-         * A specialiced function that returns the sessions based on the desired level.
-         * Follows the special mode's database structure.
-         * @return {Array}
+         * Recolor the shown point cloud with the current range, the points are not sent again.
          */
-        fetchSessions() {
-            return window.nativeExtension.sessionsIds(this.levelKey());
+        updateColorScale() {
+            this.viewportHandle.ready.then((viewportController) => {
+                viewportController.raise("set_point_cloud_color_scale", this.pointCloud.min(), this.pointCloud.desired(), this.pointCloud.max());
+            });
         }
 
         /**
@@ -563,31 +882,144 @@ define(function (require) {
                 return;
             }
 
-            let documents = null;
+            this.cancelFetch();
+
+            let handle = 0;
+            let columnar = { columnar: true };
+            let progress = { progress: FETCH_PROGRESS_CALLBACK };
+            let positionParser = { position_parser: this.selectedMode };
 
             if (this.selectedMode == Parsers.POSITION) {
 
-                let tempSessionIDs = this.fetchSessions();
+                // The native plugin joins the level to its sessions, the ids stay native
+                let sessions = this.levelSessions();
+
+                this.lastFetchArgs = [collection, skip, limit, sessions, positionParser];
+                this.lastLiveArgs = [collection, fields, sessions, positionParser];
+                handle = window.nativeExtension.fetchDocumentsAsync(collection, skip, limit, fields, sortBy, sessions, columnar, progress, positionParser);
+            } else {
+                this.lastFetchArgs = [collection, skip, limit, positionParser];
+                this.lastLiveArgs = [collection, fields, positionParser];
+                handle = window.nativeExtension.fetchDocumentsAsync(collection, skip, limit, fields, sortBy, columnar, progress, positionParser);
+            }
+
+            if (!handle) {
+                console.warn("Could not start fetching documents");
+                return;
+            }
 
-                /* For some reason the sessionIDs used directly. Another array is used to store
-                the sessions instead. */
-                let sessionIDs = [];
-                tempSessionIDs.forEach(item => { sessionIDs.push(item); });
+            this.fetchHandle = handle;
+            this.fetchStatus("Fetching...");
+            this.createDocumentList(fields["fields"]);
+            this.resultHandle = handle;
 
-                let sessions = { sessions_ids: sessionIDs };
+            // update visualization component
+            this.pointCloud.setFields(fields);
+            this.heatmap.setFields(fields);
+            this.trajectory.setFields(fields);
+            this.clusters.setFields(fields);
 
-                documents = window.nativeExtension.fetchDocuments(collection, skip, limit, fields, sortBy, sessions);
-            } else {
-                documents = window.nativeExtension.fetchDocuments(collection, skip, limit, fields, sortBy);
+            // Keep polling a request until it is done, even if it was replaced, so the plugin can release it.
+            let timer = setInterval(() => {
+                let state = window.nativeExtension.pollFetch(handle);
+
+                if (!state || state.done)
+                    clearInterval(timer);
+
+                if (state && handle === this.fetchHandle)
+                    this.onFetchState(state);
+            }, FETCH_POLL_INTERVAL);
+        }
+
+        /**
+         * Replaces the document list with one page of Amount documents, ordered by the sorted fields.
+         * Pages continue from a token instead of skipping, so later pages are as fast as the first,
+         * and the native plugin prefetches the next page while this one is shown.
+         * @param {boolean} next Continue after the current page instead of starting over.
+         */
+        fetchPage(next) {
+            let collection = this.selectedCollection;
+            let fields = { fields: this.getIsIncludedFields() };
+
+            if (collection == null || fields.fields.length == 0) {
+                console.warn("Select a collection and field(s) first");
+                return;
+            }
+
+            if (next && !this.pageToken) {
+                console.warn("No more pages");
+                return;
             }
 
-            const keys = Object.keys(documents);
-            const values = Object.values(documents);
+            this.cancelFetch();
 
-            let numItems = 0;
+            let args = [collection, { limit: this.fetchLimit() }, fields, { sort: this.getSortFields() },
+                { columnar: true }, { position_parser: this.selectedMode }, { after: next ? this.pageToken : '' }];
 
-            for (let value of values)
-                numItems = Math.max(numItems, value.length);
+            if (this.selectedMode == Parsers.POSITION)
+                args.push(this.levelSessions());
+
+            let page = window.nativeExtension.fetchPage(...args);
+            if (!page) {
+                console.warn("Could not fetch the page");
+                return;
+            }
+
+            this.pageToken = page.next;
+            this.pageNumber = next ? this.pageNumber + 1 : 1;
+
+            this.createDocumentList(fields.fields);
+            this.appendDocuments(page);
+            this.pointCloud.setFields(fields);
+            this.heatmap.setFields(fields);
+            this.trajectory.setFields(fields);
+            this.clusters.setFields(fields);
+            this.visualizeButton.attrs.disabled = false;
+
+            this.fetchStatus("Page " + this.pageNumber + ", " + page.count + " documents" + (page.next ? "" : " (last page)"));
+            m.redraw();
+        }
+
+        /**
+         * Cancels the fetch in progress, if any.
+         */
+        cancelFetch() {
+            if (this.fetchHandle) {
+                window.nativeExtension.cancelFetch(this.fetchHandle);
+                this.fetchHandle = null;
+                this.fetchStatus("Cancelled");
+            }
+        }
+
+        /**
+         * Appends a delivered chunk to the document list and reports when the fetch is done.
+         * @param {object} state
+         */
+        onFetchState(state) {
+            if (state.chunk && !state.cancelled) {
+                this.appendDocuments(state.chunk);
+                this.visualizeButton.attrs.disabled = false;
+            }
+
+            if (state.done) {
+                this.fetchHandle = null;
+
+                if (state.error)
+                    this.fetchStatus("Fetch failed: " + state.error);
+                else
+                    this.fetchStatus("Fetched " + this.documentsConfig.items.length + " documents" + (state.from_cache ? " (cached)" : ""));
+            }
+
+            m.redraw();
+        }
+
+        /**
+         * Creates an empty document list with one column per fetched field.
+         * @param {Array} keys
+         */
+        createDocumentList(keys) {
+            this.releaseFetchResult();
+            this.filterStatus('');
 
             const columns = [{
                 uniqueId: "isIncluded",
@@ -602,17 +1034,8 @@ define(function (require) {
                 property: key,
             })));
 
-            const documentItems = [];
-            for (let i = 0; i < numItems; ++i) {
-                let item = { id: i, isIncluded: false };
-                for (let k = 0; k < keys.length; ++k)
-                    item[keys[k]] = values[k][i];
-
-                documentItems.push(item);
-            }
-
             this.documentsConfig = ListView.config({
-                items: documentItems,
+                items: [],
                 columns: columns,
                 layoutOptions: ListView.toLayoutOptions({
                     size: "3",
@@ -639,10 +1062,338 @@ define(function (require) {
             );
 
             m.redraw(this.documentAccordion);
+        }
 
-            // update visualization component
-            this.activeVisualization.setFields(fields);
-            this.visualizeButton.attrs.disabled = false;
+        /**
+         * Lets the native plugin release the rows it kept of the fetch shown in the document list.
+         */
+        releaseFetchResult() {
+            if (this.resultHandle)
+                window.nativeExtension.releaseFetchResult(this.resultHandle);
+            this.resultHandle = null;
+        }
+
+        /**
+         * Includes exactly the documents of the fetch matching the row filter, evaluated natively over the fetched columns
+         * without querying the database again. Filters are JSON objects with a single key: and, or (arrays of filters),
+         * range ([field, min, max], null for an open bound), equals ([field, value]), in ([field, [values]]) and prefix ([field, string]).
+         */
+        applyRowFilter() {
+            if (!this.resultHandle) {
+                console.warn("Filters run on the rows of a fetch, fetch the documents first.");
+                return;
+            }
+
+            let filter;
+            try {
+                filter = JSON.parse(this.rowFilter());
+            } catch (e) {
+                this.filterStatus("Invalid filter: " + e.message);
+                return;
+            }
+
+            let result = window.nativeExtension.filterRows(this.resultHandle, filter);
+            if (!result || result.error) {
+                this.filterStatus("Filter failed: " + (result ? result.error : ""));
+                return;
+            }
+
+            // The rows of a fetch are the ids of its documents, the list may have been sorted since
+            const items = this.documentsConfig.items;
+            let itemsById = [];
+            items.forEach(item => {
+                item.isIncluded = false;
+                itemsById[item.id] = item;
+            });
+            for (let r = 0; r + 1 < result.ranges.length; r += 2) {
+                let end = Math.min(result.ranges[r + 1], itemsById.length);
+                for (let row = result.ranges[r]; row < end; ++row) {
+                    if (itemsById[row])
+                        itemsById[row].isIncluded = true;
+                }
+            }
+
+            this.filterStatus(result.rows + " of " + items.length + " documents included");
+            m.redraw();
+        }
+
+        /**
+         * Returns the included documents of the list as a flat array of [begin, end) row pairs,
+         * the rows of a fetch being the ids of its documents.
+         * @return {Array}
+         */
+        getIncludedRowRanges() {
+            const items = this.documentsConfig.items;
+            let included = new Uint8Array(items.length);
+            items.forEach(item => {
+                if (item.isIncluded)
+                    included[item.id] = 1;
+            });
+
+            let ranges = [];
+            for (let row = 0; row < included.length; ++row) {
+                if (!included[row])
+                    continue;
+                let begin = row;
+                while (row < included.length && included[row])
+                    ++row;
+                ranges.push(begin, row);
+            }
+            return ranges;
+        }
+
+        /**
+         * Shows the included documents of a fetch through a point set the native plugin shares with the engine,
+         * so the positions, scalars and times never go through the viewport event arguments.
+         * Returns false if the rows of the fetch are not kept natively, such as for pages.
+         * @param {string} scalarKey
+         * @param {string} timeKey
+         * @return {boolean}
+         */
+        visualizeSharedPoints(scalarKey, timeKey) {
+            if (!this.resultHandle)
+                return false;
+
+            let shared = window.nativeExtension.shareWithEngine(this.resultHandle, this.pointCloud.getPositionKey(),
+                scalarKey || "", timeKey || "", this.getIncludedRowRanges());
+            if (!shared || shared.error) {
+                console.warn("Could not share the points with the engine", shared ? shared.error : "");
+                return false;
+            }
+
+            if (timeKey)
+                this.pointCloud.setTimeRange(shared.time_min, shared.time_max);
+
+            this.viewportHandle.ready.then((viewportController) => {
+                viewportController.raise("visualize_shared_point_cloud", shared.name, !!scalarKey, this.pointCloud.min(), this.pointCloud.desired(), this.pointCloud.max());
+            });
+            return true;
+        }
+
+        /**
+         * Shows the density of the included documents of a fetch from a point set of their positions alone,
+         * shared with the engine like visualizeSharedPoints.
+         * Returns false if the rows of the fetch are not kept natively, such as for pages.
+         * @return {boolean}
+         */
+        visualizeSharedHeatmap() {
+            if (!this.resultHandle)
+                return false;
+
+            let shared = window.nativeExtension.shareWithEngine(this.resultHandle, this.heatmap.getPositionKey(), "", "", this.getIncludedRowRanges());
+            if (!shared || shared.error) {
+                console.warn("Could not share the positions with the engine", shared ? shared.error : "");
+                return false;
+            }
+
+            this.viewportHandle.ready.then((viewportController) => {
+                viewportController.raise("visualize_shared_heatmap", shared.name, this.heatmap.cellSize(), this.heatmap.blur(), this.heatmap.flat());
+            });
+            return true;
+        }
+
+        /**
+         * Shows one path per session of the included documents of a fetch. The native plugin groups the rows by session,
+         * orders them by time and simplifies the paths in parallel, then shares them with the engine like visualizeSharedPoints.
+         * Only fetches kept natively can be drawn as trajectories, not pages.
+         */
+        visualizeTrajectories() {
+            if (!this.resultHandle) {
+                console.warn("Trajectories are built from the rows of a fetch, fetch the documents first.");
+                return;
+            }
+
+            let shared = window.nativeExtension.shareTrajectoriesWithEngine(this.resultHandle, this.trajectory.getPositionKey(),
+                this.trajectory.getSessionKey(), this.trajectory.getTimeKey() || "", this.trajectory.tolerance(), this.getIncludedRowRanges());
+            if (!shared || shared.error) {
+                console.warn("Could not share the trajectories with the engine", shared ? shared.error : "");
+                return;
+            }
+
+            console.log("Trajectories: " + shared.paths + " paths, " + shared.points + " of " + shared.source_points + " points kept");
+            this.viewportHandle.ready.then((viewportController) => {
+                viewportController.raise("visualize_shared_trajectories", shared.name);
+            });
+        }
+
+        /**
+         * Clusters the positions of the included documents of a fetch and shows every cluster as a box around its points,
+         * colored by the mean of the scalar field. The native plugin clusters on background threads while this polls it,
+         * starting again cancels the clustering that is still running.
+         */
+        visualizeClusters() {
+            if (!this.resultHandle) {
+                console.warn("Clusters are found in the rows of a fetch, fetch the documents first.");
+                return;
+            }
+
+            if (this.clusterHandle)
+                window.nativeExtension.cancelClusters(this.clusterHandle);
+
+            let handle = window.nativeExtension.clusterPoints(this.resultHandle, this.clusters.getPositionKey(),
+                this.clusters.useScalar() ? this.clusters.getScalarKey() : "", this.clusters.method(), this.getIncludedRowRanges(),
+                { radius: this.clusters.radius() }, { min_points: this.clusters.minPoints() }, { k: this.clusters.k() },
+                { max_clusters: this.clusters.maxClusters() });
+            if (!handle) {
+                console.warn("Could not cluster the points");
+                return;
+            }
+
+            this.clusterHandle = handle;
+            let timer = setInterval(() => {
+                let state = window.nativeExtension.pollClusters(handle);
+                if (state && !state.done)
+                    return;
+
+                clearInterval(timer);
+                if (!state || handle !== this.clusterHandle)
+                    return;
+
+                this.clusterHandle = 0;
+                this.showClusters(state);
+            }, CLUSTER_POLL_INTERVAL);
+        }
+
+        /**
+         * Sends the clusters of a finished clustering to the engine, see visualizeClusters.
+         * @param {object} state The final state returned by pollClusters.
+         */
+        showClusters(state) {
+            let mins = [], maxs = [], scalars = [], sizes = [];
+            for (let cluster of state.clusters) {
+                mins.push(...cluster.min);
+                maxs.push(...cluster.max);
+                scalars.push(_.isNil(cluster.scalar_mean) ? false : cluster.scalar_mean);
+                sizes.push(cluster.size);
+            }
+
+            let means = state.clusters.map(cluster => cluster.scalar_mean).filter(mean => !_.isNil(mean));
+            let min = means.length > 0 ? Math.min(...means) : 0;
+            let max = means.length > 0 ? Math.max(...means) : 0;
+
+            console.log("Clusters: " + state.cluster_count + " found, " + state.clusters.length + " shown, " + state.noise_points + " noise points");
+            this.viewportHandle.ready.then((viewportController) => {
+                viewportController.raise("visualize_clusters", mins, maxs, scalars, sizes, min, (min + max) / 2, max);
+            });
+        }
+
+        /**
+         * Appends the documents of a columnar result to the document list.
+         * @param {object} documents
+         */
+        appendDocuments(documents) {
+            const numItems = documents.count;
+            const decodedColumns = documents.columns.map(column => decodeColumn(column, numItems));
+            const keys = decodedColumns.map(column => column.name);
+            const documentItems = this.documentsConfig.items;
+            const firstId = documentItems.length;
+
+            for (let i = 0; i < numItems; ++i) {
+                let item = { id: firstId + i, isIncluded: false, positions: {} };
+                for (let k = 0; k < keys.length; ++k) {
+                    const column = decodedColumns[k];
+                    item[keys[k]] = columnValue(column, i);
+
+                    if (column.positions && !isNaN(column.positions[3 * i]))
+                        item.positions[keys[k]] = [column.positions[3 * i], column.positions[3 * i + 1], column.positions[3 * i + 2]];
+                }
+
+                documentItems.push(item);
+            }
+        }
+
+        /**
+         * Streams documents inserted after now with the collection, fields and filter of the last fetch,
+         * and appends their positions to the point cloud. Only the latest max points are kept.
+         */
+        startLive() {
+            if (!this.lastLiveArgs) {
+                console.warn("Fetch documents before going live");
+                return;
+            }
+
+            this.stopLive();
+
+            let handle = window.nativeExtension.startLive(...this.lastLiveArgs, { flush_ms: this.liveFlushInterval() });
+            if (!handle) {
+                console.warn("Could not start the live stream");
+                return;
+            }
+
+            let positionKey = this.pointCloud.getPositionKey();
+            let scalarKey = this.pointCloud.useScalar() ? this.pointCloud.getScalarKey() : null;
+
+            this.liveHandle = handle;
+            this.liveStatus("Live");
+            this.viewportHandle.ready.then((viewportController) => {
+                viewportController.raise("start_live_point_cloud", this.liveMaxPoints());
+            });
+
+            let timer = setInterval(() => {
+                let state = window.nativeExtension.pollLive(handle);
+
+                if (!state || state.done || handle !== this.liveHandle) {
+                    clearInterval(timer);
+                    if (state && state.error && handle === this.liveHandle) {
+                        this.liveHandle = null;
+                        this.liveStatus("Live stream failed: " + state.error);
+                        m.redraw();
+                    }
+                    return;
+                }
+
+                if (state.chunk)
+                    this.appendLivePoints(state.chunk, positionKey, scalarKey);
+
+                this.liveStatus("Live, " + state.documents_received + " documents" + (state.documents_dropped > 0 ? ", " + state.documents_dropped + " dropped" : ""));
+                m.redraw();
+            }, LIVE_POLL_INTERVAL);
+        }
+
+        /**
+         * Stops the live stream, the points received so far stay in the point cloud.
+         */
+        stopLive() {
+            if (this.liveHandle) {
+                window.nativeExtension.stopLive(this.liveHandle);
+                this.liveHandle = null;
+                this.liveStatus("Stopped");
+            }
+        }
+
+        /**
+         * Sends the positions (and scalars) of a batch of live documents to the point cloud.
+         * @param {object} chunk
+         * @param {string} positionKey
+         * @param {string} scalarKey
+         */
+        appendLivePoints(chunk, positionKey, scalarKey) {
+            const numItems = chunk.count;
+            const decodedColumns = chunk.columns.map(column => decodeColumn(column, numItems));
+            const positionColumn = decodedColumns.find(column => column.name === positionKey);
+            const scalarColumn = scalarKey ? decodedColumns.find(column => column.name === scalarKey) : null;
+
+            if (!positionColumn || !positionColumn.positions)
+                return;
+
+            let positions = [];
+            let scalars = [];
+            for (let i = 0; i < numItems; ++i) {
+                if (isNaN(positionColumn.positions[3 * i]))
+                    continue;
+
+                positions.push(positionColumn.positions[3 * i], positionColumn.positions[3 * i + 1], positionColumn.positions[3 * i + 2]);
+                if (scalarColumn)
+                    scalars.push(columnValue(scalarColumn, i));
+            }
+
+            this.viewportHandle.ready.then((viewportController) => {
+                if (scalarColumn) {
+                    viewportController.raise("append_point_cloud", positions, scalars, this.pointCloud.min(), this.pointCloud.desired(), this.pointCloud.max());
+                } else {
+                    viewportController.raise("append_point_cloud", positions);
+                }
+            });
         }
 
         /**
@@ -652,18 +1403,43 @@ define(function (require) {
 
             switch (this.visualizationMethodModel()) {
                 case Visualizations.POINTCLOUD:
-                    let positions = this.getSelectedDataFields(this.pointCloud.getPositionKey());
+                    let scalarKey = this.pointCloud.useScalar() ? this.pointCloud.getScalarKey() : null;
+                    let timeKey = this.pointCloud.useTime() ? this.pointCloud.getTimeKey() : null;
+                    if (this.visualizeSharedPoints(scalarKey, timeKey))
+                        break;
+
+                    let selection = this.getSelectedPositions(this.pointCloud.getPositionKey(), scalarKey, timeKey);
+                    let times = timeKey ? selection.times : null;
+                    this.pointCloud.setTimes(times);
 
                     this.viewportHandle.ready.then((viewportController) => {
-                        if (this.pointCloud.useScalar()) {
-                            let scalars = this.getSelectedDataFields(this.pointCloud.getScalarKey());
-                            viewportController.raise("visualize_point_cloud", this.selectedMode, positions, scalars, this.pointCloud.min(), this.pointCloud.desired(), this.pointCloud.max());
+                        if (scalarKey) {
+                            viewportController.raise("visualize_point_cloud", selection.positions, selection.scalars, this.pointCloud.min(), this.pointCloud.desired(), this.pointCloud.max(), times);
                         } else {
-                            viewportController.raise("visualize_point_cloud", this.selectedMode, positions);
+                            viewportController.raise("visualize_point_cloud", selection.positions, [], 0, 0, 0, times);
                         }
                     });
                     break;
 
+                case Visualizations.HEATMAP:
+                    if (this.visualizeSharedHeatmap())
+                        break;
+
+                    let positions = this.getSelectedPositions(this.heatmap.getPositionKey(), null).positions;
+
+                    this.viewportHandle.ready.then((viewportController) => {
+                        viewportController.raise("visualize_heatmap", positions, this.heatmap.cellSize(), this.heatmap.blur(), this.heatmap.flat());
+                    });
+                    break;
+
+                case Visualizations.TRAJECTORY:
+                    this.visualizeTrajectories();
+                    break;
+
+                case Visualizations.CLUSTERS:
+                    this.visualizeClusters();
+                    break;
+
                 /**
                  * More visualization types can be regisered here.
                  */
@@ -673,6 +1449,53 @@ define(function (require) {
             }
         }
 
+        /**
+         * Reads the stage timings of the native plugin and prints the engine ones to the console.
+         */
+        refreshTimings() {
+            this.profileStages = window.nativeExtension.profileStats().stages || [];
+            this.viewportHandle.ready.then((viewportController) => {
+                viewportController.raise("print_engine_profile");
+            });
+        }
+
+        resetTimings() {
+            window.nativeExtension.resetProfile();
+            this.profileStages = [];
+        }
+
+        /**
+         * Writes the editor scopes to the trace path and the engine scopes next to it, for chrome://tracing.
+         */
+        dumpTimings() {
+            let path = this.tracePath();
+            if (!path) {
+                console.warn("No trace file path.");
+                return;
+            }
+
+            if (!window.nativeExtension.dumpProfileTrace(path))
+                console.warn("Could not write the trace to " + path);
+
+            this.viewportHandle.ready.then((viewportController) => {
+                viewportController.raise("print_engine_profile", path.replace(/(\.json)?$/, '.engine.json'));
+            });
+        }
+
+        /**
+         * Table of the editor stage timings, in milliseconds.
+         * @return {view}
+         */
+        timingsTable() {
+            const columns = ['name', 'count', 'p50_ms', 'p95_ms', 'p99_ms', 'max_ms', 'total_ms', 'bytes', 'documents'];
+            const cell = (stage, column) => typeof stage[column] === 'number' && column.endsWith('_ms') ? stage[column].toFixed(3) : stage[column];
+
+            return m('table', { style: 'width:100%;' }, [
+                m('tr', columns.map((column) => m('th', column))),
+                this.profileStages.map((stage) => m('tr', columns.map((column) => m('td', cell(stage, column)))))
+            ]);
+        }
+
         /**
          * Renders the viewer with all the UI components.
          * @return {view}
@@ -691,6 +1514,7 @@ define(function (require) {
                                 this.fieldAccordion,
                                 this.documentAccordion,
                                 this.visualizationAccordion,
+                                this.timingsAccordion,
                             ]),
                         ]),
                         m.resizer.panel({ 'min-size': 200, ratio: 1, className: '' }, [
@@ -747,7 +1571,7 @@ define(function (require) {
 
     class PointCloud {
 
-        constructor(fields) {
+        constructor(suggestRange, colorScaleChanged, timeWindowChanged, play) {
 
             let activeFields = null;
 
@@ -756,6 +1580,30 @@ define(function (require) {
             this.desired = m.prop(0);
             this.max = m.prop(0);
 
+            // Time window of the shown points, within the earliest and latest time of the shown points
+            this.useTime = m.prop(false);
+            this.windowStart = m.prop(0);
+            this.windowEnd = m.prop(0);
+            this.timeMin = m.prop(0);
+            this.timeMax = m.prop(0);
+
+            // Spinner models that recolor the point cloud when the range is edited
+            let rangeModel = (prop) => (value) => {
+                if (!_.isNil(value) && value !== prop()) {
+                    prop(value);
+                    colorScaleChanged();
+                }
+                return prop();
+            };
+
+            let windowModel = (prop) => (value) => {
+                if (!_.isNil(value) && value !== prop()) {
+                    prop(value);
+                    timeWindowChanged();
+                }
+                return prop();
+            };
+
             let positionModel = m.helper.modelWithTransformer(m.prop(1), null, (viewStrValue) => {
                 let parsed = parseInt(viewStrValue);
 
@@ -768,6 +1616,12 @@ define(function (require) {
                 return parsed;
             });
 
+            let timeModel = m.helper.modelWithTransformer(m.prop(1), null, (viewStrValue) => {
+                let parsed = parseInt(viewStrValue);
+
+                return parsed;
+            });
+
             this.getPositionKey = () => {
                 return activeFields[positionModel()];
             }
@@ -776,6 +1630,25 @@ define(function (require) {
                 return activeFields[scalarModel()];
             }
 
+            this.getTimeKey = () => {
+                return activeFields[timeModel()];
+            }
+
+            /**
+             * Reset the time window to every shown point, from the times sent with them (null if none were).
+             */
+            this.setTimes = (times) => {
+                let timed = times ? times.filter(time => _.isNumber(time)) : [];
+                this.setTimeRange(timed.length > 0 ? _.min(timed) : 0, timed.length > 0 ? _.max(timed) : 0);
+            }
+
+            this.setTimeRange = (min, max) => {
+                this.timeMin(_.isNil(min) ? 0 : min);
+                this.timeMax(_.isNil(max) ? 0 : max);
+                this.windowStart(this.timeMin());
+                this.windowEnd(this.timeMax());
+            }
+
             let getOptions = () => {
                 return activeFields;
             };
@@ -784,25 +1657,35 @@ define(function (require) {
                 activeFields = fields["fields"];
             }
 
+            let layout = () => {
+                this.component = [
+                    Toolbar.component({ items: positionComponent }),
+                    Toolbar.component({ items: useScalarComponent })];
+                if (this.useScalar()) {
+                    this.component.push(Toolbar.component({ items: scalarComponent }));
+                    this.component.push(Toolbar.component({ items: minMaxComponent }));
+                }
+                this.component.push(Toolbar.component({ items: useTimeComponent }));
+                if (this.useTime())
+                    this.component.push(Toolbar.component({ items: timeWindowComponent }));
+            };
+
             let checkboxModel = (value) => {
                 if (!_.isNil(value)) {
-                    if (value) {
-                        this.useScalar(true);
-                        this.component = [
-                            Toolbar.component({ items: positionComponent }),
-                            Toolbar.component({ items: useScalarComponent }),
-                            Toolbar.component({ items: scalarComponent }),
-                            Toolbar.component({ items: minMaxComponent })];
-                    } else {
-                        this.useScalar(false);
-                        this.component = [
-                            Toolbar.component({ items: positionComponent }),
-                            Toolbar.component({ items: useScalarComponent })];
-                    }
+                    this.useScalar(value);
+                    layout();
                 }
                 return this.useScalar();
             }
 
+            let timeCheckboxModel = (value) => {
+                if (!_.isNil(value)) {
+                    this.useTime(value);
+                    layout();
+                }
+                return this.useTime();
+            }
+
             let positionComponent = [
                 { component: "Position: " },
                 { component: Choice.component({ model: positionModel, getOptions: getOptions, useDictValueForLabel: true }) },
@@ -822,7 +1705,7 @@ define(function (require) {
                 { component: "Min: " },
                 {
                     component: Spinner.component({
-                        model: this.min,
+                        model: rangeModel(this.min),
                         increment: 1.0,
                         showLabel: false,
                         decimal: 0,
@@ -831,7 +1714,7 @@ define(function (require) {
                 { component: "Desired: " },
                 {
                     component: Spinner.component({
-                        model: this.desired,
+                        model: rangeModel(this.desired),
                         increment: 1.0,
                         min: 0,
                         showLabel: false,
@@ -841,18 +1724,226 @@ define(function (require) {
                 { component: "Max: " },
                 {
                     component: Spinner.component({
-                        model: this.max,
+                        model: rangeModel(this.max),
                         increment: 1.0,
                         min: 0,
                         showLabel: false,
                         decimal: 0,
                     })
-                }
+                },
+                { component: Button.component({ text: "Suggest range", onclick: () => suggestRange() }) }
+            ];
+
+            let useTimeComponent = [
+                { component: "Timeline: " },
+                { component: Checkbox.component({ model: timeCheckboxModel }) },
+                { component: Choice.component({ model: timeModel, getOptions: getOptions, useDictValueForLabel: true }) },
             ];
 
+            let timeWindowComponent = [
+                { component: "From: " },
+                {
+                    component: Spinner.component({
+                        model: windowModel(this.windowStart),
+                        increment: 1000,
+                        showLabel: false,
+                        decimal: 0,
+                    })
+                },
+                { component: "To: " },
+                {
+                    component: Spinner.component({
+                        model: windowModel(this.windowEnd),
+                        increment: 1000,
+                        showLabel: false,
+                        decimal: 0,
+                    })
+                },
+                { component: Button.component({ text: "Play", onclick: () => play() }) }
+            ];
+
+            layout();
+        }
+    }
+
+    /**
+    * Settings of the density heatmap: the position field, the grid cell size and the blur in cells.
+    */
+    class Heatmap {
+
+        constructor() {
+
+            let activeFields = null;
+
+            this.cellSize = m.prop(2.0);
+            this.blur = m.prop(1.0);
+            this.flat = m.prop(true);
+
+            let positionModel = m.helper.modelWithTransformer(m.prop(1), null, (viewStrValue) => {
+                return parseInt(viewStrValue);
+            });
+
+            this.getPositionKey = () => {
+                return activeFields[positionModel()];
+            }
+
+            this.setFields = (fields) => {
+                activeFields = fields["fields"];
+            }
+
+            let flatModel = (value) => {
+                if (!_.isNil(value))
+                    this.flat(value);
+                return this.flat();
+            }
+
             this.component = [
-                Toolbar.component({ items: positionComponent }),
-                Toolbar.component({ items: useScalarComponent })];
+                Toolbar.component({
+                    items: [
+                        { component: "Position: " },
+                        { component: Choice.component({ model: positionModel, getOptions: () => activeFields, useDictValueForLabel: true }) },
+                    ]
+                }),
+                Toolbar.component({
+                    items: [
+                        { component: "Cell size: " },
+                        { component: Spinner.component({ model: this.cellSize, increment: 0.5, min: 0.1, showLabel: false, decimal: 1 }) },
+                        { component: "Blur: " },
+                        { component: Spinner.component({ model: this.blur, increment: 0.5, min: 0, showLabel: false, decimal: 1 }) },
+                        { component: "Flat: " },
+                        { component: Checkbox.component({ model: flatModel }) },
+                    ]
+                })];
+        }
+    }
+
+    /**
+    * Settings of the trajectory view: the position, session and time fields and the simplification tolerance in world units.
+    */
+    class Trajectory {
+
+        constructor() {
+
+            let activeFields = null;
+
+            this.tolerance = m.prop(0.5);
+
+            let fieldModel = () => m.helper.modelWithTransformer(m.prop(1), null, (viewStrValue) => {
+                return parseInt(viewStrValue);
+            });
+
+            let positionModel = fieldModel();
+            let sessionModel = fieldModel();
+            let timeModel = fieldModel();
+
+            this.getPositionKey = () => {
+                return activeFields[positionModel()];
+            }
+
+            this.getSessionKey = () => {
+                return activeFields[sessionModel()];
+            }
+
+            this.getTimeKey = () => {
+                return activeFields[timeModel()];
+            }
+
+            this.setFields = (fields) => {
+                activeFields = fields["fields"];
+            }
+
+            this.component = [
+                Toolbar.component({
+                    items: [
+                        { component: "Position: " },
+                        { component: Choice.component({ model: positionModel, getOptions: () => activeFields, useDictValueForLabel: true }) },
+                        { component: "Session: " },
+                        { component: Choice.component({ model: sessionModel, getOptions: () => activeFields, useDictValueForLabel: true }) },
+                    ]
+                }),
+                Toolbar.component({
+                    items: [
+                        { component: "Time: " },
+                        { component: Choice.component({ model: timeModel, getOptions: () => activeFields, useDictValueForLabel: true }) },
+                        { component: "Tolerance: " },
+                        { component: Spinner.component({ model: this.tolerance, increment: 0.1, min: 0, showLabel: false, decimal: 2 }) },
+                    ]
+                })];
+        }
+    }
+
+    /**
+    * Settings of the cluster view: the position field, an optional scalar field averaged per cluster, the method
+    * and its settings. DBSCAN finds clusters of any shape from a radius and a density, k-means splits the points in k.
+    */
+    class Clusters {
+
+        constructor() {
+
+            let activeFields = null;
+
+            this.radius = m.prop(2.0);
+            this.minPoints = m.prop(8);
+            this.k = m.prop(8);
+            this.maxClusters = m.prop(64);
+            this.useScalar = m.prop(false);
+
+            let fieldModel = () => m.helper.modelWithTransformer(m.prop(1), null, (viewStrValue) => {
+                return parseInt(viewStrValue);
+            });
+
+            let positionModel = fieldModel();
+            let scalarModel = fieldModel();
+
+            let methods = { 'DBSCAN': 'dbscan', 'k-means': 'kmeans' };
+            this.method = m.prop('dbscan');
+
+            this.getPositionKey = () => {
+                return activeFields[positionModel()];
+            }
+
+            this.getScalarKey = () => {
+                return activeFields[scalarModel()];
+            }
+
+            this.setFields = (fields) => {
+                activeFields = fields["fields"];
+            }
+
+            let useScalarModel = (value) => {
+                if (!_.isNil(value))
+                    this.useScalar(value);
+                return this.useScalar();
+            }
+
+            this.component = [
+                Toolbar.component({
+                    items: [
+                        { component: "Position: " },
+                        { component: Choice.component({ model: positionModel, getOptions: () => activeFields, useDictValueForLabel: true }) },
+                        { component: "Scalar: " },
+                        { component: Checkbox.component({ model: useScalarModel }) },
+                        { component: Choice.component({ model: scalarModel, getOptions: () => activeFields, useDictValueForLabel: true }) },
+                    ]
+                }),
+                Toolbar.component({
+                    items: [
+                        { component: "Method: " },
+                        { component: Choice.component({ model: this.method, getOptions: () => methods }) },
+                        { component: "Radius: " },
+                        { component: Spinner.component({ model: this.radius, increment: 0.5, min: 0.1, showLabel: false, decimal: 1 }) },
+                        { component: "Min points: " },
+                        { component: Spinner.component({ model: this.minPoints, increment: 1, min: 1, showLabel: false, decimal: 0 }) },
+                    ]
+                }),
+                Toolbar.component({
+                    items: [
+                        { component: "k: " },
+                        { component: Spinner.component({ model: this.k, increment: 1, min: 1, showLabel: false, decimal: 0 }) },
+                        { component: "Max clusters: " },
+                        { component: Spinner.component({ model: this.maxClusters, increment: 8, min: 1, showLabel: false, decimal: 0 }) },
+                    ]
+                })];
         }
     }
 
@@ -17,11 +17,9 @@ function TelemetryEditorViewportBehavior:init(id, editor, window)
     self._shading_environment = World.create_shading_environment(self._world)
     self._is_dirty = true
     self._grid = self._level_editing.grid
-    self._fields =  {}
-    self._visualization_modes = { NON = 1, POINTCLOUD = 2, POINTCLOUD_COLOR = 3 }
+    self._visualization_modes = { NON = 1, POINTCLOUD = 2, POINTCLOUD_COLOR = 3, HEATMAP = 4, TRAJECTORY = 5, CLUSTERS = 6 }
     self._visualization_mode = self._visualization_modes.NON --Default mode
-    self._parser_modes = { NON = 0, VECTOR3 = 1, POSITION = 2 }
-    self._parser_mode = self._parser_modes.NON
+    self._cluster_labels = {}
 
     if self._window then
         -- Required by EditorViewport
@@ -43,6 +41,16 @@ function TelemetryEditorViewportBehavior:init(id, editor, window)
     self:on("destroy_entity")
     self:on("set_component_property")
     self:on("visualize_point_cloud")
+    self:on("visualize_shared_point_cloud")
+    self:on("visualize_shared_trajectories")
+    self:on("visualize_clusters")
+    self:on("start_live_point_cloud")
+    self:on("append_point_cloud")
+    self:on("set_point_cloud_color_scale")
+    self:on("set_point_cloud_time_window")
+    self:on("visualize_heatmap")
+    self:on("visualize_shared_heatmap")
+    self:on("print_engine_profile")
 end
 
 function TelemetryEditorViewportBehavior:on(method_name)
@@ -56,168 +64,60 @@ function TelemetryEditorViewportBehavior:off(method_name, callback)
     self._editor:off(self._id, method_name, callback)
 end
 
+-- Unit hosting the native point cloud mesh, its first material must draw vertex colors
+local POINT_CLOUD_HOST_UNIT = "core/units/primitives/cube_primitive"
+local POINT_CLOUD_BOX_SIZE = 1.0
+-- Font of the cluster labels, drawn in a world gui above every cluster volume
+local CLUSTER_LABEL_FONT = "core/performance_hud/debug"
+local CLUSTER_LABEL_SIZE = 1.0
+-- Widest viewport aspect ratio assumed when culling the point cloud, wider viewports may pop cells at the sides
+local POINT_CLOUD_VIEW_ASPECT = 2.0
+
 -------------------------------------
--- Parse an array of strings to Vector3
--- @param positions Array of strings.
+-- Pack a color as a 0xAARRGGBB number for the native point cloud
 -------------------------------------
-local function special_string_to_vec3(positions)
-
-    local result = {}
-
-    for i=1, #positions do
-        local val1, val2, val3
-        local position = string.sub(positions[i], string.len("Vector3(") + 1)
-
-        local x = string.find(position, ",")
-        if x ~= nil  then
-            val1 = string.sub(position, 0, x - 1)
-            position = string.sub(position, string.len(val1) + string.len(", ") + 1)
-        end        
-
-        local y = string.find(position, ",")
-        if y ~= nil  then
-            val2 = string.sub(position, 0, y - 1)
-            position = string.sub(position, string.len(val2) + string.len(", ") + 1)
-        end
-
-        val3 = string.sub(position, 0, string.len(position) - 1)
-        
-        val1_num, val2_num, val3_num = tonumber(val1), tonumber(val2), tonumber(val3) 
-
-        if type(val1_num) == "nil" or type(val2_num) == "nil" or type(val3_num) == "nil"  then
-            result[i] = nil
-        else
-            result[i] = Vector3(val1_num, val2_num, val3_num)
-        end
-    end
-
-    return result
+local function pack_color(a, r, g, b)
+    return math.floor(a) * 16777216 + math.floor(r) * 65536 + math.floor(g) * 256 + math.floor(b)
 end
 
 -------------------------------------
--- Parse an array of string to Vector3
--- @param positions Array of strings.
+-- Color stops of the point cloud scale as flat value, color pairs. Red (bad) - black (OK) - green (good)
+-- The points are colored natively, values equal to desired_min are drawn black.
 -------------------------------------
-local function testdb_string_to_vec3(positions)
-
-    local result = {}
-
-    for i=1, #positions do
-        local val1, val2, val3
-        local position = string.sub(positions[i], string.len("position(") + 2)
-
-        local x = string.find(position, ",")
-        if x ~= nil  then
-            val1 = string.sub(position, 0, x - 1)
-            position = string.sub(position, string.len(val1) + string.len(", ") + 1)
-        end
-        
-        local y = string.find(position, ",")
-        if y ~= nil  then
-            val2 = string.sub(position, 0, y - 1)
-            position = string.sub(position, string.len(val2) + string.len(", ") + 1)
-        end
-
-        val3 = string.sub(position, 0, string.len(position) - 1)
-
-        val1_num, val2_num, val3_num = tonumber(val1), tonumber(val2), tonumber(val3) 
-
-        if type(val1_num) == "nil" or type(val2_num) == "nil" or type(val3_num) == "nil" then
-            result[i] = nil
-        else
-            result[i] = Vector3(val1_num, val2_num, val3_num)
-        end
-    end
-
-    return result
+local function point_cloud_color_stops(min, desired_min, max)
+    desired_min = math.max(desired_min, min)
+    max = math.max(max, desired_min)
+    return { min, pack_color(255, 255, 0, 0), desired_min, pack_color(255, 0, 0, 0), max, pack_color(255, 0, 255, 0) }
 end
 
-
 -------------------------------------
--- Write your own parser if you have a different string layout
--- @param positions Array of strings.
+-- Heatmap color stops over the density relative to the densest cell. Blue (sparse) - yellow - red (dense)
 -------------------------------------
---[[local function exampel_parser(positions)
-    local result = {}
-
-    for i=1, #positions do
-        --Parse string
-    end
-
-    return result
-end
-]]
-
-local function parse_data(data, parser_mode)
-
-local data_output = nil
-
-if parser_mode == 0 then
-    data_output = data
-elseif parser_mode == 1 then
-    data_output = testdb_string_to_vec3(data)
-elseif parser_mode == 2 then
-    data_output = special_string_to_vec3(data)
-end
-
-return data_output
-
+local function heatmap_color_stops()
+    return { 0, pack_color(255, 0, 0, 255), 0.5, pack_color(255, 255, 255, 0), 1, pack_color(255, 255, 0, 0) }
 end
 
 -------------------------------------
--- Parse an array of strings to Vector3
--- @param positions Array of strings.
+-- Trajectory color stops over [0, 1], every path takes one color of this hue wheel
 -------------------------------------
-local function render_point_cloud(lines, fields, data_mode)
-
-    local positions = parse_data(fields.positions, data_mode)
-
-    local alpha = 255
-    local color_value = 255
-
-    for i=1, #positions do
-        local position = positions[i]
-
-        if position ~= nil then
-            LineObject.add_box(lines, Color(alpha, color_value, color_value, color_value), Matrix4x4.from_translation(position), Vector3(1.0,1.0,1.0))
-        end
-    end    
+local function trajectory_color_stops()
+    return { 0, pack_color(255, 255, 64, 64), 0.2, pack_color(255, 255, 224, 64), 0.4, pack_color(255, 64, 255, 96),
+        0.6, pack_color(255, 64, 224, 255), 0.8, pack_color(255, 96, 96, 255), 1, pack_color(255, 255, 64, 224) }
 end
 
 -------------------------------------
--- Render a point_cloud of boxes with a color. Red (bad) - black (OK) - green (good) 
--- @param lines, A line object
--- @param fields, Arrays of postions and scalar values 
+-- Create the native point cloud the first time it is needed
+-- @return The point cloud handle, nil if it could not be created
 -------------------------------------
-local function render_point_cloud_scale(lines, fields, data_mode)
-
-    local positions = parse_data(fields.positions, data_mode)
-
-    local scalars = fields.scalars
-    local alpha = 255
-    local color_value_default = 0
-
-    for i=1, #positions do
-        local position = positions[i]
-
-        if position ~= nil then
-            local scalar_value = scalars[i]
-            local color_scale_value
-
-            if type(scalar_value) == "nil" or type(scalar_value) ~= "number" then
-                color_value_default, color_scale_value = 125, 125
-            elseif scalar_value > fields.desired_min then 
-                color_scale_value = 255*((scalar_value - fields.desired_min) / (fields.max - fields.desired_min)) --Normalize values between 0 and 255
-                LineObject.add_box(lines, Color(alpha, color_value_default, color_scale_value, color_value_default), Matrix4x4.from_translation(position), Vector3(1.0, 1.0, 1.0)) --red to black color scale
-            elseif scalar_value < fields.desired_min then 
-                color_scale_value = 255 - 255*((scalar_value - fields.min) / (fields.desired_min - fields.min)) --Normalize values between 255 and 0
-                LineObject.add_box(lines, Color(alpha, color_scale_value, color_value_default, color_value_default), Matrix4x4.from_translation(position), Vector3(1.0, 1.0, 1.0)) --red to black color scale
-            end
-        end
+function TelemetryEditorViewportBehavior:point_cloud()
+    if self._point_cloud == nil then
+        self._point_cloud_unit = World.spawn_unit(self._world, POINT_CLOUD_HOST_UNIT)
+        Unit.set_mesh_visibility(self._point_cloud_unit, 1, false)
+        self._point_cloud = TelemetryPointCloud.create(self._point_cloud_unit)
     end
+    return self._point_cloud
 end
 
-
 function TelemetryEditorViewportBehavior:render(editor_viewport, lines, lines_no_z)
     if self._shading_environment ~= nil then
         ShadingEnvironment.blend(self._shading_environment, {"default", 1.0})
@@ -230,17 +130,22 @@ function TelemetryEditorViewportBehavior:render(editor_viewport, lines, lines_no
 
     World.clear_permanent_lines(self._world)
 
-    if self._visualization_mode == self._visualization_modes.POINTCLOUD then
-        render_point_cloud(lines_no_z, self._fields, self._parser_mode)
-    elseif self._visualization_mode == self._visualization_modes.POINTCLOUD_COLOR then
-        render_point_cloud_scale(lines_no_z, self._fields, self._parser_mode)
-    end
-    
     LineObject.dispatch(self._world, lines)
     LineObject.dispatch(self._world, lines_no_z)
 
     LineObject.reset(lines);
 
+    -- Cull and pick the level of detail of large point clouds, nothing is uploaded if the camera did not move
+    if self._point_cloud ~= nil then
+        local camera = self._editor_camera:camera()
+        TelemetryPointCloud.update_view(self._point_cloud, Camera.world_pose(camera), Camera.vertical_fov(camera),
+            POINT_CLOUD_VIEW_ASPECT, Camera.near_range(camera), Camera.far_range(camera))
+    end
+
+    if self._visualization_mode == self._visualization_modes.CLUSTERS then
+        self:draw_cluster_labels()
+    end
+
     if self._window ~= nil then
         Application.render_world(self._world, self._editor_camera:camera(), self._viewport, self._shading_environment, self._window)
     end
@@ -264,6 +169,27 @@ function TelemetryEditorViewportBehavior:shutdown()
 
     self:off(self._id, "load_background_level")
     self:off("visualize_point_cloud")
+    self:off("visualize_shared_point_cloud")
+    self:off("visualize_shared_trajectories")
+    self:off("visualize_clusters")
+    self:off("start_live_point_cloud")
+    self:off("append_point_cloud")
+    self:off("set_point_cloud_color_scale")
+    self:off("set_point_cloud_time_window")
+    self:off("visualize_heatmap")
+    self:off("visualize_shared_heatmap")
+    self:off("print_engine_profile")
+
+    if self._cluster_gui ~= nil then
+        World.destroy_gui(self._world, self._cluster_gui)
+        self._cluster_gui = nil
+    end
+
+    if self._point_cloud ~= nil then
+        TelemetryPointCloud.destroy(self._point_cloud)
+        World.destroy_unit(self._world, self._point_cloud_unit)
+        self._point_cloud, self._point_cloud_unit = nil, nil
+    end
 
     Application.destroy_viewport(self._world, self._viewport)
     World.destroy_shading_environment(self._world, self._shading_environment)
@@ -368,36 +294,228 @@ end
 end
 
 -------------------------------------
--- Assign arrays to database fields values and sets a visualization mode
--- @param positions, Array of positions.
--- @param scalars, Array of scalars.
+-- Upload positions and colors to the native point cloud and sets a visualization mode.
+-- The points are only sent to the renderer here, not every frame.
+-- @param positions, Array of positions as flat x, y, z triplets.
+-- @param scalars, Array of scalars, nil or empty to draw the points without a color scale.
 -- @param min, Minimum value when appyling the color scale.
 -- @param medium, The value to differentiate "good" and "bad"" values when appyling the color scale.
 -- @param max, Maximum value when appyling the color scale.
+-- @param times, Optional array of one time per position, sorted natively so set_point_cloud_time_window can scrub them.
 -------------------------------------
-function TelemetryEditorViewportBehavior:visualize_point_cloud(parser_mode, positions, scalars, min, desired_min, max)    
-   
-    self._fields = {} --Reset table
+function TelemetryEditorViewportBehavior:visualize_point_cloud(positions, scalars, min, desired_min, max, times)
 
-    self._fields["positions"] = positions
+    local point_cloud = self:point_cloud()
+    if point_cloud == nil then
+        return
+    end
 
     --different modes. With or without scalar values
-    if(scalars == nil) then
+    if(scalars == nil or #scalars == 0) then
         self._visualization_mode = self._visualization_modes.POINTCLOUD
+        TelemetryPointCloud.set_points(point_cloud, positions, nil, POINT_CLOUD_BOX_SIZE, times)
+    else
+        self._visualization_mode = self._visualization_modes.POINTCLOUD_COLOR
+        TelemetryPointCloud.set_scalar_points(point_cloud, positions, scalars, POINT_CLOUD_BOX_SIZE, point_cloud_color_stops(min, desired_min, max), times)
+    end
+end
+
+-------------------------------------
+-- Show a point set shared by the editor plugin. Only its name crosses from the viewer,
+-- the positions, scalars and times are read natively from shared memory.
+-- @param name, Name of the shared point set returned by shareWithEngine.
+-- @param use_scalars, Color the points with the scalars of the set.
+-- @param min, desired_min, max, Color scale range, as for visualize_point_cloud.
+-------------------------------------
+function TelemetryEditorViewportBehavior:visualize_shared_point_cloud(name, use_scalars, min, desired_min, max)
+
+    local point_cloud = self:point_cloud()
+    if point_cloud == nil then
+        return
+    end
+
+    if use_scalars then
+        self._visualization_mode = self._visualization_modes.POINTCLOUD_COLOR
+        TelemetryPointCloud.set_shared_points(point_cloud, name, POINT_CLOUD_BOX_SIZE, point_cloud_color_stops(min, desired_min, max))
+    else
+        self._visualization_mode = self._visualization_modes.POINTCLOUD
+        TelemetryPointCloud.set_shared_points(point_cloud, name, POINT_CLOUD_BOX_SIZE, nil)
+    end
+end
+
+-------------------------------------
+-- Show the paths of a trajectory set shared by the editor plugin as lines, one color per path.
+-- The paths are grouped by session, ordered by time and simplified natively before they are shared.
+-- @param name, Name of the shared trajectory set returned by shareTrajectoriesWithEngine.
+-------------------------------------
+function TelemetryEditorViewportBehavior:visualize_shared_trajectories(name)
+
+    local point_cloud = self:point_cloud()
+    if point_cloud == nil then
+        return
+    end
+
+    self._visualization_mode = self._visualization_modes.TRAJECTORY
+    TelemetryPointCloud.set_shared_paths(point_cloud, name, trajectory_color_stops())
+end
+
+-------------------------------------
+-- Show clusters found by the editor plugin as boxes around their points, colored by their mean scalar,
+-- with a label giving the number of points and the mean above every box.
+-- @param mins, Minimum corners of the clusters as flat x, y, z triplets.
+-- @param maxs, Maximum corners of the clusters as flat x, y, z triplets.
+-- @param scalars, Mean scalar of every cluster, false for clusters without one.
+-- @param sizes, Number of points of every cluster.
+-- @param min, desired_min, max, Color scale range, as for visualize_point_cloud.
+-------------------------------------
+function TelemetryEditorViewportBehavior:visualize_clusters(mins, maxs, scalars, sizes, min, desired_min, max)
+
+    local point_cloud = self:point_cloud()
+    if point_cloud == nil then
+        return
+    end
+
+    self._visualization_mode = self._visualization_modes.CLUSTERS
+    TelemetryPointCloud.set_volumes(point_cloud, mins, maxs, scalars, point_cloud_color_stops(min, desired_min, max))
+
+    self._cluster_labels = {}
+    for i = 1, #sizes do
+        local text = tostring(sizes[i])
+        if type(scalars[i]) == "number" then
+            text = text .. string.format(" (%.2f)", scalars[i])
+        end
+        local position = Vector3((mins[i * 3 - 2] + maxs[i * 3 - 2]) * 0.5, (mins[i * 3 - 1] + maxs[i * 3 - 1]) * 0.5, maxs[i * 3])
+        self._cluster_labels[i] = { text = text, position = Vector3Box(position) }
+    end
+end
+
+-------------------------------------
+-- Draw the labels of visualize_clusters, facing the camera. The world gui is created the first time.
+-------------------------------------
+function TelemetryEditorViewportBehavior:draw_cluster_labels()
+
+    if self._cluster_gui == nil then
+        self._cluster_gui = World.create_world_gui(self._world, Matrix4x4.identity(), 1, 1, "immediate")
+    end
+
+    local camera_rotation = Camera.world_rotation(self._editor_camera:camera())
+    for _, label in ipairs(self._cluster_labels) do
+        local tm = Matrix4x4.from_quaternion_position(camera_rotation, label.position:unbox())
+        Gui.text_3d(self._cluster_gui, label.text, CLUSTER_LABEL_FONT, CLUSTER_LABEL_SIZE, CLUSTER_LABEL_FONT, tm, Vector3.zero(), 0, Color(255, 255, 255, 255))
+    end
+end
+
+-------------------------------------
+-- Only draw the points of the point cloud with a time within [t0, t1], found natively by binary search.
+-- Nothing is uploaded, so the window can follow a slider or play back every frame.
+-- @param t0, Start of the window, nil for the earliest point.
+-- @param t1, End of the window, nil for the latest point.
+-------------------------------------
+function TelemetryEditorViewportBehavior:set_point_cloud_time_window(t0, t1)
+
+    if self._point_cloud == nil then
+        return
+    end
+
+    TelemetryPointCloud.set_time_window(self._point_cloud, t0, t1)
+end
+
+-------------------------------------
+-- Recolor a point cloud shown with scalars. Nothing is uploaded unless the range changed.
+-------------------------------------
+function TelemetryEditorViewportBehavior:set_point_cloud_color_scale(min, desired_min, max)
+
+    if self._point_cloud == nil or self._visualization_mode ~= self._visualization_modes.POINTCLOUD_COLOR then
+        return
+    end
+
+    TelemetryPointCloud.set_color_scale(self._point_cloud, point_cloud_color_stops(min, desired_min, max))
+end
+
+-------------------------------------
+-- Print the timings of the native point cloud stages and frames to the console.
+-- @param trace_path, Optional file to write the recorded scopes to as a Chrome trace.
+-------------------------------------
+function TelemetryEditorViewportBehavior:print_engine_profile(trace_path)
+
+    for _, stage in ipairs(TelemetryProfiler.stats()) do
+        print(string.format("%-28s count %6d  p50 %8.3f ms  p95 %8.3f ms  p99 %8.3f ms  max %8.3f ms  total %10.3f ms  items %d",
+            stage.name, stage.count, stage.p50_ms, stage.p95_ms, stage.p99_ms, stage.max_ms, stage.total_ms, stage.items))
+    end
+
+    if trace_path ~= nil and trace_path ~= "" and not TelemetryProfiler.dump_trace(trace_path) then
+        print("Could not write the engine trace to " .. trace_path)
+    end
+end
+
+-------------------------------------
+-- Show the density of positions as colored grid cells, binned natively.
+-- The density is only computed again when the positions or the grid settings change.
+-- @param positions, Array of positions as flat x, y, z triplets.
+-- @param cell_size, Size of a grid cell in world units.
+-- @param blur_sigma, Standard deviation of the Gaussian blur in cells, 0 for no blur.
+-- @param flat, Bin on x and y only, for telemetry on mostly flat levels.
+-------------------------------------
+function TelemetryEditorViewportBehavior:visualize_heatmap(positions, cell_size, blur_sigma, flat)
+
+    local point_cloud = self:point_cloud()
+    if point_cloud == nil then
+        return
+    end
+
+    self._visualization_mode = self._visualization_modes.HEATMAP
+    TelemetryPointCloud.set_density(point_cloud, positions, cell_size, blur_sigma, flat, heatmap_color_stops())
+end
+
+-------------------------------------
+-- Show the density of a point set shared by the editor plugin, like visualize_heatmap.
+-- Only its name crosses from the viewer, the positions are read natively from shared memory.
+-- @param name, Name of the shared point set returned by shareWithEngine.
+-- @param cell_size, blur_sigma, flat, Grid settings, as for visualize_heatmap.
+-------------------------------------
+function TelemetryEditorViewportBehavior:visualize_shared_heatmap(name, cell_size, blur_sigma, flat)
+
+    local point_cloud = self:point_cloud()
+    if point_cloud == nil then
+        return
+    end
+
+    self._visualization_mode = self._visualization_modes.HEATMAP
+    TelemetryPointCloud.set_shared_density(point_cloud, name, cell_size, blur_sigma, flat, heatmap_color_stops())
+end
+
+-------------------------------------
+-- Clear the point cloud and keep the latest max_points points appended by append_point_cloud.
+-- @param max_points, Size of the point ring, the oldest points are dropped once it is full.
+-------------------------------------
+function TelemetryEditorViewportBehavior:start_live_point_cloud(max_points)
+
+    local point_cloud = self:point_cloud()
+    if point_cloud == nil then
+        return
+    end
+
+    self._visualization_mode = self._visualization_modes.POINTCLOUD
+    TelemetryPointCloud.reserve(point_cloud, max_points, POINT_CLOUD_BOX_SIZE)
+end
+
+-------------------------------------
+-- Append a batch of live points to the point cloud, only the new points are colored and uploaded.
+-- Takes the same arguments as visualize_point_cloud.
+-------------------------------------
+function TelemetryEditorViewportBehavior:append_point_cloud(positions, scalars, min, desired_min, max)
+
+    local point_cloud = self:point_cloud()
+    if point_cloud == nil then
+        return
+    end
+
+    if(scalars == nil) then
+        TelemetryPointCloud.append(point_cloud, positions, nil)
     else
         self._visualization_mode = self._visualization_modes.POINTCLOUD_COLOR
-        self._fields["scalars"] = scalars
-        self._fields["min"] = min
-        self._fields["desired_min"] = desired_min
-        self._fields["max"] = max
-    end
-
-    if parser_mode == 0 then
-        self._parser_mode = self._parser_modes.NON
-    elseif parser_mode == 1 then
-        self._parser_mode = self._parser_modes.VECTOR3
-    elseif parser_mode == 2 then
-        self._parser_mode = self._parser_modes.POSITION
+        local drawn_positions, colors = TelemetryPointCloud.scale_colors(positions, scalars, point_cloud_color_stops(min, desired_min, max))
+        TelemetryPointCloud.append(point_cloud, drawn_positions, colors)
     end
 end
 
@@ -0,0 +1,846 @@
+#include "aggregate_query.h"
+#include "color_scale.h"
+#include "column_set.h"
+#include "document_decoder.h"
+#include "fetch_query.h"
+#include "fetch_requests.h"
+#include "position_parser.h"
+#include "query_cache.h"
+#include "session_filter.h"
+
+#include <mongoc.h>
+#include <bson.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace PLUGIN_NAMESPACE
+{
+	const size_t INSERT_BATCH_SIZE = 1000;
+	const int64_t EVENT_INTERVAL_MS = 100;
+	const int64_t FIRST_EVENT_MS = 1500000000000;
+
+	/**
+	* Command line options shared by generate and run.
+	*/
+	struct BenchOptions
+	{
+		std::string uri = "mongodb://localhost:27017";
+		std::string database = "telemetry_bench";
+		std::string collection = "events";
+		std::string file; // Concatenated BSON documents instead of a server, as written by mongodump
+		std::string level = "bench_level";
+
+		// Generator
+		unsigned sessions = 100;
+		unsigned events_per_session = 10000;
+		unsigned scalars = 2;
+		double extent = 1000.0;
+		unsigned seed = 1;
+
+		// Runs
+		std::vector<uint64_t> sizes = { 10000, 100000, 1000000 };
+		unsigned repetitions = 5;
+		std::vector<unsigned> threads = { DEFAULT_FETCH_THREADS }; // The fetch case runs at every count
+		double cell_size = 10.0;
+	};
+
+	/**
+	* Where generated documents go, a file or batched inserts into a collection.
+	*/
+	struct DocumentSink
+	{
+		FILE* file = nullptr;
+		mongoc_collection_t* collection = nullptr;
+		mongoc_bulk_operation_t* bulk = nullptr;
+		size_t pending = 0;
+		uint64_t written = 0;
+		uint64_t bytes = 0;
+	};
+
+	bool flush_sink(DocumentSink& sink)
+	{
+		if (sink.bulk == nullptr)
+			return true;
+
+		bson_error_t error;
+		auto ok = sink.pending == 0 || mongoc_bulk_operation_execute(sink.bulk, nullptr, &error) != 0;
+		if (!ok)
+			fprintf(stderr, "Insert failed: %s\n", error.message);
+
+		mongoc_bulk_operation_destroy(sink.bulk);
+		sink.bulk = nullptr;
+		sink.pending = 0;
+		return ok;
+	}
+
+	bool write_document(DocumentSink& sink, const bson_t* doc)
+	{
+		sink.bytes += doc->len;
+		++sink.written;
+
+		if (sink.file != nullptr)
+			return fwrite(bson_get_data(doc), 1, doc->len, sink.file) == doc->len;
+
+		if (sink.bulk == nullptr)
+			sink.bulk = mongoc_collection_create_bulk_operation_with_opts(sink.collection, nullptr);
+
+		bson_error_t error;
+		if (!mongoc_bulk_operation_insert_with_opts(sink.bulk, doc, nullptr, &error))
+		{
+			fprintf(stderr, "Insert failed: %s\n", error.message);
+			return false;
+		}
+
+		return ++sink.pending < INSERT_BATCH_SIZE || flush_sink(sink);
+	}
+
+	/**
+	* Build one event in the layout the viewer expects:
+	* { session_id, timestamp, params: { level_key, position: "Vector3(x, y, z)", value_0, value_1, ... } }.
+	*/
+	void build_event(bson_t* doc, const BenchOptions& options, const char* session_id, int64_t timestamp, const double* position, std::mt19937& rng)
+	{
+		char position_str[96];
+		snprintf(position_str, sizeof(position_str), "Vector3(%.3f, %.3f, %.3f)", position[0], position[1], position[2]);
+
+		std::normal_distribution<double> scalar(50.0, 15.0);
+		bson_t params;
+
+		BSON_APPEND_UTF8(doc, "session_id", session_id);
+		BSON_APPEND_DATE_TIME(doc, "timestamp", timestamp);
+		BSON_APPEND_DOCUMENT_BEGIN(doc, "params", &params);
+		BSON_APPEND_UTF8(&params, "level_key", options.level.c_str());
+		BSON_APPEND_UTF8(&params, "position", position_str);
+		for (unsigned i = 0; i < options.scalars; ++i)
+		{
+			char key[32];
+			snprintf(key, sizeof(key), "value_%u", i);
+			BSON_APPEND_DOUBLE(&params, key, scalar(rng));
+		}
+		bson_append_document_end(doc, &params);
+	}
+
+	/**
+	* Fill the file or collection with sessions of players random walking over the level.
+	* On a server the session_start collection and the session_id index are created as well.
+	*/
+	bool generate(const BenchOptions& options, mongoc_database_t* database)
+	{
+		DocumentSink sink, sessions_sink;
+		bson_error_t error;
+
+		if (!options.file.empty())
+		{
+			sink.file = fopen(options.file.c_str(), "wb");
+			if (sink.file == nullptr)
+			{
+				fprintf(stderr, "Could not open %s\n", options.file.c_str());
+				return false;
+			}
+		}
+		else
+		{
+			sink.collection = mongoc_database_get_collection(database, options.collection.c_str());
+			sessions_sink.collection = mongoc_database_get_collection(database, "session_start");
+			mongoc_collection_drop(sink.collection, &error);
+			mongoc_collection_drop(sessions_sink.collection, &error);
+		}
+
+		std::mt19937 rng(options.seed);
+		std::uniform_real_distribution<double> start(-options.extent * 0.5, options.extent * 0.5);
+		std::normal_distribution<double> step(0.0, 2.0);
+
+		auto ok = true;
+		auto timestamp = FIRST_EVENT_MS;
+		for (unsigned s = 0; s < options.sessions && ok; ++s)
+		{
+			char session_id[32];
+			snprintf(session_id, sizeof(session_id), "session_%06u", s);
+
+			if (sessions_sink.collection != nullptr)
+			{
+				bson_t session, params;
+				bson_init(&session);
+				BSON_APPEND_UTF8(&session, "session_id", session_id);
+				BSON_APPEND_DOCUMENT_BEGIN(&session, "params", &params);
+				BSON_APPEND_UTF8(&params, "level_key", options.level.c_str());
+				bson_append_document_end(&session, &params);
+				ok = write_document(sessions_sink, &session);
+				bson_destroy(&session);
+			}
+
+			double position[3] = { start(rng), start(rng), 0.0 };
+			for (unsigned e = 0; e < options.events_per_session && ok; ++e)
+			{
+				bson_t event;
+				bson_init(&event);
+				build_event(&event, options, session_id, timestamp, position, rng);
+				ok = write_document(sink, &event);
+				bson_destroy(&event);
+
+				timestamp += EVENT_INTERVAL_MS;
+				position[0] += step(rng);
+				position[1] += step(rng);
+				position[2] = std::max(0.0, position[2] + step(rng) * 0.1);
+			}
+		}
+
+		ok = flush_sink(sink) && ok;
+		ok = flush_sink(sessions_sink) && ok;
+
+		if (ok && sink.collection != nullptr)
+		{
+			bson_t keys, index_opts;
+			bson_init(&keys);
+			bson_init(&index_opts);
+			BSON_APPEND_INT32(&keys, "session_id", 1);
+			BSON_APPEND_INT32(&keys, "params.position", 1);
+			if (!mongoc_collection_create_index_with_opts(sink.collection, &keys, &index_opts, nullptr, &error))
+				fprintf(stderr, "Could not create the session index: %s\n", error.message);
+			bson_destroy(&index_opts);
+			bson_destroy(&keys);
+		}
+
+		if (sink.file != nullptr)
+			ok = fclose(sink.file) == 0 && ok;
+		if (sink.collection != nullptr)
+			mongoc_collection_destroy(sink.collection);
+		if (sessions_sink.collection != nullptr)
+			mongoc_collection_destroy(sessions_sink.collection);
+
+		printf("Wrote %llu events (%.1f MB) of %u sessions\n", (unsigned long long)sink.written, sink.bytes / 1e6, options.sessions);
+		return ok;
+	}
+
+	/**
+	* Read up to count documents from the file or the collection, to decode and parse in memory.
+	*/
+	bool load_documents(const BenchOptions& options, mongoc_database_t* database, uint64_t count, std::vector<bson_t*>& documents)
+	{
+		if (!options.file.empty())
+		{
+			bson_error_t error;
+			auto reader = bson_reader_new_from_file(options.file.c_str(), &error);
+			if (reader == nullptr)
+			{
+				fprintf(stderr, "Could not read %s: %s\n", options.file.c_str(), error.message);
+				return false;
+			}
+
+			const bson_t* doc = nullptr;
+			bool eof = false;
+			while (documents.size() < count && (doc = bson_reader_read(reader, &eof)) != nullptr)
+				documents.push_back(bson_copy(doc));
+
+			bson_reader_destroy(reader);
+			return true;
+		}
+
+		bson_t filter, opts;
+		bson_init(&filter);
+		bson_init(&opts);
+		BSON_APPEND_INT64(&opts, "limit", (int64_t)count);
+
+		auto collection = mongoc_database_get_collection(database, options.collection.c_str());
+		auto cursor = mongoc_collection_find_with_opts(collection, &filter, &opts, nullptr);
+		const bson_t* doc = nullptr;
+		while (mongoc_cursor_next(cursor, &doc))
+			documents.push_back(bson_copy(doc));
+
+		bson_error_t error;
+		auto ok = !mongoc_cursor_error(cursor, &error);
+		if (!ok)
+			fprintf(stderr, "Could not load documents: %s\n", error.message);
+
+		mongoc_cursor_destroy(cursor);
+		mongoc_collection_destroy(collection);
+		bson_destroy(&opts);
+		bson_destroy(&filter);
+		return ok;
+	}
+
+	/**
+	* Time repetitions of a case and print one line in the spirit of Google Benchmark:
+	* name/size, mean and fastest wall time, items and bytes per second of the fastest run.
+	* Cases that cannot measure the bytes they process leave them at 0 and print n/a.
+	*/
+	template<typename Run>
+	void run_case(const char* name, uint64_t size, const BenchOptions& options, Run run)
+	{
+		std::vector<double> seconds;
+		uint64_t items = 0, bytes = 0;
+
+		for (unsigned r = 0; r < options.repetitions; ++r)
+		{
+			items = bytes = 0;
+			auto start = std::chrono::steady_clock::now();
+			run(items, bytes);
+			seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		auto fastest = *std::min_element(seconds.begin(), seconds.end());
+		auto mean = 0.0;
+		for (auto s : seconds)
+			mean += s / seconds.size();
+
+		char label[64], bandwidth[32];
+		snprintf(label, sizeof(label), "%s/%llu", name, (unsigned long long)size);
+		if (bytes > 0)
+			snprintf(bandwidth, sizeof(bandwidth), "%10.1f MB/s", fastest > 0.0 ? bytes / fastest / 1e6 : 0.0);
+		else
+			snprintf(bandwidth, sizeof(bandwidth), "%15s", "n/a");
+		printf("%-28s %12.3f ms %12.3f ms %14.0f items/s %s\n", label, mean * 1e3, fastest * 1e3,
+			fastest > 0.0 ? items / fastest : 0.0, bandwidth);
+	}
+
+	FetchQuery bench_query(const BenchOptions& options, uint64_t size, int position_parser)
+	{
+		FetchQuery query;
+		query.collection = options.collection;
+		query.limit = size;
+		query.fields = { "session_id", "params.position", "params.value_0" };
+		query.columnar = true;
+		query.position_parser = position_parser;
+		query.chunk_size = (size_t)-1;
+		query.thread_count = options.threads.front();
+		return query;
+	}
+
+	/**
+	* Query of the sessions of more than two session batches sorted on value_0, skipping half of size,
+	* so that the batches have to be merged before skip and limit apply.
+	*/
+	FetchQuery sorted_sessions_query(const BenchOptions& options, uint64_t size)
+	{
+		auto query = bench_query(options, size, POSITION_PARSER_VECTOR3);
+		query.skip = size / 2;
+		query.sort = { 0, 0, 1 };
+		query.filter_sessions = true;
+
+		// Ids past the generated sessions match nothing but still make batches
+		auto session_count = std::max<size_t>(options.sessions, 2 * SESSION_BATCH_SIZE + 1);
+		for (size_t s = 0; s < session_count; ++s)
+		{
+			char session_id[32];
+			snprintf(session_id, sizeof(session_id), "session_%06u", (unsigned)s);
+			query.sessions_ids.push_back(session_id);
+		}
+		return query;
+	}
+
+	/**
+	* Return true if the value_0 column of the chunks of a sorted fetch never decreases.
+	*/
+	bool rows_in_sort_order(const FetchRequest& request)
+	{
+		double previous = -INFINITY;
+		for (const auto& chunk : request.chunks)
+		{
+			for (size_t row = 0; row < chunk[2].size; ++row)
+			{
+				auto value = chunk[2].number_at(row);
+				if (value < previous)
+					return false;
+				previous = value;
+			}
+		}
+		return true;
+	}
+
+	/**
+	* Query of every generated field, --scalars values wide, for the wide decode cases.
+	*/
+	FetchQuery wide_query(const BenchOptions& options, uint64_t size)
+	{
+		auto query = bench_query(options, size, -1);
+		query.fields = { "session_id", "timestamp", "params.level_key", "params.position" };
+		for (unsigned i = 0; i < options.scalars; ++i)
+			query.fields.push_back("params.value_" + std::to_string(i));
+		return query;
+	}
+
+	/**
+	* Decode the way fetches did before DocumentDecoder, searching the document again for every field,
+	* as the baseline of the wide decode case.
+	*/
+	void read_document_by_path(const bson_t* doc, const FetchQuery& query, std::vector<Column>& columns)
+	{
+		for (auto i = 0; i < query.fields.size(); ++i)
+		{
+			bson_iter_t iter, field;
+			if (bson_iter_init(&iter, doc) && bson_iter_find_descendant(&iter, query.fields[i].c_str(), &field))
+				push_bson_value(columns[i], bson_iter_value(&field));
+			else
+				columns[i].push_null();
+		}
+	}
+
+	/**
+	* Stand-in for a ConfigValue node of the editor API, which the bench cannot link: one heap node per value,
+	* arrays holding their items by pointer.
+	*/
+	struct ConfigNode
+	{
+		bson_type_t type = BSON_TYPE_NULL;
+		double number = 0.0;
+		std::string string;
+		std::vector<std::unique_ptr<ConfigNode>> items;
+	};
+
+	/**
+	* Marshal documents the way fetch_documents does without { columnar: true }, one array per field
+	* and one node pushed per value, as the baseline of the marshal_columnar case.
+	*/
+	void marshal_config_values(const std::vector<bson_t*>& documents, uint64_t count, const FetchQuery& query, std::vector<ConfigNode>& fields)
+	{
+		DocumentDecoder decoder(query);
+		fields.resize(query.fields.size());
+		for (uint64_t d = 0; d < count; ++d)
+		{
+			decoder.walk(documents[d]);
+			for (size_t i = 0; i < query.fields.size(); ++i)
+			{
+				auto field = decoder.field(i);
+				if (field == nullptr)
+					continue;
+
+				std::unique_ptr<ConfigNode> item(new ConfigNode());
+				item->type = bson_iter_type(field);
+				if (item->type == BSON_TYPE_UTF8)
+					item->string = bson_iter_utf8(field, nullptr);
+				else
+					item->number = bson_iter_as_double(field);
+				fields[i].items.push_back(std::move(item));
+			}
+		}
+	}
+
+	/**
+	* Marshal documents the way fetch_documents does with { columnar: true }: decode into packed columns
+	* and encode every buffer once as base64. Returns the encoded size.
+	*/
+	size_t marshal_columnar(const std::vector<bson_t*>& documents, uint64_t count, const FetchQuery& query)
+	{
+		std::vector<Column> columns;
+		init_columns(query, columns);
+		DocumentDecoder decoder(query);
+		for (uint64_t d = 0; d < count; ++d)
+			decoder.read(documents[d], columns);
+
+		size_t encoded = 0;
+		for (const auto& column : columns)
+		{
+			auto view = view_column(column);
+			encoded += base64_encode(view.data, view.data_size).size();
+			encoded += base64_encode(view.validity, view.validity_size).size();
+			if (view.type == COLUMN_TYPE_STRING && view.offsets != nullptr)
+				encoded += base64_encode(view.offsets, (view.size + 1) * sizeof(uint32_t)).size();
+			if (view.position_state == POSITIONS_PARSED && view.positions != nullptr)
+				encoded += base64_encode(view.positions, view.size * 3 * sizeof(float)).size();
+		}
+		return encoded;
+	}
+
+	/**
+	* Color the way the viewer did in Lua before map_scalars_to_colors, as the baseline of the color_scale case:
+	* red to black below desired_min, black to green above it, points with a value equal to desired_min left out.
+	*/
+	void lua_scale_colors(const std::vector<float>& positions, const std::vector<float>& scalars, float min, float desired_min, float max,
+		std::vector<float>& drawn_positions, std::vector<uint32_t>& colors)
+	{
+		auto pack_color = [](double a, double r, double g, double b) {
+			return (uint32_t)(floor(a) * 16777216.0 + floor(r) * 65536.0 + floor(g) * 256.0 + floor(b));
+		};
+
+		for (size_t i = 0; i < scalars.size(); ++i)
+		{
+			auto value = scalars[i];
+			if (isnan(value) || value == desired_min)
+				continue;
+
+			if (value > desired_min)
+				colors.push_back(pack_color(255, 0, 255 * ((value - desired_min) / (max - desired_min)), 0));
+			else
+				colors.push_back(pack_color(255, 255 - 255 * ((value - min) / (desired_min - min)), 0, 0));
+			drawn_positions.insert(drawn_positions.end(), &positions[i * 3], &positions[i * 3 + 3]);
+		}
+	}
+
+	/**
+	* Check that the vector path of map_scalars_to_colors colors like its scalar tail: NaN, values outside the stops,
+	* on the stops and between them, over the three-stop scale, a single stop and two equal stops.
+	* Every value is mapped once in a block wide enough for AVX2 and once alone, which only the scalar loop handles.
+	*/
+	bool check_color_scale()
+	{
+		const float values[] = { NAN, -INFINITY, INFINITY, -1e30f, 1e30f, -5.0f, 0.0f, 0.25f, 0.5f, 0.75f, 1.0f, 1.5f, 0.4999f, 0.5001f, -0.0f, 2.0f };
+		const auto value_count = sizeof(values) / sizeof(values[0]);
+
+		ColorScale scales[3];
+		make_three_stop_color_scale(0.0f, 0.5f, 1.0f, scales[0]);
+		float single_value = 0.5f, step_values[] = { 0.5f, 0.5f };
+		uint32_t single_color = 0xFF336699, step_colors[] = { 0xFF0000FF, 0xFFFF0000 };
+		make_color_scale(&single_value, &single_color, 1, scales[1]);
+		make_color_scale(step_values, step_colors, 2, scales[2]);
+
+		auto ok = true;
+		for (const auto& scale : scales)
+		{
+			uint32_t block[value_count];
+			map_scalars_to_colors(values, (unsigned)value_count, scale, block);
+			for (size_t i = 0; i < value_count; ++i)
+			{
+				uint32_t single = 0;
+				map_scalars_to_colors(&values[i], 1, scale, &single);
+				if (block[i] != single)
+				{
+					fprintf(stderr, "Color scale of %u stops maps %g to %08x in a block but %08x alone\n", scale.num_stops, values[i], block[i], single);
+					ok = false;
+				}
+			}
+		}
+		return ok;
+	}
+
+	/**
+	* Run fetch, decode, parse and aggregate at every size. Fetch and aggregate need a server,
+	* decode and parse run on documents loaded in memory so they do not include any I/O.
+	*/
+	bool run(const BenchOptions& options, mongoc_client_pool_t* pool, mongoc_database_t* database)
+	{
+		auto largest = *std::max_element(options.sizes.begin(), options.sizes.end());
+
+		std::vector<bson_t*> documents;
+		if (!load_documents(options, database, largest, documents))
+			return false;
+
+		// Position strings are pulled out once so parse only times the parser
+		std::vector<std::string> positions;
+		for (auto doc : documents)
+		{
+			bson_iter_t iter, field;
+			if (bson_iter_init(&iter, doc) && bson_iter_find_descendant(&iter, "params.position", &field) && bson_iter_type(&field) == BSON_TYPE_UTF8)
+			{
+				uint32_t len = 0;
+				auto str = bson_iter_utf8(&field, &len);
+				positions.emplace_back(str, len);
+			}
+		}
+
+		if (!check_color_scale())
+			fprintf(stderr, "The vector and scalar color scale paths disagree\n");
+
+		printf("%-28s %15s %15s %22s %15s\n", "Case", "Mean", "Fastest", "Throughput", "Bandwidth");
+
+		for (auto size : options.sizes)
+		{
+			if (pool != nullptr)
+			{
+				for (auto threads : options.threads)
+				{
+					char name[32];
+					if (options.threads.size() > 1)
+						snprintf(name, sizeof(name), "fetch_threads_%u", threads);
+					else
+						snprintf(name, sizeof(name), "fetch");
+					run_case(name, size, options, [&](uint64_t& items, uint64_t& bytes) {
+						FetchRequest request;
+						request.query = bench_query(options, size, POSITION_PARSER_VECTOR3);
+						request.query.thread_count = threads;
+						request.pool = pool;
+						request.database_name = options.database;
+						run_fetch_request(&request);
+						if (!request.error.empty())
+							fprintf(stderr, "Fetch failed: %s\n", request.error.c_str());
+						items = request.documents_scanned;
+						bytes = request.bytes_received;
+					});
+				}
+
+				run_case("fetch_sorted_sessions", size, options, [&](uint64_t& items, uint64_t& bytes) {
+					FetchRequest request;
+					request.query = sorted_sessions_query(options, size);
+					request.pool = pool;
+					request.database_name = options.database;
+					run_fetch_request(&request);
+					if (!request.error.empty())
+						fprintf(stderr, "Sorted session fetch failed: %s\n", request.error.c_str());
+					else if (!rows_in_sort_order(request))
+						fprintf(stderr, "Sorted session fetch returned rows out of order\n");
+					items = request.documents_scanned;
+					bytes = request.bytes_received;
+				});
+			}
+
+			auto count = std::min<uint64_t>(size, documents.size());
+			if (count < size)
+				fprintf(stderr, "Only %llu documents to decode and parse\n", (unsigned long long)count);
+
+			run_case("decode", size, options, [&](uint64_t& items, uint64_t& bytes) {
+				auto query = bench_query(options, size, -1);
+				std::vector<Column> columns;
+				init_columns(query, columns);
+				DocumentDecoder decoder(query);
+				for (uint64_t i = 0; i < count; ++i)
+				{
+					decoder.read(documents[i], columns);
+					bytes += documents[i]->len;
+				}
+				items = count;
+			});
+
+			run_case("decode_parse", size, options, [&](uint64_t& items, uint64_t& bytes) {
+				auto query = bench_query(options, size, POSITION_PARSER_VECTOR3);
+				std::vector<Column> columns;
+				init_columns(query, columns);
+				DocumentDecoder decoder(query);
+				for (uint64_t i = 0; i < count; ++i)
+				{
+					decoder.read(documents[i], columns);
+					bytes += documents[i]->len;
+				}
+				items = count;
+			});
+
+			run_case("decode_wide", size, options, [&](uint64_t& items, uint64_t& bytes) {
+				auto query = wide_query(options, size);
+				std::vector<Column> columns;
+				init_columns(query, columns);
+				DocumentDecoder decoder(query);
+				for (uint64_t i = 0; i < count; ++i)
+				{
+					decoder.read(documents[i], columns);
+					bytes += documents[i]->len;
+				}
+				items = count;
+			});
+
+			run_case("decode_wide_by_path", size, options, [&](uint64_t& items, uint64_t& bytes) {
+				auto query = wide_query(options, size);
+				std::vector<Column> columns;
+				init_columns(query, columns);
+				for (uint64_t i = 0; i < count; ++i)
+				{
+					read_document_by_path(documents[i], query, columns);
+					bytes += documents[i]->len;
+				}
+				items = count;
+			});
+
+			run_case("marshal_config_value", size, options, [&](uint64_t& items, uint64_t& bytes) {
+				std::vector<ConfigNode> fields;
+				marshal_config_values(documents, count, wide_query(options, size), fields);
+				for (uint64_t i = 0; i < count; ++i)
+					bytes += documents[i]->len;
+				items = count;
+			});
+
+			run_case("marshal_columnar", size, options, [&](uint64_t& items, uint64_t& bytes) {
+				marshal_columnar(documents, count, wide_query(options, size));
+				for (uint64_t i = 0; i < count; ++i)
+					bytes += documents[i]->len;
+				items = count;
+			});
+
+			run_case("parse", size, options, [&](uint64_t& items, uint64_t& bytes) {
+				auto parser = find_position_parser(POSITION_PARSER_VECTOR3);
+				auto parsed = std::min<uint64_t>(size, positions.size());
+				float xyz[3];
+				for (uint64_t i = 0; i < parsed; ++i)
+				{
+					if (parser(positions[i].data(), (uint32_t)positions[i].size(), xyz))
+						++items;
+					bytes += positions[i].size();
+				}
+			});
+
+			// Scalars around the range of the scale, every 16th has none
+			std::mt19937 rng(options.seed);
+			std::normal_distribution<float> scalar(50.0f, 15.0f);
+			std::vector<float> scalars(size), scalar_positions(size * 3, 0.0f);
+			for (uint64_t i = 0; i < size; ++i)
+				scalars[i] = i % 16 == 15 ? NAN : scalar(rng);
+
+			run_case("color_scale", size, options, [&](uint64_t& items, uint64_t& bytes) {
+				ColorScale scale;
+				make_three_stop_color_scale(20.0f, 50.0f, 80.0f, scale);
+				std::vector<uint32_t> colors(size);
+				map_scalars_to_colors(scalars.data(), (unsigned)size, scale, colors.data());
+				items = size;
+				bytes = size * (sizeof(float) + sizeof(uint32_t));
+			});
+
+			run_case("color_scale_lua", size, options, [&](uint64_t& items, uint64_t& bytes) {
+				std::vector<float> drawn_positions;
+				std::vector<uint32_t> colors;
+				lua_scale_colors(scalar_positions, scalars, 20.0f, 50.0f, 80.0f, drawn_positions, colors);
+				items = size;
+				bytes = size * (sizeof(float) + sizeof(uint32_t));
+			});
+
+			if (pool != nullptr)
+			{
+				run_case("aggregate", size, options, [&](uint64_t& items, uint64_t&) {
+					auto query = bench_query(options, size, POSITION_PARSER_VECTOR3);
+					AggregateQuery aggregate;
+					aggregate.position_field = "params.position";
+					aggregate.scalar_field = "params.value_0";
+					aggregate.cell_size = options.cell_size;
+
+					auto collection = mongoc_database_get_collection(database, options.collection.c_str());
+					std::vector<Column> cells;
+					std::string error;
+					if (!aggregate_cells(collection, query, aggregate, cells, error))
+						fprintf(stderr, "Aggregate failed: %s\n", error.c_str());
+					mongoc_collection_destroy(collection);
+					items = size; // Matched documents, the bytes scanned on the server are not reported
+				});
+			}
+		}
+
+		for (auto doc : documents)
+			bson_destroy(doc);
+		return true;
+	}
+
+	void parse_sizes(const char* list, std::vector<uint64_t>& sizes)
+	{
+		sizes.clear();
+		for (auto p = list; *p != '\0';)
+		{
+			char* end = nullptr;
+			auto size = strtoull(p, &end, 10);
+			if (end == p)
+				break;
+			if (size > 0)
+				sizes.push_back(size);
+			p = *end == ',' ? end + 1 : end;
+		}
+	}
+
+	void parse_thread_counts(const char* list, std::vector<unsigned>& threads)
+	{
+		std::vector<uint64_t> counts;
+		parse_sizes(list, counts);
+		threads.clear();
+		for (auto count : counts)
+			threads.push_back((unsigned)std::min<uint64_t>(count, MAX_FETCH_THREADS));
+	}
+
+	void print_usage()
+	{
+		printf(
+			"telemetry_bench generate [options]  Fill a collection (or --file) with synthetic telemetry\n"
+			"telemetry_bench run [options]       Time fetch, decode, marshal, parse, color scale and aggregate\n"
+			"\n"
+			"  --uri <uri>                 MongoDB server (mongodb://localhost:27017)\n"
+			"  --database <name>           Database (telemetry_bench)\n"
+			"  --collection <name>         Event collection (events)\n"
+			"  --file <path>               Use a BSON file instead of a server, fetch and aggregate are skipped\n"
+			"  --sessions <n>              Sessions to generate (100)\n"
+			"  --events <n>                Events per session (10000)\n"
+			"  --scalars <n>               Scalar fields value_0 .. value_n-1 per event (2)\n"
+			"  --extent <size>             Size of the area the sessions start in (1000)\n"
+			"  --seed <n>                  Random seed (1)\n"
+			"  --sizes <n,n,...>           Documents per case (10000,100000,1000000)\n"
+			"  --repetitions <n>           Runs per case (5)\n"
+			"  --threads <n,n,...>         Parallel cursors of a fetch, the fetch case runs at every count (4)\n"
+			"  --cell-size <size>          Aggregation cell size (10)\n");
+	}
+
+	bool parse_options(int argc, char** argv, BenchOptions& options)
+	{
+		for (auto i = 2; i < argc; ++i)
+		{
+			auto name = argv[i];
+			if (i + 1 == argc)
+			{
+				fprintf(stderr, "Missing value of %s\n", name);
+				return false;
+			}
+
+			auto value = argv[++i];
+			if (strcmp(name, "--uri") == 0) options.uri = value;
+			else if (strcmp(name, "--database") == 0) options.database = value;
+			else if (strcmp(name, "--collection") == 0) options.collection = value;
+			else if (strcmp(name, "--file") == 0) options.file = value;
+			else if (strcmp(name, "--sessions") == 0) options.sessions = (unsigned)atoi(value);
+			else if (strcmp(name, "--events") == 0) options.events_per_session = (unsigned)atoi(value);
+			else if (strcmp(name, "--scalars") == 0) options.scalars = (unsigned)atoi(value);
+			else if (strcmp(name, "--extent") == 0) options.extent = atof(value);
+			else if (strcmp(name, "--seed") == 0) options.seed = (unsigned)atoi(value);
+			else if (strcmp(name, "--sizes") == 0) parse_sizes(value, options.sizes);
+			else if (strcmp(name, "--repetitions") == 0) options.repetitions = (unsigned)std::max(1, atoi(value));
+			else if (strcmp(name, "--threads") == 0) parse_thread_counts(value, options.threads);
+			else if (strcmp(name, "--cell-size") == 0) options.cell_size = atof(value);
+			else
+			{
+				fprintf(stderr, "Unknown option %s\n", name);
+				return false;
+			}
+		}
+
+		if (options.sizes.empty() || options.threads.empty())
+		{
+			fprintf(stderr, "No sizes or thread counts to run\n");
+			return false;
+		}
+		return true;
+	}
+}
+
+using namespace PLUGIN_NAMESPACE;
+
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	if (argc < 2 || (strcmp(argv[1], "generate") != 0 && strcmp(argv[1], "run") != 0) || !parse_options(argc, argv, options))
+	{
+		print_usage();
+		return 1;
+	}
+
+	mongoc_init();
+	set_query_cache_enabled(false); // Every fetch goes to the server
+
+	mongoc_client_pool_t* pool = nullptr;
+	mongoc_client_t* client = nullptr;
+	mongoc_database_t* database = nullptr;
+
+	if (options.file.empty())
+	{
+		auto uri = mongoc_uri_new(options.uri.c_str());
+		if (uri == nullptr)
+		{
+			fprintf(stderr, "Invalid MongoDB URI %s\n", options.uri.c_str());
+			return 1;
+		}
+
+		pool = mongoc_client_pool_new(uri);
+		mongoc_client_pool_set_error_api(pool, MONGOC_ERROR_API_VERSION_2);
+		client = mongoc_client_pool_pop(pool);
+		database = mongoc_client_get_database(client, options.database.c_str());
+		mongoc_uri_destroy(uri);
+	}
+
+	auto ok = strcmp(argv[1], "generate") == 0 ? generate(options, database) : run(options, pool, database);
+
+	if (database != nullptr)
+		mongoc_database_destroy(database);
+	if (client != nullptr)
+		mongoc_client_pool_push(pool, client);
+	if (pool != nullptr)
+		mongoc_client_pool_destroy(pool);
+	mongoc_cleanup();
+
+	return ok ? 0 : 1;
+}